@@ -20,23 +20,248 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <pthread.h>
 #include "liblogitech.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <unistd.h>
 #include <libusb-1.0/libusb.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include "config.h"
 
 static libusb_context *context = NULL;
-static libusb_device_handle *keyboard_device = NULL;
-static int open_interface = -1;
 static int libg15_debugging_enabled = 0;
-static int enospc_slowdown = 0;
 
-static int found_devicetype = -1;
-static int shared_device = 0;
-static int g15_keys_endpoint = 0;
-static int g15_lcd_endpoint = 0;
-static pthread_mutex_t libusb_mutex;
+/* Five 8-pixel rows + a little 3-pixel row.  This formula will calculate
+   the minimum number of bytes required to hold a complete column.  (It
+   basically divides by eight and rounds up the result to the nearest byte,
+   but at compile time.
+  */
+#define G15_LCD_HEIGHT_IN_BYTES  ((G15_LCD_HEIGHT + ((8 - (G15_LCD_HEIGHT % 8)) % 8)) / 8)
+#define G15_LCD_ROW_BYTES        (G15_LCD_WIDTH / 8)
+
+/* bytes of a caller's pixmap that end up on the LCD */
+#define G15_PIXMAP_BYTES         (G15_LCD_HEIGHT_IN_BYTES * G15_LCD_WIDTH)
+
+/* asynchronous LCD transfers - one in flight, one queued, one being filled */
+#define G15_LCD_TRANSFERS 3
+
+/* key changes queued for lg_drain_key_events, a power of two */
+#define G15_KEY_EVENTS 256
+
+enum
+{
+    LCD_SLOT_FREE = 0,
+    LCD_SLOT_FILLING,
+    LCD_SLOT_QUEUED,
+    LCD_SLOT_INFLIGHT
+};
+
+/* an interrupt transfer as seen by the rest of the library.  the transport keeps its own
+   transfer in priv.  status is an enum libusb_transfer_status, for every transport */
+typedef struct lg_xfer_t lg_xfer_t;
+struct lg_xfer_t {
+    lg_device_t *dev;
+    unsigned char endpoint;
+    unsigned char *buffer;
+    int length;
+    unsigned int timeout;
+    int status;
+    int actual_length;
+    void (*callback)(lg_xfer_t *xfer);     /* runs on the usb event thread */
+    void *user_data;
+    void *priv;
+    int stat;                               /* G15_STATS_x it is counted in */
+    struct timespec submitted;
+};
+
+typedef struct lcd_slot_t {
+    lg_xfer_t xfer;
+    lg_device_t *dev;
+    unsigned char *buffer;              /* G15_BUFFER_LEN bytes from the transport, NULL while closed */
+    int dev_mem;
+    int state;
+} lcd_slot_t;
+
+/* everything that talks to the hardware goes through a transport: libusb, or the virtual
+   keyboards used to run without any (see lg_virtual_enable).  handles and devices are the
+   transport's own, and errors are libusb error codes in both */
+typedef struct lg_transport_t {
+    const char *name;
+    int (*init)(void);
+    int (*enumerate)(lg_device_info_t *list, int max);
+    /* open the device arrived (from a hotplug event) or else the first free one matching
+       want and dev->want_devicetype, filling in dev->handle, endpoints and address */
+    int (*open)(lg_device_t *dev, lg_device_info_t const *want, void *arrived);
+    /* close handle, which was dev's and has already been taken off it */
+    int (*close)(lg_device_t *dev, void *handle, int reattach);
+    int (*reset)(lg_device_t *dev);
+    int (*clear_halt)(lg_device_t *dev, unsigned char endpoint);
+    int (*interrupt_transfer)(lg_device_t *dev, unsigned char endpoint, unsigned char *data,
+                              int length, int *transferred, unsigned int timeout);
+    /* a HID set-report */
+    int (*control_transfer)(lg_device_t *dev, unsigned int value, unsigned int index,
+                            unsigned char *data, unsigned int length, unsigned int timeout);
+    int (*submit)(lg_xfer_t *xfer);
+    int (*cancel)(lg_xfer_t *xfer);
+    void (*free_xfer)(lg_xfer_t *xfer);
+    /* memory for transfer buffers, DMA-able where the transport manages it, setting
+       *dev_mem if so.  buffers belong to the open device and are freed before close */
+    unsigned char *(*alloc_buffer)(lg_device_t *dev, int length, int *dev_mem);
+    void (*free_buffer)(lg_device_t *dev, unsigned char *buffer, int length, int dev_mem);
+    /* run completions and hotplug events until *completed is set or interrupt_events is called */
+    void (*handle_events)(int *completed);
+    void (*interrupt_events)(void);
+    /* drop a device handed to deviceArrived */
+    void (*unref)(void *device);
+} lg_transport_t;
+
+static const lg_transport_t *transport = NULL;
+
+/* LCD bandwidth levels, stepped down on overflow errors or very slow frames and back up
+   once the bus has been healthy for a while.  the first level is a whole frame per
+   transfer; the others split it into chunks with a pause in between */
+static const struct {
+    int chunk;              /* bytes per transfer, a divisor of G15_BUFFER_LEN */
+    int delay;              /* us to sleep after each transfer */
+} bandwidth_levels[] = {
+    { G15_BUFFER_LEN, 100 },
+    { G15_BUFFER_LEN / 4, 100 },
+    { G15_BUFFER_LEN / 8, 100 },
+    { 32, 100 },
+    { 32, 1000 }
+};
+
+#define BW_LEVELS           (sizeof(bandwidth_levels) / sizeof(bandwidth_levels[0]))
+#define BW_PROBE_FRAMES     250         /* clean frames before trying the next faster level */
+#define BW_PROBE_MAX        8000        /* limit for the probe interval after failed attempts */
+#define BW_SLOW_FRAME       100000      /* us, a frame taking longer counts as congestion */
+
+#define USB_RETRY_TIMEOUT   500         /* ms to wait for a device to settle while opening or closing it */
+#define USB_RETRY_MAX_DELAY 50000       /* us, longest pause between two attempts */
+
+/* settings sent with control transfers, in the order they are restored after a replug */
+enum
+{
+    CTL_LCD_CONTRAST = 0,
+    CTL_LCD_BRIGHTNESS,
+    CTL_KB_BRIGHTNESS,
+    CTL_G510_COLOR,
+    CTL_LEDS,
+    CTL_G110_COLOR,
+    CTL_COUNT
+};
+
+/* one setting: the value asked for and the one the device is known to have, -1 if none */
+typedef struct control_reg_t {
+    int want;
+    int hw;
+    unsigned int calls;     /* setter calls since the register was last written */
+} control_reg_t;
+
+/* everything belonging to one opened keyboard.  each device has its own locks,
+   so several keyboards can be driven from different threads at once */
+struct lg_device {
+    void *handle;               /* the transport's, NULL while closed */
+    int devicetype;             /* index into g15_devices, -1 until found */
+    int open_interface;
+    int shared_device;
+    int keys_endpoint;
+    int lcd_endpoint;
+    unsigned char bus;
+    unsigned char address;
+    pthread_mutex_t libusb_mutex;
+
+    /* what was asked for when opening, so a re-open finds the same kind of keyboard */
+    int want_devicetype;
+
+    lcd_slot_t lcd_slots[G15_LCD_TRANSFERS];
+    lcd_slot_t *lcd_queued;
+    int lcd_inflight;
+    int lcd_async_status;
+    pthread_mutex_t lcd_async_mutex;
+    pthread_cond_t lcd_async_cond;
+
+    /* the last frame handed to the LCD, so an unchanged screen is not sent again */
+    unsigned char last_frame[G15_PIXMAP_BYTES];
+    int last_frame_valid;
+    int last_frame_known;               /* last_frame holds something, restored after a replug */
+    unsigned long frames_sent;
+    unsigned long frames_skipped;
+
+    /* adaptive LCD bandwidth, protected by lcd_async_mutex */
+    int bw_level;                       /* index into bandwidth_levels */
+    unsigned int bw_good_frames;        /* clean frames since the last change or probe window */
+    unsigned int bw_probe_after;        /* clean frames needed before stepping up */
+    int bw_probing;                     /* just stepped up, congestion now means the step failed */
+    unsigned int bw_avg_latency;        /* us per frame, moving average */
+    unsigned long bw_downshifts;
+    unsigned long bw_upshifts;
+    unsigned long bw_congestion;
+
+    /* continuously armed interrupt-IN transfer on the keys endpoint */
+    lg_xfer_t key_xfer;
+    unsigned char key_buffer[G15_KEY_READ_LENGTH];
+    g15_key_handler_t key_handler;
+    void *key_handler_data;
+    int key_armed;
+    int key_recover;
+    pthread_mutex_t key_async_mutex;
+    pthread_cond_t key_async_cond;
+
+    /* every change of the held keys, written by whichever thread reads the keys (the
+       event thread, or the getPressedKeys caller) and read by lg_drain_key_events.
+       one producer and one consumer, so the ring needs no lock */
+    lg_key_event_t key_events[G15_KEY_EVENTS];
+    unsigned int key_events_head;       /* next to drain, only the consumer moves it */
+    unsigned int key_events_tail;       /* next to fill, only the producer moves it */
+    unsigned long key_events_dropped;
+    uint64_t key_state;                 /* keys held as of the last queued event */
+
+    /* hotplug notifications from the event thread, protected by devices_mutex */
+    int unplugged;
+    void *arrived;                      /* where the keyboard came back, used by lg_reopen */
+    g15_hotplug_handler_t hotplug_handler;
+    void *hotplug_handler_data;
+
+    /* shadow of the LED and backlight settings, protected by libusb_mutex. written
+       again after a replug */
+    control_reg_t controls[CTL_COUNT];
+    int controls_deferred;              /* setters wait for lg_flush_controls */
+    unsigned long controls_sent;
+    unsigned long controls_avoided;     /* setter calls that needed no transfer of their own */
+
+    /* how long the last lg_open or lg_reopen took, phase by phase */
+    lg_startup_timing_t startup;
+
+    /* transfer statistics, protected by stats_mutex.  the usb lock counters of
+       lg_stats_t are kept apart, updated with atomics by whoever takes libusb_mutex */
+    lg_stats_t stats;
+    pthread_mutex_t stats_mutex;
+    unsigned long lock_acquisitions;
+    uint64_t lock_wait_ns;
+    uint64_t lock_held_ns;
+    struct timespec usb_locked;         /* when libusb_mutex was taken, for its holder */
+
+    lg_device_t *next;
+};
+
+/* every device opened with lg_open, walked by the event thread */
+static lg_device_t *open_devices = NULL;
+static int open_device_count = 0;
+static pthread_mutex_t devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the transport reports hotplug events */
+static int hotplug_registered = 0;
+static libusb_hotplug_callback_handle hotplug_handle;
+
+/* the device behind the original single-keyboard api */
+static lg_device_t *default_device = NULL;
+
+/* usb event handling thread, drives completion of all async transfers on all devices */
+static pthread_t usb_event_thread;
+static int usb_event_thread_running = 0;
+static int usb_event_thread_exit = 0;
 
 /* to add a new device, simply create a new DEVICE() in this list */
 /* Fields are: "Name",VendorID,ProductID,Capabilities */
@@ -54,9 +279,10 @@ const libg15_devices_t g15_devices[] = {
 };
 
 /* return device capabilities */
-int g15DeviceCapabilities() {
-    if(found_devicetype>-1)
-        return g15_devices[found_devicetype].caps;
+int lg_get_caps(lg_device_t *dev)
+{
+    if(dev && dev->devicetype>-1)
+        return g15_devices[dev->devicetype].caps;
     else
         return -1;
 }
@@ -82,38 +308,215 @@ static int g15_log (FILE *fd, unsigned int level, const char *fmt, ...) {
     return 0;
 }
 
-/* return number of connected and supported devices */
-int g15NumberOfConnectedDevices() {
-	libusb_device **devices;
-	struct libusb_device_descriptor desc;
-	ssize_t count;
-	int i, j;
-    unsigned int found = 0;
-
-    if (context) {	/* Ensure we're initialized. */
-    	count = libusb_get_device_list(context, &devices);
-    	for (i = 0; i < count; i++) {
-    		if (!libusb_get_device_descriptor(devices[i], &desc)) {
-    			/* Only check device if we successfully returned its descriptor. */
-    			for (j = 0; g15_devices[j].name != NULL; j++) {
-    				if ((desc.idVendor == g15_devices[j].vendorid) &&
-    					(desc.idProduct == g15_devices[j].productid)) {
-    					found++;
-    				}
-    			}
-    		}
-    	}
-    	libusb_free_device_list(devices, 1);	/* De-reference the entire list. */
+static unsigned int usSince(struct timespec const *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static uint64_t monotonicUs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* add the time since *mark to a startup phase and start timing the next one */
+static void phaseDone(unsigned int *phase, struct timespec *mark)
+{
+    *phase += usSince(mark);
+    clock_gettime(CLOCK_MONOTONIC, mark);
+}
+
+/* return the index into g15_devices of a supported device, or -1 */
+static int lookupDeviceType(unsigned int vendorid, unsigned int productid)
+{
+    int j;
+
+    for (j = 0; g15_devices[j].name != NULL; j++) {
+        if ((vendorid == g15_devices[j].vendorid) &&
+            (productid == g15_devices[j].productid))
+            return j;
     }
-    g15_log(stderr,G15_LOG_INFO,"Found %i supported devices\n",found);
-    return found;
+    return -1;
+}
+
+/* statistics */
+
+static int histBucket(unsigned int value)
+{
+    int bucket, exponent;
+
+    if (value < 8)
+        return value;
+    exponent = 31 - __builtin_clz(value);
+    bucket = (exponent - 2) * 8 + ((value >> (exponent - 3)) & 7);
+    return bucket < G15_HIST_BUCKETS ? bucket : G15_HIST_BUCKETS - 1;
+}
+
+unsigned int lg_stats_bucket_value(int bucket)
+{
+    if (bucket < 8)
+        return bucket;
+    return (unsigned int)(8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+unsigned int lg_stats_percentile(lg_latency_hist_t const *hist, double percentile)
+{
+    unsigned long want, seen = 0;
+    int i;
+
+    if (!hist->count)
+        return 0;
+    want = (unsigned long)(hist->count * percentile / 100.0 + 0.5);
+    if (want < 1)
+        want = 1;
+    for (i = 0; i < G15_HIST_BUCKETS - 1; i++) {
+        seen += hist->buckets[i];
+        if (seen >= want)
+            break;
+    }
+    /* the top of the bucket, but never beyond anything actually seen */
+    if (i < G15_HIST_BUCKETS - 1 && lg_stats_bucket_value(i + 1) - 1 < hist->max)
+        return lg_stats_bucket_value(i + 1) - 1;
+    return hist->max;
 }
 
+/* count one finished transfer.  error is a libusb error code, 0 for success */
+static void recordTransfer(lg_device_t *dev, int stat, unsigned int latency, int bytes, int wanted, int error)
+{
+    lg_transfer_stats_t *t = &dev->stats.transfers[stat];
+    lg_latency_hist_t *hist = &t->latency;
+
+    pthread_mutex_lock(&dev->stats_mutex);
+    if (!hist->count || latency < hist->min)
+        hist->min = latency;
+    if (latency > hist->max)
+        hist->max = latency;
+    hist->count++;
+    hist->sum += latency;
+    hist->buckets[histBucket(latency)]++;
+    t->transfers++;
+    if (bytes > 0)
+        t->bytes += bytes;
+    if (error < 0)
+        t->errors[error > -G15_STATS_ERRORS + 1 ? -error : G15_STATS_ERRORS - 1]++;
+    else if (bytes < wanted && stat != G15_STATS_KEYS)    /* key reports are shorter than the read */
+        t->errors[0]++;
+    pthread_mutex_unlock(&dev->stats_mutex);
+}
+
+static void recordReconnect(lg_device_t *dev)
+{
+    pthread_mutex_lock(&dev->stats_mutex);
+    dev->stats.reconnects++;
+    pthread_mutex_unlock(&dev->stats_mutex);
+}
+
+static uint64_t nsSince(struct timespec const *start, struct timespec const *now)
+{
+    return (uint64_t)(now->tv_sec - start->tv_sec) * 1000000000 + now->tv_nsec - start->tv_nsec;
+}
+
+/* libusb_mutex serialises the synchronous i/o on a device, so time spent waiting for it
+   is time a caller spent behind someone else's transfer */
+static void usbLock(lg_device_t *dev)
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&dev->libusb_mutex);
+    clock_gettime(CLOCK_MONOTONIC, &dev->usb_locked);
+    __atomic_add_fetch(&dev->lock_wait_ns, nsSince(&start, &dev->usb_locked), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dev->lock_acquisitions, 1, __ATOMIC_RELAXED);
+}
+
+static void usbUnlock(lg_device_t *dev)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    __atomic_add_fetch(&dev->lock_held_ns, nsSince(&dev->usb_locked, &now), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&dev->libusb_mutex);
+}
+
+void lg_get_stats(lg_device_t *dev, lg_stats_t *stats)
+{
+    pthread_mutex_lock(&dev->stats_mutex);
+    *stats = dev->stats;
+    pthread_mutex_unlock(&dev->stats_mutex);
+    stats->lock_acquisitions = __atomic_load_n(&dev->lock_acquisitions, __ATOMIC_RELAXED);
+    stats->lock_wait_ns = __atomic_load_n(&dev->lock_wait_ns, __ATOMIC_RELAXED);
+    stats->lock_held_ns = __atomic_load_n(&dev->lock_held_ns, __ATOMIC_RELAXED);
+}
+
+void lg_reset_stats(lg_device_t *dev)
+{
+    pthread_mutex_lock(&dev->stats_mutex);
+    memset(dev->stats.transfers, 0, sizeof(dev->stats.transfers));
+    dev->stats.reconnects = 0;
+    dev->stats.since = monotonicUs();
+    pthread_mutex_unlock(&dev->stats_mutex);
+    __atomic_store_n(&dev->lock_acquisitions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dev->lock_wait_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dev->lock_held_ns, 0, __ATOMIC_RELAXED);
+}
+
+/* must be called with devices_mutex held, on the event thread. the transport saw the
+   keyboard behind dev go away */
+static void deviceLeft(lg_device_t *dev)
+{
+    if (dev->unplugged)
+        return;
+    g15_log(stderr, G15_LOG_INFO, "%s unplugged\n", g15_devices[dev->devicetype].name);
+    dev->unplugged = 1;
+    if (dev->hotplug_handler)
+        dev->hotplug_handler(G15_HOTPLUG_LEFT, dev->hotplug_handler_data);
+}
+
+/* must be called with devices_mutex held, on the event thread. opening a device needs
+   synchronous requests, which are not allowed there, so just note where a keyboard of
+   this type came back and let lg_reopen do it.  returns 1 if a device kept it, the
+   caller then owes it a reference the transport's unref drops */
+static int deviceArrived(void *device, int type)
+{
+    lg_device_t *dev;
+
+    for (dev = open_devices; dev; dev = dev->next) {
+        if ((dev->unplugged || !dev->handle) && !dev->arrived &&
+            (dev->want_devicetype < 0 || dev->want_devicetype == type)) {
+            g15_log(stderr, G15_LOG_INFO, "%s plugged in\n", g15_devices[type].name);
+            dev->arrived = device;
+            if (dev->hotplug_handler)
+                dev->hotplug_handler(G15_HOTPLUG_ARRIVED, dev->hotplug_handler_data);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the event thread looks devices up by their handle with devices_mutex held (hotplug
+   events, key transfer recovery), so the handle is only changed under it.  a handle
+   being closed is taken off its device first and closed once nobody can find it */
+static void setDeviceHandle(lg_device_t *dev, void *handle)
+{
+    pthread_mutex_lock(&devices_mutex);
+    dev->handle = handle;
+    pthread_mutex_unlock(&devices_mutex);
+}
+
+/* the libusb transport */
+
 static int initLibUsb()
 {
 	int	ret;
 
-	// TODO : OK to init twice???
+	/* further devices and re-inits after the keyboard went away keep the existing context, the event thread is still using it */
+	if (context)
+		return	0;
     ret = libusb_init(&context);
     if (ret == 0) {
     	libusb_set_debug(context, libg15_debugging_enabled);
@@ -121,198 +524,1675 @@ static int initLibUsb()
     return	ret;
 }
 
-/* Convenience function to correctly cleanup open device list. */
-static libusb_device_handle *findCleanup(libusb_device_handle *handle, libusb_device **devices) {
-	if (handle)
-		libusb_close(handle);
-	libusb_free_device_list(devices, 1);	/* De-reference entire list. */
+static int usbEnumerate(lg_device_info_t *list, int max)
+{
+	libusb_device **devices;
+	struct libusb_device_descriptor desc;
+	ssize_t count;
+	int i, type;
+    int found = 0;
+
+    count = libusb_get_device_list(context, &devices);
+    for (i = 0; i < count; i++) {
+    	/* Only check device if we successfully returned its descriptor. */
+    	if (libusb_get_device_descriptor(devices[i], &desc))
+    		continue;
+    	if ((type = lookupDeviceType(desc.idVendor, desc.idProduct)) < 0)
+    		continue;
+    	if (list && found < max) {
+    		list[found].devicetype = type;
+    		list[found].name = g15_devices[type].name;
+    		list[found].caps = g15_devices[type].caps;
+    		list[found].bus = libusb_get_bus_number(devices[i]);
+    		list[found].address = libusb_get_device_address(devices[i]);
+    	}
+    	found++;
+    }
+    libusb_free_device_list(devices, 1);	/* De-reference the entire list. */
+    return found;
+}
+
+static int LIBUSB_CALL hotplugCallback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+	struct libusb_device_descriptor desc;
+	lg_device_t *dev;
+	int type;
+
+	if (libusb_get_device_descriptor(device, &desc) || (type = lookupDeviceType(desc.idVendor, desc.idProduct)) < 0)
+		return	0;
+
+	/* handles are only taken off their devices under devices_mutex, so none of those
+	   seen here has been closed */
+	pthread_mutex_lock(&devices_mutex);
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+		for (dev = open_devices; dev; dev = dev->next) {
+			if (dev->handle && libusb_get_device(dev->handle) == device) {
+				deviceLeft(dev);
+				break;
+			}
+		}
+	} else if (deviceArrived(device, type)) {
+		libusb_ref_device(device);
+	}
+	pthread_mutex_unlock(&devices_mutex);
+	return	0;
+}
+
+static void registerHotplug()
+{
+	pthread_mutex_lock(&devices_mutex);
+	if (!hotplug_registered && libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		if (libusb_hotplug_register_callback(context,
+				LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, 0,
+				LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+				hotplugCallback, NULL, &hotplug_handle) == LIBUSB_SUCCESS)
+			hotplug_registered = 1;
+		else
+			g15_log(stderr, G15_LOG_INFO, "Unable to register for hotplug events\n");
+	}
+	pthread_mutex_unlock(&devices_mutex);
+}
+
+static int usbInit()
+{
+	int	ret;
+
+	if ((ret = initLibUsb()))
+		return	ret;
+	registerHotplug();
+	return	0;
+}
+
+/* is this bus address already driven by another lg_device_t */
+static int isDeviceOpen(unsigned char bus, unsigned char address)
+{
+	lg_device_t *dev;
+	int ret = 0;
+
+	pthread_mutex_lock(&devices_mutex);
+	for (dev = open_devices; dev; dev = dev->next) {
+		if (dev->handle && dev->bus == bus && dev->address == address) {
+			ret = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&devices_mutex);
+	return	ret;
+}
+
+/* Convenience function to correctly cleanup a half opened device. */
+static libusb_device_handle *openCleanup(libusb_device_handle *handle, struct libusb_config_descriptor *cfg) {
+	libusb_free_config_descriptor(cfg);
+	libusb_close(handle);
 	return	NULL;
 }
 
-static libusb_device_handle * findAndOpenDevice(libg15_devices_t handled_device, int device_index)
+/* errors that waiting will not fix */
+static int usbErrorIsFinal(int ret)
+{
+	return	ret == LIBUSB_ERROR_NO_DEVICE || ret == LIBUSB_ERROR_ACCESS ||
+			ret == LIBUSB_ERROR_NOT_FOUND || ret == LIBUSB_ERROR_NOT_SUPPORTED ||
+			ret == LIBUSB_ERROR_INVALID_PARAM;
+}
+
+/* call op until it succeeds, fails for good or timeout ms have passed.  the pause
+   between attempts starts at 1 ms and doubles up to USB_RETRY_MAX_DELAY, so a device
+   that is ready straight away costs nothing and a slow one is not hammered */
+static int usbRetry(int (*op)(libusb_device_handle *, int), libusb_device_handle *handle, int arg,
+		unsigned int timeout, int *retries)
+{
+	struct timespec start;
+	unsigned int delay = 1000;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((ret = op(handle, arg)) != LIBUSB_SUCCESS && !usbErrorIsFinal(ret) &&
+			usSince(&start) < timeout * 1000) {
+		usleep(delay);
+		if (delay < USB_RETRY_MAX_DELAY)
+			delay *= 2;
+		if (retries)
+			(*retries)++;
+	}
+	return	ret;
+}
+
+/* a device that has just been configured may not answer straight away.  ask for its
+   status until it does instead of sleeping for a worst case settle time */
+static int usbGetStatus(libusb_device_handle *handle, int unused)
+{
+	unsigned char status[2];
+	int ret;
+
+	ret = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_STANDARD | LIBUSB_RECIPIENT_DEVICE,
+			LIBUSB_REQUEST_GET_STATUS, 0, 0, status, sizeof(status), USB_RETRY_MAX_DELAY / 1000);
+	return	ret < 0 ? ret : LIBUSB_SUCCESS;
+}
+
+/* open a device known to be of type device_index and claim its LCD and keys interfaces */
+static libusb_device_handle * openDevice(lg_device_t *dev, libusb_device *device, struct libusb_device_descriptor const *desc, int device_index)
 {
-	libusb_device **devices;
 	libusb_device_handle *handle = NULL;
-	struct libusb_device_descriptor desc;
 	struct libusb_config_descriptor *cfg;
 	const struct libusb_interface *interface;
 	const struct libusb_interface_descriptor *if_desc;
+	struct timespec mark;
+	int j, k, l, m, ret, retries = 0;
+
+	dev->devicetype = device_index;
+	dev->bus = libusb_get_bus_number(device);
+	dev->address = libusb_get_device_address(device);
+	g15_log(stderr, G15_LOG_INFO, "Found %s, trying to open it\n", g15_devices[device_index].name);
+	ret = libusb_open(device, &handle);
+	if (ret != 0) {
+		g15_log(stderr, G15_LOG_INFO, "Error %d, could not open keyboard\nPerhaps you don't have the appropriate permissions\n", ret);
+		return	NULL;
+	}
+	g15_log(stderr, G15_LOG_INFO, "Device has %i possible configurations\n", desc->bNumConfigurations);
+
+	/* if device is shared with another driver, such as the Z-10 speakers sharing with alsa, we have to disable some calls */
+	if (lg_get_caps(dev) & G15_DEVICE_IS_SHARED)
+		dev->shared_device = 1;
+	clock_gettime(CLOCK_MONOTONIC, &mark);
+	for (j = 0; j < desc->bNumConfigurations; j++) {
+		ret = libusb_get_config_descriptor(device, j, &cfg);
+		if (ret != 0) {
+			g15_log(stderr, G15_LOG_INFO, "Error %d, could not get config descriptor", ret);
+			continue;	/* NOT break */
+		}
+		for (k = 0; k < cfg->bNumInterfaces; k++) {
+			if (lg_get_caps(dev) & G15_DEVICE_G510) {
+				if (k == G510_STANDARD_KEYBOARD_INTERFACE)
+					continue;	/* NOT break */
+			}
+			if ((dev->keys_endpoint != 0) && (dev->lcd_endpoint != 0)) {
+				break;	/* We're done, so finish up. */
+			}
+			interface = &(cfg->interface[k]);
+			g15_log(stderr, G15_LOG_INFO, "Device has %i Alternate Settings\n", interface->num_altsetting);
+			for (l = 0; l < interface->num_altsetting; l++) {
+				if_desc = &(interface->altsetting[l]);
+
+				/* Verify the interface is for a HID device */
+				if (if_desc->bInterfaceClass != LIBUSB_CLASS_HID)
+					continue;
+				g15_log(stderr, G15_LOG_INFO, "Interface %i has %i Endpoints\n", k, if_desc->bNumEndpoints);
+
+				ret = libusb_kernel_driver_active(handle, k);
+				if (ret == 1) {	/* This is the only case where the kernel driver is actually active. */
+					dev->open_interface = k;
+					ret = usbRetry(libusb_detach_kernel_driver, handle, k, USB_RETRY_TIMEOUT, NULL);
+					if (!ret) {
+						g15_log(stderr, G15_LOG_INFO, "Success, detached the driver\n");
+					} else {
+						g15_log(stderr, G15_LOG_INFO, "Sorry, couldn't detach the driver, error %d\n", ret);
+						return	openCleanup(handle, cfg);
+					}
+				}
+				/* don't set configuration if device is shared */
+				if (0 == dev->shared_device) {
+					ret = usbRetry(libusb_set_configuration, handle, 1, USB_RETRY_TIMEOUT, NULL);
+					if (ret != 0) {
+						g15_log(stderr, G15_LOG_INFO, "Unable to set configuration, error %d\n", ret);
+						return	openCleanup(handle, cfg);
+					}
+				}
+				g15_log(stderr, G15_LOG_INFO, "Trying to claim interface %d\n", k);
+				ret = usbRetry(libusb_claim_interface, handle, k, USB_RETRY_TIMEOUT, &retries);
+				if (retries)
+					g15_log(stderr, G15_LOG_INFO, "Claimed interface %d after %d retries\n", k, retries);
+				if (ret) {
+					g15_log(stderr, G15_LOG_INFO, "Error claiming interface, code %d\n", ret);
+					return	openCleanup(handle, cfg);
+				}
+				for (m = 0; m < if_desc->bNumEndpoints; m++) {
+					const struct libusb_endpoint_descriptor *end = &(if_desc->endpoint[m]);
+
+					g15_log(stderr, G15_LOG_INFO, "Found %s endpoint %i with address 0x%X maxtransfersize=%i\n",
+							((0x80 & end->bEndpointAddress) ? "\"Extra Keys\"" : "\"LCD\""),
+							end->bEndpointAddress & 0x0f, end->bEndpointAddress, end->wMaxPacketSize);
+					if (0x80 & end->bEndpointAddress) {
+						dev->keys_endpoint = end->bEndpointAddress;
+					} else {
+						dev->lcd_endpoint = end->bEndpointAddress;
+					}
+				}
+			}
+		}
+		libusb_free_config_descriptor(cfg);
+	}
+	/* the first control transfers follow right away, make sure the device takes them */
+	if ((ret = usbRetry(usbGetStatus, handle, 0, USB_RETRY_TIMEOUT, NULL)))
+		g15_log(stderr, G15_LOG_INFO, "Device did not answer a status request, error %d\n", ret);
+	phaseDone(&dev->startup.claim, &mark);
+	g15_log(stderr, G15_LOG_INFO, "Done opening the keyboard\n");
+	return	handle;
+}
+
+/* open the first supported device that nobody has open yet, optionally of a given type or
+   at a given bus address.  the bus is walked once, each entry matched against g15_devices,
+   and when several keyboards qualify the one listed first in g15_devices wins */
+static libusb_device_handle * findAndOpenG15(lg_device_t *dev, lg_device_info_t const *want) {
+	libusb_device **devices;
+	libusb_device *best = NULL;
+	libusb_device_handle *handle = NULL;
+	struct libusb_device_descriptor desc, best_desc;
+	struct timespec mark;
 	ssize_t count;
-	int i, j, k, l, m, ret, retries;
-	unsigned int found = 0;
+	int i, type, best_type = -1, found = 0;
+	unsigned char bus, address;
 
 	if (!context)	/* Ensure we're initialized. */
 		return	NULL;
+	clock_gettime(CLOCK_MONOTONIC, &mark);
 	count = libusb_get_device_list(context, &devices);
 	for (i = 0; i < count; i++) {
-		if (!libusb_get_device_descriptor(devices[i], &desc)) {
-			/* Only check device if we successfully returned its descriptor. */
-			if ((desc.idVendor == handled_device.vendorid) && (desc.idProduct == handled_device.productid)) {
-				found_devicetype = device_index;
-				g15_log(stderr, G15_LOG_INFO, "Found %s, trying to open it\n", handled_device.name);
-				ret = libusb_open(devices[i], &handle);
-				if (ret != 0) {
-					g15_log(stderr, G15_LOG_INFO, "Error %d, could not open keyboard\nPerhaps you don't have the appropriate permissions\n", ret);
-					return	NULL;
-				}
-				usleep(50 * 1000);
-				g15_log(stderr, G15_LOG_INFO, "Device has %i possible configurations\n", desc.bNumConfigurations);
-
-				/* if device is shared with another driver, such as the Z-10 speakers sharing with alsa, we have to disable some calls */
-                if(g15DeviceCapabilities() & G15_DEVICE_IS_SHARED)
-                  shared_device = 1;
-                for (j = 0; j < desc.bNumConfigurations; j++) {
-                	ret = libusb_get_config_descriptor(devices[i], j, &cfg);
-                	if (ret != 0) {
-                		g15_log(stderr, G15_LOG_INFO, "Error %d, could not get config descriptor", ret);
-                		continue;	/* NOT break */
-                	}
-                	for (k = 0; k < cfg->bNumInterfaces; k++) {
-                		if (g15DeviceCapabilities() & G15_DEVICE_G510) {
-                			if (k == G510_STANDARD_KEYBOARD_INTERFACE)
-                				continue;	/* NOT break */
-                		}
-                		if ((g15_keys_endpoint != 0) && (g15_lcd_endpoint != 0)) {
-                			break;	/* We're done, so finish up. */
-                		}
-                		interface = &(cfg->interface[k]);
-                		g15_log(stderr, G15_LOG_INFO, "Device has %i Alternate Settings\n", interface->num_altsetting);
-                		for (l = 0; l < interface->num_altsetting; l++) {
-                			if_desc = &(interface->altsetting[l]);
-
-                			/* Verify the interface is for a HID device */
-                			if (if_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
-                				g15_log(stderr, G15_LOG_INFO, "Interface %i has %i Endpoints\n", i, if_desc->bNumEndpoints);
-                				usleep(50 * 1000);
-
-                				ret = libusb_kernel_driver_active(handle, k);
-                				if (ret == 1) {	/* This is the only case where the kernel driver is actually active. */
-                					open_interface = k;
-                					ret = libusb_detach_kernel_driver(handle, k);
-                					if (!ret) {
-                						g15_log(stderr, G15_LOG_INFO, "Success, detached the driver\n");
-                					} else {
-                						g15_log(stderr, G15_LOG_INFO, "Sorry, couldn't detach the driver, error %d\n", ret);
-                						return	findCleanup(handle, devices);
-                					}
-                				}
-   								/* don't set configuration if device is shared */
-                                if(0 == shared_device) {
-                                  	ret = libusb_set_configuration(handle, 1);
-                                   	if (ret != 0) {
-                                   		g15_log(stderr, G15_LOG_INFO, "Unable to set configuration, error %d\n", ret);
-                                   		return	findCleanup(handle, devices);
-                                   	}
-                                }
-                                usleep(50*1000);
-                                g15_log(stderr, G15_LOG_INFO, "Trying to claim interface %d\n", k);
-                                while ((ret = libusb_claim_interface(handle, k)) && (retries < 10)) {
-                                	usleep(50*1000);
-                                    retries++;
-                                    g15_log(stderr, G15_LOG_INFO, "Trying to claim interface %d, retry %d\n", k, retries);
-                                }
-                                if (ret) {
-                                   	g15_log(stderr, G15_LOG_INFO, "Error claiming interface, code %d\n", ret);
-                                   	return	findCleanup(handle, devices);
-                                }
-                                for (m = 0; m < if_desc->bNumEndpoints; m++) {
-                                   	const struct libusb_endpoint_descriptor *end = &(if_desc->endpoint[m]);
-
-                                   	g15_log(stderr, G15_LOG_INFO, "Found %s endpoint %i with address 0x%X maxtransfersize=%i\n",
-                                   			((0x80 & end->bEndpointAddress) ? "\"Extra Keys\"" : "\"LCD\""),
-                                   			end->bEndpointAddress & 0x0f, end->bEndpointAddress, end->wMaxPacketSize);
-                                   	if (0x80 & end->bEndpointAddress) {
-                                   		g15_keys_endpoint = end->bEndpointAddress;
-                                   	} else {
-                                   		g15_lcd_endpoint = end->bEndpointAddress;
-                                   	}
-                                }
-                                if (ret) {
-                                   	g15_log(stderr, G15_LOG_INFO, "Error %d setting Alternative Interface\n", ret);
-                				}
-                			}
-                		}
-                	}
+		/* Only check device if we successfully returned its descriptor. */
+		if (libusb_get_device_descriptor(devices[i], &desc))
+			continue;
+		if ((type = lookupDeviceType(desc.idVendor, desc.idProduct)) < 0)
+			continue;
+		found++;
+		if (best && type >= best_type)
+			continue;
+		if (want && want->devicetype != type)
+			continue;
+		if (dev->want_devicetype > -1 && dev->want_devicetype != type)
+			continue;
+		bus = libusb_get_bus_number(devices[i]);
+		address = libusb_get_device_address(devices[i]);
+		if (want && (want->bus != bus || want->address != address))
+			continue;
+		if (isDeviceOpen(bus, address))
+			continue;
+		best = devices[i];
+		best_desc = desc;
+		best_type = type;
+	}
+	g15_log(stderr, G15_LOG_INFO, "Found %i supported devices\n", found);
+	phaseDone(&dev->startup.enumerate, &mark);
+	if (best)
+		handle = openDevice(dev, best, &best_desc, best_type);
+	else
+		g15_log(stderr, G15_LOG_INFO, "No supported device available\n");
+	libusb_free_device_list(devices, 1);	/* De-reference all entries, an opened device still has 1 ref */
+	return	handle;
+}
+
+static int usbOpen(lg_device_t *dev, lg_device_info_t const *want, void *arrived)
+{
+    struct libusb_device_descriptor desc;
+    libusb_device_handle *handle = NULL;
+    int type;
+
+    /* hotplug told us where the keyboard came back, so there is no need to look for it */
+    if (arrived) {
+        if (!libusb_get_device_descriptor(arrived, &desc) &&
+            (type = lookupDeviceType(desc.idVendor, desc.idProduct)) >= 0)
+            handle = openDevice(dev, arrived, &desc, type);
+    } else {
+        handle = findAndOpenG15(dev, want);
+    }
+    if (!handle)
+        return LIBUSB_ERROR_NOT_FOUND;
+    setDeviceHandle(dev, handle);
+    return LIBUSB_SUCCESS;
+}
+
+/* release the keyboard, giving it back to the kernel driver if reattach is set */
+static int usbClose(lg_device_t *dev, void *handle, int reattach)
+{
+    int retval = 0;
+
+#ifndef SUN_LIBUSB
+    retval = libusb_release_interface (handle, dev->open_interface);
+#endif
+    if (reattach) {
+#if 0
+        retval = usb_reset(handle);
+        usleep(50*1000);
+#endif
+        /* the kernel may still be letting go of the interface */
+        retval = usbRetry(libusb_attach_kernel_driver, handle, dev->open_interface, USB_RETRY_TIMEOUT, NULL);
+        if (retval != 0) {
+        	g15_log(stderr, G15_LOG_INFO, "Unable to re-attach kernel driver, error %d\n", retval);
+        }
+    }
+    libusb_close(handle);
+    return retval;
+}
+
+static int usbReset(lg_device_t *dev)
+{
+    return libusb_reset_device(dev->handle);
+}
+
+static int usbClearHalt(lg_device_t *dev, unsigned char endpoint)
+{
+    return libusb_clear_halt(dev->handle, endpoint);
+}
+
+static int usbInterruptTransfer(lg_device_t *dev, unsigned char endpoint, unsigned char *data,
+                                int length, int *transferred, unsigned int timeout)
+{
+    return libusb_interrupt_transfer(dev->handle, endpoint, data, length, transferred, timeout);
+}
+
+static int usbControlTransfer(lg_device_t *dev, unsigned int value, unsigned int index,
+                              unsigned char *data, unsigned int length, unsigned int timeout)
+{
+    return libusb_control_transfer(dev->handle, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9,
+                                   value, index, data, length, timeout);
+}
+
+static void LIBUSB_CALL usbTransferDone(struct libusb_transfer *transfer)
+{
+    lg_xfer_t *xfer = (lg_xfer_t*)transfer->user_data;
+
+    xfer->status = transfer->status;
+    xfer->actual_length = transfer->actual_length;
+    xfer->callback(xfer);
+}
+
+static int usbSubmit(lg_xfer_t *xfer)
+{
+    struct libusb_transfer *transfer = (struct libusb_transfer*)xfer->priv;
+
+    if (!transfer && !(transfer = xfer->priv = libusb_alloc_transfer(0)))
+        return LIBUSB_ERROR_NO_MEM;
+    libusb_fill_interrupt_transfer(transfer, xfer->dev->handle, xfer->endpoint,
+                                   xfer->buffer, xfer->length, usbTransferDone, xfer, xfer->timeout);
+    return libusb_submit_transfer(transfer);
+}
+
+static int usbCancel(lg_xfer_t *xfer)
+{
+    return libusb_cancel_transfer((struct libusb_transfer*)xfer->priv);
+}
+
+static void usbFreeXfer(lg_xfer_t *xfer)
+{
+    if (xfer->priv)
+        libusb_free_transfer((struct libusb_transfer*)xfer->priv);
+    xfer->priv = NULL;
+}
+
+/* usbfs can map memory the host controller reads from directly, which spares the kernel a
+   copy of every frame.  older libusb or kernels get ordinary memory */
+static unsigned char *usbAllocBuffer(lg_device_t *dev, int length, int *dev_mem)
+{
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    unsigned char *buffer = libusb_dev_mem_alloc(dev->handle, length);
+
+    if (buffer) {
+        *dev_mem = 1;
+        return buffer;
+    }
+#endif
+    *dev_mem = 0;
+    return malloc(length);
+}
+
+static void usbFreeBuffer(lg_device_t *dev, unsigned char *buffer, int length, int dev_mem)
+{
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    if (dev_mem) {
+        libusb_dev_mem_free(dev->handle, buffer, length);
+        return;
+    }
+#endif
+    free(buffer);
+}
+
+static void usbHandleEvents(int *completed)
+{
+    libusb_handle_events_completed(context, completed);
+}
+
+static void usbInterruptEvents()
+{
+    libusb_interrupt_event_handler(context);
+}
+
+static void usbUnref(void *device)
+{
+    libusb_unref_device((libusb_device*)device);
+}
+
+static const lg_transport_t usb_transport = {
+    "libusb",
+    usbInit,
+    usbEnumerate,
+    usbOpen,
+    usbClose,
+    usbReset,
+    usbClearHalt,
+    usbInterruptTransfer,
+    usbControlTransfer,
+    usbSubmit,
+    usbCancel,
+    usbFreeXfer,
+    usbAllocBuffer,
+    usbFreeBuffer,
+    usbHandleEvents,
+    usbInterruptEvents,
+    usbUnref
+};
+
+/* the virtual transport.  an in-process stand-in for the bus with one emulated keyboard per
+   lg_virtual_add, so the library and the daemon can run without hardware.  LCD frames and
+   control requests are recorded, key reports are injected by the caller, and latency,
+   overflows, stalls and unplugging are simulated on request.  completions and hotplug
+   events are delivered on the usb event thread, as libusb does */
+
+#define VIRTUAL_DEVICES         16      /* room for one of every model in g15_devices */
+#define VIRTUAL_FRAMES          64      /* recorded frames kept per device */
+#define VIRTUAL_CONTROLS        64
+#define VIRTUAL_REPORTS         64      /* injected key reports not read yet */
+#define VIRTUAL_LCD_ENDPOINT    0x02
+#define VIRTUAL_KEYS_ENDPOINT   0x81
+
+/* G15_VIRTUAL_LCD or G15_VIRTUAL_KEYS */
+#define VIRTUAL_EP(endpoint)    (((endpoint) & 0x80) ? G15_VIRTUAL_KEYS : G15_VIRTUAL_LCD)
+
+typedef struct virtual_device_t {
+    int devicetype;                 /* index into g15_devices */
+    int present;
+    int opened;
+    unsigned char address;          /* changes on every replug, like a real re-enumeration */
+    unsigned int latency;           /* us added to every transfer */
+    int fail[2];                    /* libusb error for the next fail_count transfers, per endpoint */
+    unsigned int fail_count[2];
+    int hotplug;                    /* events for the event thread, 1 << G15_HOTPLUG_* */
+
+    unsigned char lcd_buffer[G15_BUFFER_LEN];   /* a frame being put together from chunks */
+    int lcd_offset;
+    lg_virtual_frame_t frames[VIRTUAL_FRAMES];
+    unsigned long frame_count;
+    lg_virtual_control_t controls[VIRTUAL_CONTROLS];
+    unsigned long control_count;
+
+    unsigned char reports[VIRTUAL_REPORTS][G15_KEY_READ_LENGTH];
+    int report_length[VIRTUAL_REPORTS];
+    unsigned int report_head;
+    unsigned int report_count;
+} virtual_device_t;
+
+/* an async transfer waiting on a virtual device */
+typedef struct virtual_xfer_t {
+    lg_xfer_t *xfer;
+    virtual_device_t *vdev;
+    struct timespec due;            /* the simulated latency, not completed before this */
+    struct timespec deadline;       /* times out after this if xfer->timeout is set */
+    int cancelled;
+    int queued;
+    struct virtual_xfer_t *next;
+} virtual_xfer_t;
+
+static virtual_device_t virtual_devices[VIRTUAL_DEVICES];
+static int virtual_device_count = 0;
+static virtual_xfer_t *virtual_pending = NULL;
+static int virtual_interrupted = 0;
+static pthread_mutex_t virtual_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t virtual_cond;
+static pthread_once_t virtual_once = PTHREAD_ONCE_INIT;
+
+static const int virtual_failures[] = {
+    0,                          /* G15_VIRTUAL_FAIL_NONE */
+    LIBUSB_ERROR_OVERFLOW,      /* G15_VIRTUAL_FAIL_OVERFLOW */
+    LIBUSB_ERROR_TIMEOUT,       /* G15_VIRTUAL_FAIL_TIMEOUT */
+    LIBUSB_ERROR_PIPE           /* G15_VIRTUAL_FAIL_STALL */
+};
+
+static void timespecAddUs(struct timespec *t, unsigned long us)
+{
+    t->tv_sec += us / 1000000;
+    t->tv_nsec += (us % 1000000) * 1000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+static int timespecBefore(struct timespec const *a, struct timespec const *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* must be called with virtual_mutex held */
+static virtual_device_t *virtualDevice(int id)
+{
+    if (id < 0 || id >= virtual_device_count)
+        return NULL;
+    return &virtual_devices[id];
+}
+
+/* must be called with virtual_mutex held. the error an injected failure turns the next
+   transfer on ep into, or 0 */
+static int virtualFailure(virtual_device_t *vdev, int ep)
+{
+    if (!vdev->present)
+        return LIBUSB_ERROR_NO_DEVICE;
+    if (!vdev->fail_count[ep])
+        return 0;
+    vdev->fail_count[ep]--;
+    return vdev->fail[ep];
+}
+
+/* must be called with virtual_mutex held. take all or part of an LCD frame, recording it once complete */
+static int virtualWriteLCD(virtual_device_t *vdev, unsigned char const *data, int length)
+{
+    lg_virtual_frame_t *frame;
+    int ret;
+
+    if ((ret = virtualFailure(vdev, G15_VIRTUAL_LCD))) {
+        vdev->lcd_offset = 0;
+        return ret;
+    }
+    if (length > G15_BUFFER_LEN)
+        return LIBUSB_ERROR_OVERFLOW;
+    /* a whole frame arriving after a partial one */
+    if (vdev->lcd_offset + length > G15_BUFFER_LEN)
+        vdev->lcd_offset = 0;
+    memcpy(vdev->lcd_buffer + vdev->lcd_offset, data, length);
+    vdev->lcd_offset += length;
+    if (vdev->lcd_offset < G15_BUFFER_LEN)
+        return 0;
+
+    vdev->lcd_offset = 0;
+    frame = &vdev->frames[vdev->frame_count++ % VIRTUAL_FRAMES];
+    memcpy(frame->data, vdev->lcd_buffer, G15_BUFFER_LEN);
+    frame->when = monotonicUs();
+    return 0;
+}
+
+/* must be called with virtual_mutex held. LIBUSB_ERROR_TIMEOUT if no report is waiting */
+static int virtualReadKeys(virtual_device_t *vdev, unsigned char *data, int length, int *read)
+{
+    int n;
+
+    if (!vdev->present || vdev->fail_count[G15_VIRTUAL_KEYS])
+        return virtualFailure(vdev, G15_VIRTUAL_KEYS);
+    if (!vdev->report_count)
+        return LIBUSB_ERROR_TIMEOUT;
+
+    n = vdev->report_length[vdev->report_head];
+    if (n > length)
+        n = length;
+    memcpy(data, vdev->reports[vdev->report_head], n);
+    vdev->report_head = (vdev->report_head + 1) % VIRTUAL_REPORTS;
+    vdev->report_count--;
+    *read = n;
+    return 0;
+}
+
+static int virtualTransferStatus(int error)
+{
+    switch (error) {
+        case LIBUSB_SUCCESS:
+            return LIBUSB_TRANSFER_COMPLETED;
+        case LIBUSB_ERROR_TIMEOUT:
+            return LIBUSB_TRANSFER_TIMED_OUT;
+        case LIBUSB_ERROR_PIPE:
+            return LIBUSB_TRANSFER_STALL;
+        case LIBUSB_ERROR_NO_DEVICE:
+            return LIBUSB_TRANSFER_NO_DEVICE;
+        case LIBUSB_ERROR_OVERFLOW:
+            return LIBUSB_TRANSFER_OVERFLOW;
+        default:
+            return LIBUSB_TRANSFER_ERROR;
+    }
+}
+
+static void virtualInitOnce()
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&virtual_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* plug in a keyboard of type, returning its id or -1 */
+static int virtualAdd(int type)
+{
+    virtual_device_t *vdev;
+    int id;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (virtual_device_count == VIRTUAL_DEVICES) {
+        pthread_mutex_unlock(&virtual_mutex);
+        return -1;
+    }
+    id = virtual_device_count++;
+    vdev = &virtual_devices[id];
+    memset(vdev, 0, sizeof(virtual_device_t));
+    vdev->devicetype = type;
+    vdev->present = 1;
+    vdev->address = id + 1;
+    vdev->hotplug = 1 << G15_HOTPLUG_ARRIVED;
+    pthread_cond_broadcast(&virtual_cond);
+    pthread_mutex_unlock(&virtual_mutex);
+    g15_log(stderr, G15_LOG_INFO, "Virtual %s plugged in as %i\n", g15_devices[type].name, id);
+    return id;
+}
+
+/* LIBLOGITECH_VIRTUAL holds the product ids of the keyboards to start with, eg "c222,c21c" */
+static int virtualInit()
+{
+    const char *env = getenv("LIBLOGITECH_VIRTUAL");
+    char *end;
+    unsigned long productid;
+    int type;
+
+    pthread_once(&virtual_once, virtualInitOnce);
+    hotplug_registered = 1;
+    while (env && *env) {
+        productid = strtoul(env, &end, 16);
+        if (end == env)
+            break;
+        if ((type = lookupDeviceType(0x46d, productid)) >= 0)
+            virtualAdd(type);
+        else
+            g15_log(stderr, G15_LOG_INFO, "No supported device with product id %lx\n", productid);
+        env = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
+}
+
+static int virtualEnumerate(lg_device_info_t *list, int max)
+{
+    virtual_device_t *vdev;
+    int i, found = 0;
+
+    pthread_mutex_lock(&virtual_mutex);
+    for (i = 0; i < virtual_device_count; i++) {
+        vdev = &virtual_devices[i];
+        if (!vdev->present)
+            continue;
+        if (list && found < max) {
+            list[found].devicetype = vdev->devicetype;
+            list[found].name = g15_devices[vdev->devicetype].name;
+            list[found].caps = g15_devices[vdev->devicetype].caps;
+            list[found].bus = 0;
+            list[found].address = vdev->address;
+        }
+        found++;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return found;
+}
+
+static int virtualOpen(lg_device_t *dev, lg_device_info_t const *want, void *arrived)
+{
+    virtual_device_t *vdev = NULL, *v;
+    unsigned int caps;
+    int i;
+
+    pthread_mutex_lock(&virtual_mutex);
+    for (i = 0; i < virtual_device_count && !vdev; i++) {
+        v = &virtual_devices[i];
+        if (!v->present || v->opened || (arrived && v != arrived))
+            continue;
+        if (want && (want->devicetype != v->devicetype || want->bus != 0 || want->address != v->address))
+            continue;
+        if (dev->want_devicetype > -1 && dev->want_devicetype != v->devicetype)
+            continue;
+        vdev = v;
+    }
+    if (!vdev) {
+        pthread_mutex_unlock(&virtual_mutex);
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    vdev->opened = 1;
+    vdev->lcd_offset = 0;
+    pthread_mutex_unlock(&virtual_mutex);
+
+    caps = g15_devices[vdev->devicetype].caps;
+    dev->devicetype = vdev->devicetype;
+    dev->bus = 0;
+    dev->address = vdev->address;
+    dev->open_interface = 0;
+    dev->shared_device = (caps & G15_DEVICE_IS_SHARED) ? 1 : 0;
+    dev->lcd_endpoint = (caps & G15_LCD) ? VIRTUAL_LCD_ENDPOINT : 0;
+    dev->keys_endpoint = VIRTUAL_KEYS_ENDPOINT;
+    setDeviceHandle(dev, vdev);
+    g15_log(stderr, G15_LOG_INFO, "Opened virtual %s\n", g15_devices[vdev->devicetype].name);
+    return LIBUSB_SUCCESS;
+}
+
+static int virtualClose(lg_device_t *dev, void *handle, int reattach)
+{
+    virtual_device_t *vdev = (virtual_device_t*)handle;
+
+    pthread_mutex_lock(&virtual_mutex);
+    vdev->opened = 0;
+    pthread_mutex_unlock(&virtual_mutex);
+    return 0;
+}
+
+static int virtualReset(lg_device_t *dev)
+{
+    virtual_device_t *vdev = (virtual_device_t*)dev->handle;
+    int ret = LIBUSB_ERROR_NOT_FOUND;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (vdev->present) {
+        vdev->lcd_offset = 0;
+        ret = LIBUSB_SUCCESS;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+/* a stall lasts until it is cleared, whatever count it was injected with */
+static int virtualClearHalt(lg_device_t *dev, unsigned char endpoint)
+{
+    virtual_device_t *vdev = (virtual_device_t*)dev->handle;
+    int ep = VIRTUAL_EP(endpoint);
+    int ret = LIBUSB_ERROR_NO_DEVICE;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (vdev->present) {
+        if (vdev->fail[ep] == LIBUSB_ERROR_PIPE)
+            vdev->fail_count[ep] = 0;
+        ret = LIBUSB_SUCCESS;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+static int virtualInterruptTransfer(lg_device_t *dev, unsigned char endpoint, unsigned char *data,
+                                    int length, int *transferred, unsigned int timeout)
+{
+    virtual_device_t *vdev = (virtual_device_t*)dev->handle;
+    struct timespec deadline;
+    unsigned int latency;
+    int ret, expired = 0;
+
+    *transferred = 0;
+    pthread_mutex_lock(&virtual_mutex);
+    latency = vdev->latency;
+    pthread_mutex_unlock(&virtual_mutex);
+    if (latency)
+        usleep(latency);
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (VIRTUAL_EP(endpoint) == G15_VIRTUAL_LCD) {
+        ret = virtualWriteLCD(vdev, data, length);
+        if (ret == LIBUSB_SUCCESS)
+            *transferred = length;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        timespecAddUs(&deadline, timeout * 1000UL);
+        while ((ret = virtualReadKeys(vdev, data, length, transferred)) == LIBUSB_ERROR_TIMEOUT && !expired) {
+            if (timeout)
+                expired = pthread_cond_timedwait(&virtual_cond, &virtual_mutex, &deadline) == ETIMEDOUT;
+            else
+                pthread_cond_wait(&virtual_cond, &virtual_mutex);
+        }
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+static int virtualControlTransfer(lg_device_t *dev, unsigned int value, unsigned int index,
+                                  unsigned char *data, unsigned int length, unsigned int timeout)
+{
+    virtual_device_t *vdev = (virtual_device_t*)dev->handle;
+    lg_virtual_control_t *control;
+    int ret = LIBUSB_ERROR_NO_DEVICE;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (vdev->present) {
+        control = &vdev->controls[vdev->control_count++ % VIRTUAL_CONTROLS];
+        control->when = monotonicUs();
+        control->value = value;
+        control->index = index;
+        control->length = length;
+        memcpy(control->data, data, length < sizeof(control->data) ? length : sizeof(control->data));
+        ret = length;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+static int virtualSubmit(lg_xfer_t *xfer)
+{
+    virtual_device_t *vdev = (virtual_device_t*)xfer->dev->handle;
+    virtual_xfer_t *vx = (virtual_xfer_t*)xfer->priv;
+    virtual_xfer_t **link;
+
+    if (!vdev)
+        return LIBUSB_ERROR_NO_DEVICE;
+    if (!vx && !(vx = xfer->priv = calloc(1, sizeof(virtual_xfer_t))))
+        return LIBUSB_ERROR_NO_MEM;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (!vdev->present || vx->queued) {
+        pthread_mutex_unlock(&virtual_mutex);
+        return vx->queued ? LIBUSB_ERROR_BUSY : LIBUSB_ERROR_NO_DEVICE;
+    }
+    vx->xfer = xfer;
+    vx->vdev = vdev;
+    vx->cancelled = 0;
+    vx->queued = 1;
+    vx->next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &vx->due);
+    vx->deadline = vx->due;
+    timespecAddUs(&vx->deadline, xfer->timeout * 1000UL);
+    timespecAddUs(&vx->due, vdev->latency);
+    for (link = &virtual_pending; *link; link = &(*link)->next)
+        ;
+    *link = vx;
+    pthread_cond_broadcast(&virtual_cond);
+    pthread_mutex_unlock(&virtual_mutex);
+    return LIBUSB_SUCCESS;
+}
+
+static int virtualCancel(lg_xfer_t *xfer)
+{
+    virtual_xfer_t *vx = (virtual_xfer_t*)xfer->priv;
+    int ret = LIBUSB_ERROR_NOT_FOUND;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (vx && vx->queued) {
+        vx->cancelled = 1;
+        pthread_cond_broadcast(&virtual_cond);
+        ret = LIBUSB_SUCCESS;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+static void virtualFreeXfer(lg_xfer_t *xfer)
+{
+    virtual_xfer_t *vx = (virtual_xfer_t*)xfer->priv;
+    virtual_xfer_t **link;
+
+    if (!vx)
+        return;
+    pthread_mutex_lock(&virtual_mutex);
+    for (link = &virtual_pending; vx->queued && *link; link = &(*link)->next) {
+        if (*link == vx) {
+            *link = vx->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    free(vx);
+    xfer->priv = NULL;
+}
+
+static unsigned char *virtualAllocBuffer(lg_device_t *dev, int length, int *dev_mem)
+{
+    *dev_mem = 0;
+    return malloc(length);
+}
+
+static void virtualFreeBuffer(lg_device_t *dev, unsigned char *buffer, int length, int dev_mem)
+{
+    free(buffer);
+}
+
+/* must be called with virtual_mutex held. fills in the transfer's status and returns 1 if it
+   is done, otherwise moves wake up to when it could be */
+static int virtualComplete(virtual_xfer_t *vx, struct timespec const *now, struct timespec *wake)
+{
+    lg_xfer_t *xfer = vx->xfer;
+    int ret;
+
+    xfer->actual_length = 0;
+    if (vx->cancelled) {
+        xfer->status = LIBUSB_TRANSFER_CANCELLED;
+        return 1;
+    }
+    if (!vx->vdev->present) {
+        xfer->status = LIBUSB_TRANSFER_NO_DEVICE;
+        return 1;
+    }
+    if (timespecBefore(now, &vx->due)) {
+        if (timespecBefore(&vx->due, wake))
+            *wake = vx->due;
+        return 0;
+    }
+    if (VIRTUAL_EP(xfer->endpoint) == G15_VIRTUAL_LCD) {
+        ret = virtualWriteLCD(vx->vdev, xfer->buffer, xfer->length);
+        if (ret == LIBUSB_SUCCESS)
+            xfer->actual_length = xfer->length;
+    } else {
+        ret = virtualReadKeys(vx->vdev, xfer->buffer, xfer->length, &xfer->actual_length);
+        /* no report yet, keep waiting unless the transfer has timed out */
+        if (ret == LIBUSB_ERROR_TIMEOUT && (!xfer->timeout || timespecBefore(now, &vx->deadline))) {
+            if (xfer->timeout && timespecBefore(&vx->deadline, wake))
+                *wake = vx->deadline;
+            return 0;
+        }
+    }
+    xfer->status = virtualTransferStatus(ret);
+    return 1;
+}
+
+static void virtualHandleEvents(int *completed)
+{
+    virtual_xfer_t *done = NULL, **tail = &done;
+    virtual_xfer_t *vx, **link;
+    lg_device_t *dev;
+    struct timespec now, wake;
+    int hotplug[VIRTUAL_DEVICES];
+    int i, count = 0, events = 0;
+
+    pthread_mutex_lock(&virtual_mutex);
+    while (!*completed && !virtual_interrupted) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wake = now;
+        timespecAddUs(&wake, 1000000);
+        for (link = &virtual_pending; (vx = *link); ) {
+            if (virtualComplete(vx, &now, &wake)) {
+                *link = vx->next;
+                vx->queued = 0;
+                vx->next = NULL;
+                *tail = vx;
+                tail = &vx->next;
+            } else {
+                link = &vx->next;
+            }
+        }
+        count = virtual_device_count;
+        for (i = 0; i < count; i++) {
+            hotplug[i] = virtual_devices[i].hotplug;
+            virtual_devices[i].hotplug = 0;
+            events |= hotplug[i];
+        }
+        if (done || events)
+            break;
+        pthread_cond_timedwait(&virtual_cond, &virtual_mutex, &wake);
+    }
+    virtual_interrupted = 0;
+    pthread_mutex_unlock(&virtual_mutex);
+
+    /* both of these call back into the transport, so virtual_mutex must not be held */
+    if (events) {
+        pthread_mutex_lock(&devices_mutex);
+        for (i = 0; i < count; i++) {
+            if (hotplug[i] & (1 << G15_HOTPLUG_LEFT)) {
+                for (dev = open_devices; dev; dev = dev->next) {
+                    if (dev->handle == &virtual_devices[i]) {
+                        deviceLeft(dev);
+                        break;
+                    }
                 }
-           	g15_log(stderr, G15_LOG_INFO, "Done opening the keyboard\n");
-           	usleep(50 * 1000);
-           	libusb_free_device_list(devices, 1);	/* De-reference all entries, opened device still has 1 ref */
-           	return	handle;
-			}
-		}
+            }
+            if (hotplug[i] & (1 << G15_HOTPLUG_ARRIVED))
+                deviceArrived(&virtual_devices[i], virtual_devices[i].devicetype);
+        }
+        pthread_mutex_unlock(&devices_mutex);
+    }
+    while ((vx = done)) {
+        done = vx->next;
+        vx->xfer->callback(vx->xfer);
+    }
+}
+
+static void virtualInterruptEvents()
+{
+    pthread_mutex_lock(&virtual_mutex);
+    virtual_interrupted = 1;
+    pthread_cond_broadcast(&virtual_cond);
+    pthread_mutex_unlock(&virtual_mutex);
+}
+
+/* virtual devices live as long as the process */
+static void virtualUnref(void *device)
+{
+}
+
+static const lg_transport_t virtual_transport = {
+    "virtual",
+    virtualInit,
+    virtualEnumerate,
+    virtualOpen,
+    virtualClose,
+    virtualReset,
+    virtualClearHalt,
+    virtualInterruptTransfer,
+    virtualControlTransfer,
+    virtualSubmit,
+    virtualCancel,
+    virtualFreeXfer,
+    virtualAllocBuffer,
+    virtualFreeBuffer,
+    virtualHandleEvents,
+    virtualInterruptEvents,
+    virtualUnref
+};
+
+/* the transport is picked on first use and kept for the life of the process */
+static int initTransport()
+{
+    int ret;
+
+    if (transport)
+        return 0;
+    if (getenv("LIBLOGITECH_VIRTUAL"))
+        return lg_virtual_enable();
+    if ((ret = usb_transport.init()))
+        return ret;
+    transport = &usb_transport;
+    return 0;
+}
+
+int lg_virtual_enable()
+{
+    int ret;
+
+    if (transport == &virtual_transport)
+        return G15_NO_ERROR;
+    if (transport)
+        return G15_ERROR_UNSUPPORTED;
+    if ((ret = virtual_transport.init()))
+        return ret;
+    transport = &virtual_transport;
+    g15_log(stderr, G15_LOG_INFO, "Using virtual devices\n");
+    return G15_NO_ERROR;
+}
+
+int lg_virtual_add(unsigned int productid)
+{
+    int type;
+
+    if (lg_virtual_enable() != G15_NO_ERROR)
+        return -1;
+    if ((type = lookupDeviceType(0x46d, productid)) < 0)
+        return -1;
+    return virtualAdd(type);
+}
+
+int lg_virtual_unplug(int id)
+{
+    virtual_device_t *vdev;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (!(vdev = virtualDevice(id))) {
+        pthread_mutex_unlock(&virtual_mutex);
+        return -ENODEV;
+    }
+    if (vdev->present) {
+        vdev->present = 0;
+        vdev->hotplug |= 1 << G15_HOTPLUG_LEFT;
+        pthread_cond_broadcast(&virtual_cond);
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return G15_NO_ERROR;
+}
+
+int lg_virtual_plug(int id)
+{
+    virtual_device_t *vdev;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (!(vdev = virtualDevice(id))) {
+        pthread_mutex_unlock(&virtual_mutex);
+        return -ENODEV;
+    }
+    if (!vdev->present) {
+        vdev->present = 1;
+        vdev->address += VIRTUAL_DEVICES;
+        if (vdev->address > 127)
+            vdev->address = id + 1;
+        vdev->fail_count[G15_VIRTUAL_LCD] = vdev->fail_count[G15_VIRTUAL_KEYS] = 0;
+        vdev->report_count = 0;
+        vdev->lcd_offset = 0;
+        vdev->hotplug |= 1 << G15_HOTPLUG_ARRIVED;
+        pthread_cond_broadcast(&virtual_cond);
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return G15_NO_ERROR;
+}
+
+int lg_virtual_set_latency(int id, unsigned int latency)
+{
+    virtual_device_t *vdev;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if ((vdev = virtualDevice(id)))
+        vdev->latency = latency;
+    pthread_mutex_unlock(&virtual_mutex);
+    return vdev ? G15_NO_ERROR : -ENODEV;
+}
+
+int lg_virtual_fail(int id, int endpoint, int failure, unsigned int count)
+{
+    virtual_device_t *vdev;
+
+    if ((endpoint != G15_VIRTUAL_LCD && endpoint != G15_VIRTUAL_KEYS) ||
+        failure < G15_VIRTUAL_FAIL_NONE || failure > G15_VIRTUAL_FAIL_STALL)
+        return G15_ERROR_UNSUPPORTED;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if ((vdev = virtualDevice(id))) {
+        vdev->fail[endpoint] = virtual_failures[failure];
+        vdev->fail_count[endpoint] = failure == G15_VIRTUAL_FAIL_NONE ? 0 : count;
+        pthread_cond_broadcast(&virtual_cond);
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return vdev ? G15_NO_ERROR : -ENODEV;
+}
+
+int lg_virtual_inject_report(int id, unsigned char const *report, int length)
+{
+    virtual_device_t *vdev;
+    int ret = G15_NO_ERROR;
+    unsigned int slot;
+
+    if (length <= 0 || length > G15_KEY_READ_LENGTH)
+        return G15_ERROR_UNSUPPORTED;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (!(vdev = virtualDevice(id))) {
+        ret = -ENODEV;
+    } else if (vdev->report_count == VIRTUAL_REPORTS) {
+        ret = G15_ERROR_TRY_AGAIN;
+    } else {
+        slot = (vdev->report_head + vdev->report_count++) % VIRTUAL_REPORTS;
+        memcpy(vdev->reports[slot], report, length);
+        vdev->report_length[slot] = length;
+        pthread_cond_broadcast(&virtual_cond);
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+static int encodeKeyReport(int devicetype, uint64_t keys, unsigned char *buffer);
+
+int lg_virtual_press_keys(int id, uint64_t keys)
+{
+    unsigned char report[G15_KEY_READ_LENGTH];
+    int type;
+
+    pthread_mutex_lock(&virtual_mutex);
+    type = virtualDevice(id) ? virtual_devices[id].devicetype : -1;
+    pthread_mutex_unlock(&virtual_mutex);
+    if (type < 0)
+        return -ENODEV;
+    return lg_virtual_inject_report(id, report, encodeKeyReport(type, keys, report));
+}
+
+unsigned long lg_virtual_frame_count(int id)
+{
+    virtual_device_t *vdev;
+    unsigned long count = 0;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if ((vdev = virtualDevice(id)))
+        count = vdev->frame_count;
+    pthread_mutex_unlock(&virtual_mutex);
+    return count;
+}
+
+int lg_virtual_get_frame(int id, unsigned long n, lg_virtual_frame_t *frame)
+{
+    virtual_device_t *vdev;
+    int ret = -1;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (!(vdev = virtualDevice(id))) {
+        ret = -ENODEV;
+    } else if (n < vdev->frame_count && n < VIRTUAL_FRAMES) {
+        *frame = vdev->frames[(vdev->frame_count - 1 - n) % VIRTUAL_FRAMES];
+        ret = G15_NO_ERROR;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+unsigned long lg_virtual_control_count(int id)
+{
+    virtual_device_t *vdev;
+    unsigned long count = 0;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if ((vdev = virtualDevice(id)))
+        count = vdev->control_count;
+    pthread_mutex_unlock(&virtual_mutex);
+    return count;
+}
+
+int lg_virtual_get_control(int id, unsigned long n, lg_virtual_control_t *control)
+{
+    virtual_device_t *vdev;
+    int ret = -1;
+
+    pthread_mutex_lock(&virtual_mutex);
+    if (!(vdev = virtualDevice(id))) {
+        ret = -ENODEV;
+    } else if (n < vdev->control_count && n < VIRTUAL_CONTROLS) {
+        *control = vdev->controls[(vdev->control_count - 1 - n) % VIRTUAL_CONTROLS];
+        ret = G15_NO_ERROR;
+    }
+    pthread_mutex_unlock(&virtual_mutex);
+    return ret;
+}
+
+/* fill in up to max entries of list, returning the number of connected and supported devices */
+int lg_enumerate(lg_device_info_t *list, int max)
+{
+    int found;
+
+    if (initTransport())
+        return 0;
+    found = transport->enumerate(list, max);
+    g15_log(stderr,G15_LOG_INFO,"Found %i supported devices\n",found);
+    return found;
+}
+
+static void recoverKeyTransfers();
+
+static void *usbEventThread(void *arg)
+{
+	while (!usb_event_thread_exit) {
+		transport->handle_events(&usb_event_thread_exit);
+		recoverKeyTransfers();
+	}
+	return	NULL;
+}
+
+static int startUsbEventThread()
+{
+	if (usb_event_thread_running)
+		return	0;
+	usb_event_thread_exit = 0;
+	if (pthread_create(&usb_event_thread, NULL, usbEventThread, NULL) != 0) {
+		g15_log(stderr, G15_LOG_INFO, "Unable to create usb event thread\n");
+		return	-1;
 	}
-	libusb_free_device_list(devices, 1);	/* De-reference all entries. */
+	usb_event_thread_running = 1;
 	return	0;
 }
 
-
-static libusb_device_handle * findAndOpenG15() {
-    int i;
-    for (i=0; g15_devices[i].name !=NULL  ;i++){
-        g15_log(stderr,G15_LOG_INFO,"Trying to find %s\n",g15_devices[i].name);
-        if(keyboard_device = findAndOpenDevice(g15_devices[i],i)){
+static void stopUsbEventThread()
+{
+	if (!usb_event_thread_running)
+		return;
+	usb_event_thread_exit = 1;
+	transport->interrupt_events();
+	pthread_join(usb_event_thread, NULL);
+	usb_event_thread_running = 0;
+}
+
+static void cancelLCDTransfers(lg_device_t *dev);
+static void freeLCDTransfers(lg_device_t *dev);
+static void releaseLCDBuffers(lg_device_t *dev);
+static int armKeyTransfer(lg_device_t *dev);
+static void disarmKeyTransfer(lg_device_t *dev);
+
+/* stop all transfers on a device that has gone away and drop its handle */
+static void closeLostDevice(lg_device_t *dev)
+{
+    void *handle = dev->handle;
+
+    cancelLCDTransfers(dev);
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    releaseLCDBuffers(dev);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    pthread_mutex_lock(&dev->key_async_mutex);
+    disarmKeyTransfer(dev);
+    pthread_mutex_unlock(&dev->key_async_mutex);
+    setDeviceHandle(dev, NULL);
+    transport->close(dev, handle, 0);
+    dev->lcd_endpoint = 0;
+    dev->keys_endpoint = 0;
+}
+
+static void restoreDeviceState(lg_device_t *dev);
+
+/* the transport's open is done.  its time not spent finding the device or claiming
+   interfaces, which the transport records itself, is the open phase */
+static void startupOpened(lg_device_t *dev, struct timespec *mark)
+{
+    unsigned int spent = usSince(mark);
+    unsigned int known = dev->startup.enumerate + dev->startup.claim;
+
+    dev->startup.open = spent > known ? spent - known : 0;
+    clock_gettime(CLOCK_MONOTONIC, mark);
+}
+
+static void startupDone(lg_device_t *dev, struct timespec *mark, struct timespec const *start)
+{
+    lg_startup_timing_t *t = &dev->startup;
+
+    phaseDone(&t->setup, mark);
+    t->total = usSince(start);
+    g15_log(stderr, G15_LOG_INFO, "Startup took %u us: init %u, enumerate %u, open %u, claim %u, setup %u\n",
+            t->total, t->init, t->enumerate, t->open, t->claim, t->setup);
+}
+
+/* find the keyboard again after it was unplugged ie ENODEV was returned at some point */
+int lg_reopen(lg_device_t *dev)
+{
+    struct timespec start, mark;
+    void *arrived;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mark = start;
+    memset(&dev->startup, 0, sizeof(dev->startup));
+
+    /* the async key reader reports a vanished device without closing it */
+    if (dev->handle)
+        closeLostDevice(dev);
+    dev->shared_device = 0;
+
+    /* a replugged keyboard starts with a clean slate */
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    dev->bw_level = 0;
+    dev->bw_good_frames = 0;
+    dev->bw_probing = 0;
+    dev->bw_probe_after = BW_PROBE_FRAMES;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+
+    pthread_mutex_lock(&devices_mutex);
+    arrived = dev->arrived;
+    dev->arrived = NULL;
+    dev->unplugged = 0;
+    pthread_mutex_unlock(&devices_mutex);
+
+    if (arrived) {
+        transport->open(dev, NULL, arrived);
+        transport->unref(arrived);
+    }
+    if (!dev->handle && transport->open(dev, NULL, NULL) != LIBUSB_SUCCESS)
+        return G15_ERROR_OPENING_USB_DEVICE;
+    startupOpened(dev, &mark);
+
+    /* a registered key handler survives a re-open */
+    pthread_mutex_lock(&dev->key_async_mutex);
+    if (dev->key_handler)
+        armKeyTransfer(dev);
+    pthread_mutex_unlock(&dev->key_async_mutex);
+
+    restoreDeviceState(dev);
+    recordReconnect(dev);
+    startupDone(dev, &mark, &start);
+    return G15_NO_ERROR;
+}
+
+/* open the device described by info (from lg_enumerate), or the first supported
+   device that is not already open if info is NULL */
+int lg_open(lg_device_info_t const *info, lg_device_t **devp)
+{
+    lg_device_t *dev;
+    struct timespec start, mark;
+    unsigned int init;
+    int retval = G15_NO_ERROR;
+    int i;
+
+    *devp = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    retval = initTransport();
+    if (retval)
+        return retval;
+    init = usSince(&start);
+
+    g15_log(stderr,G15_LOG_INFO,"%s\n",PACKAGE_STRING);
+
+#ifdef SUN_LIBUSB
+    g15_log(stderr,G15_LOG_INFO,"Using Sun libusb.\n");
+#endif
+
+    dev = (lg_device_t*)calloc(1, sizeof(lg_device_t));
+    if (!dev)
+        return G15_ERROR_OPENING_USB_DEVICE;
+    dev->devicetype = -1;
+    dev->open_interface = -1;
+    dev->want_devicetype = info ? info->devicetype : -1;
+    dev->bw_probe_after = BW_PROBE_FRAMES;
+    for (i = 0; i < CTL_COUNT; i++)
+        dev->controls[i].want = dev->controls[i].hw = -1;
+    pthread_mutex_init(&dev->libusb_mutex, NULL);
+    pthread_mutex_init(&dev->stats_mutex, NULL);
+    dev->stats.since = monotonicUs();
+    pthread_mutex_init(&dev->lcd_async_mutex, NULL);
+    pthread_cond_init(&dev->lcd_async_cond, NULL);
+    pthread_mutex_init(&dev->key_async_mutex, NULL);
+    pthread_cond_init(&dev->key_async_cond, NULL);
+    dev->startup.init = init;
+
+    /* the transport finds and opens the device in a single pass over the bus */
+    clock_gettime(CLOCK_MONOTONIC, &mark);
+    if (transport->open(dev, info, NULL) != LIBUSB_SUCCESS) {
+        retval = G15_ERROR_OPENING_USB_DEVICE;
+        goto fail;
+    }
+    startupOpened(dev, &mark);
+
+    pthread_mutex_lock(&devices_mutex);
+    if (open_device_count == 0 && startUsbEventThread()) {
+        pthread_mutex_unlock(&devices_mutex);
+        transport->close(dev, dev->handle, 0);
+        retval = G15_ERROR_OPENING_USB_DEVICE;
+        goto fail;
+    }
+    dev->next = open_devices;
+    open_devices = dev;
+    open_device_count++;
+    pthread_mutex_unlock(&devices_mutex);
+
+    startupDone(dev, &mark, &start);
+    *devp = dev;
+    return G15_NO_ERROR;
+
+fail:
+    pthread_mutex_destroy(&dev->libusb_mutex);
+    pthread_mutex_destroy(&dev->stats_mutex);
+    pthread_mutex_destroy(&dev->lcd_async_mutex);
+    pthread_cond_destroy(&dev->lcd_async_cond);
+    pthread_mutex_destroy(&dev->key_async_mutex);
+    pthread_cond_destroy(&dev->key_async_cond);
+    free(dev);
+    return retval;
+}
+
+/* reset the keyboard, returning it to a known state, and free dev */
+int lg_close(lg_device_t *dev)
+{
+    lg_device_t **link;
+    int retval = -1;
+    int last = 0;
+
+    cancelLCDTransfers(dev);
+    pthread_mutex_lock(&dev->key_async_mutex);
+    disarmKeyTransfer(dev);
+    dev->key_handler = NULL;
+    pthread_mutex_unlock(&dev->key_async_mutex);
+
+    pthread_mutex_lock(&devices_mutex);
+    for (link = &open_devices; *link; link = &(*link)->next) {
+        if (*link == dev) {
+            *link = dev->next;
             break;
         }
-        else
-            g15_log(stderr,G15_LOG_INFO,"%s not found\n",g15_devices[i].name);
     }
-    return keyboard_device;
+    last = (--open_device_count == 0);
+    if (dev->arrived)
+        transport->unref(dev->arrived);
+    pthread_mutex_unlock(&devices_mutex);
+    if (last)
+        stopUsbEventThread();
+
+    freeLCDTransfers(dev);
+    transport->free_xfer(&dev->key_xfer);
+    if (dev->handle) {
+        pthread_mutex_lock(&dev->lcd_async_mutex);
+        releaseLCDBuffers(dev);
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        retval = transport->close(dev, dev->handle, 1);
+    }
+    pthread_mutex_destroy(&dev->libusb_mutex);
+    pthread_mutex_destroy(&dev->stats_mutex);
+    pthread_mutex_destroy(&dev->lcd_async_mutex);
+    pthread_cond_destroy(&dev->lcd_async_cond);
+    pthread_mutex_destroy(&dev->key_async_mutex);
+    pthread_cond_destroy(&dev->key_async_cond);
+    free(dev);
+    return retval;
 }
 
 
-int re_initLibG15()
+
+/* Each 8x8 pixel block of the source (one byte from each of eight rows) becomes eight
+   bytes of output, one per pixel column - an 8x8 bit matrix transpose.  The source rows
+   of the last block row run past the 43 visible lines, up to byte 960 of the pixmap. */
+
+/* transpose a single block held in a 64 bit word, least significant byte first */
+static void transposeBlock(unsigned char *lcd_buffer, unsigned char const *data)
 {
-	return	initLibG15();
+    uint64_t x = 0, t;
+    int k;
+
+    for (k = 0; k < 8; k++)
+        x |= (uint64_t)data[k * G15_LCD_ROW_BYTES] << (8 * k);
+
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+
+    /* the leftmost pixel is the top bit of each source byte */
+    for (k = 0; k < 8; k++)
+        lcd_buffer[k] = (unsigned char)(x >> (8 * (7 - k)));
 }
 
-int initLibG15()
+static void transposeScalar(unsigned char *lcd_buffer, unsigned char const *data)
 {
-    int retval = G15_NO_ERROR;
-    retval = initLibUsb();
-    if (retval)
-        return retval;
+    unsigned int row, col;
 
-    g15_log(stderr,G15_LOG_INFO,"%s\n",PACKAGE_STRING);
+    for (row = 0; row < G15_LCD_HEIGHT_IN_BYTES; row++)
+        for (col = 0; col < G15_LCD_ROW_BYTES; col++)
+            transposeBlock(lcd_buffer + (row * G15_LCD_WIDTH) + (col * 8),
+                           data + (row * G15_LCD_WIDTH) + col);
+}
 
-#ifdef SUN_LIBUSB
-    g15_log(stderr,G15_LOG_INFO,"Using Sun libusb.\n");
-#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define G15_TRANSPOSE_X86
+#include <immintrin.h>
+
+/* interleave eight rows of sixteen source bytes so that each register ends up holding
+   the eight rows of two adjacent source columns.  works per 128 bit lane */
+#define INTERLEAVE_ROWS(T, W, r, g) do { \
+    T a0 = W##unpacklo_epi8(r[0], r[1]), a1 = W##unpackhi_epi8(r[0], r[1]); \
+    T b0 = W##unpacklo_epi8(r[2], r[3]), b1 = W##unpackhi_epi8(r[2], r[3]); \
+    T c0 = W##unpacklo_epi8(r[4], r[5]), c1 = W##unpackhi_epi8(r[4], r[5]); \
+    T d0 = W##unpacklo_epi8(r[6], r[7]), d1 = W##unpackhi_epi8(r[6], r[7]); \
+    T e0 = W##unpacklo_epi16(a0, b0), e1 = W##unpackhi_epi16(a0, b0); \
+    T e2 = W##unpacklo_epi16(a1, b1), e3 = W##unpackhi_epi16(a1, b1); \
+    T f0 = W##unpacklo_epi16(c0, d0), f1 = W##unpackhi_epi16(c0, d0); \
+    T f2 = W##unpacklo_epi16(c1, d1), f3 = W##unpackhi_epi16(c1, d1); \
+    g[0] = W##unpacklo_epi32(e0, f0); g[1] = W##unpackhi_epi32(e0, f0); \
+    g[2] = W##unpacklo_epi32(e1, f1); g[3] = W##unpackhi_epi32(e1, f1); \
+    g[4] = W##unpacklo_epi32(e2, f2); g[5] = W##unpackhi_epi32(e2, f2); \
+    g[6] = W##unpacklo_epi32(e3, f3); g[7] = W##unpackhi_epi32(e3, f3); \
+} while (0)
+
+/* sixteen source columns of one block row.  movemask picks the top bit of every byte, which
+   is one output byte per source column; doubling each byte moves the next pixel up */
+__attribute__((target("sse2")))
+static void transposeBand16SSE2(unsigned char *lcd_buffer, unsigned char const *data)
+{
+    __m128i r[8], g[8], v;
+    unsigned int m;
+    int i, k;
+
+    for (k = 0; k < 8; k++)
+        r[k] = _mm_loadu_si128((__m128i const *)(data + k * G15_LCD_ROW_BYTES));
+    INTERLEAVE_ROWS(__m128i, _mm_, r, g);
+
+    for (i = 0; i < 8; i++) {
+        v = g[i];
+        for (k = 0; k < 8; k++) {
+            m = _mm_movemask_epi8(v);
+            lcd_buffer[(2 * i) * 8 + k] = m & 0xff;
+            lcd_buffer[(2 * i + 1) * 8 + k] = m >> 8;
+            v = _mm_add_epi8(v, v);
+        }
+    }
+}
 
-    g15NumberOfConnectedDevices();
+/* the 20 byte wide rows are done as columns 0-15 and 4-19, the overlap is simply written twice */
+__attribute__((target("sse2")))
+static void transposeSSE2(unsigned char *lcd_buffer, unsigned char const *data)
+{
+    unsigned int row;
 
-    keyboard_device = findAndOpenG15();
-    if (!keyboard_device)
-        return G15_ERROR_OPENING_USB_DEVICE;
+    for (row = 0; row < G15_LCD_HEIGHT_IN_BYTES; row++) {
+        transposeBand16SSE2(lcd_buffer + row * G15_LCD_WIDTH, data + row * G15_LCD_WIDTH);
+        transposeBand16SSE2(lcd_buffer + row * G15_LCD_WIDTH + 4 * 8, data + row * G15_LCD_WIDTH + 4);
+    }
+}
 
-    pthread_mutex_init(&libusb_mutex, NULL);
-    return retval;
+/* as transposeBand16SSE2, with a second block row in the upper lane */
+__attribute__((target("avx2")))
+static void transposeBand16AVX2(unsigned char *lcd_lo, unsigned char *lcd_hi,
+                                unsigned char const *data_lo, unsigned char const *data_hi)
+{
+    __m256i r[8], g[8], v;
+    unsigned int m;
+    int i, k;
+
+    for (k = 0; k < 8; k++)
+        r[k] = _mm256_inserti128_si256(
+                   _mm256_castsi128_si256(_mm_loadu_si128((__m128i const *)(data_lo + k * G15_LCD_ROW_BYTES))),
+                   _mm_loadu_si128((__m128i const *)(data_hi + k * G15_LCD_ROW_BYTES)), 1);
+    INTERLEAVE_ROWS(__m256i, _mm256_, r, g);
+
+    for (i = 0; i < 8; i++) {
+        v = g[i];
+        for (k = 0; k < 8; k++) {
+            m = (unsigned int)_mm256_movemask_epi8(v);
+            lcd_lo[(2 * i) * 8 + k] = m & 0xff;
+            lcd_lo[(2 * i + 1) * 8 + k] = (m >> 8) & 0xff;
+            lcd_hi[(2 * i) * 8 + k] = (m >> 16) & 0xff;
+            lcd_hi[(2 * i + 1) * 8 + k] = m >> 24;
+            v = _mm256_add_epi8(v, v);
+        }
+    }
 }
 
-/* reset the keyboard, returning it to a known state */
-int exitLibG15()
+__attribute__((target("avx2")))
+static void transposeAVX2(unsigned char *lcd_buffer, unsigned char const *data)
 {
-    int retval = G15_NO_ERROR;
-    if (keyboard_device){
-#ifndef SUN_LIBUSB
-        retval = libusb_release_interface (keyboard_device, open_interface);
-        usleep(50*1000);
-#endif
-#if 0
-        retval = usb_reset(keyboard_device);
-        usleep(50*1000);
-#endif
-        retval = libusb_attach_kernel_driver(keyboard_device, open_interface);
-        if (retval != 0) {
-        	g15_log(stderr, G15_LOG_INFO, "Unable to re-attach kernel driver, error %d\n", retval);
+    unsigned int row, col;
+    unsigned char *lo, *hi;
+
+    for (row = 0; row < G15_LCD_HEIGHT_IN_BYTES; row += 2) {
+        for (col = 0; col <= 4; col += 4) {
+            lo = lcd_buffer + row * G15_LCD_WIDTH + col * 8;
+            hi = lo + G15_LCD_WIDTH;
+            transposeBand16AVX2(lo, hi, data + row * G15_LCD_WIDTH + col,
+                                data + (row + 1) * G15_LCD_WIDTH + col);
         }
-        libusb_close(keyboard_device);
-        keyboard_device=0;
-        pthread_mutex_destroy(&libusb_mutex);
-        return retval;
     }
-    return -1;
 }
 
+#undef INTERLEAVE_ROWS
+#endif
+
+static void (*transposePixmap)(unsigned char *lcd_buffer, unsigned char const *data) = transposeScalar;
+static pthread_once_t transpose_once = PTHREAD_ONCE_INIT;
+
+/* pick the widest transpose the cpu can run */
+static void selectTranspose(void)
+{
+#ifdef G15_TRANSPOSE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && (G15_LCD_HEIGHT_IN_BYTES % 2) == 0)
+        transposePixmap = transposeAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        transposePixmap = transposeSSE2;
+#endif
+}
 
 static void dumpPixmapIntoLCDFormat(unsigned char *lcd_buffer, unsigned char const *data)
 {
@@ -352,53 +2232,66 @@ static void dumpPixmapIntoLCDFormat(unsigned char *lcd_buffer, unsigned char con
 
 */
 
-    unsigned int output_offset = G15_LCD_OFFSET;
-    unsigned int base_offset = 0;
-    unsigned int curr_row = 0;
-    unsigned int curr_col = 0;
-
-    /* Five 8-pixel rows + a little 3-pixel row.  This formula will calculate
-       the minimum number of bytes required to hold a complete column.  (It
-       basically divides by eight and rounds up the result to the nearest byte,
-       but at compile time.
-      */
+    pthread_once(&transpose_once, selectTranspose);
+    transposePixmap(lcd_buffer + G15_LCD_OFFSET, data);
+}
 
-#define G15_LCD_HEIGHT_IN_BYTES  ((G15_LCD_HEIGHT + ((8 - (G15_LCD_HEIGHT % 8)) % 8)) / 8)
+/* must be called with lcd_async_mutex held. step down to smaller, slower LCD transfers */
+static void bandwidthCongested(lg_device_t *dev)
+{
+    dev->bw_congestion++;
+    dev->bw_good_frames = 0;
+    if (dev->bw_probing) {
+        /* the faster level did not hold, wait longer before trying it again */
+        dev->bw_probing = 0;
+        if (dev->bw_probe_after < BW_PROBE_MAX)
+            dev->bw_probe_after *= 2;
+    }
+    if (dev->bw_level < BW_LEVELS - 1) {
+        dev->bw_level++;
+        dev->bw_downshifts++;
+        g15_log(stderr,G15_LOG_INFO,"LCD bandwidth reduced to %i byte transfers, %ius apart\n",
+                bandwidth_levels[dev->bw_level].chunk, bandwidth_levels[dev->bw_level].delay);
+    }
+}
 
-    for (curr_row = 0; curr_row < G15_LCD_HEIGHT_IN_BYTES; ++curr_row)
-    {
-        for (curr_col = 0; curr_col < G15_LCD_WIDTH; ++curr_col)
-        {
-            unsigned int bit = curr_col % 8;
-		/* Copy a 1x8 column of pixels across from the source image to the LCD buffer. */
-
-            lcd_buffer[output_offset] =
-			(((data[base_offset                        ] << bit) & 0x80) >> 7) |
-			(((data[base_offset +  G15_LCD_WIDTH/8     ] << bit) & 0x80) >> 6) |
-			(((data[base_offset + (G15_LCD_WIDTH/8 * 2)] << bit) & 0x80) >> 5) |
-			(((data[base_offset + (G15_LCD_WIDTH/8 * 3)] << bit) & 0x80) >> 4) |
-			(((data[base_offset + (G15_LCD_WIDTH/8 * 4)] << bit) & 0x80) >> 3) |
-			(((data[base_offset + (G15_LCD_WIDTH/8 * 5)] << bit) & 0x80) >> 2) |
-			(((data[base_offset + (G15_LCD_WIDTH/8 * 6)] << bit) & 0x80) >> 1) |
-			(((data[base_offset + (G15_LCD_WIDTH/8 * 7)] << bit) & 0x80) >> 0);
-            ++output_offset;
-            if (bit == 7)
-              base_offset++;
-        }
-	/* Jump down seven pixel-rows in the source image, since we've just
-	   done a row of eight pixels in one pass (and we counted one pixel-row
-  	   while we were going, so now we skip the next seven pixel-rows.) */
-	base_offset += G15_LCD_WIDTH - (G15_LCD_WIDTH / 8);
+/* must be called with lcd_async_mutex held. a frame reached the LCD after latency us */
+static void bandwidthFrameDone(lg_device_t *dev, unsigned int latency)
+{
+    dev->bw_avg_latency = dev->bw_avg_latency ? (dev->bw_avg_latency * 7 + latency) / 8 : latency;
+    if (latency > BW_SLOW_FRAME) {
+        bandwidthCongested(dev);
+        return;
+    }
+    if (++dev->bw_good_frames < dev->bw_probe_after)
+        return;
+
+    /* a whole window without trouble */
+    dev->bw_good_frames = 0;
+    if (dev->bw_probing) {
+        dev->bw_probing = 0;
+        dev->bw_probe_after = BW_PROBE_FRAMES;
+    }
+    if (dev->bw_level > 0 && dev->bw_avg_latency < BW_SLOW_FRAME / 4) {
+        dev->bw_level--;
+        dev->bw_upshifts++;
+        dev->bw_probing = 1;
+        g15_log(stderr,G15_LOG_INFO,"LCD bandwidth raised to %i byte transfers, %ius apart\n",
+                bandwidth_levels[dev->bw_level].chunk, bandwidth_levels[dev->bw_level].delay);
     }
 }
 
-int handle_usb_errors(const char *prefix, int ret) {
-	libusb_device_handle *tmp = NULL;
+static int handle_usb_errors(lg_device_t *dev, const char *prefix, int ret) {
 	int	retval;
 
     switch (ret){
         case -ETIMEDOUT:
         case LIBUSB_ERROR_TIMEOUT:
+            if (strcmp(prefix, "Keyboard Read")) {	/* an LCD write timing out is a sign of a congested bus */
+                pthread_mutex_lock(&dev->lcd_async_mutex);
+                bandwidthCongested(dev);
+                pthread_mutex_unlock(&dev->lcd_async_mutex);
+            }
             return G15_ERROR_READING_USB_DEVICE;  /* backward-compatibility */
             break;
         case LIBUSB_ERROR_OVERFLOW:
@@ -406,31 +2299,29 @@ int handle_usb_errors(const char *prefix, int ret) {
             	if (strcmp(prefix, "Keyboard Read")) {	/* Should only try to do this if it's the LCD */
             		/* Of course, the bigger question is what do we do about the overflow from the keyboard? */
             		g15_log(stderr,G15_LOG_INFO,"usb error: %s overflow (%d)... reducing speed\n", prefix, ret);
-            		enospc_slowdown = 1;
+            		pthread_mutex_lock(&dev->lcd_async_mutex);
+            		bandwidthCongested(dev);
+            		pthread_mutex_unlock(&dev->lcd_async_mutex);
             	}
                 break;
             case LIBUSB_ERROR_NO_DEVICE:
             case -ENODEV: /* the device went away - we probably should attempt to reattach */
+                if (!dev->handle)
+                    return -ENODEV;
                 g15_log(stderr,G15_LOG_INFO,"usb error: %s %s (%i) - attempting to re-connect...\n", prefix, libusb_error_name(ret), ret);
-                retval = libusb_reset_device(keyboard_device);
+                retval = transport->reset(dev);
                 switch (retval) {
                 case LIBUSB_ERROR_NOT_FOUND :
                     g15_log(stderr,G15_LOG_INFO,"Unable to reconnect, usb error: %s %s (%i)\n", prefix, libusb_error_name(retval), retval);
-#ifndef SUN_LIBUSB
-                    libusb_release_interface (keyboard_device, open_interface);
-                    usleep(50*1000);
-#endif
-                    libusb_close(keyboard_device);
-                    keyboard_device = NULL;
-                    g15_lcd_endpoint = 0;
-                    g15_keys_endpoint = 0;
+                    closeLostDevice(dev);
                     return	-ENODEV;	// For compatibility with previous versions.
                 	break;
                 case 0:
                 	g15_log(stderr, G15_LOG_INFO, "Reconnect successful\n");
+                	recordReconnect(dev);
                 	break;
                 default:
-                	handle_usb_errors(prefix, retval);
+                	handle_usb_errors(dev, prefix, retval);
                 	break;
                 }
             	break;
@@ -444,9 +2335,9 @@ int handle_usb_errors(const char *prefix, int ret) {
             case -EPIPE: /* endpoint is stalled */
             case LIBUSB_ERROR_PIPE:
                  g15_log(stderr,G15_LOG_INFO,"usb error: %s EPIPE! clearing...\n",prefix);
-                 pthread_mutex_lock(&libusb_mutex);
-                 libusb_clear_halt(keyboard_device, 0x81);
-                 pthread_mutex_unlock(&libusb_mutex);
+                 usbLock(dev);
+                 transport->clear_halt(dev, strcmp(prefix, "Keyboard Read") ? dev->lcd_endpoint : dev->keys_endpoint);
+                 usbUnlock(dev);
                  break;
             default: /* timed out */
                  g15_log(stderr,G15_LOG_INFO,"Unknown usb error: %s !! (err is %i (%s))\n",prefix,ret, libusb_error_name(ret));
@@ -455,185 +2346,709 @@ int handle_usb_errors(const char *prefix, int ret) {
     return ret;
 }
 
-int writePixmapToLCD(unsigned char const *data)
+static void formatLCDBuffer(unsigned char *lcd_buffer, unsigned char const *data)
 {
-    int ret = 0;
-    int written = 0;
-    int transfercount=0;
-    unsigned char lcd_buffer[G15_BUFFER_LEN];
     /* The pixmap conversion function will overwrite everything after G15_LCD_OFFSET, so we only need to blank
        the buffer up to this point.  (Even though the keyboard only cares about bytes 0-23.) */
     memset(lcd_buffer, 0, G15_LCD_OFFSET);  /* G15_BUFFER_LEN); */
 
     dumpPixmapIntoLCDFormat(lcd_buffer, data);
 
-    if(!(g15_devices[found_devicetype].caps & G15_LCD))
-        return 0;
-
     /* the keyboard needs this magic byte */
     lcd_buffer[0] = 0x03;
-  /* in an attempt to reduce peak bus utilisation, we break the transfer into 32 byte chunks and sleep a bit in between.
-    It shouldnt make much difference, but then again, the g15 shouldnt be flooding the bus enough to cause ENOSPC, yet
-    apparently does on some machines...
-    I'm not sure how successful this will be in combatting ENOSPC, but we'll give it try in the real-world. */
+}
+
+/* must be called with lcd_async_mutex held. is data already what the LCD shows (or will show next) */
+static int frameUnchanged(lg_device_t *dev, unsigned char const *data)
+{
+    if (dev->last_frame_valid && memcmp(dev->last_frame, data, G15_PIXMAP_BYTES) == 0) {
+        dev->frames_skipped++;
+        return 1;
+    }
+    return 0;
+}
+
+/* must be called with lcd_async_mutex held */
+static void frameSent(lg_device_t *dev, unsigned char const *data)
+{
+    memcpy(dev->last_frame, data, G15_PIXMAP_BYTES);
+    dev->last_frame_valid = 1;
+    dev->last_frame_known = 1;
+    dev->frames_sent++;
+}
+
+/* send the next frame even if it is the same as the last one, eg after the LCD was reset */
+void lg_force_lcd_write(lg_device_t *dev)
+{
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    dev->last_frame_valid = 0;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+}
+
+void lg_get_lcd_counters(lg_device_t *dev, unsigned long *sent, unsigned long *skipped)
+{
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    *sent = dev->frames_sent;
+    *skipped = dev->frames_skipped;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+}
+
+void lg_get_bandwidth_stats(lg_device_t *dev, lg_bandwidth_stats_t *stats)
+{
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    stats->level = dev->bw_level;
+    stats->levels = BW_LEVELS;
+    stats->chunk_size = bandwidth_levels[dev->bw_level].chunk;
+    stats->chunk_delay = bandwidth_levels[dev->bw_level].delay;
+    stats->avg_latency = dev->bw_avg_latency;
+    stats->downshifts = dev->bw_downshifts;
+    stats->upshifts = dev->bw_upshifts;
+    stats->congestion = dev->bw_congestion;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+}
+
+void lg_get_startup_timing(lg_device_t *dev, lg_startup_timing_t *timing)
+{
+    *timing = dev->startup;
+}
+
+/* the synchronous transfers, timed and counted in the statistics */
+static int timedInterruptTransfer(lg_device_t *dev, int stat, unsigned char endpoint, unsigned char *data,
+                                  int length, int *transferred, unsigned int timeout)
+{
+    struct timespec start;
+    int ret;
+
+    *transferred = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = transport->interrupt_transfer(dev, endpoint, data, length, transferred, timeout);
+    recordTransfer(dev, stat, usSince(&start), *transferred, length, ret);
+    return ret;
+}
+
+static int timedControlTransfer(lg_device_t *dev, unsigned int value, unsigned int index,
+                                unsigned char *data, unsigned int length, unsigned int timeout)
+{
+    struct timespec start;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = transport->control_transfer(dev, value, index, data, length, timeout);
+    recordTransfer(dev, G15_STATS_CONTROL, usSince(&start), ret > 0 ? ret : 0, length, ret < 0 ? ret : 0);
+    return ret;
+}
+
+static lcd_slot_t *leaseLCDSlot(lg_device_t *dev);
+static void returnLCDSlot(lg_device_t *dev, lcd_slot_t *slot);
+
+/* send a formatted buffer with synchronous transfers.  a congested bus gets the frame in
+   smaller pieces with pauses in between, see bandwidth_levels */
+static int writeLCDSync(lg_device_t *dev, unsigned char *lcd_buffer)
+{
+    int ret = 0;
+    int written = 0;
+    int offset, chunk, delay;
+    struct timespec start;
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    chunk = bandwidth_levels[dev->bw_level].chunk;
+    delay = bandwidth_levels[dev->bw_level].delay;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
 
-    if(enospc_slowdown != 0){
+    clock_gettime(CLOCK_MONOTONIC, &start);
 #ifndef LIBUSB_BLOCKS
-        pthread_mutex_lock(&libusb_mutex);
+    usbLock(dev);
 #endif
-        for(transfercount = 0;transfercount<=31;transfercount++){
-        	// TODO : Check buffer lengths and transfer amounts???
-            ret = libusb_interrupt_transfer(keyboard_device, g15_lcd_endpoint, (char*)lcd_buffer+(32*transfercount), 32, &written, 1000);
-            if (written != 32)
-            {
-                handle_usb_errors ("LCDPixmap Slow Write",ret);
-                return G15_ERROR_WRITING_PIXMAP;
-            }
-            usleep(100);
-        }
+    for (offset = 0; offset < G15_BUFFER_LEN; offset += chunk) {
+        ret = timedInterruptTransfer(dev, G15_STATS_LCD, dev->lcd_endpoint, lcd_buffer+offset, chunk, &written, 1000);
+        if (written != chunk)
+        {
 #ifndef LIBUSB_BLOCKS
-        pthread_mutex_unlock(&libusb_mutex);
-#endif
-    }else{
-        /* transfer entire buffer in one hit */
-#ifdef LIBUSB_BLOCKS
-        ret = libusb_interrupt_transfer(keyboard_device, g15_lcd_endpoint, (char*)lcd_buffer, G15_BUFFER_LEN, &written, 1000);
-#else
-        pthread_mutex_lock(&libusb_mutex);
-        ret = libusb_interrupt_transfer(keyboard_device, g15_lcd_endpoint, (char*)lcd_buffer, G15_BUFFER_LEN, &written, 1000);
-        pthread_mutex_unlock(&libusb_mutex);
+            usbUnlock(dev);
 #endif
-        if (written != G15_BUFFER_LEN)
-        {
-            handle_usb_errors ("LCDPixmap Write",ret);
+            handle_usb_errors (dev, "LCDPixmap Write",ret);
             return G15_ERROR_WRITING_PIXMAP;
         }
-        usleep(100);
+        usleep(delay);
+    }
+#ifndef LIBUSB_BLOCKS
+    usbUnlock(dev);
+#endif
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    bandwidthFrameDone(dev, usSince(&start));
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    return 0;
+}
+
+int lg_write_pixmap(lg_device_t *dev, unsigned char const *data)
+{
+    int ret = 0;
+    lcd_slot_t *slot;
+    unsigned char lcd_buffer[G15_BUFFER_LEN];
+
+    if(!(lg_get_caps(dev) & G15_LCD))
+        return 0;
+
+    if(!dev->handle)
+        return -ENODEV;
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    ret = frameUnchanged(dev, data);
+    /* whatever is on the screen after this is unknown until the write succeeds */
+    dev->last_frame_valid = 0;
+    /* a transfer buffer from the transport saves the kernel a copy, if one is free */
+    slot = ret ? NULL : leaseLCDSlot(dev);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    if (ret)
+        return 0;
+
+    formatLCDBuffer(slot ? slot->buffer : lcd_buffer, data);
+    ret = writeLCDSync(dev, slot ? slot->buffer : lcd_buffer);
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    if (slot)
+        returnLCDSlot(dev, slot);
+    if (ret == 0)
+        frameSent(dev, data);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    return ret;
+}
+
+/* map the status of a failed async transfer onto the error codes returned by the synchronous calls */
+static int transferStatusToError(int status)
+{
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:
+            return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return LIBUSB_ERROR_OVERFLOW;
+        case LIBUSB_TRANSFER_CANCELLED:
+            return LIBUSB_ERROR_INTERRUPTED;
+        default:
+            return LIBUSB_ERROR_IO;
+    }
+}
+
+/* put an async transfer on the bus, noting when for the statistics */
+static int submitXfer(lg_xfer_t *xfer)
+{
+    clock_gettime(CLOCK_MONOTONIC, &xfer->submitted);
+    return transport->submit(xfer);
+}
+
+/* count a completed async transfer, from its callback.  cancelling is our own doing */
+static void xferFinished(lg_xfer_t *xfer)
+{
+    if (xfer->status == LIBUSB_TRANSFER_CANCELLED)
+        return;
+    recordTransfer(xfer->dev, xfer->stat, usSince(&xfer->submitted), xfer->actual_length, xfer->length,
+                   transferStatusToError(xfer->status));
+}
+
+/* must be called with lcd_async_mutex held */
+static int submitLCDSlot(lcd_slot_t *slot)
+{
+    lg_device_t *dev = slot->dev;
+    int ret;
+
+    slot->xfer.endpoint = dev->lcd_endpoint;
+    ret = submitXfer(&slot->xfer);
+    if (ret == 0) {
+        slot->state = LCD_SLOT_INFLIGHT;
+        dev->lcd_inflight = 1;
+    } else {
+        slot->state = LCD_SLOT_FREE;
+    }
+    return ret;
+}
+
+/* runs on the usb event thread: retire the finished frame and put the newest queued one on the bus */
+static void lcdTransferDone(lg_xfer_t *xfer)
+{
+    lcd_slot_t *slot = (lcd_slot_t*)xfer->user_data;
+    lg_device_t *dev = slot->dev;
+    int ret;
+
+    xferFinished(xfer);
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    slot->state = LCD_SLOT_FREE;
+    dev->lcd_inflight = 0;
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED || xfer->actual_length != G15_BUFFER_LEN) {
+        dev->last_frame_valid = 0;
+        /* error recovery does synchronous i/o, so leave it to the next writer */
+        if (xfer->status != LIBUSB_TRANSFER_CANCELLED)
+            dev->lcd_async_status = transferStatusToError(xfer->status);
+        if (dev->lcd_queued) {
+            dev->lcd_queued->state = LCD_SLOT_FREE;
+            dev->lcd_queued = NULL;
+        }
+    } else {
+        bandwidthFrameDone(dev, usSince(&slot->xfer.submitted));
+    }
+    if (dev->lcd_queued && dev->lcd_async_status == 0) {
+        slot = dev->lcd_queued;
+        dev->lcd_queued = NULL;
+        if ((ret = submitLCDSlot(slot)) != 0) {
+            dev->lcd_async_status = ret;
+            dev->last_frame_valid = 0;
+        }
+    }
+    pthread_cond_broadcast(&dev->lcd_async_cond);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+}
+
+/* must be called with lcd_async_mutex held.  the transport allocates its own transfers on
+   first submit, and the buffers once per open device */
+static void setupLCDTransfers(lg_device_t *dev)
+{
+    lcd_slot_t *slot;
+    int i;
+
+    for (i = 0; i < G15_LCD_TRANSFERS; i++) {
+        slot = &dev->lcd_slots[i];
+        if (!slot->dev) {
+            slot->dev = dev;
+            slot->state = LCD_SLOT_FREE;
+            slot->xfer.dev = dev;
+            slot->xfer.length = G15_BUFFER_LEN;
+            slot->xfer.timeout = 1000;
+            slot->xfer.callback = lcdTransferDone;
+            slot->xfer.user_data = slot;
+            slot->xfer.stat = G15_STATS_LCD;
+        }
+        if (!slot->buffer && dev->handle) {
+            slot->buffer = transport->alloc_buffer(dev, G15_BUFFER_LEN, &slot->dev_mem);
+            if (!slot->buffer)
+                continue;
+            memset(slot->buffer, 0, G15_BUFFER_LEN);
+            slot->xfer.buffer = slot->buffer;
+        }
+    }
+}
+
+/* must be called with lcd_async_mutex held and nothing on the bus, before the transport
+   closes the device the buffers belong to */
+static void releaseLCDBuffers(lg_device_t *dev)
+{
+    lcd_slot_t *slot;
+    int i;
+
+    for (i = 0; i < G15_LCD_TRANSFERS; i++) {
+        slot = &dev->lcd_slots[i];
+        if (!slot->buffer)
+            continue;
+        if (slot->state == LCD_SLOT_FILLING)
+            g15_log(stderr, G15_LOG_INFO, "LCD frame still leased while closing the device\n");
+        transport->free_buffer(dev, slot->buffer, G15_BUFFER_LEN, slot->dev_mem);
+        slot->buffer = NULL;
+        slot->xfer.buffer = NULL;
+        slot->state = LCD_SLOT_FREE;
+    }
+}
+
+/* must be called with lcd_async_mutex held.  take a free transfer buffer for filling, with
+   the LCD header in place, or NULL if they are all busy */
+static lcd_slot_t *leaseLCDSlot(lg_device_t *dev)
+{
+    lcd_slot_t *slot;
+    int i;
+
+    setupLCDTransfers(dev);
+    for (i = 0; i < G15_LCD_TRANSFERS; i++) {
+        slot = &dev->lcd_slots[i];
+        if (slot->state == LCD_SLOT_FREE && slot->buffer) {
+            slot->state = LCD_SLOT_FILLING;
+            /* a caller filling a native frame may have scribbled over the header */
+            memset(slot->buffer + 1, 0, G15_LCD_OFFSET - 1);
+            slot->buffer[0] = 0x03;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* must be called with lcd_async_mutex held */
+static void returnLCDSlot(lg_device_t *dev, lcd_slot_t *slot)
+{
+    slot->state = LCD_SLOT_FREE;
+}
+
+/* must be called with lcd_async_mutex held.  put a filled slot on the bus, or behind the
+   frame on it, where the latest frame wins */
+static int queueLCDSlot(lg_device_t *dev, lcd_slot_t *slot)
+{
+    if (!dev->lcd_inflight)
+        return submitLCDSlot(slot);
+    if (dev->lcd_queued)
+        dev->lcd_queued->state = LCD_SLOT_FREE;
+    slot->state = LCD_SLOT_QUEUED;
+    dev->lcd_queued = slot;
+    return 0;
+}
+
+/* drop any queued frame and wait for the one on the bus to be retired */
+static void cancelLCDTransfers(lg_device_t *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    if (dev->lcd_queued) {
+        dev->lcd_queued->state = LCD_SLOT_FREE;
+        dev->lcd_queued = NULL;
+    }
+    dev->last_frame_valid = 0;
+    for (i = 0; i < G15_LCD_TRANSFERS; i++)
+        if (dev->lcd_slots[i].state == LCD_SLOT_INFLIGHT)
+            transport->cancel(&dev->lcd_slots[i].xfer);
+    while (dev->lcd_inflight && usb_event_thread_running)
+        pthread_cond_wait(&dev->lcd_async_cond, &dev->lcd_async_mutex);
+    dev->lcd_async_status = 0;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+}
+
+static void freeLCDTransfers(lg_device_t *dev)
+{
+    int i;
+
+    for (i = 0; i < G15_LCD_TRANSFERS; i++) {
+        transport->free_xfer(&dev->lcd_slots[i].xfer);
+        dev->lcd_slots[i].state = LCD_SLOT_FREE;
+    }
+}
+
+/* queue a frame for the LCD without waiting for the bus.  If a frame is already
+   in flight the new one replaces any frame still waiting behind it. */
+int lg_write_pixmap_async(lg_device_t *dev, unsigned char const *data)
+{
+    lcd_slot_t *slot = NULL;
+    int ret = 0;
+
+    if(!(lg_get_caps(dev) & G15_LCD))
+        return 0;
+
+    if(!dev->handle)
+        return -ENODEV;
+
+    if(!usb_event_thread_running)
+        return lg_write_pixmap(dev, data);
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    if (dev->lcd_async_status) {
+        ret = dev->lcd_async_status;
+        dev->lcd_async_status = 0;
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        if (handle_usb_errors(dev, "LCDPixmap Async Write", ret) == -ENODEV)
+            return -ENODEV;
+        return G15_ERROR_WRITING_PIXMAP;
+    }
+    /* the chunked levels pace themselves with sleeps, so they stay synchronous */
+    if (dev->bw_level != 0) {
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        return lg_write_pixmap(dev, data);
+    }
+    if (frameUnchanged(dev, data)) {
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        return 0;
+    }
+    slot = leaseLCDSlot(dev);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    if (!slot)
+        return G15_ERROR_TRY_AGAIN;
+
+    /* the header is in place already, only the pixels need converting */
+    dumpPixmapIntoLCDFormat(slot->buffer, data);
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    ret = queueLCDSlot(dev, slot);
+    if (ret == 0)
+        frameSent(dev, data);
+    else
+        dev->last_frame_valid = 0;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+
+    if (ret) {
+        handle_usb_errors(dev, "LCDPixmap Async Write", ret);
+        return G15_ERROR_WRITING_PIXMAP;
     }
+    return 0;
+}
+
+/* must be called with lcd_async_mutex held.  the leased slot behind a frame pointer */
+static lcd_slot_t *leasedLCDSlot(lg_device_t *dev, unsigned char const *frame)
+{
+    int i;
+
+    for (i = 0; i < G15_LCD_TRANSFERS; i++)
+        if (dev->lcd_slots[i].buffer == frame && dev->lcd_slots[i].state == LCD_SLOT_FILLING)
+            return &dev->lcd_slots[i];
+    return NULL;
+}
+
+unsigned char *lg_lease_frame(lg_device_t *dev)
+{
+    lcd_slot_t *slot = NULL;
+
+    if (!(lg_get_caps(dev) & G15_LCD) || !dev->handle)
+        return NULL;
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    slot = leaseLCDSlot(dev);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    return slot ? slot->buffer : NULL;
+}
+
+void lg_release_frame(lg_device_t *dev, unsigned char *frame)
+{
+    lcd_slot_t *slot;
 
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    if ((slot = leasedLCDSlot(dev, frame)))
+        returnLCDSlot(dev, slot);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+}
+
+/* send a leased frame as it is, asynchronously where lg_write_pixmap_async would be.
+   the lease ends whatever the outcome */
+int lg_submit_frame(lg_device_t *dev, unsigned char *frame)
+{
+    lcd_slot_t *slot;
+    int ret = 0, sync;
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    if (!(slot = leasedLCDSlot(dev, frame))) {
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        return -EINVAL;
+    }
+    /* there is no pixmap to compare the next frame with, or to restore after a replug */
+    dev->last_frame_valid = 0;
+    dev->last_frame_known = 0;
+    ret = dev->handle ? dev->lcd_async_status : -ENODEV;
+    if (ret) {
+        dev->lcd_async_status = 0;
+        returnLCDSlot(dev, slot);
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        if (ret == -ENODEV || handle_usb_errors(dev, "LCDFrame Write", ret) == -ENODEV)
+            return -ENODEV;
+        return G15_ERROR_WRITING_PIXMAP;
+    }
+    sync = !usb_event_thread_running || dev->bw_level != 0;
+    if (!sync) {
+        ret = queueLCDSlot(dev, slot);
+        if (ret == 0)
+            dev->frames_sent++;
+    }
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+
+    if (sync) {
+        ret = writeLCDSync(dev, slot->buffer);
+        pthread_mutex_lock(&dev->lcd_async_mutex);
+        returnLCDSlot(dev, slot);
+        if (ret == 0)
+            dev->frames_sent++;
+        pthread_mutex_unlock(&dev->lcd_async_mutex);
+        return ret;
+    }
+    if (ret) {
+        handle_usb_errors(dev, "LCDFrame Write", ret);
+        return G15_ERROR_WRITING_PIXMAP;
+    }
     return 0;
 }
 
-int setLCDContrast(unsigned int level)
+void lg_pixmap_to_frame(unsigned char *frame, unsigned char const *data)
+{
+    dumpPixmapIntoLCDFormat(frame, data);
+}
+
+/* wait until every queued LCD frame has gone out, or timeout (in ms) expires */
+int lg_flush(lg_device_t *dev, unsigned int timeout)
+{
+    struct timespec deadline;
+    int ret = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    while ((dev->lcd_inflight || dev->lcd_queued) && usb_event_thread_running && ret == 0)
+        ret = pthread_cond_timedwait(&dev->lcd_async_cond, &dev->lcd_async_mutex, &deadline);
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+
+    return ret == ETIMEDOUT ? G15_ERROR_TIMEOUT : G15_NO_ERROR;
+}
+
+/* the set-report that puts value into a control register. returns its length */
+static unsigned int controlReport(lg_device_t *dev, int reg, int value, unsigned int *report,
+                                  unsigned int *index, unsigned char *data)
+{
+    static const unsigned char contrast_levels[] = { 18, 22, 26 };
+    static const unsigned char lcd_levels[] = { 0x00, 0x10, 0x20 };
+    static const unsigned char kb_levels[] = { 0x0, 0x1, 0x2 };
+
+    memset(data, 0, 5);
+    *report = 0x302;
+    *index = 0;
+    switch (reg) {
+        case CTL_LCD_CONTRAST:
+            data[0] = 2; data[1] = 32; data[2] = 129;
+            data[3] = contrast_levels[value < 3 ? value : 0];
+            return 4;
+        case CTL_LCD_BRIGHTNESS:
+            data[0] = 2; data[1] = 2;
+            data[2] = lcd_levels[value < 3 ? value : 0];
+            return 4;
+        case CTL_KB_BRIGHTNESS:
+            data[0] = 2; data[1] = 1;
+            data[2] = kb_levels[value < 3 ? value : 0];
+            return 4;
+        case CTL_G510_COLOR:
+            *report = 0x305;
+            *index = 1;
+            data[0] = 4;
+            data[1] = value >> 16;
+            data[2] = value >> 8;
+            data[3] = value;
+            return 4;
+        case CTL_LEDS:
+            if (lg_get_caps(dev) & G15_DEVICE_G110) {
+                *report = 0x303;
+                data[0] = 3;
+                data[1] = (unsigned char)value;
+                return 2;
+            }
+            data[0] = 2; data[1] = 4;
+            data[2] = ~(unsigned char)value;
+            return 4;
+        case CTL_G110_COLOR:
+        default:
+            *report = 0x307;
+            data[0] = 7;
+            data[1] = value >> 8;
+            data[4] = value;
+            return 5;
+    }
+}
+
+/* must be called with libusb_mutex held. send a register if the device doesn't have its
+   value already, and account for the setter calls that did not need a transfer of their own */
+static int writeControl(lg_device_t *dev, int reg)
+{
+    control_reg_t *ctl = &dev->controls[reg];
+    unsigned char data[5];
+    unsigned int report, index, size;
+    int retval = 0;
+
+    if (ctl->want >= 0 && ctl->want != ctl->hw) {
+        if (!dev->handle)
+            return -ENODEV;
+        size = controlReport(dev, reg, ctl->want, &report, &index, data);
+        retval = timedControlTransfer(dev, report, index, data, size, 10000);
+        ctl->hw = retval >= 0 ? ctl->want : -1;
+        dev->controls_sent++;
+        if (ctl->calls)
+            ctl->calls--;
+    }
+    dev->controls_avoided += ctl->calls;
+    ctl->calls = 0;
+    return retval;
+}
+
+/* the setters only record the new value in the shadow register; it goes to the device
+   right away, or on lg_flush_controls while deferred */
+static int setControl(lg_device_t *dev, int reg, int value)
 {
     int retval = 0;
-    unsigned char usb_data[] = { 2, 32, 129, 0 };
 
-    if(shared_device>0)
-        return G15_ERROR_UNSUPPORTED;
+    usbLock(dev);
+    dev->controls[reg].want = value;
+    dev->controls[reg].calls++;
+    if (!dev->controls_deferred)
+        retval = writeControl(dev, reg);
+    usbUnlock(dev);
+    return retval;
+}
 
-    switch(level)
-    {
-        case 1:
-            usb_data[3] = 22;
-            break;
-        case 2:
-            usb_data[3] = 26;
-            break;
-        default:
-            usb_data[3] = 18;
+void lg_defer_controls(lg_device_t *dev)
+{
+    usbLock(dev);
+    dev->controls_deferred = 1;
+    usbUnlock(dev);
+}
+
+/* send every register changed since lg_defer_controls, and stop deferring */
+int lg_flush_controls(lg_device_t *dev)
+{
+    int reg, ret, retval = G15_NO_ERROR;
+
+    usbLock(dev);
+    dev->controls_deferred = 0;
+    for (reg = 0; reg < CTL_COUNT; reg++) {
+        ret = writeControl(dev, reg);
+        if (ret < 0 && retval == G15_NO_ERROR)
+            retval = ret;
     }
-    pthread_mutex_lock(&libusb_mutex);
-    retval = libusb_control_transfer(keyboard_device, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9, 0x302, 0, (char*)usb_data, 4, 10000);
-    pthread_mutex_unlock(&libusb_mutex);
+    usbUnlock(dev);
     return retval;
 }
 
-int setLEDs(unsigned int leds)
+void lg_get_control_counters(lg_device_t *dev, unsigned long *sent, unsigned long *avoided)
 {
-    int retval = 0;
-    int cmd_size = 4;
-    unsigned int cmd_code = 0;
-    unsigned char m_led_buf[4] = { 0, 0, 0, 0 };
-    if(g15DeviceCapabilities() & G15_DEVICE_G110)
-    {
-        m_led_buf[0] = 3;
-        m_led_buf[1] = (unsigned char)leds;
-        cmd_size = 2;
-        cmd_code = 0x303;
-    }else
-    {
-        m_led_buf[0] = 2;
-        m_led_buf[1] = 4;
-        m_led_buf[2] = ~(unsigned char)leds;
-        cmd_code = 0x302;
+    usbLock(dev);
+    *sent = dev->controls_sent;
+    *avoided = dev->controls_avoided;
+    usbUnlock(dev);
+}
 
-        if(g15DeviceCapabilities()&G15_DEVICE_G510)
-           setG510LEDColor(0, 255, 0);
-    }
-    if(shared_device>0)
+int lg_set_lcd_contrast(lg_device_t *dev, unsigned int level)
+{
+    if(dev->shared_device>0)
         return G15_ERROR_UNSUPPORTED;
 
-    pthread_mutex_lock(&libusb_mutex);
-    retval = libusb_control_transfer(keyboard_device, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9, cmd_code, 0, (char*)m_led_buf, cmd_size, 10000);
-    pthread_mutex_unlock(&libusb_mutex);
-    return retval;
+    return setControl(dev, CTL_LCD_CONTRAST, level > 2 ? 0 : level);
 }
 
-int setLCDBrightness(unsigned int level)
+int lg_set_leds(lg_device_t *dev, unsigned int leds)
 {
-    int retval = 0;
-    unsigned char usb_data[] = { 2, 2, 0, 0 };
+    if(lg_get_caps(dev) & G15_DEVICE_G510)
+        lg_set_g510_led_color(dev, 0, 255, 0);
 
-    if(shared_device>0)
+    if(dev->shared_device>0)
         return G15_ERROR_UNSUPPORTED;
 
-    switch(level)
-    {
-        case 1 :
-            usb_data[2] = 0x10;
-            break;
-        case 2 :
-            usb_data[2] = 0x20;
-            break;
-        default:
-            usb_data[2] = 0x00;
-    }
-    pthread_mutex_lock(&libusb_mutex);
-    retval = libusb_control_transfer(keyboard_device, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9, 0x302, 0, (char*)usb_data, 4, 10000);
-    pthread_mutex_unlock(&libusb_mutex);
-    return retval;
+    return setControl(dev, CTL_LEDS, leds & 0xff);
 }
 
-/* set the keyboard backlight. doesnt affect lcd backlight. 0==off,1==medium,2==high */
-int setKBBrightness(unsigned int level)
+int lg_set_lcd_brightness(lg_device_t *dev, unsigned int level)
 {
-    int retval = 0;
-    unsigned char usb_data[] = { 2, 1, 0, 0 };
-
-    if(shared_device>0)
+    if(dev->shared_device>0)
         return G15_ERROR_UNSUPPORTED;
 
-    switch(level)
-    {
-        case 1 :
-            usb_data[2] = 0x1;
-            break;
-        case 2 :
-            usb_data[2] = 0x2;
-            break;
-        default:
-            usb_data[2] = 0x0;
-    }
-    pthread_mutex_lock(&libusb_mutex);
-    retval = libusb_control_transfer(keyboard_device, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9, 0x302, 0, (char*)usb_data, 4, 10000);
-    pthread_mutex_unlock(&libusb_mutex);
-    return retval;
+    return setControl(dev, CTL_LCD_BRIGHTNESS, level > 2 ? 0 : level);
 }
 
-int setG510LEDColor(unsigned char r, unsigned char g, unsigned char b)
+/* set the keyboard backlight. doesnt affect lcd backlight. 0==off,1==medium,2==high */
+int lg_set_kb_brightness(lg_device_t *dev, unsigned int level)
 {
-    int retval = 0;
-    unsigned char usb_data[] = { 4, 0, 0, 0 };
+    if(dev->shared_device>0)
+        return G15_ERROR_UNSUPPORTED;
 
-    usb_data[1] = r;
-    usb_data[2] = g;
-    usb_data[3] = b;
+    return setControl(dev, CTL_KB_BRIGHTNESS, level > 2 ? 0 : level);
+}
 
-    pthread_mutex_lock(&libusb_mutex);
-    retval = libusb_control_transfer(keyboard_device, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9, 0x305, 1, (char*)usb_data, 4, 10000);
-    pthread_mutex_unlock(&libusb_mutex);
-    return retval;
+int lg_set_g510_led_color(lg_device_t *dev, unsigned char r, unsigned char g, unsigned char b)
+{
+    return setControl(dev, CTL_G510_COLOR, (r << 16) | (g << 8) | b);
 }
 
 /*
@@ -641,18 +3056,44 @@ int setG510LEDColor(unsigned char r, unsigned char g, unsigned char b)
 	color is the color tome from 0x00 -> red to 0xff -> blue
 	brightness is the 8 bit brightness level (0x00 - 0x0e)
 */
-int setG110LEDColor(unsigned char color, unsigned char brightness)
+int lg_set_g110_led_color(lg_device_t *dev, unsigned char color, unsigned char brightness)
 {
-    int retval = 0;
-    unsigned char usb_data[] = { 7, 0, 0, 0, 0 };
+    return setControl(dev, CTL_G110_COLOR, (color << 8) | brightness);
+}
+
+/* put back what the keyboard showed before it was unplugged */
+static void restoreDeviceState(lg_device_t *dev)
+{
+    unsigned char frame[G15_PIXMAP_BYTES];
+    int reg, known;
+
+    /* a replugged keyboard has lost all of its settings */
+    usbLock(dev);
+    for (reg = 0; reg < CTL_COUNT; reg++) {
+        dev->controls[reg].hw = -1;
+        writeControl(dev, reg);
+    }
+    usbUnlock(dev);
+
+    pthread_mutex_lock(&dev->lcd_async_mutex);
+    known = dev->last_frame_known;
+    memcpy(frame, dev->last_frame, G15_PIXMAP_BYTES);
+    dev->last_frame_valid = 0;
+    pthread_mutex_unlock(&dev->lcd_async_mutex);
+    if (known)
+        lg_write_pixmap(dev, frame);
+}
 
-    usb_data[1] = color;
-    usb_data[4] = brightness;
+int lg_register_hotplug_handler(lg_device_t *dev, g15_hotplug_handler_t handler, void *userdata)
+{
+    if (!hotplug_registered)
+        return G15_ERROR_UNSUPPORTED;
 
-    pthread_mutex_lock(&libusb_mutex);
-    retval = libusb_control_transfer(keyboard_device, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE, 9, 0x307, 0, (char*)usb_data, 5, 10000);
-    pthread_mutex_unlock(&libusb_mutex);
-    return retval;
+    pthread_mutex_lock(&devices_mutex);
+    dev->hotplug_handler = handler;
+    dev->hotplug_handler_data = userdata;
+    pthread_mutex_unlock(&devices_mutex);
+    return G15_NO_ERROR;
 }
 
 static unsigned char g15KeyToLogitechKeyCode(int key)
@@ -669,441 +3110,599 @@ static unsigned char g15KeyToLogitechKeyCode(int key)
     }
 }
 
-static void processKeyEventG13(unsigned int *pressed_keys, unsigned char *buffer)
-{
-    int i;
-
-    *pressed_keys = 0;
-
-    g15_log(stderr,G15_LOG_WARN,"Keyboard G13: %x, %x, %x, %x, %x, %x, %x, %x, %x\n",buffer[0],buffer[1],buffer[2],buffer[3],buffer[4],buffer[5],buffer[6],buffer[7],buffer[8]);
-
-    if (buffer[0] == 0x25)
-    {
-        if (buffer[3]&0x01)
-      *pressed_keys |= G15_KEY_G1;
-        if (buffer[3]&0x02)
-      *pressed_keys |= G15_KEY_G2;
-        if (buffer[3]&0x04)
-      *pressed_keys |= G15_KEY_G3;
-        if (buffer[3]&0x08)
-      *pressed_keys |= G15_KEY_G4;
-        if (buffer[3]&0x10)
-      *pressed_keys |= G15_KEY_G5;
-        if (buffer[3]&0x20)
-      *pressed_keys |= G15_KEY_G6;
-        if (buffer[3]&0x40)
-      *pressed_keys |= G15_KEY_G7;
-        if (buffer[3]&0x80)
-      *pressed_keys |= G15_KEY_G8;
-
-        if (buffer[4]&0x01)
-      *pressed_keys |= G15_KEY_G9;
-        if (buffer[4]&0x02)
-      *pressed_keys |= G15_KEY_G10;
-        if (buffer[4]&0x04)
-      *pressed_keys |= G15_KEY_G11;
-        if (buffer[4]&0x08)
-      *pressed_keys |= G15_KEY_G12;
-        if (buffer[4]&0x10)
-      *pressed_keys |= G15_KEY_G13;
-        if (buffer[4]&0x20)
-      *pressed_keys |= G15_KEY_G14;
-        if (buffer[4]&0x40)
-      *pressed_keys |= G15_KEY_G15;
-        if (buffer[4]&0x80)
-      *pressed_keys |= G15_KEY_G16;
-        if (buffer[5]&0x01)
-      *pressed_keys |= G15_KEY_G17;
-        if (buffer[5]&0x02)
-      *pressed_keys |= G15_KEY_G18;
-        if (buffer[5]&0x04)
-      *pressed_keys |= G15_KEY_G19;
-        if (buffer[5]&0x08)
-      *pressed_keys |= G15_KEY_G20;
-        if (buffer[5]&0x10)
-      *pressed_keys |= G15_KEY_G21;
-        if (buffer[5]&0x20)
-      *pressed_keys |= G15_KEY_G22;
-        if (buffer[5]&0x80)
-      *pressed_keys |= G15_KEY_LIGHT;
-
-        if (buffer[6]&0x01)
-      *pressed_keys |= G15_KEY_L1;
-        if (buffer[6]&0x02)
-      *pressed_keys |= G15_KEY_L2;
-        if (buffer[6]&0x04)
-      *pressed_keys |= G15_KEY_L3;
-        if (buffer[6]&0x08)
-      *pressed_keys |= G15_KEY_L4;
-        if (buffer[6]&0x10)
-      *pressed_keys |= G15_KEY_L5;
-
-        if (buffer[6]&0x20)
-      *pressed_keys |= G15_KEY_M1;
-        if (buffer[6]&0x40)
-      *pressed_keys |= G15_KEY_M2;
-        if (buffer[6]&0x80)
-      *pressed_keys |= G15_KEY_M3;
-        if (buffer[7]&0x01)
-      *pressed_keys |= G15_KEY_MR;
-
-      /*
-        if (buffer[7]&0x02)
-      *pressed_keys |= G15_KEY_JOYBL;
-        if (buffer[7]&0x04)
-      *pressed_keys |= G15_KEY_JOYBD;
-        if (buffer[7]&0x08)
-      *pressed_keys |= G15_KEY_JOYBS;
-      */
-    }
-
-}
-
-static void processKeyEvent9Byte(unsigned int *pressed_keys, unsigned char *buffer)
-{
-    int i;
-
-    *pressed_keys = 0;
-
-    g15_log(stderr,G15_LOG_WARN,"Keyboard: %x, %x, %x, %x, %x, %x, %x, %x, %x\n",buffer[0],buffer[1],buffer[2],buffer[3],buffer[4],buffer[5],buffer[6],buffer[7],buffer[8]);
-
-    if (buffer[0] == 0x02)
-    {
-        if (buffer[1]&0x01)
-            *pressed_keys |= G15_KEY_G1;
-
-        if (buffer[2]&0x02)
-            *pressed_keys |= G15_KEY_G2;
-
-        if (buffer[3]&0x04)
-            *pressed_keys |= G15_KEY_G3;
-
-        if (buffer[4]&0x08)
-            *pressed_keys |= G15_KEY_G4;
-
-        if (buffer[5]&0x10)
-            *pressed_keys |= G15_KEY_G5;
-
-        if (buffer[6]&0x20)
-            *pressed_keys |= G15_KEY_G6;
-
-
-        if (buffer[2]&0x01)
-            *pressed_keys |= G15_KEY_G7;
-
-        if (buffer[3]&0x02)
-            *pressed_keys |= G15_KEY_G8;
-
-        if (buffer[4]&0x04)
-            *pressed_keys |= G15_KEY_G9;
-
-        if (buffer[5]&0x08)
-            *pressed_keys |= G15_KEY_G10;
-
-        if (buffer[6]&0x10)
-            *pressed_keys |= G15_KEY_G11;
-
-        if (buffer[7]&0x20)
-            *pressed_keys |= G15_KEY_G12;
-
-        if (buffer[1]&0x04)
-            *pressed_keys |= G15_KEY_G13;
-
-        if (buffer[2]&0x08)
-            *pressed_keys |= G15_KEY_G14;
+/* one key in a report: set when buffer[byte] & mask */
+typedef struct key_bit_t {
+    unsigned char byte;
+    unsigned char mask;
+    unsigned char key;      /* G15_KEYBIT_* */
+} key_bit_t;
+
+#define KEYBIT(byte, mask, key) { byte, mask, G15_KEYBIT_##key }
+
+static const key_bit_t keys_g13[] = {
+    KEYBIT(3,0x01,G1),  KEYBIT(3,0x02,G2),  KEYBIT(3,0x04,G3),  KEYBIT(3,0x08,G4),
+    KEYBIT(3,0x10,G5),  KEYBIT(3,0x20,G6),  KEYBIT(3,0x40,G7),  KEYBIT(3,0x80,G8),
+    KEYBIT(4,0x01,G9),  KEYBIT(4,0x02,G10), KEYBIT(4,0x04,G11), KEYBIT(4,0x08,G12),
+    KEYBIT(4,0x10,G13), KEYBIT(4,0x20,G14), KEYBIT(4,0x40,G15), KEYBIT(4,0x80,G16),
+    KEYBIT(5,0x01,G17), KEYBIT(5,0x02,G18), KEYBIT(5,0x04,G19), KEYBIT(5,0x08,G20),
+    KEYBIT(5,0x10,G21), KEYBIT(5,0x20,G22), KEYBIT(5,0x80,LIGHT),
+    KEYBIT(6,0x01,L1),  KEYBIT(6,0x02,L2),  KEYBIT(6,0x04,L3),  KEYBIT(6,0x08,L4),
+    KEYBIT(6,0x10,L5),  KEYBIT(6,0x20,M1),  KEYBIT(6,0x40,M2),  KEYBIT(6,0x80,M3),
+    KEYBIT(7,0x01,MR),  KEYBIT(7,0x02,JOYBL), KEYBIT(7,0x04,JOYBD), KEYBIT(7,0x08,JOYBS)
+};
 
-        if (buffer[3]&0x10)
-            *pressed_keys |= G15_KEY_G15;
+/* original G15 */
+static const key_bit_t keys_9byte[] = {
+    KEYBIT(1,0x01,G1),  KEYBIT(2,0x02,G2),  KEYBIT(3,0x04,G3),  KEYBIT(4,0x08,G4),
+    KEYBIT(5,0x10,G5),  KEYBIT(6,0x20,G6),  KEYBIT(2,0x01,G7),  KEYBIT(3,0x02,G8),
+    KEYBIT(4,0x04,G9),  KEYBIT(5,0x08,G10), KEYBIT(6,0x10,G11), KEYBIT(7,0x20,G12),
+    KEYBIT(1,0x04,G13), KEYBIT(2,0x08,G14), KEYBIT(3,0x10,G15), KEYBIT(4,0x20,G16),
+    KEYBIT(5,0x40,G17), KEYBIT(8,0x40,G18),
+    KEYBIT(6,0x01,M1),  KEYBIT(7,0x02,M2),  KEYBIT(8,0x04,M3),  KEYBIT(7,0x40,MR),
+    KEYBIT(8,0x80,L1),  KEYBIT(2,0x80,L2),  KEYBIT(3,0x80,L3),  KEYBIT(4,0x80,L4),
+    KEYBIT(5,0x80,L5),  KEYBIT(1,0x80,LIGHT)
+};
 
-        if (buffer[4]&0x20)
-            *pressed_keys |= G15_KEY_G16;
+/* G15 v2 */
+static const key_bit_t keys_5byte[] = {
+    KEYBIT(1,0x01,G1),  KEYBIT(1,0x02,G2),  KEYBIT(1,0x04,G3),  KEYBIT(1,0x08,G4),
+    KEYBIT(1,0x10,G5),  KEYBIT(1,0x20,G6),  KEYBIT(1,0x40,M1),  KEYBIT(1,0x80,M2),
+    KEYBIT(2,0x20,M3),  KEYBIT(2,0x40,MR),  KEYBIT(2,0x80,L1),  KEYBIT(2,0x02,L2),
+    KEYBIT(2,0x04,L3),  KEYBIT(2,0x08,L4),  KEYBIT(2,0x10,L5),  KEYBIT(2,0x01,LIGHT)
+};
 
-        if (buffer[5]&0x40)
-            *pressed_keys |= G15_KEY_G17;
+static const key_bit_t keys_g510[] = {
+    KEYBIT(1,0x01,G1),  KEYBIT(1,0x02,G2),  KEYBIT(1,0x04,G3),  KEYBIT(1,0x08,G4),
+    KEYBIT(1,0x10,G5),  KEYBIT(1,0x20,G6),  KEYBIT(1,0x40,G7),  KEYBIT(1,0x80,G8),
+    KEYBIT(2,0x01,G9),  KEYBIT(2,0x02,G10), KEYBIT(2,0x04,G11), KEYBIT(2,0x08,G12),
+    KEYBIT(2,0x10,G13), KEYBIT(2,0x20,G14), KEYBIT(2,0x40,G15), KEYBIT(2,0x80,G16),
+    KEYBIT(3,0x01,G17), KEYBIT(3,0x02,G18), KEYBIT(3,0x08,LIGHT),
+    KEYBIT(3,0x10,M1),  KEYBIT(3,0x20,M2),  KEYBIT(3,0x40,M3),  KEYBIT(3,0x80,MR),
+    KEYBIT(4,0x01,L1),  KEYBIT(4,0x02,L2),  KEYBIT(4,0x04,L3),  KEYBIT(4,0x08,L4),
+    KEYBIT(4,0x10,L5)
+};
 
-        if (buffer[8]&0x40)
-            *pressed_keys |= G15_KEY_G18;
+/* G110 */
+static const key_bit_t keys_4byte[] = {
+    KEYBIT(1,0x01,G1),  KEYBIT(1,0x02,G2),  KEYBIT(1,0x04,G3),  KEYBIT(1,0x08,G4),
+    KEYBIT(1,0x10,G5),  KEYBIT(1,0x20,G6),  KEYBIT(1,0x40,G7),  KEYBIT(1,0x80,G8),
+    KEYBIT(2,0x01,G9),  KEYBIT(2,0x02,G10), KEYBIT(2,0x04,G11), KEYBIT(2,0x08,G12),
+    KEYBIT(2,0x10,M1),  KEYBIT(2,0x20,M2),  KEYBIT(2,0x40,M3),  KEYBIT(2,0x80,MR),
+    KEYBIT(3,0x01,LIGHT), KEYBIT(3,0x02,HEADSETMUTE)
+};
 
-        if (buffer[6]&0x01)
-            *pressed_keys |= G15_KEY_M1;
-        if (buffer[7]&0x02)
-            *pressed_keys |= G15_KEY_M2;
-        if (buffer[8]&0x04)
-            *pressed_keys |= G15_KEY_M3;
-        if (buffer[7]&0x40)
-            *pressed_keys |= G15_KEY_MR;
+#undef KEYBIT
+
+/* which table decodes a report, picked by report length, report id (byte 0) and device caps */
+typedef struct key_report_t {
+    int length;             /* 0 matches any length */
+    unsigned char id;
+    unsigned int caps;      /* device must have all of these */
+    const key_bit_t *bits;
+    int nbits;
+} key_report_t;
+
+#define KEYREPORT(length, id, caps, table) { length, id, caps, table, sizeof(table) / sizeof(table[0]) }
+
+static const key_report_t key_reports[] = {
+    KEYREPORT(0, 0x25, G15_DEVICE_G13, keys_g13),
+    KEYREPORT(4, 0x02, 0, keys_4byte),
+    KEYREPORT(5, 0x02, 0, keys_5byte),
+    KEYREPORT(5, 0x03, 0, keys_g510),
+    KEYREPORT(9, 0x02, 0, keys_9byte),
+    // TODO : Add case for return of 2 bytes (G510 media keys).
+};
 
-        if (buffer[8]&0x80)
-            *pressed_keys |= G15_KEY_L1;
-        if (buffer[2]&0x80)
-            *pressed_keys |= G15_KEY_L2;
-        if (buffer[3]&0x80)
-            *pressed_keys |= G15_KEY_L3;
-        if (buffer[4]&0x80)
-            *pressed_keys |= G15_KEY_L4;
-        if (buffer[5]&0x80)
-            *pressed_keys |= G15_KEY_L5;
+#undef KEYREPORT
 
-        if (buffer[1]&0x80)
-            *pressed_keys |= G15_KEY_LIGHT;
+static unsigned int keyMaskTo32(uint64_t keys)
+{
+    return G15_KEYMASK32(keys);
+}
 
+/* called by the one thread reading keys with every decoded report.  queues the report
+   if the held keys changed.  a full ring drops the event without touching key_state, so
+   the next one queued carries the missed change in its delta */
+static void queueKeyEvent(lg_device_t *dev, uint64_t keys)
+{
+    unsigned int tail = dev->key_events_tail;
+    lg_key_event_t *event;
+
+    if (keys == dev->key_state)
+        return;
+    if (tail - __atomic_load_n(&dev->key_events_head, __ATOMIC_ACQUIRE) >= G15_KEY_EVENTS) {
+        __atomic_add_fetch(&dev->key_events_dropped, 1, __ATOMIC_RELAXED);
+        return;
     }
+    event = &dev->key_events[tail % G15_KEY_EVENTS];
+    event->when = monotonicUs();
+    event->keys = keys;
+    event->changed = keys ^ dev->key_state;
+    dev->key_state = keys;
+    __atomic_store_n(&dev->key_events_tail, tail + 1, __ATOMIC_RELEASE);
 }
 
-static void processKeyEvent5Byte(unsigned int *pressed_keys, unsigned char *buffer)
+/* the consumer side: copy out up to max events, oldest first */
+int lg_drain_key_events(lg_device_t *dev, lg_key_event_t *events, int max)
 {
-    int i;
-
-    *pressed_keys = 0;
-
-    g15_log(stderr,G15_LOG_WARN,"Keyboard: %x, %x, %x, %x, %x\n",buffer[0],buffer[1],buffer[2],buffer[3],buffer[4]);
-
-    if (buffer[0] == 0x02)
-    {
-        if (buffer[1]&0x01)
-            *pressed_keys |= G15_KEY_G1;
-
-        if (buffer[1]&0x02)
-            *pressed_keys |= G15_KEY_G2;
-
-        if (buffer[1]&0x04)
-            *pressed_keys |= G15_KEY_G3;
-
-        if (buffer[1]&0x08)
-            *pressed_keys |= G15_KEY_G4;
-
-        if (buffer[1]&0x10)
-            *pressed_keys |= G15_KEY_G5;
-
-        if (buffer[1]&0x20)
-            *pressed_keys |= G15_KEY_G6;
-
-        if (buffer[1]&0x40)
-            *pressed_keys |= G15_KEY_M1;
-
-        if (buffer[1]&0x80)
-            *pressed_keys |= G15_KEY_M2;
-
-        if (buffer[2]&0x20)
-            *pressed_keys |= G15_KEY_M3;
-
-        if (buffer[2]&0x40)
-            *pressed_keys |= G15_KEY_MR;
-
-        if (buffer[2]&0x80)
-            *pressed_keys |= G15_KEY_L1;
+    unsigned int head = dev->key_events_head;
+    unsigned int tail = __atomic_load_n(&dev->key_events_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail && n < max)
+        events[n++] = dev->key_events[head++ % G15_KEY_EVENTS];
+    __atomic_store_n(&dev->key_events_head, head, __ATOMIC_RELEASE);
+    return n;
+}
 
-        if (buffer[2]&0x2)
-            *pressed_keys |= G15_KEY_L2;
+unsigned long lg_get_key_events_dropped(lg_device_t *dev)
+{
+    return __atomic_load_n(&dev->key_events_dropped, __ATOMIC_RELAXED);
+}
 
-        if (buffer[2]&0x4)
-            *pressed_keys |= G15_KEY_L3;
+/* decode a raw report from the keys endpoint.  returns G15_NO_ERROR with pressed_keys filled in,
+   G15_ERROR_TRY_AGAIN for the half of the g15 reports we ignore, or -1 for a report of unknown length */
+static int decodeKeyReport(lg_device_t *dev, uint64_t *pressed_keys, unsigned char *buffer, int read)
+{
+    const key_report_t *report = NULL;
+    const key_bit_t *bits;
+    uint64_t keys = 0;
+    unsigned int caps;
+    int i;
 
-        if (buffer[2]&0x8)
-            *pressed_keys |= G15_KEY_L4;
+    if (read <= 0)
+        return -1;
+    if (buffer[0] == 1)
+        return G15_ERROR_TRY_AGAIN;
 
-        if (buffer[2]&0x10)
-            *pressed_keys |= G15_KEY_L5;
+    g15_log(stderr,G15_LOG_WARN,"Keyboard: %x, %x, %x, %x, %x, %x, %x, %x, %x\n",buffer[0],buffer[1],buffer[2],buffer[3],buffer[4],buffer[5],buffer[6],buffer[7],buffer[8]);
 
-        if (buffer[2]&0x1)
-            *pressed_keys |= G15_KEY_LIGHT;
+    caps = lg_get_caps(dev);
+    for (i = 0; i < sizeof(key_reports) / sizeof(key_reports[0]); i++) {
+        if ((key_reports[i].length == 0 || key_reports[i].length == read) &&
+            key_reports[i].id == buffer[0] && (caps & key_reports[i].caps) == key_reports[i].caps) {
+            report = &key_reports[i];
+            break;
+        }
     }
 
-    // G510
-    if (buffer[0] == 0x03)
-    {
-        if (buffer[1]&0x01)
-            *pressed_keys |= G15_KEY_G1;
+    if (!report) {
+        /* an unknown report id of a known length decodes to no keys */
+        if (read != 4 && read != 5 && read != 9)
+            return -1;
+        *pressed_keys = 0;
+        return G15_NO_ERROR;
+    }
 
-        if (buffer[1]&0x02)
-            *pressed_keys |= G15_KEY_G2;
+    bits = report->bits;
+    for (i = 0; i < report->nbits; i++)
+        keys |= (uint64_t)((buffer[bits[i].byte] & bits[i].mask) != 0) << bits[i].key;
+    *pressed_keys = keys;
+    return G15_NO_ERROR;
+}
 
-        if (buffer[1]&0x04)
-            *pressed_keys |= G15_KEY_G3;
+/* the other way round, for the virtual keyboards: the report a device of this type sends
+   while keys are held down.  returns its length */
+static int encodeKeyReport(int devicetype, uint64_t keys, unsigned char *buffer)
+{
+    const key_report_t *report;
+    unsigned int caps = g15_devices[devicetype].caps;
+    int i, j, length;
+
+    if (caps & G15_DEVICE_G13)
+        length = 8;
+    else if (caps & G15_DEVICE_G110)
+        length = 4;
+    else if (caps & (G15_DEVICE_5BYTE_RETURN | G15_DEVICE_G510))
+        length = 5;
+    else
+        length = 9;
+
+    memset(buffer, 0, G15_KEY_READ_LENGTH);
+    buffer[0] = (caps & G15_DEVICE_G13) ? 0x25 : (caps & G15_DEVICE_G510) ? 0x03 : 0x02;
+    for (i = 0; i < sizeof(key_reports) / sizeof(key_reports[0]); i++) {
+        report = &key_reports[i];
+        if ((report->length == 0 || report->length == length) &&
+            report->id == buffer[0] && (caps & report->caps) == report->caps) {
+            for (j = 0; j < report->nbits; j++)
+                if (keys & G15_KEY64(report->bits[j].key))
+                    buffer[report->bits[j].byte] |= report->bits[j].mask;
+            break;
+        }
+    }
+    return length;
+}
 
-        if (buffer[1]&0x08)
-            *pressed_keys |= G15_KEY_G4;
+int lg_read_keys64(lg_device_t *dev, uint64_t *pressed_keys, unsigned int timeout)
+{
+    unsigned char buffer[G15_KEY_READ_LENGTH];
+    int ret = 0;
+    int	read = 0;
 
-        if (buffer[1]&0x10)
-            *pressed_keys |= G15_KEY_G5;
+    if (!dev->handle)
+        return -ENODEV;
 
-        if (buffer[1]&0x20)
-            *pressed_keys |= G15_KEY_G6;
+    memset(buffer, 0, sizeof(buffer));
+#ifdef LIBUSB_BLOCKS
+    ret = timedInterruptTransfer(dev, G15_STATS_KEYS, dev->keys_endpoint, buffer, G15_KEY_READ_LENGTH, &read, timeout);
+#else
+    usbLock(dev);
+    ret = timedInterruptTransfer(dev, G15_STATS_KEYS, dev->keys_endpoint, buffer, G15_KEY_READ_LENGTH, &read, timeout);
+    usbUnlock(dev);
+#endif
+    if (ret != 0) {
+    	ret = handle_usb_errors(dev, "Keyboard Read", ret);
+    	if (ret == -ENODEV)
+    		queueKeyEvent(dev, 0);	/* nothing is held on a keyboard that has gone */
+    	return	ret;
+    }
+    ret = decodeKeyReport(dev, pressed_keys, buffer, read);
+    if (ret < 0)
+        return handle_usb_errors(dev, "Keyboard Read", 0); /* allow the app to deal with errors */
+    if (ret == G15_NO_ERROR)
+        queueKeyEvent(dev, *pressed_keys);
+    return ret;
+}
 
-        if (buffer[1]&0x40)
-            *pressed_keys |= G15_KEY_G7;
+int lg_read_keys(lg_device_t *dev, unsigned int *pressed_keys, unsigned int timeout)
+{
+    uint64_t keys = 0;
+    int ret;
 
-        if (buffer[1]&0x80)
-            *pressed_keys |= G15_KEY_G8;
+    ret = lg_read_keys64(dev, &keys, timeout);
+    if (ret == G15_NO_ERROR)
+        *pressed_keys = keyMaskTo32(keys);
+    return ret;
+}
 
-        if (buffer[2]&0x01)
-            *pressed_keys |= G15_KEY_G9;
+/* runs on the usb event thread: decode the report, hand it to the registered handler and re-arm */
+static void keyTransferDone(lg_xfer_t *xfer)
+{
+    lg_device_t *dev = xfer->dev;
+    uint64_t pressed_keys = 0;
+    int ret;
+
+    xferFinished(xfer);
+    pthread_mutex_lock(&dev->key_async_mutex);
+    switch (xfer->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            ret = decodeKeyReport(dev, &pressed_keys, xfer->buffer, xfer->actual_length);
+            if (ret == G15_NO_ERROR)
+                queueKeyEvent(dev, pressed_keys);
+            if (ret == G15_NO_ERROR && dev->key_handler)
+                dev->key_handler(keyMaskTo32(pressed_keys), G15_NO_ERROR, dev->key_handler_data);
+            break;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            break;
+        case LIBUSB_TRANSFER_CANCELLED:
+            dev->key_armed = 0;
+            break;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            dev->key_armed = 0;
+            queueKeyEvent(dev, 0);
+            if (dev->key_handler)
+                dev->key_handler(0, -ENODEV, dev->key_handler_data);
+            break;
+        default:
+            /* clearing a stall is synchronous, so the event thread does it after this callback returns */
+            g15_log(stderr, G15_LOG_INFO, "usb error: Keyboard Async Read status %i\n", xfer->status);
+            dev->key_armed = 0;
+            dev->key_recover = 1;
+            break;
+    }
+    if (dev->key_armed && dev->key_handler && dev->handle) {
+        if (submitXfer(xfer) != 0)
+            dev->key_armed = 0;
+    }
+    pthread_cond_broadcast(&dev->key_async_cond);
+    pthread_mutex_unlock(&dev->key_async_mutex);
+}
 
-        if (buffer[2]&0x02)
-            *pressed_keys |= G15_KEY_G10;
+/* must be called with key_async_mutex held */
+static int armKeyTransfer(lg_device_t *dev)
+{
+    int ret;
 
-        if (buffer[2]&0x04)
-            *pressed_keys |= G15_KEY_G11;
+    if (dev->key_armed)
+        return 0;
+    if (!dev->handle || !dev->keys_endpoint || !(lg_get_caps(dev) & G15_KEYS))
+        return G15_ERROR_UNSUPPORTED;
 
-        if (buffer[2]&0x08)
-            *pressed_keys |= G15_KEY_G12;
+    dev->key_xfer.dev = dev;
+    dev->key_xfer.endpoint = dev->keys_endpoint;
+    dev->key_xfer.buffer = dev->key_buffer;
+    dev->key_xfer.length = G15_KEY_READ_LENGTH;
+    dev->key_xfer.timeout = 0;
+    dev->key_xfer.callback = keyTransferDone;
+    dev->key_xfer.stat = G15_STATS_KEYS;
+    ret = submitXfer(&dev->key_xfer);
+    if (ret != 0) {
+        g15_log(stderr, G15_LOG_INFO, "Unable to arm key transfer, error %d\n", ret);
+        return G15_ERROR_READING_USB_DEVICE;
+    }
+    dev->key_armed = 1;
+    return G15_NO_ERROR;
+}
 
-        if (buffer[2]&0x10)
-            *pressed_keys |= G15_KEY_G13;
+/* must be called with key_async_mutex held */
+static void disarmKeyTransfer(lg_device_t *dev)
+{
+    if (dev->key_armed) {
+        transport->cancel(&dev->key_xfer);
+        while (dev->key_armed && usb_event_thread_running)
+            pthread_cond_wait(&dev->key_async_cond, &dev->key_async_mutex);
+    }
+}
 
-        if (buffer[2]&0x20)
-            *pressed_keys |= G15_KEY_G14;
+/* called by the usb event thread between rounds of event handling */
+static void recoverKeyTransfers()
+{
+    lg_device_t *dev;
+
+    pthread_mutex_lock(&devices_mutex);
+    for (dev = open_devices; dev; dev = dev->next) {
+        pthread_mutex_lock(&dev->key_async_mutex);
+        if (dev->key_recover && dev->handle) {
+            dev->key_recover = 0;
+            transport->clear_halt(dev, dev->keys_endpoint);
+            if (dev->key_handler)
+                armKeyTransfer(dev);
+        }
+        pthread_mutex_unlock(&dev->key_async_mutex);
+    }
+    pthread_mutex_unlock(&devices_mutex);
+}
 
-        if (buffer[2]&0x40)
-            *pressed_keys |= G15_KEY_G15;
+int lg_register_key_handler(lg_device_t *dev, g15_key_handler_t handler, void *userdata)
+{
+    int ret = G15_NO_ERROR;
 
-        if (buffer[2]&0x80)
-            *pressed_keys |= G15_KEY_G16;
+    if (!usb_event_thread_running)
+        return G15_ERROR_UNSUPPORTED;
 
-        if (buffer[3]&0x01)
-            *pressed_keys |= G15_KEY_G17;
+    pthread_mutex_lock(&dev->key_async_mutex);
+    if (!handler) {
+        disarmKeyTransfer(dev);
+        dev->key_handler = NULL;
+        dev->key_handler_data = NULL;
+    } else {
+        dev->key_handler = handler;
+        dev->key_handler_data = userdata;
+        ret = armKeyTransfer(dev);
+        if (ret != G15_NO_ERROR)
+            dev->key_handler = NULL;
+    }
+    pthread_mutex_unlock(&dev->key_async_mutex);
+    return ret;
+}
 
-        if (buffer[3]&0x02)
-            *pressed_keys |= G15_KEY_G18;
+/* the original single-keyboard api, operating on a default device */
 
-        if (buffer[3]&0x10)
-            *pressed_keys |= G15_KEY_M1;
+int g15DeviceCapabilities() {
+    return lg_get_caps(default_device);
+}
 
-        if (buffer[3]&0x20)
-            *pressed_keys |= G15_KEY_M2;
+/* return number of connected and supported devices */
+int g15NumberOfConnectedDevices() {
+    if (!transport)	/* Ensure we're initialized. */
+        return 0;
+    return lg_enumerate(NULL, 0);
+}
 
-        if (buffer[3]&0x40)
-            *pressed_keys |= G15_KEY_M3;
+int initLibG15()
+{
+    if (default_device)
+        return lg_reopen(default_device);
+    return lg_open(NULL, &default_device);
+}
 
-        if (buffer[3]&0x80)
-            *pressed_keys |= G15_KEY_MR;
+int re_initLibG15()
+{
+    if (!default_device)
+        return initLibG15();
+    return lg_reopen(default_device);
+}
 
-        if (buffer[4]&0x1)
-            *pressed_keys |= G15_KEY_L1;
+int exitLibG15()
+{
+    int retval;
 
-        if (buffer[4]&0x2)
-            *pressed_keys |= G15_KEY_L2;
+    if (!default_device)
+        return -1;
+    retval = lg_close(default_device);
+    default_device = NULL;
+    return retval;
+}
 
-        if (buffer[4]&0x4)
-            *pressed_keys |= G15_KEY_L3;
+int writePixmapToLCD(unsigned char const *data)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_write_pixmap(default_device, data);
+}
 
-        if (buffer[4]&0x8)
-            *pressed_keys |= G15_KEY_L4;
+int writePixmapToLCDAsync(unsigned char const *data)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_write_pixmap_async(default_device, data);
+}
 
-        if (buffer[4]&0x10)
-            *pressed_keys |= G15_KEY_L5;
+int flushLCD(unsigned int timeout)
+{
+    if (!default_device)
+        return G15_NO_ERROR;
+    return lg_flush(default_device, timeout);
+}
 
-        if (buffer[3]&0x8)
-            *pressed_keys |= G15_KEY_LIGHT;
-    }
+void forceLCDWrite()
+{
+    if (default_device)
+        lg_force_lcd_write(default_device);
 }
 
-static void processKeyEvent4Byte(unsigned int *pressed_keys, unsigned char *buffer)
+unsigned char *leaseLCDFrame()
 {
-	int i;
+    if (!default_device)
+        return NULL;
+    return lg_lease_frame(default_device);
+}
 
-	*pressed_keys = 0;
+int submitLCDFrame(unsigned char *frame)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_submit_frame(default_device, frame);
+}
 
-	g15_log(stderr,G15_LOG_WARN,"Keyboard: %x, %x, %x, %x\n",buffer[0],buffer[1],buffer[2],buffer[3]);
+void releaseLCDFrame(unsigned char *frame)
+{
+    if (default_device)
+        lg_release_frame(default_device, frame);
+}
 
-	if (buffer[0] == 0x02)
-	{
-		if (buffer[1]&0x01)
-			*pressed_keys |= G15_KEY_G1;
+void convertPixmapToFrame(unsigned char *frame, unsigned char const *data)
+{
+    lg_pixmap_to_frame(frame, data);
+}
 
-		if (buffer[1]&0x02)
-			*pressed_keys |= G15_KEY_G2;
+void getLCDFrameCounters(unsigned long *sent, unsigned long *skipped)
+{
+    *sent = *skipped = 0;
+    if (default_device)
+        lg_get_lcd_counters(default_device, sent, skipped);
+}
 
-		if (buffer[1]&0x04)
-			*pressed_keys |= G15_KEY_G3;
+int getLCDBandwidthStats(lg_bandwidth_stats_t *stats)
+{
+    if (!default_device)
+        return -ENODEV;
+    lg_get_bandwidth_stats(default_device, stats);
+    return G15_NO_ERROR;
+}
 
-		if (buffer[1]&0x08)
-			*pressed_keys |= G15_KEY_G4;
+int getStartupTiming(lg_startup_timing_t *timing)
+{
+    if (!default_device)
+        return -ENODEV;
+    lg_get_startup_timing(default_device, timing);
+    return G15_NO_ERROR;
+}
 
-		if (buffer[1]&0x10)
-			*pressed_keys |= G15_KEY_G5;
+int getTransferStats(lg_stats_t *stats)
+{
+    if (!default_device)
+        return -ENODEV;
+    lg_get_stats(default_device, stats);
+    return G15_NO_ERROR;
+}
 
-		if (buffer[1]&0x20)
-			*pressed_keys |= G15_KEY_G6;
+void resetTransferStats()
+{
+    if (default_device)
+        lg_reset_stats(default_device);
+}
 
-		if (buffer[1]&0x40)
-			*pressed_keys |= G15_KEY_G7;
+int setLCDContrast(unsigned int level)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_set_lcd_contrast(default_device, level);
+}
 
-		if (buffer[1]&0x80)
-			*pressed_keys |= G15_KEY_G8;
+void deferControls()
+{
+    if (default_device)
+        lg_defer_controls(default_device);
+}
 
-		if (buffer[2]&0x01)
-			*pressed_keys |= G15_KEY_G9;
+int flushControls()
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_flush_controls(default_device);
+}
 
-		if (buffer[2]&0x02)
-			*pressed_keys |= G15_KEY_G10;
+void getControlCounters(unsigned long *sent, unsigned long *avoided)
+{
+    *sent = *avoided = 0;
+    if (default_device)
+        lg_get_control_counters(default_device, sent, avoided);
+}
 
-		if (buffer[2]&0x04)
-			*pressed_keys |= G15_KEY_G11;
+int setLEDs(unsigned int leds)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_set_leds(default_device, leds);
+}
 
-		if (buffer[2]&0x08)
-			*pressed_keys |= G15_KEY_G12;
+int setLCDBrightness(unsigned int level)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_set_lcd_brightness(default_device, level);
+}
 
-		if (buffer[2]&0x10)
-			*pressed_keys |= G15_KEY_M1;
+int setKBBrightness(unsigned int level)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_set_kb_brightness(default_device, level);
+}
 
-		if (buffer[2]&0x20)
-			*pressed_keys |= G15_KEY_M2;
+int setG510LEDColor(unsigned char r, unsigned char g, unsigned char b)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_set_g510_led_color(default_device, r, g, b);
+}
 
-		if (buffer[2]&0x40)
-			*pressed_keys |= G15_KEY_M3;
+int setG110LEDColor(unsigned char color, unsigned char brightness)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_set_g110_led_color(default_device, color, brightness);
+}
 
-		if (buffer[2]&0x80)
-			*pressed_keys |= G15_KEY_MR;
+int getPressedKeys(unsigned int *pressed_keys, unsigned int timeout)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_read_keys(default_device, pressed_keys, timeout);
+}
 
-		if (buffer[3]&0x1)
-			*pressed_keys |= G15_KEY_LIGHT;
+int getPressedKeys64(uint64_t *pressed_keys, unsigned int timeout)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_read_keys64(default_device, pressed_keys, timeout);
+}
 
-		if (buffer[3]&0x2)
-			*pressed_keys |= G15_KEY_HEADSETMUTE;
-	}
+int drainKeyEvents(lg_key_event_t *events, int max)
+{
+    if (!default_device)
+        return -ENODEV;
+    return lg_drain_key_events(default_device, events, max);
 }
 
-// TODO : Convert this to using uint_fast64_t * for pressed_keys to support additional keys.
+unsigned long getKeyEventsDropped()
+{
+    if (!default_device)
+        return 0;
+    return lg_get_key_events_dropped(default_device);
+}
 
-int getPressedKeys(unsigned int *pressed_keys, unsigned int timeout)
+int registerKeyHandler(g15_key_handler_t handler, void *userdata)
 {
-    unsigned char buffer[G15_KEY_READ_LENGTH];
-    int ret = 0;
-    int caps = 0;
-    int	read = 0;
+    if (!default_device)
+        return G15_ERROR_UNSUPPORTED;
+    return lg_register_key_handler(default_device, handler, userdata);
+}
 
-#ifdef LIBUSB_BLOCKS
-    ret = libusb_interrupt_transfer(keyboard_device, g15_keys_endpoint, (char*)buffer, G15_KEY_READ_LENGTH, &read, timeout);
-#else
-    pthread_mutex_lock(&libusb_mutex);
-    ret = libusb_interrupt_transfer(keyboard_device, g15_keys_endpoint, (char*)buffer, G15_KEY_READ_LENGTH, &read, timeout);
-    pthread_mutex_unlock(&libusb_mutex);
-#endif
-    if (ret != 0)
-    	return	handle_usb_errors("Keyboard Read", ret);
-    if (read > 0) {
-    	if(buffer[0] == 1)
-    		return G15_ERROR_TRY_AGAIN;
-
-    	caps = g15DeviceCapabilities();
-    	if((caps & G15_DEVICE_G13) && buffer[0]==0x25){
-    		processKeyEventG13(pressed_keys, buffer);
-    		return G15_NO_ERROR;
-    	}
-    }
-    switch(read) {
-      case 4:
-          processKeyEvent4Byte(pressed_keys, buffer);
-          return G15_NO_ERROR;
-      case 5:
-          processKeyEvent5Byte(pressed_keys, buffer);
-          return G15_NO_ERROR;
-      case 9:
-          processKeyEvent9Byte(pressed_keys, buffer);
-          return G15_NO_ERROR;
-      // TODO : Add case for return of 2 bytes (G510 media keys).
-      default:
-          return handle_usb_errors("Keyboard Read", ret); /* allow the app to deal with errors */
-    }
+int registerHotplugHandler(g15_hotplug_handler_t handler, void *userdata)
+{
+    if (!default_device)
+        return G15_ERROR_UNSUPPORTED;
+    return lg_register_hotplug_handler(default_device, handler, userdata);
 }
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifndef _LIBLOGITECH_H_
 #define _LIBLOGITECH_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -53,7 +55,7 @@ struct libg15_devices_t {
 }
 
   /* allow for api changes */
-#define LIBG15_VERSION 2000
+#define LIBG15_VERSION 3200
 
   enum 
   {
@@ -146,12 +148,60 @@ struct libg15_devices_t {
     G15_KEY_LIGHT = 1<<27,
     G15_KEY_HEADSETMUTE = 1<<28
 
-    //need to add them to the enum but not enough positions left
-    //  G15_KEY_JOYBL = 1<<32,
-    //  G15_KEY_JOYBD = 1<<33,
-    //  G15_KEY_JOYBS = 1<<34
+    // G19-G22 and the G13 joystick buttons only fit in the 64 bit mask below
+  };
+
+  /* bit numbers in the mask returned by getPressedKeys64. G1 to HEADSETMUTE are
+   * at the same positions as the G15_KEY_ values above */
+  enum
+  {
+    G15_KEYBIT_G1 = 0,
+    G15_KEYBIT_G2,
+    G15_KEYBIT_G3,
+    G15_KEYBIT_G4,
+    G15_KEYBIT_G5,
+    G15_KEYBIT_G6,
+    G15_KEYBIT_G7,
+    G15_KEYBIT_G8,
+    G15_KEYBIT_G9,
+    G15_KEYBIT_G10,
+    G15_KEYBIT_G11,
+    G15_KEYBIT_G12,
+    G15_KEYBIT_G13,
+    G15_KEYBIT_G14,
+    G15_KEYBIT_G15,
+    G15_KEYBIT_G16,
+    G15_KEYBIT_G17,
+    G15_KEYBIT_G18,
+
+    G15_KEYBIT_M1,
+    G15_KEYBIT_M2,
+    G15_KEYBIT_M3,
+    G15_KEYBIT_MR,
+
+    G15_KEYBIT_L1,
+    G15_KEYBIT_L2,
+    G15_KEYBIT_L3,
+    G15_KEYBIT_L4,
+    G15_KEYBIT_L5,
+
+    G15_KEYBIT_LIGHT,
+    G15_KEYBIT_HEADSETMUTE,
+
+    G15_KEYBIT_G19 = 32,
+    G15_KEYBIT_G20,
+    G15_KEYBIT_G21,
+    G15_KEYBIT_G22,
+
+    G15_KEYBIT_JOYBL,
+    G15_KEYBIT_JOYBD,
+    G15_KEYBIT_JOYBS
   };
 
+#define G15_KEY64(bit) ((uint64_t)1 << (bit))
+/* the 32 bit mask getPressedKeys returns for a 64 bit one: G19-G22 share bits 28-31 with HEADSETMUTE */
+#define G15_KEYMASK32(keys) ((unsigned int)((keys) & 0x1fffffff) | (unsigned int)(((keys) >> 32) & 0xf) << 28)
+
 
   /* this one return G15_NO_ERROR on success, something
    * else otherwise (for instance G15_ERROR_OPENING_USB_DEVICE */
@@ -164,12 +214,117 @@ struct libg15_devices_t {
   void libg15Debug(int option);
   
   int writePixmapToLCD(unsigned char const *data);
+  /* queue a frame for the LCD and return without waiting for the bus. frames are
+   * double-buffered behind the one in flight, and a newer frame replaces an older
+   * one that has not been sent yet (latest frame wins). may return
+   * G15_ERROR_TRY_AGAIN if every transfer buffer is busy */
+  int writePixmapToLCDAsync(unsigned char const *data);
+  /* wait up to timeout ms for all queued LCD frames to reach the device */
+  int flushLCD(unsigned int timeout);
+  /* both writes skip a frame identical to the last one sent. this makes the next
+   * write go out regardless, eg after the LCD has been reset behind our back */
+  void forceLCDWrite();
+  /* number of frames sent to the LCD and of unchanged frames skipped */
+  void getLCDFrameCounters(unsigned long *sent, unsigned long *skipped);
+  /* frames in the LCD's own format, without any copying: lease one of the library's
+   * G15_BUFFER_LEN byte transfer buffers, DMA-able memory where libusb and the kernel
+   * support it, fill in everything from G15_LCD_OFFSET on (convertPixmapToFrame does
+   * it for a pixmap) and hand it back with submitLCDFrame, or releaseLCDFrame to drop
+   * it.  the header before G15_LCD_OFFSET is filled in already.  leaseLCDFrame
+   * returns NULL while every buffer is busy.  leased frames are not compared with the
+   * last one sent nor restored after a replug, and must be given back before
+   * re_initLibG15 or exitLibG15 */
+  unsigned char *leaseLCDFrame();
+  int submitLCDFrame(unsigned char *frame);
+  void releaseLCDFrame(unsigned char *frame);
+  void convertPixmapToFrame(unsigned char *frame, unsigned char const *data);
+
+  /* LCD writes back off to smaller, paced transfers when the bus reports overflows
+   * or frames take too long, and step back up once it has been healthy for a while */
+  typedef struct lg_bandwidth_stats_t {
+    int level;			/* 0 is a whole frame per transfer, up to levels-1 */
+    int levels;
+    int chunk_size;		/* bytes per transfer at this level */
+    int chunk_delay;		/* us between transfers at this level */
+    unsigned int avg_latency;	/* us per frame, moving average */
+    unsigned long downshifts;
+    unsigned long upshifts;
+    unsigned long congestion;	/* overflows, timeouts and slow frames seen */
+  } lg_bandwidth_stats_t;
+  int getLCDBandwidthStats(lg_bandwidth_stats_t *stats);
+
+  /* how long the last initLibG15 or re_initLibG15 took, in us, phase by phase */
+  typedef struct lg_startup_timing_t {
+    unsigned int init;		/* libusb and hotplug setup, 0 once done */
+    unsigned int enumerate;	/* finding the keyboard on the bus */
+    unsigned int open;		/* opening it, not counting the claim phase */
+    unsigned int claim;		/* detaching kernel drivers, configuring and claiming interfaces */
+    unsigned int setup;		/* event thread, key handler and restoring settings */
+    unsigned int total;
+  } lg_startup_timing_t;
+  int getStartupTiming(lg_startup_timing_t *timing);
+
+  /* transfer statistics, kept all the time, to tell a slow bus from a slow caller */
+  enum
+  {
+    G15_STATS_LCD = 0,		/* LCD writes, each chunk of a frame is one transfer */
+    G15_STATS_KEYS,		/* key reads. an async read waits for a key, so its latency does too */
+    G15_STATS_CONTROL,		/* LED and backlight set-reports */
+    G15_STATS_TYPES
+  };
+
+#define G15_STATS_ERRORS 14
+#define G15_HIST_BUCKETS 200
+
+  /* log-linear latency histogram in us: values below 8 have a bucket each, above that
+   * every power of two is split into 8 buckets, so a bucket is within 12.5% of what
+   * it counts.  the last bucket (126 s and up) takes everything longer */
+  typedef struct lg_latency_hist_t {
+    unsigned long count;
+    uint64_t sum;			/* us */
+    unsigned int min;
+    unsigned int max;
+    unsigned long buckets[G15_HIST_BUCKETS];
+  } lg_latency_hist_t;
+
+  typedef struct lg_transfer_stats_t {
+    lg_latency_hist_t latency;		/* submit to completion */
+    unsigned long transfers;
+    uint64_t bytes;			/* actually moved */
+    /* errors[n] counts libusb error -n (errors[1] is LIBUSB_ERROR_IO), errors[0] LCD and
+     * control transfers that moved fewer bytes than asked, errors[G15_STATS_ERRORS-1]
+     * any other error */
+    unsigned long errors[G15_STATS_ERRORS];
+  } lg_transfer_stats_t;
+
+  typedef struct lg_stats_t {
+    uint64_t since;			/* CLOCK_MONOTONIC us when counting started */
+    lg_transfer_stats_t transfers[G15_STATS_TYPES];
+    unsigned long reconnects;		/* after a reset or a replug */
+    unsigned long lock_acquisitions;	/* of the device's usb lock */
+    uint64_t lock_wait_ns;		/* waiting for it */
+    uint64_t lock_held_ns;		/* holding it, ie doing synchronous i/o */
+  } lg_stats_t;
+  int getTransferStats(lg_stats_t *stats);
+  void resetTransferStats();
+  /* the latency below which percentile % of the transfers completed, to bucket precision */
+  unsigned int lg_stats_percentile(lg_latency_hist_t const *hist, double percentile);
+  /* the smallest latency counted in a bucket */
+  unsigned int lg_stats_bucket_value(int bucket);
   int setLCDContrast(unsigned int level);
   int setLEDs(unsigned int leds);
   int setLCDBrightness(unsigned int level);
   int setKBBrightness(unsigned int level);  
   int setG510LEDColor(unsigned char r, unsigned char g, unsigned char b);  
   int setG110LEDColor(unsigned char color, unsigned char level);
+  /* the setters above keep a shadow of the keyboard's settings and skip a transfer
+   * when the value is already there, returning 0. between deferControls and
+   * flushControls they only update the shadow, and flushControls sends each
+   * setting that changed once, eg once per LCD frame */
+  void deferControls();
+  int flushControls();
+  /* control transfers sent, and setter calls that needed none of their own */
+  void getControlCounters(unsigned long *sent, unsigned long *avoided);
 
   /* Please be warned
    * the g15 sends two different usb msgs for each key press
@@ -179,7 +334,160 @@ struct libg15_devices_t {
    * in the bad case you will get G15_ERROR_TRY_AGAIN -> try again
    */
   int getPressedKeys(unsigned int *pressed_keys, unsigned int timeout);
-  
+  /* as getPressedKeys, but every key has its own bit: test with G15_KEY64(G15_KEYBIT_x) */
+  int getPressedKeys64(uint64_t *pressed_keys, unsigned int timeout);
+
+  /* every change of the held keys, whichever way they are read, is also queued with
+   * the time it was seen, so a press and release between two polls or a chord
+   * building up key by key is not lost.  when is CLOCK_MONOTONIC in us */
+  typedef struct lg_key_event_t {
+    uint64_t when;
+    uint64_t keys;		/* G15_KEY64 bits of all keys held after the change */
+    uint64_t changed;		/* keys that went down or up */
+  } lg_key_event_t;
+  /* copy up to max queued events to events, oldest first, and return how many.
+   * never blocks.  one thread may drain while another reads keys, but not more.
+   * when 256 events are waiting newer ones are dropped, and the next one kept
+   * carries the missed changes in changed */
+  int drainKeyEvents(lg_key_event_t *events, int max);
+  unsigned long getKeyEventsDropped();
+
+  /* called from the library's usb event thread for every decoded key report.
+   * status is G15_NO_ERROR, or -ENODEV once the device has gone away (call
+   * re_initLibG15, the handler is re-armed automatically) */
+  typedef void (*g15_key_handler_t)(unsigned int pressed_keys, int status, void *userdata);
+  /* keep an interrupt transfer armed on the keys endpoint and deliver every report
+   * to handler instead of polling with getPressedKeys. pass NULL to stop.
+   * the two ways of reading keys must not be mixed */
+  int registerKeyHandler(g15_key_handler_t handler, void *userdata);
+
+  enum
+  {
+    G15_HOTPLUG_ARRIVED = 1,
+    G15_HOTPLUG_LEFT
+  };
+
+  /* called from the library's usb event thread when the keyboard is unplugged, and
+   * when a matching keyboard is plugged back in. after G15_HOTPLUG_ARRIVED,
+   * re_initLibG15 opens the new device directly and restores the last frame, LEDs
+   * and backlight. must not call back into the library */
+  typedef void (*g15_hotplug_handler_t)(int event, void *userdata);
+  /* returns G15_ERROR_UNSUPPORTED if libusb can't report hotplug events on this
+   * system - keep retrying re_initLibG15 instead */
+  int registerHotplugHandler(g15_hotplug_handler_t handler, void *userdata);
+
+  /* multi-device api. each lg_device_t has its own usb lock and transfers, so one
+   * process can drive several keyboards concurrently. the functions above act on a
+   * default device opened by initLibG15 */
+  typedef struct lg_device lg_device_t;
+
+  typedef struct lg_device_info_t {
+    int devicetype;		/* model, used to find the device again after a replug */
+    const char *name;
+    unsigned int caps;
+    unsigned char bus;
+    unsigned char address;
+  } lg_device_info_t;
+
+  /* fills in up to max entries of list and returns the number of supported devices connected */
+  int lg_enumerate(lg_device_info_t *list, int max);
+  /* open the device described by info, or the first supported device not already
+   * open if info is NULL. returns G15_NO_ERROR and sets *dev on success */
+  int lg_open(lg_device_info_t const *info, lg_device_t **dev);
+  /* find a device of the same model again after ENODEV */
+  int lg_reopen(lg_device_t *dev);
+  /* give the device back to the kernel and free dev */
+  int lg_close(lg_device_t *dev);
+  int lg_get_caps(lg_device_t *dev);
+
+  int lg_write_pixmap(lg_device_t *dev, unsigned char const *data);
+  int lg_write_pixmap_async(lg_device_t *dev, unsigned char const *data);
+  int lg_flush(lg_device_t *dev, unsigned int timeout);
+  void lg_force_lcd_write(lg_device_t *dev);
+  void lg_get_lcd_counters(lg_device_t *dev, unsigned long *sent, unsigned long *skipped);
+  unsigned char *lg_lease_frame(lg_device_t *dev);
+  int lg_submit_frame(lg_device_t *dev, unsigned char *frame);
+  void lg_release_frame(lg_device_t *dev, unsigned char *frame);
+  void lg_pixmap_to_frame(unsigned char *frame, unsigned char const *data);
+  void lg_get_bandwidth_stats(lg_device_t *dev, lg_bandwidth_stats_t *stats);
+  void lg_get_startup_timing(lg_device_t *dev, lg_startup_timing_t *timing);
+  void lg_get_stats(lg_device_t *dev, lg_stats_t *stats);
+  void lg_reset_stats(lg_device_t *dev);
+  int lg_read_keys(lg_device_t *dev, unsigned int *pressed_keys, unsigned int timeout);
+  int lg_read_keys64(lg_device_t *dev, uint64_t *pressed_keys, unsigned int timeout);
+  int lg_drain_key_events(lg_device_t *dev, lg_key_event_t *events, int max);
+  unsigned long lg_get_key_events_dropped(lg_device_t *dev);
+  int lg_register_key_handler(lg_device_t *dev, g15_key_handler_t handler, void *userdata);
+  int lg_register_hotplug_handler(lg_device_t *dev, g15_hotplug_handler_t handler, void *userdata);
+
+  int lg_set_lcd_contrast(lg_device_t *dev, unsigned int level);
+  int lg_set_leds(lg_device_t *dev, unsigned int leds);
+  int lg_set_lcd_brightness(lg_device_t *dev, unsigned int level);
+  int lg_set_kb_brightness(lg_device_t *dev, unsigned int level);
+  int lg_set_g510_led_color(lg_device_t *dev, unsigned char r, unsigned char g, unsigned char b);
+  int lg_set_g110_led_color(lg_device_t *dev, unsigned char color, unsigned char level);
+  void lg_defer_controls(lg_device_t *dev);
+  int lg_flush_controls(lg_device_t *dev);
+  void lg_get_control_counters(lg_device_t *dev, unsigned long *sent, unsigned long *avoided);
+
+  /* virtual keyboards, for running the library and everything on top of it without
+   * hardware. each one emulates an entry of g15_devices: LCD frames and control
+   * requests are recorded, key reports are injected, and latency, bus errors and
+   * unplugging can be simulated. lg_virtual_enable must come before the first
+   * initLibG15/lg_open/lg_enumerate, after which the process uses virtual devices
+   * only. setting LIBLOGITECH_VIRTUAL to a list of product ids (eg "c222,c21c")
+   * does the same and plugs those keyboards in, eg to run logitoolsd without one */
+  int lg_virtual_enable(void);
+  /* plug in a keyboard with this product id, returning its id (from 0) or -1.
+   * lg_virtual_enable is implied */
+  int lg_virtual_add(unsigned int productid);
+  /* unplug and replug a keyboard, with hotplug events as for a real one. a replugged
+   * keyboard has a new address and its injected failures and reports are dropped */
+  int lg_virtual_unplug(int id);
+  int lg_virtual_plug(int id);
+  /* us every transfer takes */
+  int lg_virtual_set_latency(int id, unsigned int latency);
+
+  enum
+  {
+    G15_VIRTUAL_LCD = 0,
+    G15_VIRTUAL_KEYS
+  };
+
+  enum
+  {
+    G15_VIRTUAL_FAIL_NONE = 0,
+    G15_VIRTUAL_FAIL_OVERFLOW,	/* -ENOSPC, the bus is out of bandwidth */
+    G15_VIRTUAL_FAIL_TIMEOUT,
+    G15_VIRTUAL_FAIL_STALL	/* endpoint halted, until cleared */
+  };
+  /* fail the next count transfers on the LCD or keys endpoint */
+  int lg_virtual_fail(int id, int endpoint, int failure, unsigned int count);
+  /* queue a raw report for the keys endpoint, up to G15_KEY_READ_LENGTH bytes */
+  int lg_virtual_inject_report(int id, unsigned char const *report, int length);
+  /* queue the report the keyboard sends while keys (G15_KEY64 bits) are held */
+  int lg_virtual_press_keys(int id, uint64_t keys);
+
+  typedef struct lg_virtual_frame_t {
+    uint64_t when;		/* CLOCK_MONOTONIC, in us */
+    unsigned char data[G15_BUFFER_LEN];	/* as sent, header included */
+  } lg_virtual_frame_t;
+
+  typedef struct lg_virtual_control_t {
+    uint64_t when;
+    unsigned int value;
+    unsigned int index;
+    unsigned int length;
+    unsigned char data[8];	/* the first bytes of the report */
+  } lg_virtual_control_t;
+
+  /* frames and control requests received so far. the last 64 of each are kept and
+   * fetched with n counting back from the newest (0). return -1 if n is not kept */
+  unsigned long lg_virtual_frame_count(int id);
+  int lg_virtual_get_frame(int id, unsigned long n, lg_virtual_frame_t *frame);
+  unsigned long lg_virtual_control_count(int id);
+  int lg_virtual_get_control(int id, unsigned long n, lg_virtual_control_t *control);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,145 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Checks the key event ring behind lg_drain_key_events: events come out in order with
+   their timestamps across many wraps of the ring and of its counters, a full ring
+   drops newer events and counts them, and the next event kept carries the changes
+   that were missed.  Built from the library source to reach queueKeyEvent. */
+
+#include <limits.h>
+#include "../liblogitech.c"
+
+static int failures = 0;
+
+static void check(int ok, const char *what, long index, uint64_t got, uint64_t want)
+{
+    if (ok)
+        return;
+    fprintf(stderr, "%s %ld: got %llx, want %llx\n", what, index,
+            (unsigned long long)got, (unsigned long long)want);
+    failures++;
+}
+
+/* the keys held after the nth change, never the same twice running and never none */
+static uint64_t keysAt(long n)
+{
+    return (uint64_t)(n + 1) * 0x9e3779b97f4a7c15ull;
+}
+
+/* drains everything waiting, max events at a time, and checks it is changes first to
+   last of keysAt, seen between since and now */
+static long drainAndCheck(lg_device_t *dev, long first, long last, int max, uint64_t since)
+{
+    lg_key_event_t events[G15_KEY_EVENTS + 1];
+    uint64_t now = monotonicUs(), when = since;
+    long n = first;
+    int got, i;
+
+    while ((got = lg_drain_key_events(dev, events, max)) > 0) {
+        check(got <= max, "drained past max at", n, got, max);
+        for (i = 0; i < got; i++, n++) {
+            uint64_t before = n ? keysAt(n - 1) : 0;
+
+            check(events[i].keys == keysAt(n), "keys of event", n, events[i].keys, keysAt(n));
+            check(events[i].changed == (keysAt(n) ^ before), "changed of event", n,
+                  events[i].changed, keysAt(n) ^ before);
+            check(events[i].when >= when && events[i].when <= now, "time of event", n,
+                  events[i].when, when);
+            when = events[i].when;
+        }
+    }
+    check(n == last + 1, "drained up to", last, n, last + 1);
+    return n;
+}
+
+/* queued and drained in uneven chunks, so the ring wraps often and at every offset.
+   counters starting near UINT_MAX also wrap around zero */
+static void checkWrap(unsigned int start)
+{
+    lg_device_t *dev = calloc(1, sizeof(lg_device_t));
+    long n = 0, drained = 0;
+    int chunk;
+
+    dev->key_events_head = dev->key_events_tail = start;
+    for (chunk = 1; n < 20 * G15_KEY_EVENTS; chunk = chunk * 7 % (G15_KEY_EVENTS + 1)) {
+        uint64_t since = monotonicUs();
+        int i;
+
+        for (i = 0; i < chunk; i++, n++) {
+            queueKeyEvent(dev, keysAt(n));
+            queueKeyEvent(dev, keysAt(n));      /* no change, nothing queued */
+        }
+        drained = drainAndCheck(dev, drained, n - 1, 1 + chunk % 37, since);
+    }
+    check(lg_get_key_events_dropped(dev) == 0, "dropped with room, start", start,
+          lg_get_key_events_dropped(dev), 0);
+    free(dev);
+}
+
+/* a full ring keeps the oldest events, and the first one queued after a drain makes
+   up the changes lost in between */
+static void checkOverflow(void)
+{
+    lg_device_t *dev = calloc(1, sizeof(lg_device_t));
+    lg_key_event_t events[G15_KEY_EVENTS];
+    uint64_t since = monotonicUs();
+    long n;
+    int got;
+
+    for (n = 0; n < G15_KEY_EVENTS + 5; n++)
+        queueKeyEvent(dev, keysAt(n));
+    check(lg_get_key_events_dropped(dev) == 5, "dropped after", n,
+          lg_get_key_events_dropped(dev), 5);
+
+    /* one slot free: the next change goes in, measured from the last event kept */
+    got = lg_drain_key_events(dev, events, 1);
+    check(got == 1 && events[0].keys == keysAt(0), "first kept of", n, events[0].keys, keysAt(0));
+    queueKeyEvent(dev, keysAt(n));
+    queueKeyEvent(dev, keysAt(n + 1));
+    check(lg_get_key_events_dropped(dev) == 6, "dropped after", n + 2,
+          lg_get_key_events_dropped(dev), 6);
+
+    got = lg_drain_key_events(dev, events, G15_KEY_EVENTS);
+    check(got == G15_KEY_EVENTS, "events after overflow", n, got, G15_KEY_EVENTS);
+    check(events[got - 2].keys == keysAt(G15_KEY_EVENTS - 1), "last before the drop", n,
+          events[got - 2].keys, keysAt(G15_KEY_EVENTS - 1));
+    check(events[got - 1].keys == keysAt(n), "keys after the drop", n,
+          events[got - 1].keys, keysAt(n));
+    check(events[got - 1].changed == (keysAt(n) ^ keysAt(G15_KEY_EVENTS - 1)),
+          "changed after the drop", n, events[got - 1].changed,
+          keysAt(n) ^ keysAt(G15_KEY_EVENTS - 1));
+    check(events[got - 1].when >= since, "time after the drop", n, events[got - 1].when, since);
+
+    /* emptied, the ring takes changes again, still measured from the last one kept */
+    queueKeyEvent(dev, 0);
+    got = lg_drain_key_events(dev, events, G15_KEY_EVENTS);
+    check(got == 1 && events[0].changed == keysAt(n), "release after overflow", n,
+          events[0].changed, keysAt(n));
+    check(lg_drain_key_events(dev, events, G15_KEY_EVENTS) == 0, "left after draining", n, 1, 0);
+    free(dev);
+}
+
+int main(int argc, char *argv[])
+{
+    checkWrap(0);
+    checkWrap(UINT_MAX - 100);
+    checkOverflow();
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Key reports as each model sends them, and the keys the per-model decoders that
+   came before the key tables made of them.  Shared by the key tests and benchmark. */
+
+#ifndef _KEY_REPORTS_H_
+#define _KEY_REPORTS_H_
+
+/* a key is down while buffer[byte] & mask */
+typedef struct recorded_key_t {
+    unsigned char byte;
+    unsigned char mask;
+    int key;            /* G15_KEYBIT_* */
+} recorded_key_t;
+
+#define KEY(byte, mask, key) { byte, mask, G15_KEYBIT_##key }
+
+static const recorded_key_t recorded_g13[] = {
+    KEY(3,0x01,G1), KEY(3,0x02,G2), KEY(3,0x04,G3), KEY(3,0x08,G4),
+    KEY(3,0x10,G5), KEY(3,0x20,G6), KEY(3,0x40,G7), KEY(3,0x80,G8),
+    KEY(4,0x01,G9), KEY(4,0x02,G10), KEY(4,0x04,G11), KEY(4,0x08,G12),
+    KEY(4,0x10,G13), KEY(4,0x20,G14), KEY(4,0x40,G15), KEY(4,0x80,G16),
+    KEY(5,0x01,G17), KEY(5,0x02,G18), KEY(5,0x04,G19), KEY(5,0x08,G20),
+    KEY(5,0x10,G21), KEY(5,0x20,G22), KEY(5,0x80,LIGHT), KEY(6,0x01,L1),
+    KEY(6,0x02,L2), KEY(6,0x04,L3), KEY(6,0x08,L4), KEY(6,0x10,L5),
+    KEY(6,0x20,M1), KEY(6,0x40,M2), KEY(6,0x80,M3), KEY(7,0x01,MR),
+    /* not decoded by the per-model functions, new with the 64 bit mask */
+    KEY(7,0x02,JOYBL), KEY(7,0x04,JOYBD), KEY(7,0x08,JOYBS)
+};
+
+static const recorded_key_t recorded_9byte[] = {
+    KEY(1,0x01,G1), KEY(1,0x04,G13), KEY(1,0x80,LIGHT), KEY(2,0x01,G7),
+    KEY(2,0x02,G2), KEY(2,0x08,G14), KEY(2,0x80,L2), KEY(3,0x02,G8),
+    KEY(3,0x04,G3), KEY(3,0x10,G15), KEY(3,0x80,L3), KEY(4,0x04,G9),
+    KEY(4,0x08,G4), KEY(4,0x20,G16), KEY(4,0x80,L4), KEY(5,0x08,G10),
+    KEY(5,0x10,G5), KEY(5,0x40,G17), KEY(5,0x80,L5), KEY(6,0x01,M1),
+    KEY(6,0x10,G11), KEY(6,0x20,G6), KEY(7,0x02,M2), KEY(7,0x20,G12),
+    KEY(7,0x40,MR), KEY(8,0x04,M3), KEY(8,0x40,G18), KEY(8,0x80,L1)
+};
+
+static const recorded_key_t recorded_5byte[] = {
+    KEY(1,0x01,G1), KEY(1,0x02,G2), KEY(1,0x04,G3), KEY(1,0x08,G4),
+    KEY(1,0x10,G5), KEY(1,0x20,G6), KEY(1,0x40,M1), KEY(1,0x80,M2),
+    KEY(2,0x01,LIGHT), KEY(2,0x02,L2), KEY(2,0x04,L3), KEY(2,0x08,L4),
+    KEY(2,0x10,L5), KEY(2,0x20,M3), KEY(2,0x40,MR), KEY(2,0x80,L1)
+};
+
+static const recorded_key_t recorded_g510[] = {
+    KEY(1,0x01,G1), KEY(1,0x02,G2), KEY(1,0x04,G3), KEY(1,0x08,G4),
+    KEY(1,0x10,G5), KEY(1,0x20,G6), KEY(1,0x40,G7), KEY(1,0x80,G8),
+    KEY(2,0x01,G9), KEY(2,0x02,G10), KEY(2,0x04,G11), KEY(2,0x08,G12),
+    KEY(2,0x10,G13), KEY(2,0x20,G14), KEY(2,0x40,G15), KEY(2,0x80,G16),
+    KEY(3,0x01,G17), KEY(3,0x02,G18), KEY(3,0x08,LIGHT), KEY(3,0x10,M1),
+    KEY(3,0x20,M2), KEY(3,0x40,M3), KEY(3,0x80,MR), KEY(4,0x01,L1),
+    KEY(4,0x02,L2), KEY(4,0x04,L3), KEY(4,0x08,L4), KEY(4,0x10,L5)
+};
+
+static const recorded_key_t recorded_4byte[] = {
+    KEY(1,0x01,G1), KEY(1,0x02,G2), KEY(1,0x04,G3), KEY(1,0x08,G4),
+    KEY(1,0x10,G5), KEY(1,0x20,G6), KEY(1,0x40,G7), KEY(1,0x80,G8),
+    KEY(2,0x01,G9), KEY(2,0x02,G10), KEY(2,0x04,G11), KEY(2,0x08,G12),
+    KEY(2,0x10,M1), KEY(2,0x20,M2), KEY(2,0x40,M3), KEY(2,0x80,MR),
+    KEY(3,0x01,LIGHT), KEY(3,0x02,HEADSETMUTE)
+};
+
+#undef KEY
+
+typedef struct recorded_format_t {
+    const char *name;
+    int length;
+    unsigned char id;   /* byte 0 of every report */
+    const recorded_key_t *keys;
+    int nkeys;
+} recorded_format_t;
+
+#define FORMAT(name, length, id) { #name, length, id, recorded_##name, sizeof(recorded_##name) / sizeof(recorded_##name[0]) }
+
+static const recorded_format_t format_g13 = FORMAT(g13, 8, 0x25);
+static const recorded_format_t format_9byte = FORMAT(9byte, 9, 0x02);
+static const recorded_format_t format_5byte = FORMAT(5byte, 5, 0x02);
+static const recorded_format_t format_g510 = FORMAT(g510, 5, 0x03);
+static const recorded_format_t format_4byte = FORMAT(4byte, 4, 0x02);
+
+#undef FORMAT
+
+/* the reports each entry of g15_devices sends, by product id */
+static const struct {
+    unsigned int productid;
+    const recorded_format_t *format;
+} recorded_devices[] = {
+    { 0xc222, &format_9byte },  /* G15 */
+    { 0xc225, &format_9byte },  /* G11 */
+    { 0x0a07, &format_9byte },  /* Z-10 */
+    { 0xc227, &format_5byte },  /* G15 v2 */
+    { 0xc251, &format_9byte },  /* Gamepanel */
+    { 0xc21c, &format_g13 },    /* G13 */
+    { 0xc22b, &format_4byte },  /* G110 */
+    { 0xc22d, &format_g510 },   /* G510 */
+    { 0xc22e, &format_g510 }    /* G510 with audio */
+};
+
+static inline const recorded_format_t *recordedFormat(unsigned int productid)
+{
+    int i;
+
+    for (i = 0; i < sizeof(recorded_devices) / sizeof(recorded_devices[0]); i++)
+        if (recorded_devices[i].productid == productid)
+            return recorded_devices[i].format;
+    return NULL;
+}
+
+/* build the report sent while keys (G15_KEY64 bits) are down, returning its length */
+static inline int recordedReport(const recorded_format_t *format, uint64_t keys, unsigned char *buffer)
+{
+    int i;
+
+    memset(buffer, 0, G15_KEY_READ_LENGTH);
+    buffer[0] = format->id;
+    for (i = 0; i < format->nkeys; i++)
+        if (keys & G15_KEY64(format->keys[i].key))
+            buffer[format->keys[i].byte] |= format->keys[i].mask;
+    return format->length;
+}
+
+/* every key the format has */
+static inline uint64_t recordedKeys(const recorded_format_t *format)
+{
+    uint64_t keys = 0;
+    int i;
+
+    for (i = 0; i < format->nkeys; i++)
+        keys |= G15_KEY64(format->keys[i].key);
+    return keys;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Times decodeKeyReport over a stream of recorded reports for every entry of
+   g15_devices.  Built from the library source to reach it. */
+
+#include "../liblogitech.c"
+#include "key_reports.h"
+
+#define REPORTS     1024
+#define ROUNDS      2000
+
+static unsigned int rng = 12345;
+
+static unsigned int nextRandom(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* what a keyboard mostly sends: nothing held, one key, or a chord of a few */
+static uint64_t randomKeys(const recorded_format_t *format)
+{
+    uint64_t keys = 0;
+    int n = nextRandom() % 4;
+
+    while (n--)
+        keys |= G15_KEY64(format->keys[nextRandom() % format->nkeys].key);
+    return keys;
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char reports[REPORTS][G15_KEY_READ_LENGTH];
+    const recorded_format_t *format;
+    struct timespec start, end;
+    lg_device_t dev;
+    uint64_t keys, sink = 0, ns;
+    int i, j, length;
+
+    memset(&dev, 0, sizeof(dev));
+    for (i = 0; g15_devices[i].name; i++) {
+        if (!(format = recordedFormat(g15_devices[i].productid)))
+            continue;
+        dev.devicetype = i;
+        for (j = 0; j < REPORTS; j++)
+            length = recordedReport(format, randomKeys(format), reports[j]);
+
+        for (j = 0; j < REPORTS; j++)
+            decodeKeyReport(&dev, &keys, reports[j], length);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (j = 0; j < ROUNDS * REPORTS; j++) {
+            decodeKeyReport(&dev, &keys, reports[j % REPORTS], length);
+            sink += keys;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = nsSince(&start, &end);
+        printf("%-20s %d byte reports  %6.1f ns/report\n", g15_devices[i].name, length,
+               (double)ns / (ROUNDS * REPORTS));
+    }
+    return sink == 1;
+}
@@ -0,0 +1,140 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Checks decodeKeyReport against the reports recorded in key_reports.h for every
+   entry of g15_devices, and that every key comes back out of decodeKeyReport as
+   encodeKeyReport put it in.  Built from the library source to reach both. */
+
+#include "../liblogitech.c"
+#include "key_reports.h"
+
+static int failures = 0;
+
+static void check(int ok, const char *device, const char *what, int key, uint64_t got, uint64_t want)
+{
+    if (ok)
+        return;
+    fprintf(stderr, "%s: %s %d: got %llx, want %llx\n", device, what, key,
+            (unsigned long long)got, (unsigned long long)want);
+    failures++;
+}
+
+static uint64_t decode(lg_device_t *dev, unsigned char *buffer, int length, int *ret)
+{
+    uint64_t keys = ~(uint64_t)0;
+
+    *ret = decodeKeyReport(dev, &keys, buffer, length);
+    return keys;
+}
+
+/* each recorded key on its own, all of them at once, and none */
+static void checkRecorded(lg_device_t *dev, const recorded_format_t *format)
+{
+    const char *name = g15_devices[dev->devicetype].name;
+    unsigned char buffer[G15_KEY_READ_LENGTH];
+    uint64_t keys, all = recordedKeys(format);
+    int i, ret;
+
+    for (i = 0; i < format->nkeys; i++) {
+        recordedReport(format, G15_KEY64(format->keys[i].key), buffer);
+        keys = decode(dev, buffer, format->length, &ret);
+        check(ret == G15_NO_ERROR && keys == G15_KEY64(format->keys[i].key),
+              name, "recorded key", format->keys[i].key, keys, G15_KEY64(format->keys[i].key));
+    }
+    recordedReport(format, all, buffer);
+    keys = decode(dev, buffer, format->length, &ret);
+    check(ret == G15_NO_ERROR && keys == all, name, "all keys of", format->length, keys, all);
+
+    /* bits no key uses decode to nothing */
+    for (i = 1; i < format->length; i++)
+        buffer[i] = ~buffer[i];
+    keys = decode(dev, buffer, format->length, &ret);
+    check(ret == G15_NO_ERROR && keys == 0, name, "unused bits of", format->length, keys, 0);
+}
+
+/* every key through encodeKeyReport and back.  keys the model does not have are not
+   encoded, so they come back as none */
+static void checkRoundTrip(lg_device_t *dev, const recorded_format_t *format)
+{
+    const char *name = g15_devices[dev->devicetype].name;
+    unsigned char buffer[G15_KEY_READ_LENGTH];
+    uint64_t keys, want, all = recordedKeys(format);
+    int key, length, ret;
+
+    for (key = 0; key < 64; key++) {
+        want = all & G15_KEY64(key);
+        length = encodeKeyReport(dev->devicetype, G15_KEY64(key), buffer);
+        check(length == format->length, name, "report length for key", key, length, format->length);
+        keys = decode(dev, buffer, length, &ret);
+        check(ret == G15_NO_ERROR && keys == want, name, "round trip of key", key, keys, want);
+    }
+    length = encodeKeyReport(dev->devicetype, ~(uint64_t)0, buffer);
+    keys = decode(dev, buffer, length, &ret);
+    check(ret == G15_NO_ERROR && keys == all, name, "round trip of all keys", length, keys, all);
+}
+
+/* the reports that are not key states */
+static void checkOthers(lg_device_t *dev, const recorded_format_t *format)
+{
+    const char *name = g15_devices[dev->devicetype].name;
+    unsigned char buffer[G15_KEY_READ_LENGTH];
+    uint64_t keys;
+    int ret;
+
+    memset(buffer, 0xff, sizeof(buffer));
+    buffer[0] = 1;
+    decode(dev, buffer, format->length, &ret);
+    check(ret == G15_ERROR_TRY_AGAIN, name, "report id 1, return", ret, ret, G15_ERROR_TRY_AGAIN);
+
+    decode(dev, buffer, 0, &ret);
+    check(ret == -1, name, "empty report, return", ret, ret, -1);
+
+    /* a report id this model does not use, of a length no model uses, and of one they do */
+    buffer[0] = 0x42;
+    decode(dev, buffer, 3, &ret);
+    check(ret == -1, name, "3 byte report, return", ret, ret, -1);
+
+    keys = decode(dev, buffer, format->length == 8 ? 9 : format->length, &ret);
+    check(ret == G15_NO_ERROR && keys == 0, name, "unknown report id", 0x42, keys, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const recorded_format_t *format;
+    lg_device_t dev;
+    int i, devices = 0;
+
+    memset(&dev, 0, sizeof(dev));
+    for (i = 0; g15_devices[i].name; i++) {
+        if (!(g15_devices[i].caps & G15_KEYS))
+            continue;
+        if (!(format = recordedFormat(g15_devices[i].productid))) {
+            fprintf(stderr, "%s: no recorded reports\n", g15_devices[i].name);
+            failures++;
+            continue;
+        }
+        dev.devicetype = i;
+        checkRecorded(&dev, format);
+        checkRoundTrip(&dev, format);
+        checkOthers(&dev, format);
+        devices++;
+    }
+    printf("%d devices, %d failures\n", devices, failures);
+    return failures ? 1 : 0;
+}
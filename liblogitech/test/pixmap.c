@@ -0,0 +1,116 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Checks every transpose kernel the cpu can run, and dumpPixmapIntoLCDFormat which
+   picks one of them, against the per-byte conversion they replaced, on edge patterns
+   and random pixmaps.  Built from the library source to reach them. */
+
+#include "../liblogitech.c"
+#include "pixmap_reference.h"
+
+#define RANDOM_PIXMAPS  2000
+
+static int failures = 0;
+static unsigned int rng = 12345;
+
+static unsigned char nextRandom(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* the kernels fill in the frame from G15_LCD_OFFSET on and must leave the header alone */
+static void checkPixmap(transpose_kernel_t const *kernel, unsigned char const *data, const char *pattern)
+{
+    unsigned char want[G15_BUFFER_LEN], got[G15_BUFFER_LEN];
+    int i;
+
+    memset(want, 0xa5, sizeof(want));
+    memset(got, 0xa5, sizeof(got));
+    referencePixmapIntoLCDFormat(want, data);
+    if (kernel)
+        kernel->transpose(got + G15_LCD_OFFSET, data);
+    else
+        dumpPixmapIntoLCDFormat(got, data);
+    if (memcmp(want, got, sizeof(want)) == 0)
+        return;
+    for (i = 0; want[i] == got[i]; i++)
+        ;
+    fprintf(stderr, "%s: %s: byte %d is %02x, want %02x\n", kernel ? kernel->name : "dispatch",
+            pattern, i, got[i], want[i]);
+    failures++;
+}
+
+static void checkKernel(transpose_kernel_t const *kernel)
+{
+    unsigned char data[G15_PIXMAP_BYTES];
+    char pattern[64];
+    int i, j;
+
+    memset(data, 0, sizeof(data));
+    checkPixmap(kernel, data, "blank");
+    memset(data, 0xff, sizeof(data));
+    checkPixmap(kernel, data, "full");
+    for (i = 0; i < G15_PIXMAP_BYTES; i++)
+        data[i] = ((i / G15_LCD_ROW_BYTES) & 1) ? 0xaa : 0x55;
+    checkPixmap(kernel, data, "checkerboard");
+
+    /* every pixel on its own, which also catches a swapped row or column */
+    memset(data, 0, sizeof(data));
+    for (i = 0; i < G15_PIXMAP_BYTES; i++) {
+        for (j = 0; j < 8; j++) {
+            data[i] = 0x80 >> j;
+            snprintf(pattern, sizeof(pattern), "pixel %d of byte %d", j, i);
+            checkPixmap(kernel, data, pattern);
+        }
+        data[i] = 0;
+    }
+    /* and every pixel but one */
+    memset(data, 0xff, sizeof(data));
+    for (i = 0; i < G15_PIXMAP_BYTES; i++) {
+        data[i] = 0x7f;
+        snprintf(pattern, sizeof(pattern), "hole in byte %d", i);
+        checkPixmap(kernel, data, pattern);
+        data[i] = 0xff;
+    }
+
+    for (i = 0; i < RANDOM_PIXMAPS; i++) {
+        for (j = 0; j < G15_PIXMAP_BYTES; j++)
+            data[j] = nextRandom();
+        snprintf(pattern, sizeof(pattern), "random pixmap %d", i);
+        checkPixmap(kernel, data, pattern);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    transpose_kernel_t kernels[TRANSPOSE_KERNELS];
+    int i, n;
+
+    n = transposeKernels(kernels);
+    for (i = 0; i < n; i++) {
+        checkKernel(&kernels[i]);
+        printf("%s ", kernels[i].name);
+    }
+    checkKernel(NULL);
+    printf("dispatch: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
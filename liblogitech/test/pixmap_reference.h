@@ -0,0 +1,88 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* dumpPixmapIntoLCDFormat as it was before the transpose kernels, one output byte
+   at a time.  The kernels must match it byte for byte. */
+
+#ifndef _PIXMAP_REFERENCE_H_
+#define _PIXMAP_REFERENCE_H_
+
+static void referencePixmapIntoLCDFormat(unsigned char *lcd_buffer, unsigned char const *data)
+{
+    unsigned int output_offset = G15_LCD_OFFSET;
+    unsigned int base_offset = 0;
+    unsigned int curr_row = 0;
+    unsigned int curr_col = 0;
+
+    for (curr_row = 0; curr_row < G15_LCD_HEIGHT_IN_BYTES; ++curr_row)
+    {
+        for (curr_col = 0; curr_col < G15_LCD_WIDTH; ++curr_col)
+        {
+            unsigned int bit = curr_col % 8;
+		/* Copy a 1x8 column of pixels across from the source image to the LCD buffer. */
+
+            lcd_buffer[output_offset] =
+			(((data[base_offset                        ] << bit) & 0x80) >> 7) |
+			(((data[base_offset +  G15_LCD_WIDTH/8     ] << bit) & 0x80) >> 6) |
+			(((data[base_offset + (G15_LCD_WIDTH/8 * 2)] << bit) & 0x80) >> 5) |
+			(((data[base_offset + (G15_LCD_WIDTH/8 * 3)] << bit) & 0x80) >> 4) |
+			(((data[base_offset + (G15_LCD_WIDTH/8 * 4)] << bit) & 0x80) >> 3) |
+			(((data[base_offset + (G15_LCD_WIDTH/8 * 5)] << bit) & 0x80) >> 2) |
+			(((data[base_offset + (G15_LCD_WIDTH/8 * 6)] << bit) & 0x80) >> 1) |
+			(((data[base_offset + (G15_LCD_WIDTH/8 * 7)] << bit) & 0x80) >> 0);
+            ++output_offset;
+            if (bit == 7)
+              base_offset++;
+        }
+	/* Jump down seven pixel-rows in the source image, since we've just
+	   done a row of eight pixels in one pass (and we counted one pixel-row
+  	   while we were going, so now we skip the next seven pixel-rows.) */
+	base_offset += G15_LCD_WIDTH - (G15_LCD_WIDTH / 8);
+    }
+}
+
+/* the kernels this cpu can run, the scalar one first */
+typedef struct transpose_kernel_t {
+    const char *name;
+    void (*transpose)(unsigned char *lcd_buffer, unsigned char const *data);
+} transpose_kernel_t;
+
+static inline int transposeKernels(transpose_kernel_t *kernels)
+{
+    int n = 0;
+
+    kernels[n].name = "scalar";
+    kernels[n++].transpose = transposeScalar;
+#ifdef G15_TRANSPOSE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[n].name = "sse2";
+        kernels[n++].transpose = transposeSSE2;
+    }
+    if (__builtin_cpu_supports("avx2") && (G15_LCD_HEIGHT_IN_BYTES % 2) == 0) {
+        kernels[n].name = "avx2";
+        kernels[n++].transpose = transposeAVX2;
+    }
+#endif
+    return n;
+}
+
+#define TRANSPOSE_KERNELS   3
+
+#endif
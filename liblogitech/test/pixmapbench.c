@@ -0,0 +1,71 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Times the per-byte pixmap conversion the transpose kernels replaced, and every
+   kernel the cpu can run, in ns per frame.  Built from the library source to reach
+   them. */
+
+#include "../liblogitech.c"
+#include "pixmap_reference.h"
+
+#define FRAMES      64
+#define ROUNDS      2000
+
+static void timeConversion(const char *name, void (*transpose)(unsigned char *, unsigned char const *),
+                           unsigned char pixmaps[][G15_PIXMAP_BYTES], int offset)
+{
+    unsigned char frame[G15_BUFFER_LEN];
+    struct timespec start, end;
+    unsigned int sink = 0;
+    int i;
+
+    for (i = 0; i < FRAMES; i++)
+        transpose(frame + offset, pixmaps[i]);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < ROUNDS * FRAMES; i++) {
+        transpose(frame + offset, pixmaps[i % FRAMES]);
+        sink += frame[G15_LCD_OFFSET + (i % G15_PIXMAP_BYTES)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    /* printing what was read keeps the conversions from being optimised away */
+    printf("%-10s %8.1f ns/frame  (sum %x)\n", name, (double)nsSince(&start, &end) / (ROUNDS * FRAMES),
+           sink);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char pixmaps[FRAMES][G15_PIXMAP_BYTES];
+    transpose_kernel_t kernels[TRANSPOSE_KERNELS];
+    unsigned int rng = 12345;
+    int i, j, n;
+
+    for (i = 0; i < FRAMES; i++) {
+        for (j = 0; j < G15_PIXMAP_BYTES; j++) {
+            rng = rng * 1103515245 + 12345;
+            pixmaps[i][j] = rng >> 16;
+        }
+    }
+
+    timeConversion("per-byte", referencePixmapIntoLCDFormat, pixmaps, 0);
+    n = transposeKernels(kernels);
+    for (i = 0; i < n; i++)
+        timeConversion(kernels[i].name, kernels[i].transpose, pixmaps, G15_LCD_OFFSET);
+    timeConversion("dispatch", dumpPixmapIntoLCDFormat, pixmaps, 0);
+    return 0;
+}
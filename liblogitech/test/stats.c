@@ -0,0 +1,123 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Checks the latency histogram: which bucket histBucket counts a latency in, at the
+   edges of buckets and past the last one, and what lg_stats_percentile reads back
+   for known sets of latencies.  Built from the library source to reach histBucket
+   and recordTransfer. */
+
+#include <limits.h>
+#include "../liblogitech.c"
+
+static int failures = 0;
+
+static const struct {
+    unsigned int value;
+    int bucket;
+} buckets[] = {
+    {0, 0}, {1, 1}, {7, 7},
+    {8, 8}, {9, 9}, {15, 15},
+    {16, 16}, {17, 16}, {18, 17}, {31, 23},
+    {32, 24}, {100, 36},
+    {1023, 63}, {1024, 64}, {1151, 64}, {1152, 65},
+    {(15u << 23) - 1, 198}, {15u << 23, 199},     /* the last bucket, about 126 s */
+    {1u << 27, 199}, {UINT_MAX, 199},
+};
+
+#define MAX_LATENCIES 16
+
+static const struct {
+    const char *name;
+    unsigned int latency[MAX_LATENCIES];
+    int count;
+    double percentile;
+    unsigned int want;
+} percentiles[] = {
+    {"nothing", {0}, 0, 50, 0},
+    {"one zero", {0}, 1, 50, 0},
+    {"zeroes below", {0, 0, 0, 5}, 4, 50, 0},
+    {"max of the top", {0, 0, 0, 5}, 4, 100, 5},
+    {"last single bucket", {7, 8}, 2, 50, 7},
+    {"first shared bucket capped", {7, 8}, 2, 100, 8},
+    {"below a shared bucket", {15, 16, 17, 100}, 4, 25, 15},
+    {"top of a shared bucket", {15, 16, 17, 100}, 4, 50, 17},
+    {"same bucket higher up", {15, 16, 17, 100}, 4, 75, 17},
+    {"max within its bucket", {15, 16, 17, 100}, 4, 100, 100},
+    {"below a power of two", {1023, 1024}, 2, 50, 1023},
+    {"at a power of two", {1023, 1024, 2000}, 3, 67, 1151},
+    {"rounded down to the first", {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, 10, 0, 0},
+    {"half of ten", {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, 10, 50, 4},
+    {"rounded up to the last", {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, 10, 95, 9},
+    {"before the last bucket", {(15u << 23) - 1, 15u << 23}, 2, 50, (15u << 23) - 1},
+    {"in the last bucket", {10, 200000000, UINT_MAX}, 3, 50, UINT_MAX},
+    {"short of the last bucket", {10, 200000000, UINT_MAX}, 3, 33, 10},
+};
+
+static void checkBuckets(void)
+{
+    unsigned int i;
+    int b;
+
+    for (i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+        if (histBucket(buckets[i].value) == buckets[i].bucket)
+            continue;
+        fprintf(stderr, "latency %u: bucket %d, want %d\n", buckets[i].value,
+                histBucket(buckets[i].value), buckets[i].bucket);
+        failures++;
+    }
+    /* every bucket starts where lg_stats_bucket_value says, and ends before the next */
+    for (b = 0; b < G15_HIST_BUCKETS - 1; b++) {
+        unsigned int first = lg_stats_bucket_value(b), next = lg_stats_bucket_value(b + 1);
+
+        if (next > first && histBucket(first) == b && histBucket(next - 1) == b)
+            continue;
+        fprintf(stderr, "bucket %d: %u to %u counted in %d to %d\n", b, first, next - 1,
+                histBucket(first), histBucket(next - 1));
+        failures++;
+    }
+}
+
+static void checkPercentiles(void)
+{
+    unsigned int i, got;
+    int j;
+
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        lg_device_t *dev = calloc(1, sizeof(lg_device_t));
+
+        for (j = 0; j < percentiles[i].count; j++)
+            recordTransfer(dev, G15_STATS_LCD, percentiles[i].latency[j], 0, 0, 0);
+        got = lg_stats_percentile(&dev->stats.transfers[G15_STATS_LCD].latency,
+                                  percentiles[i].percentile);
+        if (got != percentiles[i].want) {
+            fprintf(stderr, "%s: %g%% is %u, want %u\n", percentiles[i].name,
+                    percentiles[i].percentile, got, percentiles[i].want);
+            failures++;
+        }
+        free(dev);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    checkBuckets();
+    checkPercentiles();
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Drives a virtual keyboard of every model through the public api: recorded key
+   reports are injected and read back by polling, through a key handler and as
+   queued events, pixmaps are written and the frames the keyboard received are
+   checked, and the keyboard is unplugged and reopened. */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../liblogitech.h"
+#include "key_reports.h"
+
+#define TIMEOUT     1000    /* ms */
+#define PIXMAP_BYTES (160 * 48 / 8)
+#define DEVICES     (int)(sizeof(recorded_devices) / sizeof(recorded_devices[0]))
+
+static int failures = 0;
+
+static void check(int ok, const char *device, const char *what, uint64_t got, uint64_t want)
+{
+    if (ok)
+        return;
+    fprintf(stderr, "%s: %s: got %llx, want %llx\n", device, what,
+            (unsigned long long)got, (unsigned long long)want);
+    failures++;
+}
+
+static pthread_mutex_t handler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handler_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int handler_keys;
+static int handler_calls;
+
+static void keyHandler(unsigned int pressed_keys, int status, void *userdata)
+{
+    pthread_mutex_lock(&handler_mutex);
+    if (status == G15_NO_ERROR) {
+        handler_keys = pressed_keys;
+        handler_calls++;
+    }
+    pthread_cond_broadcast(&handler_cond);
+    pthread_mutex_unlock(&handler_mutex);
+}
+
+/* wait for the handler to have been called calls times, returning the last keys it got */
+static unsigned int waitForHandler(int calls)
+{
+    struct timespec deadline;
+    unsigned int keys;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TIMEOUT / 1000;
+    pthread_mutex_lock(&handler_mutex);
+    while (handler_calls < calls)
+        if (pthread_cond_timedwait(&handler_cond, &handler_mutex, &deadline))
+            break;
+    keys = handler_calls < calls ? ~0u : handler_keys;
+    pthread_mutex_unlock(&handler_mutex);
+    return keys;
+}
+
+static void injectKeys(int id, const recorded_format_t *format, uint64_t keys)
+{
+    unsigned char report[G15_KEY_READ_LENGTH];
+    int length;
+
+    length = recordedReport(format, keys, report);
+    lg_virtual_inject_report(id, report, length);
+}
+
+/* every recorded key pressed and released, read by polling */
+static void checkPolledKeys(lg_device_t *dev, int id, const char *name, const recorded_format_t *format)
+{
+    lg_key_event_t events[4];
+    uint64_t key, keys;
+    int i, ret;
+
+    lg_drain_key_events(dev, events, 4);
+    for (i = 0; i < format->nkeys; i++) {
+        key = G15_KEY64(format->keys[i].key);
+        injectKeys(id, format, key);
+        keys = 0;
+        ret = lg_read_keys64(dev, &keys, TIMEOUT);
+        check(ret == G15_NO_ERROR && keys == key, name, "polled key", keys, key);
+        injectKeys(id, format, 0);
+        keys = ~(uint64_t)0;
+        ret = lg_read_keys64(dev, &keys, TIMEOUT);
+        check(ret == G15_NO_ERROR && keys == 0, name, "polled release", keys, 0);
+
+        /* and both changes were queued */
+        ret = lg_drain_key_events(dev, events, 4);
+        check(ret == 2, name, "queued events", ret, 2);
+        if (ret != 2)
+            continue;
+        check(events[0].keys == key && events[0].changed == key, name, "queued press",
+              events[0].keys, key);
+        check(events[1].keys == 0 && events[1].changed == key, name, "queued release",
+              events[1].changed, key);
+        check(events[1].when >= events[0].when, name, "queued release time", events[1].when,
+              events[0].when);
+    }
+
+    /* nothing comes of no report */
+    ret = lg_read_keys64(dev, &keys, 10);
+    check(ret != G15_NO_ERROR, name, "read with no report, return", ret, 0);
+}
+
+/* a chord through the key handler, with the 32-bit key mask of the older api */
+static void checkHandlerKeys(lg_device_t *dev, int id, const char *name, const recorded_format_t *format)
+{
+    uint64_t chord = G15_KEY64(G15_KEYBIT_G1) | G15_KEY64(G15_KEYBIT_M1);
+    unsigned int keys;
+    int calls;
+
+    pthread_mutex_lock(&handler_mutex);
+    calls = handler_calls;
+    pthread_mutex_unlock(&handler_mutex);
+
+    check(lg_register_key_handler(dev, keyHandler, NULL) == G15_NO_ERROR, name,
+          "register key handler", 0, 0);
+    lg_virtual_press_keys(id, chord);
+    keys = waitForHandler(calls + 1);
+    check(keys == (G15_KEY_G1 | G15_KEY_M1), name, "handler keys", keys, G15_KEY_G1 | G15_KEY_M1);
+    lg_virtual_press_keys(id, 0);
+    keys = waitForHandler(calls + 2);
+    check(keys == 0, name, "handler release", keys, 0);
+    lg_register_key_handler(dev, NULL, NULL);
+
+    /* polling again after the handler is gone */
+    injectKeys(id, format, G15_KEY64(G15_KEYBIT_M1));
+    keys = 0;
+    lg_read_keys(dev, &keys, TIMEOUT);
+    check(keys == G15_KEY_M1, name, "polled after handler", keys, G15_KEY_M1);
+}
+
+/* the newest frame the keyboard got is the pixmap, converted as lg_pixmap_to_frame does */
+static void checkFrame(int id, const char *name, const char *what, unsigned char const *pixmap)
+{
+    unsigned char want[G15_BUFFER_LEN];
+    lg_virtual_frame_t frame;
+    int i;
+
+    memset(want, 0, sizeof(want));
+    want[0] = 0x03;
+    lg_pixmap_to_frame(want, pixmap);
+    if (lg_virtual_get_frame(id, 0, &frame) != 0) {
+        check(0, name, what, 0, 1);
+        return;
+    }
+    for (i = 0; i < G15_BUFFER_LEN && frame.data[i] == want[i]; i++)
+        ;
+    check(i == G15_BUFFER_LEN, name, what, i, G15_BUFFER_LEN);
+}
+
+static void checkLCD(lg_device_t *dev, int id, const char *name, unsigned char *pixmap)
+{
+    unsigned long frames;
+    int i, ret;
+
+    frames = lg_virtual_frame_count(id);
+    for (i = 0; i < PIXMAP_BYTES; i++)
+        pixmap[i] = i * 7 + id;
+    ret = lg_write_pixmap(dev, pixmap);
+    check(ret == G15_NO_ERROR, name, "write pixmap, return", ret, 0);
+    check(lg_virtual_frame_count(id) == frames + 1, name, "frames sent",
+          lg_virtual_frame_count(id), frames + 1);
+    checkFrame(id, name, "frame", pixmap);
+
+    pixmap[0] ^= 0x80;
+    ret = lg_write_pixmap_async(dev, pixmap);
+    check(ret == G15_NO_ERROR, name, "write pixmap async, return", ret, 0);
+    ret = lg_flush(dev, TIMEOUT);
+    check(ret == G15_NO_ERROR, name, "flush, return", ret, 0);
+    checkFrame(id, name, "async frame", pixmap);
+}
+
+/* a replugged keyboard is found again and gets the last frame back */
+static void checkReplug(lg_device_t *dev, int id, const char *name, unsigned char *pixmap, int lcd)
+{
+    unsigned long frames = lg_virtual_frame_count(id);
+    uint64_t keys = 0;
+    int ret;
+
+    lg_virtual_unplug(id);
+    if (lcd) {
+        pixmap[1] ^= 0x01;
+        ret = lg_write_pixmap(dev, pixmap);
+        check(ret != G15_NO_ERROR, name, "write while unplugged, return", ret, 1);
+        /* what is restored is the last frame the keyboard got */
+        pixmap[1] ^= 0x01;
+    }
+    lg_virtual_plug(id);
+    ret = lg_reopen(dev);
+    check(ret == G15_NO_ERROR, name, "reopen, return", ret, 0);
+    if (ret != G15_NO_ERROR)
+        return;
+    if (lcd) {
+        check(lg_virtual_frame_count(id) == frames + 1, name, "frames restored",
+              lg_virtual_frame_count(id), frames + 1);
+        checkFrame(id, name, "restored frame", pixmap);
+    }
+    lg_virtual_press_keys(id, G15_KEY64(G15_KEYBIT_G1));
+    ret = lg_read_keys64(dev, &keys, TIMEOUT);
+    check(ret == G15_NO_ERROR && keys == G15_KEY64(G15_KEYBIT_G1), name, "key after reopen",
+          keys, G15_KEY64(G15_KEYBIT_G1));
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char pixmap[PIXMAP_BYTES];
+    lg_device_info_t list[DEVICES];
+    lg_device_t *dev;
+    int i, id, caps, devices = 0;
+
+    /* every model at once, as they are listed in the order they were plugged in */
+    for (i = 0; i < DEVICES; i++)
+        lg_virtual_add(recorded_devices[i].productid);
+    i = lg_enumerate(list, DEVICES);
+    check(i == DEVICES, "virtual", "keyboards found", i, DEVICES);
+
+    for (id = 0; id < i; id++) {
+        char name[16];
+
+        snprintf(name, sizeof(name), "%04x", recorded_devices[id].productid);
+        if (lg_open(&list[id], &dev) != G15_NO_ERROR) {
+            check(0, name, "open", id, 0);
+            continue;
+        }
+        caps = lg_get_caps(dev);
+        checkPolledKeys(dev, id, name, recorded_devices[id].format);
+        checkHandlerKeys(dev, id, name, recorded_devices[id].format);
+        if (caps & G15_LCD)
+            checkLCD(dev, id, name, pixmap);
+        checkReplug(dev, id, name, pixmap, caps & G15_LCD);
+        lg_close(dev);
+        devices++;
+    }
+    printf("%d devices, %d failures\n", devices, failures);
+    return failures ? 1 : 0;
+}
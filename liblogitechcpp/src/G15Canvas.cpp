@@ -5,7 +5,7 @@
 
 using namespace G15Tools;
 
-G15Canvas::G15Canvas(const bool debug) : debug(debug)
+G15Canvas::G15Canvas(const bool debug) : debug(debug), lastScreen(NULL)
 {
 	if (this->debug)
 	{
@@ -17,11 +17,15 @@ G15Canvas::G15Canvas(const bool debug) : debug(debug)
 	this->canvas->mode_xor = 0;
 	this->canvas->mode_cache = 0;
 	this->canvas->mode_reverse = 0;
+	g15r_resetDamage(this->canvas);
+	g15r_addDamage(this->canvas, 0, 0, G15_LCD_WIDTH - 1, G15_LCD_HEIGHT - 1);
+	this->canvas->text = NULL;
 }
 
 G15Canvas::G15Canvas(const G15Canvas& in)
 {
 	this->debug = in.debug;
+	this->lastScreen = NULL;
 	if (this->debug)
 	{
 		std::cerr << "G15Canvas(" << this << "): ";
@@ -32,6 +36,9 @@ G15Canvas::G15Canvas(const G15Canvas& in)
 	this->canvas->mode_cache = in.canvas->mode_cache;
 	this->canvas->mode_reverse = in.canvas->mode_reverse;
 	memcpy(this->canvas->buffer, in.canvas->buffer, G15_BUFFER_LEN);
+	memcpy(this->canvas->damage_x1, in.canvas->damage_x1, sizeof(this->canvas->damage_x1));
+	memcpy(this->canvas->damage_x2, in.canvas->damage_x2, sizeof(this->canvas->damage_x2));
+	this->canvas->text = g15r_refTextContext(in.canvas->text);
 }
 
 G15Canvas::~G15Canvas()
@@ -41,19 +48,33 @@ G15Canvas::~G15Canvas()
 		std::cerr << "G15Canvas(" << this << "): ";
 		std::cerr << "Destroyed." << std::endl;
 	}
+	g15r_setTextContext(this->canvas, NULL);
 	delete this->canvas;
 }
 
 void G15Canvas::render(G15Screen &screen)
 {
-	if (!this->canvas->mode_cache)
+	if (this->canvas->mode_cache)
 	{
-		if (this->debug)
-		{
-			std::cerr << "G15Canvas(" << this << "): ";
-			std::cerr << "Rendering to G15Screen(" << &screen << ")." << std::endl;
-		}
-		screen.sendData((char *) this->canvas->buffer, G15_BUFFER_LEN);
+		return;
+	}
+	// The damage only says what changed since the last render, so skipping is
+	// safe only if that went to this screen and nothing has replaced it since
+	if (this->lastScreen == &screen && screen.shows(this) &&
+	    !g15r_getDamage(this->canvas, NULL, NULL, NULL, NULL))
+	{
+		return;
+	}
+	if (this->debug)
+	{
+		std::cerr << "G15Canvas(" << this << "): ";
+		std::cerr << "Rendering to G15Screen(" << &screen << ")." << std::endl;
+	}
+	// A frame that did not go out is sent again by the next render
+	if (screen.sendFrom(this, (char *) this->canvas->buffer, G15_BUFFER_LEN) == 0)
+	{
+		g15r_resetDamage(this->canvas);
+		this->lastScreen = &screen;
 	}
 }
 
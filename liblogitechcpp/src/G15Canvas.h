@@ -12,6 +12,7 @@ namespace G15Tools
 	protected:
 		g15canvas *canvas;
 		bool debug;
+		const G15Screen *lastScreen;	// where the damage was last cleared by a render
 
 	public:
 		explicit G15Canvas(const bool debug = false);
@@ -41,6 +41,7 @@ void G15Screen::_init(const int type)
 {
 	this->g15screen_fd = new_g15_screen(type);
 	this->keys = 0;
+	this->shown = NULL;
 	this->type = type;
 	if (this->debug)
 	{
@@ -66,9 +67,27 @@ int G15Screen::sendData(const char *data, const unsigned int len)
 		std::cerr << "G15screen(" << this << "): ";
 		std::cerr << "Sending " << len << " bytes." << std::endl;
 	}
+	this->shown = NULL;
 	return g15_send(this->g15screen_fd, (char *)data, len);
 }
 
+// As sendData, and remembers source as what the screen shows once it went out
+int G15Screen::sendFrom(const void *source, const char *data, const unsigned int len)
+{
+	int ret = this->sendData(data, len);
+
+	if (ret == 0)
+	{
+		this->shown = source;
+	}
+	return ret;
+}
+
+bool G15Screen::shows(const void *source) const
+{
+	return this->shown == source;
+}
+
 int G15Screen::setKeyboardBacklight(const unsigned char brightness)
 {
 	return this->_sendCommand(G15DAEMON_KB_BACKLIGHT, brightness);
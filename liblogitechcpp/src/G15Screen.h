@@ -9,6 +9,7 @@ namespace G15Tools
 		int type;
 		bool debug;
 		unsigned char keys;
+		const void *shown;	// whose frame the screen shows, NULL if unknown
 		void _init(int type);
 		int _sendCommand(unsigned char command, unsigned char value);
 	public:
@@ -17,6 +18,8 @@ namespace G15Tools
 		G15Screen(const G15Screen& in);
 		~G15Screen();
 		int sendData(const char *data, const unsigned int len);
+		int sendFrom(const void *source, const char *data, const unsigned int len);
+		bool shows(const void *source) const;
 		int setKeyboardBacklight(const unsigned char brightness);
 		int setBacklight(const unsigned char brightness);
 		int setContrast(const unsigned char contrast);
@@ -0,0 +1,340 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * The g15canvas API.  A canvas is an LCD sized surface with its buffer held
+ * inline; each function here draws through a g15surface pointing into it.
+ */
+
+#include "liblogitechrender.h"
+
+/* Fills in a surface for canvas; inline so the wrappers below stay cheap */
+static inline void
+canvasView (g15canvas * canvas, g15surface * surface)
+{
+  surface->buffer = canvas->buffer;
+  surface->width = G15_LCD_WIDTH;
+  surface->height = G15_LCD_HEIGHT;
+  surface->stride = G15_LCD_WIDTH / BYTE_SIZE;
+  surface->damage_x1 = canvas->damage_x1;
+  surface->damage_x2 = canvas->damage_x2;
+  surface->mode_xor = canvas->mode_xor;
+  surface->mode_reverse = canvas->mode_reverse;
+}
+
+/**
+ * Points surface at the pixels, damage and drawing modes of canvas, so that the g15s_*
+ * functions draw on it.  Nothing is copied or allocated; the modes are read when this is
+ * called, so call it again after changing them.
+ *
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface Receives the surface.
+ */
+void
+g15r_canvasSurface (g15canvas * canvas, g15surface * surface)
+{
+  canvasView (canvas, surface);
+}
+
+/**
+ * Clears the screen and resets the mode values for a canvas.  The canvas has no text
+ * context until g15r_ttfLoad or g15r_setTextContext gives it one.
+ * 
+ * \param canvas A pointer to a g15canvas struct
+ */
+void
+g15r_initCanvas (g15canvas * canvas)
+{
+  memset (canvas->buffer, 0, G15_BUFFER_LEN);
+  canvas->mode_cache = 0;
+  canvas->mode_reverse = 0;
+  canvas->mode_xor = 0;
+  canvas->text = NULL;
+  g15r_resetDamage (canvas);
+  g15r_addDamage (canvas, 0, 0, G15_LCD_WIDTH - 1, G15_LCD_HEIGHT - 1);
+}
+
+/**
+ * Clears the screen and fills it with pixels of color
+ * 
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param color Screen will be filled with this color.
+ */
+void
+g15r_clearScreen (g15canvas * canvas, int color)
+{
+  memset (canvas->buffer, (color ? 0xFF : 0), G15_BUFFER_LEN);
+  g15r_addDamage (canvas, 0, 0, G15_LCD_WIDTH - 1, G15_LCD_HEIGHT - 1);
+}
+
+/*
+ * Single pixels are the one thing legacy clients do in tight loops, so these
+ * two work on the canvas directly rather than through a surface.
+ */
+
+/**
+ * Retrieves the value of the pixel at (x, y)
+ * 
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param x X offset for pixel to be retrieved.
+ * \param y Y offset for pixel to be retrieved.
+ */
+int
+g15r_getPixel (g15canvas * canvas, unsigned int x, unsigned int y)
+{
+  if (x >= G15_LCD_WIDTH || y >= G15_LCD_HEIGHT)
+    return 0;
+
+  unsigned int pixel_offset = y * G15_LCD_WIDTH + x;
+  unsigned int byte_offset = pixel_offset / BYTE_SIZE;
+  unsigned int bit_offset = 7 - (pixel_offset % BYTE_SIZE);
+
+  return (canvas->buffer[byte_offset] & (1 << bit_offset)) >> bit_offset;
+}
+
+/**
+ * Sets the value of the pixel at (x, y)
+ * 
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param x X offset for pixel to be set.
+ * \param y Y offset for pixel to be set.
+ * \param val Value to which pixel should be set.
+ */
+void
+g15r_setPixel (g15canvas * canvas, unsigned int x, unsigned int y, int val)
+{
+  if (x >= G15_LCD_WIDTH || y >= G15_LCD_HEIGHT)
+    return;
+
+  unsigned int pixel_offset = y * G15_LCD_WIDTH + x;
+  unsigned int byte_offset = pixel_offset / BYTE_SIZE;
+  unsigned int bit_offset = 7 - (pixel_offset % BYTE_SIZE);
+
+  if (x < canvas->damage_x1[y])
+    canvas->damage_x1[y] = x;
+  if (x > canvas->damage_x2[y])
+    canvas->damage_x2[y] = x;
+
+  if (canvas->mode_xor)
+    val ^= (canvas->buffer[byte_offset] >> bit_offset) & 1;
+  if (canvas->mode_reverse)
+    val = !val;
+
+  if (val)
+    canvas->buffer[byte_offset] |= 1 << bit_offset;
+  else
+    canvas->buffer[byte_offset] &= ~(1 << bit_offset);
+}
+
+/** Marks an area of the canvas as changed.  See g15s_addDamage(). */
+void
+g15r_addDamage (g15canvas * canvas, int x1, int y1, int x2, int y2)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_addDamage (&surface, x1, y1, x2, y2);
+}
+
+/** Retrieves the bounding box of everything changed since the last g15r_resetDamage.  See g15s_getDamage(). */
+int
+g15r_getDamage (g15canvas * canvas, int *x1, int *y1, int *x2, int *y2)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  return g15s_getDamage (&surface, x1, y1, x2, y2);
+}
+
+/** Retrieves the span of row y changed since the last g15r_resetDamage.  See g15s_getDamageRow(). */
+int
+g15r_getDamageRow (g15canvas * canvas, int y, int *x1, int *x2)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  return g15s_getDamageRow (&surface, y, x1, x2);
+}
+
+/** Marks the whole canvas as unchanged.  See g15s_resetDamage(). */
+void
+g15r_resetDamage (g15canvas * canvas)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_resetDamage (&surface);
+}
+
+/** Fills or reverses the area bounded by (x1, y1) and (x2, y2).  See g15s_pixelReverseFill(). */
+void
+g15r_pixelReverseFill (g15canvas * canvas, int x1, int y1, int x2, int y2,
+		       int fill, int color)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_pixelReverseFill (&surface, x1, y1, x2, y2, fill, color);
+}
+
+/** Draws the 1-bit bitmap in colormap[] with its upper left corner at (x1, y1).  See g15s_pixelOverlay(). */
+void
+g15r_pixelOverlay (g15canvas * canvas, int x1, int y1, int width, int height,
+		   short colormap[])
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_pixelOverlay (&surface, x1, y1, width, height, colormap);
+}
+
+/** Draws a line from (px1, py1) to (px2, py2).  See g15s_drawLine(). */
+void
+g15r_drawLine (g15canvas * canvas, int px1, int py1, int px2, int py2,
+	       const int color)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawLine (&surface, px1, py1, px2, py2, color);
+}
+
+/** Draws a box around the area bounded by (x1, y1) and (x2, y2).  See g15s_pixelBox(). */
+void
+g15r_pixelBox (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
+	       int thick, int fill)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_pixelBox (&surface, x1, y1, x2, y2, color, thick, fill);
+}
+
+/** Draws a circle centered at (x, y) with a radius of r.  See g15s_drawCircle(). */
+void
+g15r_drawCircle (g15canvas * canvas, int x, int y, int r, int fill, int color)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawCircle (&surface, x, y, r, fill, color);
+}
+
+/** Draws a rounded box around the area bounded by (x1, y1) and (x2, y2).  See g15s_drawRoundBox(). */
+void
+g15r_drawRoundBox (g15canvas * canvas, int x1, int y1, int x2, int y2,
+		   int fill, int color)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawRoundBox (&surface, x1, y1, x2, y2, fill, color);
+}
+
+/** Draws a bar showing num out of max.  See g15s_drawBar(). */
+void
+g15r_drawBar (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
+	      int num, int max, int type)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawBar (&surface, x1, y1, x2, y2, color, num, max, type);
+}
+
+/** wbmp splash screen loader - assumes image is 160x43.  See g15s_loadWbmpSplash(). */
+int
+g15r_loadWbmpSplash (g15canvas * canvas, char *filename)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  return g15s_loadWbmpSplash (&surface, filename);
+}
+
+/** Draw an icon to a canvas.  See g15s_drawIcon(). */
+void
+g15r_drawIcon (g15canvas * canvas, char *buf, int my_x, int my_y, int width,
+	       int height)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawIcon (&surface, buf, my_x, my_y, width, height);
+}
+
+/** Draw a sprite to a canvas.  See g15s_drawSprite(). */
+void
+g15r_drawSprite (g15canvas * canvas, char *buf, int my_x, int my_y, int width,
+		 int height, int start_x, int start_y, int total_width)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawSprite (&surface, buf, my_x, my_y, width, height, start_x, start_y,
+		   total_width);
+}
+
+/** Draw a large number to a canvas.  See g15s_drawBigNum(). */
+void
+g15r_drawBigNum (g15canvas * canvas, unsigned int x1, unsigned int y1,
+		 unsigned int x2, unsigned int y2, int color, int num)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawBigNum (&surface, x1, y1, x2, y2, color, num);
+}
+
+/** Draw an XBM Image to the canvas.  See g15s_drawXBM(). */
+void
+g15r_drawXBM (g15canvas * canvas, unsigned char *data, int width, int height,
+	      int pos_x, int pos_y)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_drawXBM (&surface, data, width, height, pos_x, pos_y);
+}
+
+/** Combines a 1-bit image with the canvas using a raster op.  See g15s_blit(). */
+void
+g15r_blit (g15canvas * canvas, const unsigned char *src,
+	   const unsigned char *mask, int src_pitch, int src_x, int src_y,
+	   int width, int height, int dst_x, int dst_y, int rop)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_blit (&surface, src, mask, src_pitch, src_x, src_y, width, height,
+	     dst_x, dst_y, rop);
+}
+
+/** Combines an area of a surface with the canvas using a raster op.  See g15s_blitSurface(). */
+void
+g15r_blitSurface (g15canvas * canvas, const g15surface * src, int src_x,
+		  int src_y, int width, int height, int dst_x, int dst_y,
+		  int rop)
+{
+  g15surface surface;
+
+  canvasView (canvas, &surface);
+  g15s_blitSurface (&surface, src, src_x, src_y, width, height, dst_x, dst_y,
+		    rop);
+}
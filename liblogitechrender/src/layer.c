@@ -0,0 +1,567 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Layer stacks.  Each layer is a surface of its own that is combined with
+ * the layers beneath it using a raster op.  Every layer but the top one also
+ * keeps a cache of itself composited over everything below, so a change to
+ * one layer is blended again from the cache under it, and only over the area
+ * it touched.
+ */
+
+#include <stdlib.h>
+#include "liblogitechrender.h"
+
+/* An area of the stack, inclusive; empty when x1 > x2 */
+typedef struct layerRect
+{
+  int x1, y1, x2, y2;
+} layerRect;
+
+struct g15layer
+{
+  g15layers *stack;
+  g15surface *surface;
+  g15surface *mask;
+  /* This layer composited over the layers below it, the size of the stack;
+     the top layer is composited onto the output instead */
+  g15surface *cache;
+  int x, y, z;
+  int visible;
+  int rop;
+  /* Area to blend again from here up, for changes not seen in the damage */
+  layerRect dirty;
+};
+
+struct g15layers
+{
+  int width;
+  int height;
+  int background;
+  int count;
+  /* In ascending z order */
+  g15layer **layer;
+  /* Area of the output to redo from the top layer alone */
+  layerRect dirty;
+};
+
+static void
+rectClear (layerRect * r)
+{
+  r->x1 = r->y1 = 0;
+  r->x2 = r->y2 = -1;
+}
+
+static void
+rectUnite (layerRect * r, int x1, int y1, int x2, int y2)
+{
+  if (x1 > x2 || y1 > y2)
+    return;
+  if (r->x1 > r->x2 || r->y1 > r->y2)
+    {
+      r->x1 = x1;
+      r->y1 = y1;
+      r->x2 = x2;
+      r->y2 = y2;
+      return;
+    }
+  if (x1 < r->x1)
+    r->x1 = x1;
+  if (y1 < r->y1)
+    r->y1 = y1;
+  if (x2 > r->x2)
+    r->x2 = x2;
+  if (y2 > r->y2)
+    r->y2 = y2;
+}
+
+/* Marks the area the layer covers as needing to be blended again */
+static void
+dirtyLayerArea (g15layer * layer, layerRect * r)
+{
+  rectUnite (r, layer->x, layer->y, layer->x + layer->surface->width - 1,
+	     layer->y + layer->surface->height - 1);
+}
+
+/* Clips r to the stack, returning 0 if nothing is left */
+static int
+rectClip (g15layers * layers, layerRect * r)
+{
+  if (r->x1 < 0)
+    r->x1 = 0;
+  if (r->y1 < 0)
+    r->y1 = 0;
+  if (r->x2 >= layers->width)
+    r->x2 = layers->width - 1;
+  if (r->y2 >= layers->height)
+    r->y2 = layers->height - 1;
+  return r->x1 <= r->x2 && r->y1 <= r->y2;
+}
+
+static void
+dirtyAll (g15layers * layers, layerRect * r)
+{
+  rectUnite (r, 0, 0, layers->width - 1, layers->height - 1);
+}
+
+static int
+layerIndex (g15layers * layers, g15layer * layer)
+{
+  int i;
+
+  for (i = 0; i < layers->count; ++i)
+    if (layers->layer[i] == layer)
+      return i;
+  return -1;
+}
+
+/* Moves the layer at index from to where its z value belongs, returning its new index */
+static int
+sortLayer (g15layers * layers, int from)
+{
+  g15layer *layer = layers->layer[from];
+  int to = from;
+
+  while (to > 0 && layers->layer[to - 1]->z > layer->z)
+    {
+      layers->layer[to] = layers->layer[to - 1];
+      --to;
+    }
+  while (to < layers->count - 1 && layers->layer[to + 1]->z <= layer->z)
+    {
+      layers->layer[to] = layers->layer[to + 1];
+      ++to;
+    }
+  layers->layer[to] = layer;
+  return to;
+}
+
+static void
+freeLayer (g15layer * layer)
+{
+  g15s_free (layer->surface);
+  g15s_free (layer->mask);
+  g15s_free (layer->cache);
+  free (layer);
+}
+
+/**
+ * Creates an empty layer stack.  Layers added to it are composited in ascending z order
+ * over a plain background by g15r_compositeLayers.
+ *
+ * \param width Width of the composite in pixels, normally G15_LCD_WIDTH.
+ * \param height Height of the composite in pixels, normally G15_LCD_HEIGHT.
+ * \param background G15_COLOR_WHITE or G15_COLOR_BLACK, the color beneath the bottom layer.
+ * \return The new stack, or NULL if the size is out of range or it could not be allocated.
+ */
+g15layers *
+g15r_newLayers (int width, int height, int background)
+{
+  g15layers *layers;
+
+  if (width <= 0 || height <= 0 || width > G15_SURFACE_MAX
+      || height > G15_SURFACE_MAX)
+    return NULL;
+
+  layers = calloc (1, sizeof (g15layers));
+  if (layers == NULL)
+    return NULL;
+  layers->width = width;
+  layers->height = height;
+  layers->background = background;
+  rectClear (&layers->dirty);
+  dirtyAll (layers, &layers->dirty);
+  return layers;
+}
+
+/**
+ * Frees a layer stack along with all of its layers.
+ *
+ * \param layers The stack to be freed, or NULL.
+ */
+void
+g15r_freeLayers (g15layers * layers)
+{
+  int i;
+
+  if (layers == NULL)
+    return;
+  for (i = 0; i < layers->count; ++i)
+    freeLayer (layers->layer[i]);
+  free (layers->layer);
+  free (layers);
+}
+
+/**
+ * Adds a blank layer to a stack.  The layer starts visible at (0, 0) with the op
+ * G15_BLIT_COPY; it is placed above any layers already holding the same z value.
+ *
+ * \param layers The stack to add to.
+ * \param width Width of the layer in pixels.
+ * \param height Height of the layer in pixels.
+ * \param z Position of the layer in the stack, higher values are composited later.
+ * \return The new layer, or NULL if it could not be allocated.
+ */
+g15layer *
+g15r_addLayer (g15layers * layers, int width, int height, int z)
+{
+  g15layer **list;
+  g15layer *layer;
+  int i;
+
+  list = realloc (layers->layer, (layers->count + 1) * sizeof (g15layer *));
+  if (list == NULL)
+    return NULL;
+  layers->layer = list;
+
+  layer = calloc (1, sizeof (g15layer));
+  if (layer == NULL)
+    return NULL;
+  layer->surface = g15s_newSized (width, height);
+  layer->cache = g15s_newSized (layers->width, layers->height);
+  if (layer->surface == NULL || layer->cache == NULL)
+    {
+      freeLayer (layer);
+      return NULL;
+    }
+  rectClear (&layer->dirty);
+  layer->stack = layers;
+  layer->z = z;
+  layer->visible = 1;
+  layer->rop = G15_BLIT_COPY;
+  g15s_resetDamage (layer->surface);
+
+  layers->layer[layers->count++] = layer;
+  i = sortLayer (layers, layers->count - 1);
+  /*
+   * The cache starts blank, so all of it is filled in from the layer below.
+   * A new top layer takes over out, leaving the old top to fill in its cache.
+   */
+  if (i > 0 && i == layers->count - 1)
+    --i;
+  dirtyAll (layers, &layers->layer[i]->dirty);
+  return layer;
+}
+
+/**
+ * Removes a layer from its stack and frees it.
+ *
+ * \param layer The layer to be removed, or NULL.
+ */
+void
+g15r_removeLayer (g15layer * layer)
+{
+  g15layers *layers;
+  int i;
+
+  if (layer == NULL)
+    return;
+  layers = layer->stack;
+  i = layerIndex (layers, layer);
+  if (i >= 0)
+    {
+      layerRect *r;
+
+      --layers->count;
+      memmove (layers->layer + i, layers->layer + i + 1,
+	       (layers->count - i) * sizeof (g15layer *));
+      /* Whatever showed the layer, or was still to be blended, is redone from the one above */
+      r = i < layers->count ? &layers->layer[i]->dirty : &layers->dirty;
+      rectUnite (r, layer->dirty.x1, layer->dirty.y1, layer->dirty.x2,
+		 layer->dirty.y2);
+      if (layer->visible)
+	dirtyLayerArea (layer, r);
+    }
+  freeLayer (layer);
+}
+
+/**
+ * Gets the surface holding the pixels of a layer.  Anything drawn on it with the g15s_*
+ * functions is picked up by the next g15r_compositeLayers.  Set bits are black; how they
+ * combine with the layers beneath depends on the op given to g15r_setLayerRop.
+ *
+ * \param layer The layer.
+ * \return The surface, which belongs to the layer.
+ */
+g15surface *
+g15r_layerSurface (g15layer * layer)
+{
+  return layer->surface;
+}
+
+/**
+ * Gets the mask of a layer, allocating a clear one the size of the layer the first time.
+ * With the op G15_BLIT_MASKED only the pixels whose mask bits are set are composited;
+ * a layer without a mask is composited as G15_BLIT_COPY.
+ *
+ * \param layer The layer.
+ * \return The mask, which belongs to the layer, or NULL if it could not be allocated.
+ */
+g15surface *
+g15r_layerMask (g15layer * layer)
+{
+  if (layer->mask == NULL)
+    {
+      layer->mask = g15s_newSized (layer->surface->width,
+				   layer->surface->height);
+      if (layer->mask != NULL)
+	dirtyLayerArea (layer, &layer->dirty);
+    }
+  return layer->mask;
+}
+
+/**
+ * Moves a layer so that its upper left corner lands on (x, y) of the composite.
+ *
+ * \param layer The layer.
+ * \param x Leftmost column of the layer, may be negative.
+ * \param y Uppermost row of the layer, may be negative.
+ */
+void
+g15r_moveLayer (g15layer * layer, int x, int y)
+{
+  if (layer->x == x && layer->y == y)
+    return;
+  dirtyLayerArea (layer, &layer->dirty);
+  layer->x = x;
+  layer->y = y;
+  dirtyLayerArea (layer, &layer->dirty);
+}
+
+/**
+ * Shows or hides a layer.  Drawing on a hidden layer costs nothing at composite time.
+ *
+ * \param layer The layer.
+ * \param visible Layer is composited if visible != 0.
+ */
+void
+g15r_showLayer (g15layer * layer, int visible)
+{
+  visible = visible != 0;
+  if (layer->visible == visible)
+    return;
+  layer->visible = visible;
+  dirtyLayerArea (layer, &layer->dirty);
+}
+
+/**
+ * Sets how a layer combines with the layers beneath it.
+ *
+ * \param layer The layer.
+ * \param rop One of G15_BLIT_COPY, G15_BLIT_OR, G15_BLIT_ANDNOT, G15_BLIT_XOR or G15_BLIT_MASKED, optionally or'd with G15_BLIT_INVERT.
+ */
+void
+g15r_setLayerRop (g15layer * layer, int rop)
+{
+  if (layer->rop == rop)
+    return;
+  layer->rop = rop;
+  dirtyLayerArea (layer, &layer->dirty);
+}
+
+/**
+ * Moves a layer up or down its stack.
+ *
+ * \param layer The layer.
+ * \param z New position of the layer; it is placed above any other layers holding the same z value.
+ */
+void
+g15r_setLayerZ (g15layer * layer, int z)
+{
+  g15layers *layers = layer->stack;
+  int from = layerIndex (layers, layer);
+  int to;
+
+  if (layer->z == z)
+    return;
+  layer->z = z;
+  to = sortLayer (layers, from);
+  /* The cache of the moved layer holds a different stack beneath it now */
+  dirtyAll (layers, &layers->layer[from < to ? from : to]->dirty);
+}
+
+/**
+ * Marks a whole layer as changed.  Drawing with the g15s_* functions is noticed by itself;
+ * this is for writing to the surface buffer directly.
+ *
+ * \param layer The layer.
+ */
+void
+g15r_markLayerDirty (g15layer * layer)
+{
+  dirtyLayerArea (layer, &layer->dirty);
+}
+
+/**
+ * Marks the whole output as changed, so the next g15r_compositeLayers redraws all of it.
+ * Use this when something else has drawn over the output surface.  Only the top layer is
+ * blended again, over the cache beneath it.
+ *
+ * \param layers The stack.
+ */
+void
+g15r_invalidateLayers (g15layers * layers)
+{
+  dirtyAll (layers, &layers->dirty);
+}
+
+/* Adds the area of the layer's surface or mask changed since the last composite */
+static void
+uniteDamage (g15layer * layer, g15surface * surface, layerRect * r)
+{
+  int x1, y1, x2, y2;
+
+  if (surface == NULL || !g15s_getDamage (surface, &x1, &y1, &x2, &y2))
+    return;
+  if (layer->visible)
+    rectUnite (r, layer->x + x1, layer->y + y1, layer->x + x2,
+	       layer->y + y2);
+  g15s_resetDamage (surface);
+}
+
+/* Clips r to the area the layer covers, returning 0 if nothing is left */
+static int
+layerClip (g15layer * layer, layerRect * r)
+{
+  int x2 = layer->x + layer->surface->width - 1;
+  int y2 = layer->y + layer->surface->height - 1;
+
+  if (r->x1 < layer->x)
+    r->x1 = layer->x;
+  if (r->y1 < layer->y)
+    r->y1 = layer->y;
+  if (r->x2 > x2)
+    r->x2 = x2;
+  if (r->y2 > y2)
+    r->y2 = y2;
+  return r->x1 <= r->x2 && r->y1 <= r->y2;
+}
+
+/* Fills in the area of target from below, or the background under the bottom layer */
+static void
+refreshArea (g15layers * layers, g15surface * target, g15surface * below,
+	     int x1, int y1, int x2, int y2)
+{
+  int mode_xor, mode_reverse;
+
+  if (x1 > x2 || y1 > y2)
+    return;
+  if (below != NULL)
+    {
+      g15s_blitSurface (target, below, x1, y1, x2 - x1 + 1, y2 - y1 + 1, x1,
+			y1, G15_BLIT_COPY);
+      return;
+    }
+
+  /* Like the blits, the plain background ignores the modes of the target */
+  mode_xor = target->mode_xor;
+  mode_reverse = target->mode_reverse;
+  target->mode_xor = target->mode_reverse = 0;
+  g15s_pixelReverseFill (target, x1, y1, x2, y2, G15_PIXEL_FILL,
+			 layers->background);
+  target->mode_xor = mode_xor;
+  target->mode_reverse = mode_reverse;
+}
+
+/* Redoes area r of target: the layer combined with what is below it */
+static void
+composeLayer (g15layers * layers, g15layer * layer, g15surface * target,
+	      g15surface * below, layerRect * r)
+{
+  g15surface *surface = layer->surface;
+  int op = layer->rop & ~G15_BLIT_INVERT;
+  layerRect in = *r;
+
+  if (!layer->visible || !layerClip (layer, &in))
+    {
+      refreshArea (layers, target, below, r->x1, r->y1, r->x2, r->y2);
+      return;
+    }
+
+  if (op == G15_BLIT_COPY || (op == G15_BLIT_MASKED && layer->mask == NULL))
+    {
+      /* An opaque layer hides what is below it, so only the rest of r is refreshed */
+      refreshArea (layers, target, below, r->x1, r->y1, r->x2, in.y1 - 1);
+      refreshArea (layers, target, below, r->x1, in.y2 + 1, r->x2, r->y2);
+      refreshArea (layers, target, below, r->x1, in.y1, in.x1 - 1, in.y2);
+      refreshArea (layers, target, below, in.x2 + 1, in.y1, r->x2, in.y2);
+    }
+  else
+    refreshArea (layers, target, below, r->x1, r->y1, r->x2, r->y2);
+
+  g15s_blit (target, surface->buffer,
+	     layer->mask ? layer->mask->buffer : NULL,
+	     surface->stride * BYTE_SIZE, in.x1 - layer->x, in.y1 - layer->y,
+	     in.x2 - in.x1 + 1, in.y2 - in.y1 + 1, in.x1, in.y1, layer->rop);
+}
+
+/**
+ * Brings out up to date with the layers.  Starting at the lowest layer that changed since
+ * the last call, each layer's cache is refreshed from the cache beneath it and the layer
+ * blended on top, over the area that changed only.  Layers below the change are not
+ * touched.  The top layer is blended straight onto out, so out receives just the changed
+ * area, which is added to its damage.
+ *
+ * The same out should be passed each time; if anything else draws on it, call
+ * g15r_invalidateLayers first.
+ *
+ * \param layers The stack.
+ * \param out The surface to composite onto, normally from g15r_canvasSurface.
+ * \return 1 if out was changed, 0 if nothing changed.
+ */
+int
+g15r_compositeLayers (g15layers * layers, g15surface * out)
+{
+  g15surface *below = NULL;
+  layerRect r;
+  int i;
+
+  rectClear (&r);
+  for (i = 0; i < layers->count; ++i)
+    {
+      g15layer *layer = layers->layer[i];
+      /* out stands in for the cache of the top layer */
+      g15surface *target = i == layers->count - 1 ? out : layer->cache;
+
+      rectUnite (&r, layer->dirty.x1, layer->dirty.y1, layer->dirty.x2,
+		 layer->dirty.y2);
+      rectClear (&layer->dirty);
+      uniteDamage (layer, layer->surface, &r);
+      uniteDamage (layer, layer->mask, &r);
+      if (target == out)
+	{
+	  rectUnite (&r, layers->dirty.x1, layers->dirty.y1,
+		     layers->dirty.x2, layers->dirty.y2);
+	  rectClear (&layers->dirty);
+	}
+
+      if (rectClip (layers, &r))
+	composeLayer (layers, layer, target, below, &r);
+      below = layer->cache;
+    }
+
+  if (layers->count == 0)
+    {
+      r = layers->dirty;
+      rectClear (&layers->dirty);
+      if (rectClip (layers, &r))
+	refreshArea (layers, out, NULL, r.x1, r.y1, r.x2, r.y2);
+    }
+  return r.x1 <= r.x2 && r.y1 <= r.y2;
+}
@@ -0,0 +1,490 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Text layout for the G15 bitmap fonts.  A string is decoded, measured,
+ * wrapped and aligned once into a g15textrun, which is kept in a cache keyed
+ * by font, box and text; drawing it again only places the glyphs.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "liblogitechrender.h"
+
+#define G15_LAYOUT_CACHE_SIZE		64
+#define G15_LAYOUT_CACHE_BUCKETS	64
+
+/* A run together with what it was laid out from; the run comes first */
+struct layoutRun
+{
+  g15textrun run;
+  int refs;
+  int width;
+  int flags;
+  unsigned int hash;
+  size_t len;
+  char *text;
+};
+
+struct layoutSlot
+{
+  struct layoutRun *entry;
+  int next;			/* hash chain */
+  int newer, older;		/* LRU list */
+};
+
+/* Recently laid out runs, most recently used first */
+static struct
+{
+  struct layoutSlot slot[G15_LAYOUT_CACHE_SIZE];
+  int bucket[G15_LAYOUT_CACHE_BUCKETS];
+  int newest, oldest, used;
+  int ready;
+} layout_cache;
+
+static pthread_mutex_t layout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Decodes the next character of a UTF-8 string and moves the string past it.  Bytes that
+ * do not start a well formed UTF-8 sequence are taken as one Latin-1 character each, so
+ * strings in that encoding still come out as before.
+ *
+ * \param string Pointer to the position in the string, advanced past the character.
+ * \return The Unicode codepoint, or 0 at the end of the string.
+ */
+unsigned int
+g15r_nextCodepoint (const char **string)
+{
+  const unsigned char *s = (const unsigned char *) *string;
+  unsigned int c = s[0];
+  int n, i;
+
+  if (c < 0x80)
+    n = 0;
+  else if (c >= 0xC2 && c <= 0xDF)
+    {
+      n = 1;
+      c &= 0x1F;
+    }
+  else if (c >= 0xE0 && c <= 0xEF)
+    {
+      n = 2;
+      c &= 0x0F;
+    }
+  else if (c >= 0xF0 && c <= 0xF4)
+    {
+      n = 3;
+      c &= 0x07;
+    }
+  else
+    n = -1;
+
+  /* The terminating 0 is not a continuation byte, so this never reads past it */
+  for (i = 1; i <= n; ++i)
+    {
+      if ((s[i] & 0xC0) != 0x80)
+	break;
+      c = c << 6 | (s[i] & 0x3F);
+    }
+  if (n < 0 || i <= n || (n == 2 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF)))
+      || (n == 3 && (c < 0x10000 || c > 0x10FFFF)))
+    {
+      n = 0;
+      c = s[0];
+    }
+
+  if (c != 0)
+    *string += n + 1;
+  return c;
+}
+
+/* The glyph drawn for codepoint c, '?' for those the font cannot hold, or -1 for none */
+static int
+layoutGlyph (g15font * font, unsigned int c)
+{
+  if (c >= G15_MAX_GLYPH)
+    c = '?';
+  if (font->active[c] == 0 || font->glyph[c].buffer == NULL)
+    return -1;
+  return c;
+}
+
+/* How far g15s_renderG15Glyph moves the pen for glyph g */
+static inline int
+layoutAdvance (g15font * font, int g)
+{
+  if (g == ' ')
+    return font->glyph[g].width;
+  return font->glyph[g].width + font->default_gap;
+}
+
+/*
+ * Places the glyphs of string into a new run.  During the first pass each
+ * glyph's x is its pen position within its line and y the line number; the
+ * second pass aligns the lines and turns line numbers into pixels.
+ */
+static struct layoutRun *
+layoutNew (g15font * font, const char *string, size_t len, int width,
+	   int flags)
+{
+  struct layoutRun *entry;
+  g15runglyph *out;
+  const char *p = string;
+  int wrap = (flags & G15_TEXT_WRAP) && width > 0;
+  int justify = flags & ~G15_TEXT_WRAP;
+  int count = 0, line = 0, start = 0, brk = -1, pen = 0;
+  int i, j;
+  unsigned int c;
+
+  entry = malloc (sizeof (struct layoutRun) + len * sizeof (g15runglyph) +
+		  len + 1);
+  if (entry == NULL)
+    return NULL;
+  out = (g15runglyph *) (entry + 1);
+  entry->text = (char *) (out + len);
+  memcpy (entry->text, string, len + 1);
+
+  while ((c = g15r_nextCodepoint (&p)) != 0)
+    {
+      int g, adv;
+
+      if (c == '\n')
+	{
+	  ++line;
+	  start = count;
+	  brk = -1;
+	  pen = 0;
+	  continue;
+	}
+      if ((g = layoutGlyph (font, c)) < 0)
+	continue;
+      adv = layoutAdvance (font, g);
+
+      /* A glyph after a space starts a word the line may be broken before */
+      if (g != ' ' && count > start && out[count - 1].glyph == ' ')
+	brk = count;
+
+      while (wrap && g != ' ' && count > start && pen + adv > width)
+	{
+	  if (brk > start)
+	    {
+	      /* Move the last word to a new line, dropping the spaces before it */
+	      int end = brk;
+	      int shift = brk < count ? out[brk].x : pen;
+
+	      while (end > start && out[end - 1].glyph == ' ')
+		--end;
+	      ++line;
+	      for (i = brk, j = end; i < count; ++i, ++j)
+		{
+		  out[j] = out[i];
+		  out[j].x -= shift;
+		  out[j].y = line;
+		}
+	      count = j;
+	      start = end;
+	      pen -= shift;
+	      brk = -1;
+	    }
+	  else
+	    {
+	      /* The word is wider than the box and is broken where it overflows */
+	      ++line;
+	      start = count;
+	      pen = 0;
+	    }
+	}
+
+      out[count].x = pen;
+      out[count].y = line;
+      out[count].glyph = g;
+      ++count;
+      pen += adv;
+    }
+
+  entry->run.font = font;
+  entry->run.glyph = out;
+  entry->run.count = count;
+  entry->run.lines = line + 1;
+  entry->run.height = entry->run.lines * font->lineheight;
+  entry->run.width = 0;
+  for (i = 0; i < count; i = j)
+    {
+      int lw;
+
+      for (j = i; j < count && out[j].y == out[i].y; ++j)
+	;
+      lw = out[j - 1].x + layoutAdvance (font, out[j - 1].glyph);
+      if (lw > entry->run.width)
+	entry->run.width = lw;
+    }
+  for (i = 0; i < count; i = j)
+    {
+      int lw, box, x = 0;
+
+      for (j = i; j < count && out[j].y == out[i].y; ++j)
+	;
+      lw = out[j - 1].x + layoutAdvance (font, out[j - 1].glyph);
+      box = width > 0 ? width : entry->run.width;
+      if (justify == G15_JUSTIFY_CENTER)
+	x = box / 2 - lw / 2;
+      else if (justify == G15_JUSTIFY_RIGHT)
+	x = box - lw;
+      for (; i < j; ++i)
+	{
+	  out[i].x += x;
+	  out[i].y *= font->lineheight;
+	}
+    }
+
+  entry->refs = 1;
+  entry->width = width;
+  entry->flags = flags;
+  entry->len = len;
+  return entry;
+}
+
+static unsigned int
+layoutHash (g15font * font, const char *string, size_t len, int width,
+	    int flags)
+{
+  unsigned long h = (unsigned long) font;
+  size_t i;
+
+  h = h * 2654435761u + (unsigned int) width * 31 + flags;
+  for (i = 0; i < len; ++i)
+    h = (h ^ (unsigned char) string[i]) * 16777619u;
+  return (unsigned int) (h ^ (h >> 16));
+}
+
+/* Drops a reference with layout_lock held */
+static void
+layoutUnref (struct layoutRun *entry)
+{
+  if (--entry->refs == 0)
+    free (entry);
+}
+
+static void
+layoutUnlink (int i)
+{
+  struct layoutSlot *s = &layout_cache.slot[i];
+
+  if (s->newer >= 0)
+    layout_cache.slot[s->newer].older = s->older;
+  else
+    layout_cache.newest = s->older;
+  if (s->older >= 0)
+    layout_cache.slot[s->older].newer = s->newer;
+  else
+    layout_cache.oldest = s->newer;
+}
+
+static void
+layoutPush (int i)
+{
+  layout_cache.slot[i].newer = -1;
+  layout_cache.slot[i].older = layout_cache.newest;
+  if (layout_cache.newest >= 0)
+    layout_cache.slot[layout_cache.newest].newer = i;
+  layout_cache.newest = i;
+  if (layout_cache.oldest < 0)
+    layout_cache.oldest = i;
+}
+
+/* Takes slot i out of the cache and its hash chain */
+static void
+layoutEvict (int i)
+{
+  struct layoutSlot *s = &layout_cache.slot[i];
+  int *link = &layout_cache.bucket[s->entry->hash % G15_LAYOUT_CACHE_BUCKETS];
+
+  while (*link != i)
+    link = &layout_cache.slot[*link].next;
+  *link = s->next;
+  layoutUnlink (i);
+  layoutUnref (s->entry);
+  s->entry = NULL;
+}
+
+/**
+ * Lays out a string in a G15 font: the string is decoded as UTF-8, broken into lines at
+ * each '\n' and, if asked, wherever a word would cross the right edge of the box, and each
+ * line is aligned within the box.  Characters the font has no glyph for are drawn as '?'
+ * if they are beyond its 256 glyphs and skipped otherwise.
+ *
+ * Runs are cached, so laying out the same string in the same font and box again costs a
+ * hash of the string.  Runs are shared and must not be changed.
+ *
+ * \param font Loaded g15font structure as returned by g15r_loadG15Font()
+ * \param string The text to lay out.
+ * \param width Width of the box in pixels.  If 0, lines are not wrapped and are aligned against the widest of them.
+ * \param flags G15_JUSTIFY_LEFT, G15_JUSTIFY_CENTER or G15_JUSTIFY_RIGHT, or'd with G15_TEXT_WRAP to wrap lines at width.
+ * \return A run holding one reference, to be dropped with g15r_unrefTextRun, or NULL on failure.
+ */
+g15textrun *
+g15r_layoutText (g15font * font, const char *string, int width, int flags)
+{
+  struct layoutRun *entry;
+  unsigned int h;
+  size_t len;
+  int i, b;
+
+  if (font == NULL || string == NULL)
+    return NULL;
+  len = strlen (string);
+  h = layoutHash (font, string, len, width, flags);
+  b = h % G15_LAYOUT_CACHE_BUCKETS;
+
+  pthread_mutex_lock (&layout_lock);
+  if (!layout_cache.ready)
+    {
+      for (i = 0; i < G15_LAYOUT_CACHE_BUCKETS; ++i)
+	layout_cache.bucket[i] = -1;
+      layout_cache.newest = layout_cache.oldest = -1;
+      layout_cache.ready = 1;
+    }
+  for (i = layout_cache.bucket[b]; i >= 0; i = layout_cache.slot[i].next)
+    {
+      entry = layout_cache.slot[i].entry;
+      if (entry->hash == h && entry->run.font == font &&
+	  entry->width == width && entry->flags == flags &&
+	  entry->len == len && memcmp (entry->text, string, len) == 0)
+	{
+	  if (layout_cache.newest != i)
+	    {
+	      layoutUnlink (i);
+	      layoutPush (i);
+	    }
+	  ++entry->refs;
+	  pthread_mutex_unlock (&layout_lock);
+	  return &entry->run;
+	}
+    }
+  pthread_mutex_unlock (&layout_lock);
+
+  entry = layoutNew (font, string, len, width, flags);
+  if (entry == NULL)
+    return NULL;
+  entry->hash = h;
+
+  pthread_mutex_lock (&layout_lock);
+  /* Take a free slot, one left by a flushed font, or the oldest run */
+  if (layout_cache.used < G15_LAYOUT_CACHE_SIZE)
+    i = layout_cache.used++;
+  else
+    {
+      for (i = 0; i < G15_LAYOUT_CACHE_SIZE; ++i)
+	if (layout_cache.slot[i].entry == NULL)
+	  break;
+      if (i == G15_LAYOUT_CACHE_SIZE)
+	{
+	  i = layout_cache.oldest;
+	  layoutEvict (i);
+	}
+    }
+  layout_cache.slot[i].entry = entry;
+  layout_cache.slot[i].next = layout_cache.bucket[b];
+  layout_cache.bucket[b] = i;
+  layoutPush (i);
+  ++entry->refs;
+  pthread_mutex_unlock (&layout_lock);
+  return &entry->run;
+}
+
+/**
+ * Drops a reference to a run returned by g15r_layoutText.
+ *
+ * \param run The run, or NULL.
+ */
+void
+g15r_unrefTextRun (g15textrun * run)
+{
+  if (run == NULL)
+    return;
+  pthread_mutex_lock (&layout_lock);
+  layoutUnref ((struct layoutRun *) run);
+  pthread_mutex_unlock (&layout_lock);
+}
+
+/**
+ * Drops the cached runs of a font, which g15r_deleteG15Font does before freeing it.  Runs
+ * still referenced elsewhere stay valid until they are dropped, but must not be drawn once
+ * their font is gone.
+ *
+ * \param font The font, or NULL for every font.
+ */
+void
+g15r_flushTextRuns (g15font * font)
+{
+  int i;
+
+  pthread_mutex_lock (&layout_lock);
+  for (i = 0; i < layout_cache.used; ++i)
+    if (layout_cache.slot[i].entry != NULL &&
+	(font == NULL || layout_cache.slot[i].entry->run.font == font))
+      layoutEvict (i);
+  pthread_mutex_unlock (&layout_lock);
+}
+
+/**
+ * Draws a run laid out by g15r_layoutText.  Nothing is decoded or measured; glyphs that
+ * fall entirely outside the surface are skipped.
+ *
+ * \param surface A pointer to the g15surface to be drawn on.
+ * \param run The run, or NULL to draw nothing.
+ * \param x Left edge of the box the run was laid out in.
+ * \param y Top of the first line, as for g15s_G15FontRenderString.
+ * \param colour desired colour of the text.
+ * \param paint_bg if !0, pixels in the glyph background will also be painted, obstructing any image behind the text.
+ */
+void
+g15s_drawTextRun (g15surface * surface, const g15textrun * run, int x, int y,
+		  int colour, int paint_bg)
+{
+  g15font *font;
+  int top, i;
+
+  if (run == NULL)
+    return;
+  font = run->font;
+  /* Top of the glyph cell, background included, relative to its line */
+  top = -(int) (font->font_height - font->ascender_height - 1) - 1;
+
+  for (i = 0; i < run->count; ++i)
+    {
+      const g15runglyph *g = &run->glyph[i];
+
+      if (x + g->x >= surface->width || y + g->y + top >= surface->height)
+	continue;
+      g15s_renderG15Glyph (surface, font, g->glyph, x + g->x, y + g->y,
+			   colour, paint_bg);
+    }
+}
+
+/** Draw a run laid out by g15r_layoutText to a canvas.  See g15s_drawTextRun(). */
+void
+g15r_drawTextRun (g15canvas * canvas, const g15textrun * run, int x, int y,
+		  int colour, int paint_bg)
+{
+  g15surface surface;
+
+  g15r_canvasSurface (canvas, &surface);
+  g15s_drawTextRun (&surface, run, x, y, colour, paint_bg);
+}
@@ -55,10 +55,50 @@ extern "C"
 #define G15_FONT_HEADER_SIZE 	15
 #define G15_CHAR_HEADER_SIZE 	4
 #define G15_MAX_GLYPH		256
+#define G15_SURFACE_MAX		16384
+#define G15_FONT_ATLAS		"default.fna"
+#define G15_ATLAS_VERSION	1
+#define G15_ATLAS_HEADER_SIZE	8
+#define G15_ATLAS_INDEX_SIZE	8
 
 #define G15_JUSTIFY_LEFT	0
 #define G15_JUSTIFY_CENTER	1
 #define G15_JUSTIFY_RIGHT	2
+#define G15_TEXT_WRAP		0x10
+
+#define G15_BLIT_COPY		0
+#define G15_BLIT_OR		1
+#define G15_BLIT_ANDNOT		2
+#define G15_BLIT_XOR		3
+#define G15_BLIT_MASKED		4
+#define G15_BLIT_INVERT		0x10
+/** \brief Shared text state (FreeType library, loaded faces and rasterized glyphs), see g15r_newTextContext.*/
+  typedef struct g15textcontext g15textcontext;
+/** \brief A stack of surfaces composited onto one surface, see g15r_newLayers.*/
+  typedef struct g15layers g15layers;
+/** \brief One layer of a g15layers stack.*/
+  typedef struct g15layer g15layer;
+
+/** \brief A 1-bit drawing target.  Every g15s_* drawing function works on one of these.*/
+  typedef struct g15surface
+  {
+/** g15surface::buffer holds height rows of stride bytes each, most significant bit leftmost.  A set bit is black.*/
+    unsigned char *buffer;
+/** g15surface::width is the width of the surface in pixels.*/
+    int width;
+/** g15surface::height is the height of the surface in pixels.*/
+    int height;
+/** g15surface::stride is the number of bytes from the start of one row to the next.*/
+    int stride;
+/** g15surface::damage_x1 and g15surface::damage_x2 point to height entries holding the leftmost and rightmost pixel of each row changed since g15s_resetDamage.  A row is unchanged if damage_x1 > damage_x2.*/
+    unsigned short *damage_x1;
+    unsigned short *damage_x2;
+/** g15surface::mode_xor determines whether xor processing is used in g15s_setPixel.*/
+    int mode_xor;
+/** g15surface::mode_reverse determines whether color values passed to g15s_setPixel are reversed.*/
+    int mode_reverse;
+  } g15surface;
+
 /** \brief This structure holds the data need to render objects to the LCD screen.*/
   typedef struct g15canvas
   {
@@ -70,11 +110,11 @@ extern "C"
     int mode_cache;
 /** g15canvas::mode_reverse determines whether color values passed to g15r_setPixel are reversed.*/
     int mode_reverse;
-#ifdef TTF_SUPPORT
-    FT_Library ftLib;
-    FT_Face ttf_face[G15_MAX_FACE][sizeof (FT_Face)];
-    int ttf_fontsize[G15_MAX_FACE];
-#endif
+/** g15canvas::damage_x1[] and g15canvas::damage_x2[] hold the leftmost and rightmost pixel of each row changed since g15r_resetDamage.  A row is unchanged if damage_x1 > damage_x2.*/
+    unsigned short damage_x1[G15_LCD_HEIGHT];
+    unsigned short damage_x2[G15_LCD_HEIGHT];
+/** g15canvas::text is the text context used by g15r_ttfLoad and g15r_ttfPrint, or NULL until one is needed.  Set it with g15r_setTextContext.*/
+    g15textcontext *text;
   } g15canvas;
 
 /** \brief Structure holding glyph data for g15render font types */
@@ -85,6 +125,8 @@ extern "C"
     unsigned char width;
     /** g15glyph::gap - recommended gap between this character and the next */
     unsigned char gap;
+    /** g15glyph::shifted - glyph rows pre-shifted for each of the 8 pixel offsets within a byte, built on first render */
+    unsigned char *shifted;
 }g15glyph;
 
 /** \brief Structure holding a single font.  One g15font struct is needed per size. */
@@ -103,10 +145,36 @@ typedef struct g15font {
     unsigned int default_gap;
     /** g15font::active - each active glyph is set to 1 else 0 */
     unsigned char active[G15_MAX_GLYPH];
-    /** g15font::glyph_buffer memory pool for glyphs */
+    /** g15font::glyph_buffer memory pool for glyphs, or NULL if the glyphs live elsewhere (e.g. the font atlas) */
     char *glyph_buffer;
 }g15font;
 
+/** \brief One glyph of a g15textrun */
+typedef struct g15runglyph {
+    /** g15runglyph::x - position of the glyph relative to the left edge of the box */
+    int x;
+    /** g15runglyph::y - position of the glyph's line relative to the first line */
+    int y;
+    /** g15runglyph::glyph - index of the glyph in the font */
+    unsigned char glyph;
+} g15runglyph;
+
+/** \brief A string laid out in a G15 font by g15r_layoutText, ready to be drawn */
+typedef struct g15textrun {
+    /** g15textrun::font - the font the glyphs are drawn in */
+    g15font *font;
+    /** g15textrun::width - width in pixels of the widest line */
+    int width;
+    /** g15textrun::lines - number of lines */
+    int lines;
+    /** g15textrun::height - lines * font->lineheight */
+    int height;
+    /** g15textrun::count - number of glyphs */
+    int count;
+    /** g15textrun::glyph - the glyphs in the order they were laid out */
+    g15runglyph *glyph;
+} g15textrun;
+
 /** \brief Fills an area bounded by (x1, y1) and (x2, y2)*/
   void g15r_pixelReverseFill (g15canvas * canvas, int x1, int y1, int x2,
 			      int y2, int fill, int color);
@@ -141,6 +209,15 @@ void g15r_drawBigNum (g15canvas * canvas, unsigned int x1, unsigned int y1, unsi
 /** \brief Draw an XBM image*/
 void
 g15r_drawXBM (g15canvas *canvas, unsigned char* data, int width, int height, int pos_x, int pos_y);
+/** \brief Combine a 1-bit image with the canvas using a raster op*/
+void g15r_blit (g15canvas * canvas, const unsigned char *src,
+		const unsigned char *mask, int src_pitch, int src_x,
+		int src_y, int width, int height, int dst_x, int dst_y,
+		int rop);
+/** \brief Combine an area of a surface with the canvas using a raster op, at any bit offset*/
+void g15r_blitSurface (g15canvas * canvas, const g15surface * src, int src_x,
+		       int src_y, int width, int height, int dst_x, int dst_y,
+		       int rop);
 
 /** \brief Gets the value of the pixel at (x, y)*/
   int g15r_getPixel (g15canvas * canvas, unsigned int x, unsigned int y);
@@ -151,6 +228,17 @@ g15r_drawXBM (g15canvas *canvas, unsigned char* data, int width, int height, int
   void g15r_clearScreen (g15canvas * canvas, int color);
 /** \brief Clears the canvas and resets the mode switches*/
   void g15r_initCanvas (g15canvas * canvas);
+/** \brief Marks the area bounded by (x1, y1) and (x2, y2) as changed*/
+  void g15r_addDamage (g15canvas * canvas, int x1, int y1, int x2, int y2);
+/** \brief Gets the bounding box of the area changed since the last reset, returns 0 if nothing changed*/
+  int g15r_getDamage (g15canvas * canvas, int *x1, int *y1, int *x2,
+		      int *y2);
+/** \brief Gets the changed span of row y, returns 0 if the row is unchanged*/
+  int g15r_getDamageRow (g15canvas * canvas, int y, int *x1, int *x2);
+/** \brief Marks the whole canvas as unchanged*/
+  void g15r_resetDamage (g15canvas * canvas);
+/** \brief Points surface at the pixels, damage and modes of canvas so the g15s_* functions can draw on it*/
+  void g15r_canvasSurface (g15canvas * canvas, g15surface * surface);
 
 /** \brief Renders a character in the large font at (x, y)*/
   void g15r_renderCharacterLarge (g15canvas * canvas, int x, int y,
@@ -173,10 +261,23 @@ g15r_drawXBM (g15canvas *canvas, unsigned char* data, int width, int height, int
 g15font * g15r_loadG15Font(char *filename);
 /** \brief Save font in font struct to given file, return 0 on success */
 int g15r_saveG15Font(char *oFilename, g15font *font);
+/** \brief Save fonts indexed by size to a font atlas file, return 0 on success */
+int g15r_saveG15FontAtlas(char *oFilename, g15font *fonts[], int count);
 /** \brief De-allocate memory associated with font */
 void g15r_deleteG15Font(g15font*font);
-/** \brief Returns length (in pixels) of string if rendered in font 'font'  */
+/** \brief Returns length (in pixels) of the widest line of string if rendered in font 'font'  */
 int g15r_testG15FontWidth(g15font *font,char *string);
+/** \brief Decodes the next UTF-8 character of *string (Latin-1 for invalid bytes) and moves past it, 0 at the end */
+unsigned int g15r_nextCodepoint(const char **string);
+/** \brief Lays out string in 'font', aligned and optionally wrapped in a box of 'width' pixels.  Returns a cached run, NULL on failure */
+g15textrun * g15r_layoutText(g15font *font, const char *string, int width, int flags);
+/** \brief Drops a reference to a run returned by g15r_layoutText */
+void g15r_unrefTextRun(g15textrun *run);
+/** \brief Drops the cached runs laid out in 'font', or in every font if NULL */
+void g15r_flushTextRuns(g15font *font);
+/** \brief Draw a run laid out by g15r_layoutText to canvas, with its box at (x, y) */
+void g15r_drawTextRun(g15canvas *canvas, const g15textrun *run, int x, int y,
+                      int colour, int paint_bg);
 /** \brief Returns g15font structure containing the default font at requested size if available */
 g15font * g15r_requestG15DefaultFont (int size);
 /** \brief render glyph 'character' from loaded font struct 'font'.  Returns width (in pixels) of rendered glyph */
@@ -193,6 +294,127 @@ void g15r_G15FontRenderString (g15canvas * canvas, g15font *font,
 void g15r_G15FPrint (g15canvas *canvas, char *string, int x, int y,
                 int size, int center, int colour, int row);
 
+/** \brief Allocates a blank LCD sized surface, NULL if out of memory*/
+  g15surface *g15s_new (void);
+/** \brief Allocates a blank offscreen surface of width x height, NULL on failure*/
+  g15surface *g15s_newSized (int width, int height);
+/** \brief Frees a surface allocated by g15s_new or g15s_newSized*/
+  void g15s_free (g15surface * surface);
+/** \brief Copies the pixels of src onto dst*/
+  void g15s_copy (g15surface * dst, const g15surface * src);
+/** \brief Gets the value of the pixel at (x, y)*/
+  int g15s_getPixel (g15surface * surface, unsigned int x, unsigned int y);
+/** \brief Sets the value of the pixel at (x, y)*/
+  void g15s_setPixel (g15surface * surface, unsigned int x, unsigned int y,
+		      int val);
+/** \brief Fills the surface with pixels of color*/
+  void g15s_clear (g15surface * surface, int color);
+/** \brief Marks the area bounded by (x1, y1) and (x2, y2) as changed*/
+  void g15s_addDamage (g15surface * surface, int x1, int y1, int x2, int y2);
+/** \brief Gets the bounding box of the area changed since the last reset, returns 0 if nothing changed*/
+  int g15s_getDamage (g15surface * surface, int *x1, int *y1, int *x2,
+		      int *y2);
+/** \brief Gets the changed span of row y, returns 0 if the row is unchanged*/
+  int g15s_getDamageRow (g15surface * surface, int y, int *x1, int *x2);
+/** \brief Marks the whole surface as unchanged*/
+  void g15s_resetDamage (g15surface * surface);
+/** \brief Fills an area bounded by (x1, y1) and (x2, y2)*/
+  void g15s_pixelReverseFill (g15surface * surface, int x1, int y1, int x2,
+			      int y2, int fill, int color);
+/** \brief Overlays a bitmap of size width x height starting at (x1, y1)*/
+  void g15s_pixelOverlay (g15surface * surface, int x1, int y1, int width,
+			  int height, short colormap[]);
+/** \brief Draws a line from (px1, py1) to (px2, py2)*/
+  void g15s_drawLine (g15surface * surface, int px1, int py1, int px2,
+		      int py2, const int color);
+/** \brief Draws a box bounded by (x1, y1) and (x2, y2)*/
+  void g15s_pixelBox (g15surface * surface, int x1, int y1, int x2, int y2,
+		      int color, int thick, int fill);
+/** \brief Draws a circle centered at (x, y) with a radius of r*/
+  void g15s_drawCircle (g15surface * surface, int x, int y, int r, int fill,
+			int color);
+/** \brief Draws a box with rounded corners bounded by (x1, y1) and (x2, y2)*/
+  void g15s_drawRoundBox (g15surface * surface, int x1, int y1, int x2,
+			  int y2, int fill, int color);
+/** \brief Draws a completion bar*/
+  void g15s_drawBar (g15surface * surface, int x1, int y1, int x2, int y2,
+		     int color, int num, int max, int type);
+/** \brief Draw a splash screen from 160x43 wbmp file*/
+  int g15s_loadWbmpSplash (g15surface * surface, char *filename);
+/** \brief Draw an icon to the surface from a wbmp buffer*/
+  void g15s_drawIcon (g15surface * surface, char *buf, int my_x, int my_y,
+		      int width, int height);
+/** \brief Draw a sprite to the surface from a wbmp buffer*/
+  void g15s_drawSprite (g15surface * surface, char *buf, int my_x, int my_y,
+			int width, int height, int start_x, int start_y,
+			int total_width);
+/** \brief Draw a large number*/
+  void g15s_drawBigNum (g15surface * surface, unsigned int x1,
+			unsigned int y1, unsigned int x2, unsigned int y2,
+			int color, int num);
+/** \brief Draw an XBM image*/
+  void g15s_drawXBM (g15surface * surface, unsigned char *data, int width,
+		     int height, int pos_x, int pos_y);
+/** \brief Combine a 1-bit image with the surface using a raster op*/
+  void g15s_blit (g15surface * surface, const unsigned char *src,
+		  const unsigned char *mask, int src_pitch, int src_x,
+		  int src_y, int width, int height, int dst_x, int dst_y,
+		  int rop);
+/** \brief Combine an area of another surface with the surface using a raster op, at any bit offset*/
+  void g15s_blitSurface (g15surface * surface, const g15surface * src,
+			 int src_x, int src_y, int width, int height,
+			 int dst_x, int dst_y, int rop);
+/** \brief render glyph 'character' from loaded font struct 'font'.  Returns width (in pixels) of rendered glyph */
+  int g15s_renderG15Glyph (g15surface * surface, g15font * font,
+			   unsigned char character, int top_left_pixel_x,
+			   int top_left_pixel_y, int colour, int paint_bg);
+/** \brief Render a string in font 'font' to surface */
+  void g15s_G15FontRenderString (g15surface * surface, g15font * font,
+				 char *string, int row, unsigned int sx,
+				 unsigned int sy, int colour, int paint_bg);
+/** \brief Print a string using the G15 default font at size 'size' */
+  void g15s_G15FPrint (g15surface * surface, char *string, int x, int y,
+		       int size, int center, int colour, int row);
+/** \brief Draw a run laid out by g15r_layoutText to surface, with its box at (x, y) */
+  void g15s_drawTextRun (g15surface * surface, const g15textrun * run,
+			 int x, int y, int colour, int paint_bg);
+
+/** \brief Creates an empty layer stack of width x height over a background color, NULL on failure*/
+  g15layers *g15r_newLayers (int width, int height, int background);
+/** \brief Frees a layer stack and all of its layers*/
+  void g15r_freeLayers (g15layers * layers);
+/** \brief Adds a blank width x height layer at position z, NULL on failure*/
+  g15layer *g15r_addLayer (g15layers * layers, int width, int height, int z);
+/** \brief Removes a layer from its stack and frees it*/
+  void g15r_removeLayer (g15layer * layer);
+/** \brief Gets the surface to draw the layer on*/
+  g15surface *g15r_layerSurface (g15layer * layer);
+/** \brief Gets the mask used by G15_BLIT_MASKED, allocating it if needed*/
+  g15surface *g15r_layerMask (g15layer * layer);
+/** \brief Places the upper left corner of the layer at (x, y)*/
+  void g15r_moveLayer (g15layer * layer, int x, int y);
+/** \brief Shows or hides the layer*/
+  void g15r_showLayer (g15layer * layer, int visible);
+/** \brief Sets the raster op combining the layer with those beneath it*/
+  void g15r_setLayerRop (g15layer * layer, int rop);
+/** \brief Moves the layer to position z in its stack*/
+  void g15r_setLayerZ (g15layer * layer, int z);
+/** \brief Marks the whole layer as changed*/
+  void g15r_markLayerDirty (g15layer * layer);
+/** \brief Marks the whole output as changed*/
+  void g15r_invalidateLayers (g15layers * layers);
+/** \brief Composites what changed since the last call onto out, returns 0 if nothing changed*/
+  int g15r_compositeLayers (g15layers * layers, g15surface * out);
+
+/** \brief Creates a text context holding one reference, NULL on failure*/
+  g15textcontext *g15r_newTextContext (void);
+/** \brief Takes another reference to text and returns it*/
+  g15textcontext *g15r_refTextContext (g15textcontext * text);
+/** \brief Drops a reference to text, freeing it with the last one*/
+  void g15r_unrefTextContext (g15textcontext * text);
+/** \brief Makes canvas use text (which may be NULL) for FreeType2 strings*/
+  void g15r_setTextContext (g15canvas * canvas, g15textcontext * text);
+
 #ifdef TTF_SUPPORT
 /** \brief Loads a font through the FreeType2 library*/
   int g15r_ttfLoad (g15canvas * canvas, char *fontname, int fontsize,
@@ -201,6 +423,17 @@ void g15r_G15FPrint (g15canvas *canvas, char *string, int x, int y,
   void g15r_ttfPrint (g15canvas * canvas, int x, int y, int fontsize,
 		      int face_num, int color, int center,
 		      char *print_string);
+/** \brief Turns kerning of FreeType2 strings on or off*/
+  void g15r_ttfSetKerning (g15canvas * canvas, int kerning);
+/** \brief Loads a font into a text context through the FreeType2 library*/
+  int g15r_textLoadTTF (g15textcontext * text, char *fontname, int fontsize,
+			int face_num);
+/** \brief Turns kerning of FreeType2 strings printed with a text context on or off*/
+  void g15r_textSetKerning (g15textcontext * text, int kerning);
+/** \brief Prints a string to a surface in a font loaded into a text context*/
+  void g15s_ttfPrint (g15surface * surface, g15textcontext * text, int x,
+		      int y, int fontsize, int face_num, int color,
+		      int center, char *print_string);
 #endif
 
 #ifdef __cplusplus
@@ -22,18 +22,50 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
 #ifdef TTF_SUPPORT
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_BITMAP_H
 #endif
 
-#ifndef TTF_SUPPORT /* No truetype support */
-int main(char *argv) {
-    printf("g15fontconvert - libg15render has no FreeType support compiled in.  This is required for the conversion program.  Leaving now.\n");
-    return -1;
+/* Pack the default-NN.fnt fonts found in fontdir into one atlas */
+int buildAtlas(char *fontdir, char *oFilename) {
+    g15font *fonts[40];
+    char filename[256];
+    int i, found = 0;
+    int retval;
+
+    for(i=0;i<40;i++) {
+        snprintf(filename,256,"%s/default-%.2i.fnt",fontdir,i);
+        fonts[i] = NULL;
+        if(access(filename,R_OK)!=0)
+            continue;
+        fonts[i] = g15r_loadG15Font(filename);
+        if(fonts[i]==NULL) {
+            printf("Unable to load %s\n",filename);
+            continue;
+        }
+        found++;
+    }
+    if(!found) {
+        printf("No default-NN.fnt fonts found in %s\n",fontdir);
+        return -1;
+    }
+
+    retval = g15r_saveG15FontAtlas(oFilename,fonts,40);
+    for(i=0;i<40;i++)
+        g15r_deleteG15Font(fonts[i]);
+    if(retval<0) {
+        printf("Problem saving atlas\n");
+        return -1;
+    }
+    printf("Atlas of %i fonts saved to %s\n",found,oFilename);
+    return 0;
 }
-#else /* TrueType Support */
+
+#ifdef TTF_SUPPORT
 
 void packpixel(unsigned char *buffer, int width, int x, int y,int colour) {
 
@@ -67,7 +99,7 @@ int convertG15Font(char *inFilename, char *oFilename, int size, int gap){
     }else {
         printf("Bitmap Font has fixed height, ignoring requested size\n");
     }
-    font = malloc(sizeof(g15font));
+    font = calloc(1, sizeof(g15font));
     font->font_height = (face->size->metrics.ascender >> 6) - (face->size->metrics.descender >> 6);
     font->ascender_height = face->size->metrics.ascender >> 6;
     font->lineheight = face->size->metrics.height >> 6;
@@ -152,9 +184,12 @@ int convertG15Font(char *inFilename, char *oFilename, int size, int gap){
     return 0;
 }
 
+#endif /* Truetype support */
+
 void helptext() {
     printf("g15fontconvert - (c) 2008 The G15Tools project\n");
     printf(" -h\t--help\t\t\tThis helptext\n");
+    printf(" -a\t--atlas [fontdir]\tPack default-NN.fnt from fontdir into a font atlas (default output %s)\n",G15_FONT_ATLAS);
     printf(" -s\t--size [size]\t\tSpecify size in pixels of desired font (default 10pixels high)\n");
     printf(" -g\t--gap [gap]\t\tSpecify gap in pixels between characters (default 1pixel)\n");
     printf(" -i\t--infile [filename]\tFilename of font to convert\n");
@@ -168,9 +203,10 @@ int main(int argc, char **argv) {
     int gap = -1;
     int have_infile=0;
     int have_outfile=0;
+    int have_atlas=0;
     char infile[128];
     char outfile[128];
-    FT_Init_FreeType(&lib);
+    char fontdir[128];
     
     if(argc<2)
         helptext();
@@ -195,6 +231,13 @@ int main(int argc, char **argv) {
                 have_infile=1;
             }
         }
+        if(0==strncasecmp((char*)argv[i],"-a",2) || 0==strncasecmp((char*)argv[i],"--atlas",7)){
+            if(argv[i+1]!=NULL) {
+                strncpy(fontdir,argv[++i],127);
+                fontdir[127]=0;
+                have_atlas=1;
+            }
+        }
         if(0==strncasecmp((char*)argv[i],"-o",2) || 0==strncasecmp((char*)argv[i],"--outfile",9)){
             if(argv[i+1]!=NULL) {
                 strncpy(outfile,argv[++i],127);
@@ -202,6 +245,16 @@ int main(int argc, char **argv) {
             }
         }
     }
+    if(have_atlas) {
+        if(!have_outfile)
+            snprintf(outfile,128,"%s",G15_FONT_ATLAS);
+        return buildAtlas(fontdir,outfile) < 0 ? 1 : 0;
+    }
+
+#ifndef TTF_SUPPORT /* No truetype support */
+    printf("g15fontconvert - libg15render has no FreeType support compiled in.  This is required for the conversion program.  Leaving now.\n");
+    return -1;
+#else /* TrueType Support */
     if(!have_infile)
         helptext();
     
@@ -216,6 +269,7 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    FT_Init_FreeType(&lib);
     printf("converting %s\n",infile);
     if(convertG15Font(infile, outfile, size,gap)<0)
         printf("problem saving font %s..\n",outfile);
@@ -223,6 +277,5 @@ int main(int argc, char **argv) {
         printf("Done.\n");
     FT_Done_FreeType(lib);
     return 0;
-}
-
 #endif /* Truetype support */
+}
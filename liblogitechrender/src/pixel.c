@@ -18,11 +18,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
 #include "liblogitechrender.h"
 
+/* What a span fill does to each covered pixel once the surface modes are applied */
+#define SPAN_KEEP	0
+#define SPAN_CLEAR	1
+#define SPAN_SET	2
+#define SPAN_INVERT	3
+
 void
 swap (int *x, int *y)
 {
@@ -33,11 +40,592 @@ swap (int *x, int *y)
   *y = tmp;
 }
 
+/*
+ * Work out what filling with color does to a pixel, folding in the same
+ * mode_xor and mode_reverse handling as g15s_setPixel.
+ */
+static int
+spanOp (g15surface * surface, int color)
+{
+  int val = color ? 1 : 0;
+
+  if (surface->mode_reverse)
+    val = !val;
+  if (surface->mode_xor)
+    return val ? SPAN_INVERT : SPAN_KEEP;
+  return val ? SPAN_SET : SPAN_CLEAR;
+}
+
+static inline void
+spanMask (unsigned char *byte, unsigned char mask, int op)
+{
+  if (op == SPAN_SET)
+    *byte |= mask;
+  else if (op == SPAN_CLEAR)
+    *byte &= ~mask;
+  else
+    *byte ^= mask;
+}
+
+/* Marks x1..x2 of row y as changed; the caller has already clipped them */
+static inline void
+damageRow (g15surface * surface, int y, int x1, int x2)
+{
+  if (x1 < surface->damage_x1[y])
+    surface->damage_x1[y] = x1;
+  if (x2 > surface->damage_x2[y])
+    surface->damage_x2[y] = x2;
+}
+
+/*
+ * Applies op to the pixels from bit offset first to last (inclusive) of
+ * buffer.  Partial bytes at either end are masked, whole bytes in between
+ * are handled with memset or 64 bits at a time.
+ */
+static void
+fillSpan (unsigned char *buffer, unsigned int first, unsigned int last,
+	  int op)
+{
+  unsigned int fb = first / BYTE_SIZE;
+  unsigned int lb = last / BYTE_SIZE;
+  unsigned char lmask = 0xFF >> (first % BYTE_SIZE);
+  unsigned char rmask = 0xFF << (7 - last % BYTE_SIZE);
+  unsigned char *p, *end;
+
+  if (fb == lb)
+    {
+      spanMask (buffer + fb, lmask & rmask, op);
+      return;
+    }
+
+  spanMask (buffer + fb, lmask, op);
+  spanMask (buffer + lb, rmask, op);
+
+  p = buffer + fb + 1;
+  end = buffer + lb;
+  if (op == SPAN_SET || op == SPAN_CLEAR)
+    {
+      memset (p, op == SPAN_SET ? 0xFF : 0, end - p);
+      return;
+    }
+
+  /* Rows need not start on a word boundary; memcpy keeps the words legal */
+  for (; end - p >= (int) sizeof (uint64_t); p += sizeof (uint64_t))
+    {
+      uint64_t w;
+      memcpy (&w, p, sizeof (w));
+      w = ~w;
+      memcpy (p, &w, sizeof (w));
+    }
+  for (; p < end; ++p)
+    *p = ~*p;
+}
+
+/*
+ * Applies op to the area with an upper left corner at (x1, y1) and lower
+ * right corner at (x2, y2), clipped to the surface.  Full-width areas of a
+ * surface without row padding are one contiguous run of the buffer and are
+ * done in a single span.
+ */
+static void
+fillRect (g15surface * surface, int x1, int y1, int x2, int y2, int op)
+{
+  unsigned int pitch = surface->stride * BYTE_SIZE;
+  int y;
+
+  if (op == SPAN_KEEP)
+    return;
+
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 >= surface->width)
+    x2 = surface->width - 1;
+  if (y2 >= surface->height)
+    y2 = surface->height - 1;
+  if (x1 > x2 || y1 > y2)
+    return;
+
+  if (x1 == 0 && x2 == (int) pitch - 1)
+    {
+      fillSpan (surface->buffer, y1 * pitch, (y2 + 1) * pitch - 1, op);
+      for (y = y1; y <= y2; ++y)
+	damageRow (surface, y, x1, x2);
+      return;
+    }
+
+  for (y = y1; y <= y2; ++y)
+    {
+      fillSpan (surface->buffer, y * pitch + x1, y * pitch + x2, op);
+      damageRow (surface, y, x1, x2);
+    }
+}
+
+/*
+ * Applies op to column x from y1 to y2 (y1 <= y2), clipped to the surface.
+ */
+static void
+fillColumn (g15surface * surface, int x, int y1, int y2, int op)
+{
+  unsigned char *p, mask;
+  int y;
+
+  if (x < 0 || x >= surface->width)
+    return;
+  if (y1 < 0)
+    y1 = 0;
+  if (y2 >= surface->height)
+    y2 = surface->height - 1;
+
+  p = surface->buffer + y1 * surface->stride + x / BYTE_SIZE;
+  mask = 0x80 >> (x % BYTE_SIZE);
+  for (y = y1; y <= y2; ++y, p += surface->stride)
+    {
+      spanMask (p, mask, op);
+      damageRow (surface, y, x, x);
+    }
+}
+
+#define OUT_LEFT	1
+#define OUT_RIGHT	2
+#define OUT_TOP		4
+#define OUT_BOTTOM	8
+
+/* Cohen-Sutherland region code of (x, y) against the surface */
+static int
+outCode (g15surface * surface, int x, int y)
+{
+  int code = 0;
+
+  if (x < 0)
+    code |= OUT_LEFT;
+  else if (x >= surface->width)
+    code |= OUT_RIGHT;
+  if (y < 0)
+    code |= OUT_TOP;
+  else if (y >= surface->height)
+    code |= OUT_BOTTOM;
+  return code;
+}
+
+/*
+ * Draws the Bresenham line from (px1, py1) to (px2, py2) straight into the
+ * buffer, visiting only the part of it that is on the surface.
+ *
+ * Cutting the line at the edges the usual Cohen-Sutherland way would round
+ * the new end points and step a slightly different line, so the outcodes
+ * are only used to accept or reject it outright.  Otherwise the visible
+ * range of steps is solved for exactly: after k steps along the major axis
+ * the minor axis has moved n(k) = (2 k dminor + dmajor) / (2 dmajor) times,
+ * which is what the error term in g15s_drawLine used to accumulate.
+ */
+static void
+clipLine (g15surface * surface, int px1, int py1, int px2, int py2, int op)
+{
+  int code1 = outCode (surface, px1, py1);
+  int code2 = outCode (surface, px2, py2);
+  int steep = abs (py2 - py1) > abs (px2 - px1);
+  int major_max = steep ? surface->height - 1 : surface->width - 1;
+  int minor_max = steep ? surface->width - 1 : surface->height - 1;
+  int pitch = surface->stride * BYTE_SIZE;
+  long long dmajor, dminor, first, last, n, error;
+  int minor_step, major_x, major_y, minor_x, minor_y, x, y, offset;
+
+  if (code1 & code2)
+    return;
+
+  if (steep)
+    {
+      swap (&px1, &py1);
+      swap (&px2, &py2);
+    }
+  if (px1 > px2)
+    {
+      swap (&px1, &px2);
+      swap (&py1, &py2);
+    }
+
+  dmajor = (long long) px2 - px1;
+  dminor = llabs ((long long) py2 - py1);
+  minor_step = (py1 < py2) ? 1 : -1;
+  first = 0;
+  last = dmajor;
+
+  if (code1 | code2)
+    {
+      /* Range of minor axis moves that keep the line on the surface */
+      long long lo, hi;
+
+      if (minor_step > 0)
+	{
+	  lo = -(long long) py1;
+	  hi = (long long) minor_max - py1;
+	}
+      else
+	{
+	  lo = (long long) py1 - minor_max;
+	  hi = py1;
+	}
+      if (hi < 0 || lo > dminor)
+	return;
+
+      if (px1 < 0)
+	first = -(long long) px1;
+      if (px2 > major_max)
+	last = (long long) major_max - px1;
+      /* First step k with n(k) >= m is ceil ((2 m - 1) dmajor / (2 dminor)) */
+      if (lo > 0)
+	{
+	  long long k = ((2 * lo - 1) * dmajor + 2 * dminor - 1) / (2 * dminor);
+	  if (k > first)
+	    first = k;
+	}
+      if (hi < dminor)
+	{
+	  long long k =
+	    ((2 * hi + 1) * dmajor + 2 * dminor - 1) / (2 * dminor) - 1;
+	  if (k < last)
+	    last = k;
+	}
+      if (first > last)
+	return;
+    }
+
+  n = (2 * first * dminor + dmajor) / (2 * dmajor);
+  error = first * dminor - n * dmajor;
+
+  if (steep)
+    {
+      x = py1 + minor_step * n;
+      y = px1 + first;
+      major_x = 0;
+      major_y = 1;
+      minor_x = minor_step;
+      minor_y = 0;
+    }
+  else
+    {
+      x = px1 + first;
+      y = py1 + minor_step * n;
+      major_x = 1;
+      major_y = 0;
+      minor_x = 0;
+      minor_y = minor_step;
+    }
+  offset = y * pitch + x;
+
+  for (; first <= last; ++first)
+    {
+      spanMask (surface->buffer + offset / BYTE_SIZE,
+		0x80 >> (offset % BYTE_SIZE), op);
+      damageRow (surface, y, x, x);
+
+      x += major_x;
+      y += major_y;
+      error += dminor;
+      if (2 * error >= dmajor)
+	{
+	  x += minor_x;
+	  y += minor_y;
+	  error -= dmajor;
+	}
+      offset = y * pitch + x;
+    }
+}
+
+/* The blit op that draws an image the way g15s_setPixel would */
+static int
+copyRop (g15surface * surface)
+{
+  return (surface->mode_xor ? G15_BLIT_XOR : G15_BLIT_COPY) |
+    (surface->mode_reverse ? G15_BLIT_INVERT : 0);
+}
+
+static inline unsigned char
+reverseBits (unsigned char b)
+{
+  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+  return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+}
+
+/*
+ * The 8 source bits that land under a destination byte, taken from bytes i
+ * and i + 1 of a source row.  Bytes outside 0..last read as 0 so the edges
+ * never touch memory past the image.
+ */
+static inline unsigned char
+shiftedByte (const unsigned char *row, int i, int sh, int last)
+{
+  unsigned char hi = (i < 0 || i > last) ? 0 : row[i];
+  unsigned char lo = (sh == 0 || i + 1 > last) ? 0 : row[i + 1];
+
+  return sh ? (hi << sh | lo >> (8 - sh)) : hi;
+}
+
+static inline void
+ropByte (unsigned char *d, unsigned char v, unsigned char dm, int op)
+{
+  switch (op)
+    {
+    case G15_BLIT_OR:
+      *d |= v & dm;
+      break;
+    case G15_BLIT_ANDNOT:
+      *d &= ~(v & dm);
+      break;
+    case G15_BLIT_XOR:
+      *d ^= v & dm;
+      break;
+    default:
+      *d = (*d & ~dm) | (v & dm);
+      break;
+    }
+}
+
+/* 8 bytes as one word, the first byte most significant like the pixels */
+static inline uint64_t
+loadWord (const unsigned char *p)
+{
+  return (uint64_t) p[0] << 56 | (uint64_t) p[1] << 48 | (uint64_t) p[2] << 40 |
+    (uint64_t) p[3] << 32 | (uint64_t) p[4] << 24 | (uint64_t) p[5] << 16 |
+    (uint64_t) p[6] << 8 | (uint64_t) p[7];
+}
+
+static inline void
+storeWord (unsigned char *p, uint64_t w)
+{
+  p[0] = (unsigned char) (w >> 56);
+  p[1] = (unsigned char) (w >> 48);
+  p[2] = (unsigned char) (w >> 40);
+  p[3] = (unsigned char) (w >> 32);
+  p[4] = (unsigned char) (w >> 24);
+  p[5] = (unsigned char) (w >> 16);
+  p[6] = (unsigned char) (w >> 8);
+  p[7] = (unsigned char) w;
+}
+
+/* The 64 source bits that land under 8 destination bytes, as shiftedByte */
+static inline uint64_t
+shiftedWord (const unsigned char *p, int sh)
+{
+  uint64_t w = loadWord (p);
+
+  return sh ? (w << sh | p[BYTE_SIZE] >> (8 - sh)) : w;
+}
+
+static inline void
+ropWord (unsigned char *d, uint64_t v, uint64_t dm, int op)
+{
+  uint64_t w = loadWord (d);
+
+  switch (op)
+    {
+    case G15_BLIT_OR:
+      w |= v & dm;
+      break;
+    case G15_BLIT_ANDNOT:
+      w &= ~(v & dm);
+      break;
+    case G15_BLIT_XOR:
+      w ^= v & dm;
+      break;
+    default:
+      w = (w & ~dm) | (v & dm);
+      break;
+    }
+  storeWord (d, w);
+}
+
+/**
+ * Combines a width x height area of a 1-bit image with the surface, with its upper left
+ * corner at (dst_x, dst_y).  The area is clipped to the surface once and each row is shifted
+ * into place a byte at a time, so the source and destination need not be byte aligned.
+ *
+ * The source holds src_pitch bits per row, most significant bit first; rows need not
+ * start on a byte boundary.  Set bits are black.  The surface modes are not applied;
+ * pick the op instead.
+ *
+ * \param surface A pointer to the g15surface to be drawn on.
+ * \param src The source image.
+ * \param mask For G15_BLIT_MASKED, an image laid out like src whose set bits select the pixels copied.  Otherwise unused.
+ * \param src_pitch Number of bits per row of src (and mask).
+ * \param src_x Leftmost column of the area in src.
+ * \param src_y Uppermost row of the area in src.
+ * \param width Width of the area.
+ * \param height Height of the area.
+ * \param dst_x Leftmost boundary of the area on the surface.
+ * \param dst_y Uppermost boundary of the area on the surface.
+ * \param rop One of G15_BLIT_COPY, G15_BLIT_OR, G15_BLIT_ANDNOT, G15_BLIT_XOR or G15_BLIT_MASKED, optionally or'd with G15_BLIT_INVERT to invert the source first.
+ */
+void
+g15s_blit (g15surface * surface, const unsigned char *src,
+	   const unsigned char *mask, int src_pitch, int src_x, int src_y,
+	   int width, int height, int dst_x, int dst_y, int rop)
+{
+  unsigned char invert = (rop & G15_BLIT_INVERT) ? 0xFF : 0;
+  int op = rop & ~G15_BLIT_INVERT;
+  int y;
+
+  if (op == G15_BLIT_MASKED && mask == NULL)
+    op = G15_BLIT_COPY;
+
+  /* Clip against the surface and the top left of the source */
+  if (dst_x < 0)
+    {
+      src_x -= dst_x;
+      width += dst_x;
+      dst_x = 0;
+    }
+  if (dst_y < 0)
+    {
+      src_y -= dst_y;
+      height += dst_y;
+      dst_y = 0;
+    }
+  if (src_x < 0)
+    {
+      dst_x -= src_x;
+      width += src_x;
+      src_x = 0;
+    }
+  if (src_y < 0)
+    {
+      dst_y -= src_y;
+      height += src_y;
+      src_y = 0;
+    }
+  if (width > surface->width - dst_x)
+    width = surface->width - dst_x;
+  if (height > surface->height - dst_y)
+    height = surface->height - dst_y;
+  if (width <= 0 || height <= 0)
+    return;
+
+  int dphase = dst_x % BYTE_SIZE;
+  int nbytes = (dphase + width - 1) / BYTE_SIZE + 1;
+  unsigned char lmask = 0xFF >> dphase;
+  unsigned char rmask = 0xFF << (7 - (dphase + width - 1) % BYTE_SIZE);
+
+  for (y = 0; y < height; ++y)
+    {
+      unsigned long sbit = (unsigned long) (src_y + y) * src_pitch + src_x;
+      const unsigned char *s = src + sbit / BYTE_SIZE;
+      const unsigned char *m = mask ? mask + sbit / BYTE_SIZE : NULL;
+      unsigned char *d = surface->buffer + (dst_y + y) * surface->stride +
+	dst_x / BYTE_SIZE;
+      int off = (int) (sbit % BYTE_SIZE) - dphase;
+      int base = off < 0 ? -1 : 0;
+      int sh = off - BYTE_SIZE * base;
+      int last = ((int) (sbit % BYTE_SIZE) + width - 1) / BYTE_SIZE;
+      int k;
+
+      damageRow (surface, dst_y + y, dst_x, dst_x + width - 1);
+
+      /* An aligned copy, say between layer caches, moves the inner bytes whole */
+      if (op == G15_BLIT_COPY && !invert && sh == 0 && nbytes > 2)
+	{
+	  ropByte (d, shiftedByte (s, 0, 0, last), lmask, op);
+	  memcpy (d + 1, s + 1, nbytes - 2);
+	  ropByte (d + nbytes - 1, shiftedByte (s, nbytes - 1, 0, last),
+		   rmask, op);
+	  continue;
+	}
+
+      for (k = 0; k < nbytes; ++k)
+	{
+	  unsigned char dm = 0xFF, v;
+	  int i = k + base;
+
+	  /* Runs of 8 inner bytes are done a word at a time */
+	  if (k > 0 && k + BYTE_SIZE < nbytes)
+	    {
+	      uint64_t wv = shiftedWord (s + i, sh), wm = ~(uint64_t) 0;
+
+	      if (op == G15_BLIT_MASKED)
+		wm = shiftedWord (m + i, sh);
+	      ropWord (d + k, invert ? ~wv : wv, wm, op);
+	      k += BYTE_SIZE - 1;
+	      continue;
+	    }
+
+	  /* Edge bytes are masked; inner ones take all 8 bits from the row */
+	  if (k == 0 || k == nbytes - 1)
+	    {
+	      if (k == 0)
+		dm &= lmask;
+	      if (k == nbytes - 1)
+		dm &= rmask;
+	      v = shiftedByte (s, i, sh, last);
+	      if (op == G15_BLIT_MASKED)
+		dm &= shiftedByte (m, i, sh, last);
+	    }
+	  else if (sh)
+	    {
+	      v = s[i] << sh | s[i + 1] >> (8 - sh);
+	      if (op == G15_BLIT_MASKED)
+		dm = m[i] << sh | m[i + 1] >> (8 - sh);
+	    }
+	  else
+	    {
+	      v = s[i];
+	      if (op == G15_BLIT_MASKED)
+		dm = m[i];
+	    }
+
+	  ropByte (d + k, v ^ invert, dm, op);
+	}
+    }
+}
+
+/**
+ * Combines the width x height area of src with its upper left corner at (src_x, src_y)
+ * with the surface, placing it at (dst_x, dst_y).  The area is clipped to both surfaces
+ * and neither position need be byte aligned, so a surface larger than the LCD can be
+ * drawn once and then scrolled a pixel at a time with one call per frame.
+ *
+ * \param surface A pointer to the g15surface to be drawn on.
+ * \param src The surface to be read.  It must not share pixels with surface.
+ * \param src_x Leftmost column of the area in src.
+ * \param src_y Uppermost row of the area in src.
+ * \param width Width of the area.
+ * \param height Height of the area.
+ * \param dst_x Leftmost boundary of the area on the surface.
+ * \param dst_y Uppermost boundary of the area on the surface.
+ * \param rop As for g15s_blit; G15_BLIT_MASKED copies.
+ */
+void
+g15s_blitSurface (g15surface * surface, const g15surface * src, int src_x,
+		  int src_y, int width, int height, int dst_x, int dst_y,
+		  int rop)
+{
+  if (src_x < 0)
+    {
+      dst_x -= src_x;
+      width += src_x;
+      src_x = 0;
+    }
+  if (src_y < 0)
+    {
+      dst_y -= src_y;
+      height += src_y;
+      src_y = 0;
+    }
+  if (width > src->width - src_x)
+    width = src->width - src_x;
+  if (height > src->height - src_y)
+    height = src->height - src_y;
+
+  g15s_blit (surface, src->buffer, NULL, src->stride * BYTE_SIZE, src_x,
+	     src_y, width, height, dst_x, dst_y, rop);
+}
+
 /**
  *  The area with an upper left corner at (x1, y1) and lower right corner at (x2, y2) will be
  *  filled with color if fill>0 or the current contents of the area will be reversed if fill==0.
  *
- *  \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ *  \param surface A pointer to the g15surface to be drawn on.
  *  \param x1 Defines leftmost bound of area to be filled.
  *  \param y1 Defines uppermost bound of area to be filled.
  *  \param x2 Defines rightmost bound of area to be filled.
@@ -46,28 +634,31 @@ swap (int *x, int *y)
  *  \param color If fill != 0, then area will be filled if color == 1 and emptied if color == 0.
  */
 void
-g15r_pixelReverseFill (g15canvas * canvas, int x1, int y1, int x2, int y2,
+g15s_pixelReverseFill (g15surface * surface, int x1, int y1, int x2, int y2,
 		       int fill, int color)
 {
-  int x = 0;
-  int y = 0;
+  int op;
 
-  for (x = x1; x <= x2; ++x)
-    {
-      for (y = y1; y <= y2; ++y)
-	{
-	  if (!fill)
-	    color = !g15r_getPixel (canvas, x, y);
-	  g15r_setPixel (canvas, x, y, color);
-	}
-    }
+  /*
+   * Reversing hands !old to g15s_setPixel, so under xor every pixel ends up
+   * as 1 (or 0 when reversed) and otherwise the area is inverted unless
+   * mode_reverse flips it straight back.
+   */
+  if (fill)
+    op = spanOp (surface, color);
+  else if (surface->mode_xor)
+    op = surface->mode_reverse ? SPAN_CLEAR : SPAN_SET;
+  else
+    op = surface->mode_reverse ? SPAN_KEEP : SPAN_INVERT;
+
+  fillRect (surface, x1, y1, x2, y2, op);
 }
 
 /**
- * A 1-bit bitmap defined in colormap[] is drawn to the canvas with an upper left corner at (x1, y1)
+ * A 1-bit bitmap defined in colormap[] is drawn to the surface with an upper left corner at (x1, y1)
  * and a lower right corner at (x1+width, y1+height).
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x1 Defines the leftmost bound of the area to be drawn.
  * \param y1 Defines the uppermost bound of the area to be drawn.
  * \param width Defines the width of the bitmap to be drawn.
@@ -75,24 +666,40 @@ g15r_pixelReverseFill (g15canvas * canvas, int x1, int y1, int x2, int y2,
  * \param colormap An array containing width*height entries of value 0 for pixel off or != 0 for pixel on.
  */
 void
-g15r_pixelOverlay (g15canvas * canvas, int x1, int y1, int width, int height,
+g15s_pixelOverlay (g15surface * surface, int x1, int y1, int width, int height,
 		   short colormap[])
 {
-  int i = 0;
+  unsigned char row[G15_LCD_WIDTH / BYTE_SIZE];
+  int x0, x2, x, y, c, n;
 
-  for (i = 0; i < (width * height); ++i)
-    {
-      int color = (colormap[i] ? G15_COLOR_BLACK : G15_COLOR_WHITE);
-      int x = x1 + i % width;
-      int y = y1 + i / width;
-      g15r_setPixel (canvas, x, y, color);
-    }
+  /* Only the columns that can land on the surface are packed */
+  x0 = x1 < 0 ? -x1 : 0;
+  x2 = width;
+  if (x2 > surface->width - x1)
+    x2 = surface->width - x1;
+  if (x0 >= x2)
+    return;
+
+  for (y = 0; y < height; ++y)
+    for (c = x0; c < x2; c += n)
+      {
+	/* Wide surfaces take a row in several pieces */
+	n = x2 - c;
+	if (n > (int) sizeof (row) * BYTE_SIZE)
+	  n = sizeof (row) * BYTE_SIZE;
+	memset (row, 0, sizeof (row));
+	for (x = c; x < c + n; ++x)
+	  if (colormap[y * width + x])
+	    row[(x - c) / BYTE_SIZE] |= 0x80 >> ((x - c) % BYTE_SIZE);
+	g15s_blit (surface, row, NULL, 0, 0, 0, n, 1, x1 + c, y1 + y,
+		   copyRop (surface));
+      }
 }
 
 /**
  * A line of color is drawn from (px1, py1) to (px2, py2).
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param px1 X component of point 1.
  * \param py1 Y component of point 1.
  * \param px2 X component of point 2.
@@ -100,53 +707,28 @@ g15r_pixelOverlay (g15canvas * canvas, int x1, int y1, int width, int height,
  * \param color Line will be drawn this color.
  */
 void
-g15r_drawLine (g15canvas * canvas, int px1, int py1, int px2, int py2,
+g15s_drawLine (g15surface * surface, int px1, int py1, int px2, int py2,
 	       const int color)
 {
-  /*
-   * Bresenham's Line Algorithm
-   * http://en.wikipedia.org/wiki/Bresenham's_algorithm
-   */
+  int op = spanOp (surface, color);
 
-  int steep = 0;
-
-  if (abs (py2 - py1) > abs (px2 - px1))
-    steep = 1;
+  if (op == SPAN_KEEP)
+    return;
 
-  if (steep)
+  if (py1 == py2)
     {
-      swap (&px1, &py1);
-      swap (&px2, &py2);
+      if (px1 > px2)
+	swap (&px1, &px2);
+      fillRect (surface, px1, py1, px2, py1, op);
     }
-
-  if (px1 > px2)
+  else if (px1 == px2)
     {
-      swap (&px1, &px2);
-      swap (&py1, &py2);
-    }
-
-  int dx = px2 - px1;
-  int dy = abs (py2 - py1);
-
-  int error = 0;
-  int y = py1;
-  int ystep = (py1 < py2) ? 1 : -1;
-  int x = 0;
-
-  for (x = px1; x <= px2; ++x)
-    {
-      if (steep)
-	g15r_setPixel (canvas, y, x, color);
-      else
-	g15r_setPixel (canvas, x, y, color);
-
-      error += dy;
-      if (2 * error >= dx)
-	{
-	  y += ystep;
-	  error -= dx;
-	}
+      if (py1 > py2)
+	swap (&py1, &py2);
+      fillColumn (surface, px1, py1, py2, op);
     }
+  else
+    clipLine (surface, px1, py1, px2, py2, op);
 }
 
 /**
@@ -154,7 +736,7 @@ g15r_drawLine (g15canvas * canvas, int px1, int py1, int px2, int py2,
  *
  * The box will be filled if fill != 0 and the sides will be thick pixels wide.
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x1 Defines leftmost bound of the box.
  * \param y1 Defines uppermost bound of the box.
  * \param x2 Defines rightmost bound of the box.
@@ -164,31 +746,24 @@ g15r_drawLine (g15canvas * canvas, int px1, int py1, int px2, int py2,
  * \param fill The box will be filled with color if fill != 0.
  */
 void
-g15r_pixelBox (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
+g15s_pixelBox (g15surface * surface, int x1, int y1, int x2, int y2, int color,
 	       int thick, int fill)
 {
   int i = 0;
   for (i = 0; i < thick; ++i)
     {
-      g15r_drawLine (canvas, x1, y1, x2, y1, color);	/* Top    */
-      g15r_drawLine (canvas, x1, y1, x1, y2, color);	/* Left   */
-      g15r_drawLine (canvas, x2, y1, x2, y2, color);	/* Right  */
-      g15r_drawLine (canvas, x1, y2, x2, y2, color);	/* Bottom */
+      g15s_drawLine (surface, x1, y1, x2, y1, color);	/* Top    */
+      g15s_drawLine (surface, x1, y1, x1, y2, color);	/* Left   */
+      g15s_drawLine (surface, x2, y1, x2, y2, color);	/* Right  */
+      g15s_drawLine (surface, x1, y2, x2, y2, color);	/* Bottom */
       x1++;
       y1++;
       x2--;
       y2--;
     }
 
-  int x = 0, y = 0;
-
   if (fill)
-    {
-      for (x = x1; x <= x2; ++x)
-	for (y = y1; y <= y2; ++y)
-	  g15r_setPixel (canvas, x, y, color);
-    }
-
+    fillRect (surface, x1, y1, x2, y2, spanOp (surface, color));
 }
 
 /**
@@ -196,7 +771,7 @@ g15r_pixelBox (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
  *
  * The circle will be filled if fill != 0.
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x Defines horizontal center of the circle.
  * \param y Defines vertical center of circle.
  * \param r Defines radius of circle.
@@ -204,7 +779,7 @@ g15r_pixelBox (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
  * \param color Lines defining the circle will be drawn this color.
  */
 void
-g15r_drawCircle (g15canvas * canvas, int x, int y, int r, int fill, int color)
+g15s_drawCircle (g15surface * surface, int x, int y, int r, int fill, int color)
 {
   int xx, yy, dd;
 
@@ -216,15 +791,15 @@ g15r_drawCircle (g15canvas * canvas, int x, int y, int r, int fill, int color)
     {
       if (!fill)
 	{
-	  g15r_setPixel (canvas, x + xx, y - yy, color);
-	  g15r_setPixel (canvas, x + xx, y + yy, color);
-	  g15r_setPixel (canvas, x - xx, y - yy, color);
-	  g15r_setPixel (canvas, x - xx, y + yy, color);
+	  g15s_setPixel (surface, x + xx, y - yy, color);
+	  g15s_setPixel (surface, x + xx, y + yy, color);
+	  g15s_setPixel (surface, x - xx, y - yy, color);
+	  g15s_setPixel (surface, x - xx, y + yy, color);
 	}
       else
 	{
-	  g15r_drawLine (canvas, x - xx, y - yy, x + xx, y - yy, color);
-	  g15r_drawLine (canvas, x - xx, y + yy, x + xx, y + yy, color);
+	  g15s_drawLine (surface, x - xx, y - yy, x + xx, y - yy, color);
+	  g15s_drawLine (surface, x - xx, y + yy, x + xx, y + yy, color);
 	}
       if (dd + yy > 0)
 	{
@@ -244,7 +819,7 @@ g15r_drawCircle (g15canvas * canvas, int x, int y, int r, int fill, int color)
  *
  * The box will be filled if fill != 0.
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x1 Defines leftmost bound of the box.
  * \param y1 Defines uppermost bound of the box.
  * \param x2 Defines rightmost bound of the box.
@@ -253,7 +828,7 @@ g15r_drawCircle (g15canvas * canvas, int x, int y, int r, int fill, int color)
  * \param color Lines defining the box will be drawn this color.
  */
 void
-g15r_drawRoundBox (g15canvas * canvas, int x1, int y1, int x2, int y2,
+g15s_drawRoundBox (g15surface * surface, int x1, int y1, int x2, int y2,
 		   int fill, int color)
 {
   int y, shave = 3;
@@ -267,29 +842,29 @@ g15r_drawRoundBox (g15canvas * canvas, int x1, int y1, int x2, int y2,
     {
       if (fill)
 	{
-	  g15r_drawLine (canvas, x1 + shave, y1, x2 - shave, y1, color);
+	  g15s_drawLine (surface, x1 + shave, y1, x2 - shave, y1, color);
 	  for (y = y1 + 1; y < y1 + shave; y++)
-	    g15r_drawLine (canvas, x1 + 1, y, x2 - 1, y, color);
+	    g15s_drawLine (surface, x1 + 1, y, x2 - 1, y, color);
 	  for (y = y1 + shave; y <= y2 - shave; y++)
-	    g15r_drawLine (canvas, x1, y, x2, y, color);
+	    g15s_drawLine (surface, x1, y, x2, y, color);
 	  for (y = y2 - shave + 1; y < y2; y++)
-	    g15r_drawLine (canvas, x1 + 1, y, x2 - 1, y, color);
-	  g15r_drawLine (canvas, x1 + shave, y2, x2 - shave, y2, color);
+	    g15s_drawLine (surface, x1 + 1, y, x2 - 1, y, color);
+	  g15s_drawLine (surface, x1 + shave, y2, x2 - shave, y2, color);
 	  if (shave == 4)
 	    {
-	      g15r_setPixel (canvas, x1 + 1, y1 + 1,
+	      g15s_setPixel (surface, x1 + 1, y1 + 1,
 			     color ==
 			     G15_COLOR_WHITE ? G15_COLOR_BLACK :
 			     G15_COLOR_WHITE);
-	      g15r_setPixel (canvas, x1 + 1, y2 - 1,
+	      g15s_setPixel (surface, x1 + 1, y2 - 1,
 			     color ==
 			     G15_COLOR_WHITE ? G15_COLOR_BLACK :
 			     G15_COLOR_WHITE);
-	      g15r_setPixel (canvas, x2 - 1, y1 + 1,
+	      g15s_setPixel (surface, x2 - 1, y1 + 1,
 			     color ==
 			     G15_COLOR_WHITE ? G15_COLOR_BLACK :
 			     G15_COLOR_WHITE);
-	      g15r_setPixel (canvas, x2 - 1, y2 - 1,
+	      g15s_setPixel (surface, x2 - 1, y2 - 1,
 			     color ==
 			     G15_COLOR_WHITE ? G15_COLOR_BLACK :
 			     G15_COLOR_WHITE);
@@ -297,27 +872,27 @@ g15r_drawRoundBox (g15canvas * canvas, int x1, int y1, int x2, int y2,
 	}
       else
 	{
-	  g15r_drawLine (canvas, x1 + shave, y1, x2 - shave, y1, color);
-	  g15r_drawLine (canvas, x1, y1 + shave, x1, y2 - shave, color);
-	  g15r_drawLine (canvas, x2, y1 + shave, x2, y2 - shave, color);
-	  g15r_drawLine (canvas, x1 + shave, y2, x2 - shave, y2, color);
+	  g15s_drawLine (surface, x1 + shave, y1, x2 - shave, y1, color);
+	  g15s_drawLine (surface, x1, y1 + shave, x1, y2 - shave, color);
+	  g15s_drawLine (surface, x2, y1 + shave, x2, y2 - shave, color);
+	  g15s_drawLine (surface, x1 + shave, y2, x2 - shave, y2, color);
 	  if (shave > 1)
 	    {
-	      g15r_drawLine (canvas, x1 + 1, y1 + 1, x1 + shave - 1, y1 + 1,
+	      g15s_drawLine (surface, x1 + 1, y1 + 1, x1 + shave - 1, y1 + 1,
 			     color);
-	      g15r_drawLine (canvas, x2 - shave + 1, y1 + 1, x2 - 1, y1 + 1,
+	      g15s_drawLine (surface, x2 - shave + 1, y1 + 1, x2 - 1, y1 + 1,
 			     color);
-	      g15r_drawLine (canvas, x1 + 1, y2 - 1, x1 + shave - 1, y2 - 1,
+	      g15s_drawLine (surface, x1 + 1, y2 - 1, x1 + shave - 1, y2 - 1,
 			     color);
-	      g15r_drawLine (canvas, x2 - shave + 1, y2 - 1, x2 - 1, y2 - 1,
+	      g15s_drawLine (surface, x2 - shave + 1, y2 - 1, x2 - 1, y2 - 1,
 			     color);
-	      g15r_drawLine (canvas, x1 + 1, y1 + 1, x1 + 1, y1 + shave - 1,
+	      g15s_drawLine (surface, x1 + 1, y1 + 1, x1 + 1, y1 + shave - 1,
 			     color);
-	      g15r_drawLine (canvas, x1 + 1, y2 - 1, x1 + 1, y2 - shave + 1,
+	      g15s_drawLine (surface, x1 + 1, y2 - 1, x1 + 1, y2 - shave + 1,
 			     color);
-	      g15r_drawLine (canvas, x2 - 1, y1 + 1, x2 - 1, y1 + shave - 1,
+	      g15s_drawLine (surface, x2 - 1, y1 + 1, x2 - 1, y1 + shave - 1,
 			     color);
-	      g15r_drawLine (canvas, x2 - 1, y2 - 1, x2 - 1, y2 - shave + 1,
+	      g15s_drawLine (surface, x2 - 1, y2 - 1, x2 - 1, y2 - shave + 1,
 			     color);
 	    }
 	}
@@ -327,7 +902,7 @@ g15r_drawRoundBox (g15canvas * canvas, int x1, int y1, int x2, int y2,
 /**
  * Given a maximum value, and a value between 0 and that maximum value, calculate and draw a bar showing that percentage.
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x1 Defines leftmost bound of the bar.
  * \param y1 Defines uppermost bound of the bar.
  * \param x2 Defines rightmost bound of the bar.
@@ -338,7 +913,7 @@ g15r_drawRoundBox (g15canvas * canvas, int x1, int y1, int x2, int y2,
  * \param type Type of bar.  1=solid bar, 2=solid bar with border, 3 = solid bar with I-frame.
  */
 void
-g15r_drawBar (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
+g15s_drawBar (g15surface * surface, int x1, int y1, int x2, int y2, int color,
 	      int num, int max, int type)
 {
   float len, length;
@@ -360,34 +935,34 @@ g15r_drawBar (g15canvas * canvas, int x1, int y1, int x2, int y2, int color,
 
   if (type == 1)
     {
-      g15r_pixelBox (canvas, x1, y1 - type, x2, y2 + type, color ^ 1, 1, 1);
-      g15r_pixelBox (canvas, x1, y1 - type, x2, y2 + type, color, 1, 0);
+      g15s_pixelBox (surface, x1, y1 - type, x2, y2 + type, color ^ 1, 1, 1);
+      g15s_pixelBox (surface, x1, y1 - type, x2, y2 + type, color, 1, 0);
     }
   else if (type == 2)
     {
-      g15r_pixelBox (canvas, x1 - 2, y1 - type, x2 + 2, y2 + type, color ^ 1,
+      g15s_pixelBox (surface, x1 - 2, y1 - type, x2 + 2, y2 + type, color ^ 1,
 		     1, 1);
-      g15r_pixelBox (canvas, x1 - 2, y1 - type, x2 + 2, y2 + type, color, 1,
+      g15s_pixelBox (surface, x1 - 2, y1 - type, x2 + 2, y2 + type, color, 1,
 		     0);
     }
   else if (type == 3)
     {
-      g15r_drawLine (canvas, x1, y1 - type, x1, y2 + type, color);
-      g15r_drawLine (canvas, x2, y1 - type, x2, y2 + type, color);
-      g15r_drawLine (canvas, x1, y1 + ((y2 - y1) / 2), x2,
+      g15s_drawLine (surface, x1, y1 - type, x1, y2 + type, color);
+      g15s_drawLine (surface, x2, y1 - type, x2, y2 + type, color);
+      g15s_drawLine (surface, x1, y1 + ((y2 - y1) / 2), x2,
 		     y1 + ((y2 - y1) / 2), color);
     }
-  g15r_pixelBox (canvas, x1, y1, (int) ceil (x1 + length), y2, color, 1, 1);
+  g15s_pixelBox (surface, x1, y1, (int) ceil (x1 + length), y2, color, 1, 1);
 }
 
 /**
  * wbmp splash screen loader - assumes image is 160x43
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param filename A string holding the path to the wbmp to be displayed.
  */
 int
-g15r_loadWbmpSplash(g15canvas *canvas, char *filename)
+g15s_loadWbmpSplash(g15surface *surface, char *filename)
 {
     int width=0, height=0;
     char *buf;
@@ -395,15 +970,20 @@ g15r_loadWbmpSplash(g15canvas *canvas, char *filename)
     buf = g15r_loadWbmpToBuf(filename,
                              &width,
                              &height);
+    if (buf == NULL)
+      return -1;
 
-    memcpy (canvas->buffer, buf, G15_BUFFER_LEN);
+    /* The image replaces what is there, whatever the drawing modes */
+    g15s_blit (surface, (unsigned char *) buf, NULL, width, 0, 0, width,
+               height, 0, 0, G15_BLIT_COPY);
+    free (buf);
     return 0;
 }
 
 /**
- * Draw an icon to a canvas
+ * Draw an icon to a surface
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated in is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param buf A pointer to the buffer holding the icon to be displayed.
  * \param my_x Leftmost boundary of image.
  * \param my_y Topmost boundary of image.
@@ -411,32 +991,16 @@ g15r_loadWbmpSplash(g15canvas *canvas, char *filename)
  * \param height Height of the image in buf.
  */
 void
-g15r_drawIcon(g15canvas *canvas, char *buf, int my_x, int my_y, int width, int height)
+g15s_drawIcon(g15surface *surface, char *buf, int my_x, int my_y, int width, int height)
 {
-    int y,x,val;
-    unsigned int pixel_offset = 0;
-    unsigned int byte_offset, bit_offset;
-
-	//TODO:http://www.g15tools.com/forum/viewtopic.php?p=314#p314
-	// Does his new piece of code work? Is it better than below? If so, replace.
-    for (y=0; y < height; y++)
-	{
-      for (x=0; x < width; x++)
-        {
-		pixel_offset = y * width + x;
-		byte_offset = pixel_offset / BYTE_SIZE;
-		bit_offset = 7 - (pixel_offset % BYTE_SIZE);
-
-		val = (buf[byte_offset] & (1 << bit_offset)) >> bit_offset;
-		g15r_setPixel (canvas, x + my_x, y + my_y, val);
-        }
-	}
+    g15s_blit (surface, (unsigned char *) buf, NULL, width, 0, 0, width, height,
+	       my_x, my_y, copyRop (surface));
 }
 
 /**
- * Draw a sprite to a canvas
+ * Draw a sprite to a surface
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated in is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param buf A pointer to the buffer holding a set of sprites.
  * \param my_x Leftmost boundary of image.
  * \param my_y Topmost boundary of image.
@@ -447,22 +1011,10 @@ g15r_drawIcon(g15canvas *canvas, char *buf, int my_x, int my_y, int width, int h
  * \param total_width Width of the set of sprites held in buf.
  */
 void
-g15r_drawSprite(g15canvas *canvas, char *buf, int my_x, int my_y, int width, int height, int start_x, int start_y, int total_width)
+g15s_drawSprite(g15surface *surface, char *buf, int my_x, int my_y, int width, int height, int start_x, int start_y, int total_width)
 {
-    int y,x,val;
-    unsigned int pixel_offset = 0;
-    unsigned int byte_offset, bit_offset;
-
-    for (y=0; y < height - 1; y++)
-      for (x=0; x < width - 1; x++)
-        {
-		pixel_offset = (y + start_y) * total_width + (x + start_x);
-		byte_offset = pixel_offset / BYTE_SIZE;
-		bit_offset = 7 - (pixel_offset % BYTE_SIZE);
-
-		val = (buf[byte_offset] & (1 << bit_offset)) >> bit_offset;
-		g15r_setPixel (canvas, x + my_x, y + my_y, val);
-        }
+    g15s_blit (surface, (unsigned char *) buf, NULL, total_width, start_x,
+	       start_y, width, height, my_x, my_y, copyRop (surface));
 }
 
 /**
@@ -539,9 +1091,9 @@ g15r_loadWbmpToBuf(char *filename, int *img_width, int *img_height)
 }
 
 /**
- * Draw a large number to a canvas
+ * Draw a large number to a surface
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x1 Defines leftmost bound of the number.
  * \param y1 Defines uppermost bound of the number.
  * \param x2 Defines rightmost bound of the number.
@@ -550,76 +1102,76 @@ g15r_loadWbmpToBuf(char *filename, int *img_width, int *img_height)
  * \param num The number to be drawn.
  */
 void
-g15r_drawBigNum (g15canvas * canvas, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2, int color, int num)
+g15s_drawBigNum (g15surface * surface, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2, int color, int num)
 {
     x1 += 2;
     x2 -= 2;
 
     switch(num){
         case 0:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1 +5, y1 +5, x2 -5, y2 - 6, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1 +5, y1 +5, x2 -5, y2 - 6, 1 - color, 1, 1);
             break;
         case 1:
-            g15r_pixelBox (canvas, x2-5, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1, x2 -5, y2, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x2-5, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2 -5, y2, 1 - color, 1, 1);
             break;
         case 2:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+5, x2 -5, y1+((y2/2)-3), 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+((y2/2)+3), x2 , y2-6, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+5, x2 -5, y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+((y2/2)+3), x2 , y2-6, 1 - color, 1, 1);
             break;
         case 3:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+5, x2 -5, y1+((y2/2)-3), 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+5, x2 -5, y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
             break;
         case 4:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+((y2/2)+3), x2 -5, y2, 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1, x2-5 , y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+((y2/2)+3), x2 -5, y2, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1, x2-5 , y1+((y2/2)-3), 1 - color, 1, 1);
             break;
         case 5:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+5, x2 , y1+((y2/2)-3), 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+5, x2 , y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
             break;
         case 6:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+5, x2 , y1+((y2/2)-3), 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+5, x2 , y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
             break;
         case 7:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+5, x2 -5, y2, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+5, x2 -5, y2, 1 - color, 1, 1);
             break;
         case 8:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+5, x2-5 , y1+((y2/2)-3), 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+5, x2-5 , y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+((y2/2)+3), x2-5 , y2-6, 1 - color, 1, 1);
             break;
         case 9:
-            g15r_pixelBox (canvas, x1, y1, x2, y2 , color, 1, 1);
-            g15r_pixelBox (canvas, x1+5, y1+5, x2-5 , y1+((y2/2)-3), 1 - color, 1, 1);
-            g15r_pixelBox (canvas, x1, y1+((y2/2)+3), x2-5 , y2, 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x1+5, y1+5, x2-5 , y1+((y2/2)-3), 1 - color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+((y2/2)+3), x2-5 , y2, 1 - color, 1, 1);
             break;
         case 10:
-            g15r_pixelBox (canvas, x2-5, y1+5, x2, y1+10 , color, 1, 1);
-            g15r_pixelBox (canvas, x2-5, y2-10, x2, y2-5 , color, 1, 1);
+            g15s_pixelBox (surface, x2-5, y1+5, x2, y1+10 , color, 1, 1);
+            g15s_pixelBox (surface, x2-5, y2-10, x2, y2-5 , color, 1, 1);
             break;
         case 11:
-            g15r_pixelBox (canvas, x1, y1+((y2/2)-2), x2, y1+((y2/2)+2), color, 1, 1);
+            g15s_pixelBox (surface, x1, y1+((y2/2)-2), x2, y1+((y2/2)+2), color, 1, 1);
             break;
         case 12:
-            g15r_pixelBox (canvas, x2-5, y2-5, x2, y2 , color, 1, 1);
+            g15s_pixelBox (surface, x2-5, y2-5, x2, y2 , color, 1, 1);
             break;
     }
 }
 
 /**
- * Draw an XBM Image to the canvas
+ * Draw an XBM Image to the surface
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated in is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param data A pointer to the buffer holding the icon to be displayed.
  * \param width Width of the image in data.
  * \param height Height of the image in data.
@@ -627,35 +1179,48 @@ g15r_drawBigNum (g15canvas * canvas, unsigned int x1, unsigned int y1, unsigned
  * \param pos_y Topmost boundary of image.
  */
 void
-g15r_drawXBM (g15canvas *canvas, unsigned char* data, int width, int height, int pos_x, int pos_y)
+g15s_drawXBM (g15surface *surface, unsigned char* data, int width, int height, int pos_x, int pos_y)
 {
-   int y = 0;
-   int z = 0;
-   unsigned char byte;
-   int bytes_per_row = ceil ((double) width / 8);
+   unsigned char row[G15_LCD_WIDTH / BYTE_SIZE + 1];
+   int bytes_per_row = (width + 7) / 8;
+   int x0, x2, first, last, y, z, c, end, lo, hi, rop;
+
+   /* Only set bits are painted, as black through g15s_setPixel */
+   if (surface->mode_xor)
+     {
+       if (surface->mode_reverse)
+	 return;
+       rop = G15_BLIT_XOR;
+     }
+   else
+     rop = surface->mode_reverse ? G15_BLIT_ANDNOT : G15_BLIT_OR;
 
-   int bits_left = width;
-   int current_bit = 0;
+   x0 = pos_x < 0 ? -pos_x : 0;
+   x2 = width;
+   if (x2 > surface->width - pos_x)
+     x2 = surface->width - pos_x;
+   if (x0 >= x2)
+     return;
+   first = x0 / 8;
+   last = (x2 - 1) / 8;
 
+   /*
+    * XBM rows are LSB first; flip the visible bytes into surface bit order,
+    * a row buffer at a time on surfaces wider than it.
+    */
    for (y = 0; y < height; y++)
    {
-      bits_left = width;
-      for (z=0; z < bytes_per_row; z++)
+      for (c = first; c <= last; c = end + 1)
       {
-         byte = data[(y * bytes_per_row) + z];
-         current_bit = 0;
-         while (current_bit < 8)
-         {
-            if (bits_left > 0)
-            {
-               if ((byte >> current_bit) & 1)
-               {
-                  g15r_setPixel(canvas, (current_bit + (z*8) + pos_x),y + pos_y,G15_COLOR_BLACK);
-               }
-               bits_left--;
-            }
-            current_bit++;
-         }
+         end = c + (int) sizeof (row) - 1;
+         if (end > last)
+            end = last;
+         for (z = c; z <= end; z++)
+            row[z - c] = reverseBits (data[(y * bytes_per_row) + z]);
+         lo = x0 > c * 8 ? x0 : c * 8;
+         hi = x2 - 1 < end * 8 + 7 ? x2 - 1 : end * 8 + 7;
+         g15s_blit (surface, row, NULL, 0, lo - c * 8, 0, hi - lo + 1, 1,
+                    pos_x + lo, pos_y + y, rop);
       }
    }
 }
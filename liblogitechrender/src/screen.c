@@ -17,86 +17,278 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <stdlib.h>
 #include "liblogitechrender.h"
 
+/**
+ * Allocates a blank offscreen surface of any size, for instance a long list or a wide
+ * ticker that is drawn once and then shown a window at a time with g15s_blitSurface.
+ * The pixels, damage and surface live in one block, so copying it costs only the pixel
+ * bytes and g15s_free releases all of it.
+ *
+ * \param width Width of the surface in pixels, 1 to G15_SURFACE_MAX.
+ * \param height Height of the surface in pixels, 1 to G15_SURFACE_MAX.
+ * \return The new surface, or NULL if the size is out of range or it could not be allocated.
+ */
+g15surface *
+g15s_newSized (int width, int height)
+{
+  int stride = (width + BYTE_SIZE - 1) / BYTE_SIZE;
+  size_t damage = (size_t) height * sizeof (unsigned short);
+  g15surface *surface;
+
+  if (width <= 0 || height <= 0 || width > G15_SURFACE_MAX
+      || height > G15_SURFACE_MAX)
+    return NULL;
+
+  surface = calloc (1, sizeof (g15surface) + 2 * damage +
+		    (size_t) stride * height);
+  if (surface == NULL)
+    return NULL;
+
+  surface->width = width;
+  surface->height = height;
+  surface->stride = stride;
+  surface->damage_x1 = (unsigned short *) (surface + 1);
+  surface->damage_x2 = surface->damage_x1 + height;
+  surface->buffer = (unsigned char *) (surface->damage_x2 + height);
+  g15s_resetDamage (surface);
+  g15s_addDamage (surface, 0, 0, surface->width - 1, surface->height - 1);
+  return surface;
+}
+
+/**
+ * Allocates a blank surface the size of the LCD.
+ *
+ * \return The new surface, or NULL if it could not be allocated.
+ */
+g15surface *
+g15s_new (void)
+{
+  return g15s_newSized (G15_LCD_WIDTH, G15_LCD_HEIGHT);
+}
+
+/**
+ * Frees a surface allocated by g15s_new or g15s_newSized.  Surfaces filled in by g15r_canvasSurface belong
+ * to their canvas and must not be passed here.
+ *
+ * \param surface The surface to be freed, or NULL.
+ */
+void
+g15s_free (g15surface * surface)
+{
+  free (surface);
+}
+
+/**
+ * Copies the pixels of src onto dst, for instance to restore a background drawn once.
+ * Only the rows and columns the two have in common are copied, and only they are marked
+ * as changed on dst.  The drawing modes of neither are used.
+ *
+ * \param dst The surface to be drawn on.
+ * \param src The surface whose pixels are copied.
+ */
+void
+g15s_copy (g15surface * dst, const g15surface * src)
+{
+  int height = dst->height < src->height ? dst->height : src->height;
+  int width = dst->width < src->width ? dst->width : src->width;
+  int len = (width + BYTE_SIZE - 1) / BYTE_SIZE;
+  int y;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  if (dst->stride == src->stride && len == dst->stride)
+    memcpy (dst->buffer, src->buffer, (size_t) len * height);
+  else
+    for (y = 0; y < height; ++y)
+      memcpy (dst->buffer + y * dst->stride, src->buffer + y * src->stride,
+	      len);
+  g15s_addDamage (dst, 0, 0, width - 1, height - 1);
+}
+
 /**
  * Retrieves the value of the pixel at (x, y)
  * 
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be read.
  * \param x X offset for pixel to be retrieved.
  * \param y Y offset for pixel to be retrieved.
  */
 int
-g15r_getPixel (g15canvas * canvas, unsigned int x, unsigned int y)
+g15s_getPixel (g15surface * surface, unsigned int x, unsigned int y)
 {
-  if (x >= G15_LCD_WIDTH || y >= G15_LCD_HEIGHT)
+  if (x >= (unsigned int) surface->width || y >= (unsigned int) surface->height)
     return 0;
 
-  unsigned int pixel_offset = y * G15_LCD_WIDTH + x;
-  unsigned int byte_offset = pixel_offset / BYTE_SIZE;
-  unsigned int bit_offset = 7 - (pixel_offset % BYTE_SIZE);
+  unsigned int byte_offset = y * surface->stride + x / BYTE_SIZE;
+  unsigned int bit_offset = 7 - (x % BYTE_SIZE);
 
-  return (canvas->buffer[byte_offset] & (1 << bit_offset)) >> bit_offset;
+  return (surface->buffer[byte_offset] & (1 << bit_offset)) >> bit_offset;
 }
 
 /**
  * Sets the value of the pixel at (x, y)
  * 
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param x X offset for pixel to be set.
  * \param y Y offset for pixel to be set.
  * \param val Value to which pixel should be set.
  */
 void
-g15r_setPixel (g15canvas * canvas, unsigned int x, unsigned int y, int val)
+g15s_setPixel (g15surface * surface, unsigned int x, unsigned int y, int val)
 {
-  if (x >= G15_LCD_WIDTH || y >= G15_LCD_HEIGHT)
+  if (x >= (unsigned int) surface->width || y >= (unsigned int) surface->height)
     return;
 
-  unsigned int pixel_offset = y * G15_LCD_WIDTH + x;
-  unsigned int byte_offset = pixel_offset / BYTE_SIZE;
-  unsigned int bit_offset = 7 - (pixel_offset % BYTE_SIZE);
+  unsigned int byte_offset = y * surface->stride + x / BYTE_SIZE;
+  unsigned int bit_offset = 7 - (x % BYTE_SIZE);
 
-  if (canvas->mode_xor)
-    val ^= g15r_getPixel (canvas, x, y);
-  if (canvas->mode_reverse)
+  if (x < surface->damage_x1[y])
+    surface->damage_x1[y] = x;
+  if (x > surface->damage_x2[y])
+    surface->damage_x2[y] = x;
+
+  if (surface->mode_xor)
+    val ^= g15s_getPixel (surface, x, y);
+  if (surface->mode_reverse)
     val = !val;
 
   if (val)
-    canvas->buffer[byte_offset] =
-      canvas->buffer[byte_offset] | 1 << bit_offset;
+    surface->buffer[byte_offset] =
+      surface->buffer[byte_offset] | 1 << bit_offset;
   else
-    canvas->buffer[byte_offset] =
-      canvas->buffer[byte_offset] & ~(1 << bit_offset);
+    surface->buffer[byte_offset] =
+      surface->buffer[byte_offset] & ~(1 << bit_offset);
 
 }
 
 /**
- * Clears the screen and fills it with pixels of color
+ * Clears the surface and fills it with pixels of color
  * 
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
- * \param color Screen will be filled with this color.
+ * \param surface A pointer to the g15surface to be drawn on.
+ * \param color Surface will be filled with this color.
  */
 void
-g15r_clearScreen (g15canvas * canvas, int color)
+g15s_clear (g15surface * surface, int color)
 {
-  memset (canvas->buffer, (color ? 0xFF : 0), G15_BUFFER_LEN);
+  memset (surface->buffer, (color ? 0xFF : 0),
+	  (size_t) surface->stride * surface->height);
+  g15s_addDamage (surface, 0, 0, surface->width - 1, surface->height - 1);
 }
 
 /**
- * Clears the screen and resets the mode values for a canvas
- * 
- * \param canvas A pointer to a g15canvas struct
+ * Marks an area of the surface as changed.  The drawing functions do this themselves;
+ * call it after writing to surface->buffer directly.
+ *
+ * \param surface A pointer to the g15surface to be operated on.
+ * \param x1 Defines leftmost bound of the area.
+ * \param y1 Defines uppermost bound of the area.
+ * \param x2 Defines rightmost bound of the area.
+ * \param y2 Defines bottommost bound of the area.
  */
 void
-g15r_initCanvas (g15canvas * canvas)
+g15s_addDamage (g15surface * surface, int x1, int y1, int x2, int y2)
 {
-  memset (canvas->buffer, 0, G15_BUFFER_LEN);
-  canvas->mode_cache = 0;
-  canvas->mode_reverse = 0;
-  canvas->mode_xor = 0;
-#ifdef TTF_SUPPORT
-  if (FT_Init_FreeType (&canvas->ftLib))
-    printf ("Freetype couldnt initialise\n");
-#endif
+  int y;
+
+  if (x1 < 0)
+    x1 = 0;
+  if (y1 < 0)
+    y1 = 0;
+  if (x2 >= surface->width)
+    x2 = surface->width - 1;
+  if (y2 >= surface->height)
+    y2 = surface->height - 1;
+  if (x1 > x2)
+    return;
+
+  for (y = y1; y <= y2; ++y)
+    {
+      if (x1 < surface->damage_x1[y])
+	surface->damage_x1[y] = x1;
+      if (x2 > surface->damage_x2[y])
+	surface->damage_x2[y] = x2;
+    }
+}
+
+/**
+ * Retrieves the bounding box of everything changed since the last g15s_resetDamage.
+ *
+ * \param surface A pointer to the g15surface to be operated on.
+ * \param x1 If not NULL, receives the leftmost changed column.
+ * \param y1 If not NULL, receives the uppermost changed row.
+ * \param x2 If not NULL, receives the rightmost changed column.
+ * \param y2 If not NULL, receives the bottommost changed row.
+ * \return 1 if anything changed, else 0 and the bounds are left alone.
+ */
+int
+g15s_getDamage (g15surface * surface, int *x1, int *y1, int *x2, int *y2)
+{
+  int y, top = -1, bottom = -1, left = surface->width, right = -1;
+
+  for (y = 0; y < surface->height; ++y)
+    {
+      if (surface->damage_x1[y] > surface->damage_x2[y])
+	continue;
+      if (top < 0)
+	top = y;
+      bottom = y;
+      if (surface->damage_x1[y] < left)
+	left = surface->damage_x1[y];
+      if (surface->damage_x2[y] > right)
+	right = surface->damage_x2[y];
+    }
+  if (top < 0)
+    return 0;
+
+  if (x1)
+    *x1 = left;
+  if (y1)
+    *y1 = top;
+  if (x2)
+    *x2 = right;
+  if (y2)
+    *y2 = bottom;
+  return 1;
+}
+
+/**
+ * Retrieves the span of row y changed since the last g15s_resetDamage.
+ *
+ * \param surface A pointer to the g15surface to be operated on.
+ * \param y Row to be queried.
+ * \param x1 If not NULL, receives the leftmost changed column.
+ * \param x2 If not NULL, receives the rightmost changed column.
+ * \return 1 if the row changed, else 0.
+ */
+int
+g15s_getDamageRow (g15surface * surface, int y, int *x1, int *x2)
+{
+  if (y < 0 || y >= surface->height
+      || surface->damage_x1[y] > surface->damage_x2[y])
+    return 0;
+
+  if (x1)
+    *x1 = surface->damage_x1[y];
+  if (x2)
+    *x2 = surface->damage_x2[y];
+  return 1;
+}
+
+/**
+ * Marks the whole surface as unchanged, typically once its contents have been sent.
+ *
+ * \param surface A pointer to the g15surface to be operated on.
+ */
+void
+g15s_resetDamage (g15surface * surface)
+{
+  int y;
+
+  for (y = 0; y < surface->height; ++y)
+    {
+      surface->damage_x1[y] = surface->width;
+      surface->damage_x2[y] = 0;
+    }
 }
@@ -19,11 +19,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "liblogitechrender.h"
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static g15font *defaultfont[40];
 
+/* The default font atlas, mapped on first use and kept for the life of the process */
+static const unsigned char *font_atlas;
+static size_t font_atlas_len;
+static int font_atlas_tried;
+
 /** Render a character in std large font
  * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
  * \param col size-dependent column to start rendering.
@@ -99,51 +107,331 @@ g15r_renderString (g15canvas * canvas, unsigned char stringOut[], int row,
       g15r_G15FPrint (canvas, (char*)stringOut, sx, sy, size, 0, G15_COLOR_BLACK, row);
 }
 
+/* Blit op for painting set glyph bits in colour, as g15r_setPixel would, or -1 if they are left alone */
+static int glyphRop(g15surface *surface, int colour)
+{
+    int val = (colour ? 1 : 0) ^ (surface->mode_reverse ? 1 : 0);
+
+    if(surface->mode_xor)
+        return val ? G15_BLIT_XOR : -1;
+    return val ? G15_BLIT_OR : G15_BLIT_ANDNOT;
+}
+
+/*
+ * Everything FreeType needs to print.  Canvases only point at one of these,
+ * so copying their pixels never touches font state and g15canvas is the same
+ * size whether or not TTF support is built in.
+ */
+struct g15textcontext {
+  int refs;
+#ifdef TTF_SUPPORT
+  FT_Library ftLib;
+  FT_Face ttf_face[G15_MAX_FACE];
+  int ttf_fontsize[G15_MAX_FACE];
+  struct g15ttf_cache *ttf_cache;
+  int ttf_kerning;
+#endif
+};
+
 #ifdef TTF_SUPPORT
+#define G15_TTF_CACHE_SIZE	256
+#define G15_TTF_CACHE_BUCKETS	128
+
+/* A rasterized glyph, packed 1 bit per pixel with pitch * 8 bits per row */
+struct g15ttf_glyph {
+  FT_Face face;
+  FT_Fixed x_scale, y_scale;
+  FT_ULong codepoint;
+  FT_UInt index;
+  int advance;
+  int left, top;
+  int width, rows, pitch;
+  unsigned char *bitmap;
+  int next;			/* hash chain */
+  int newer, older;		/* LRU list */
+};
+
+/*
+ * Glyphs keyed by face, size and codepoint, most recently used first.  Both
+ * measuring and drawing go through it, so a string costs FreeType nothing
+ * once its glyphs have been seen.
+ */
+struct g15ttf_cache {
+  struct g15ttf_glyph glyph[G15_TTF_CACHE_SIZE];
+  int bucket[G15_TTF_CACHE_BUCKETS];
+  int newest, oldest, used;
+};
+
+static unsigned int
+ttf_cache_hash (FT_Face face, FT_Fixed x_scale, FT_Fixed y_scale,
+		FT_ULong codepoint)
+{
+  unsigned long h = (unsigned long) face;
+
+  h ^= (unsigned long) x_scale * 31 + (unsigned long) y_scale;
+  h = h * 2654435761u + codepoint;
+  return (h ^ (h >> 16)) % G15_TTF_CACHE_BUCKETS;
+}
+
+static void
+ttf_cache_unlink (struct g15ttf_cache *cache, int i)
+{
+  struct g15ttf_glyph *g = &cache->glyph[i];
+
+  if (g->newer >= 0)
+    cache->glyph[g->newer].older = g->older;
+  else
+    cache->newest = g->older;
+  if (g->older >= 0)
+    cache->glyph[g->older].newer = g->newer;
+  else
+    cache->oldest = g->newer;
+}
+
+static void
+ttf_cache_push (struct g15ttf_cache *cache, int i)
+{
+  cache->glyph[i].newer = -1;
+  cache->glyph[i].older = cache->newest;
+  if (cache->newest >= 0)
+    cache->glyph[cache->newest].newer = i;
+  cache->newest = i;
+  if (cache->oldest < 0)
+    cache->oldest = i;
+}
+
+/* Takes entry i out of the cache and its hash chain */
+static void
+ttf_cache_evict (struct g15ttf_cache *cache, int i)
+{
+  struct g15ttf_glyph *g = &cache->glyph[i];
+  int *link = &cache->bucket[ttf_cache_hash (g->face, g->x_scale, g->y_scale,
+					     g->codepoint)];
+
+  while (*link != i)
+    link = &cache->glyph[*link].next;
+  *link = g->next;
+  ttf_cache_unlink (cache, i);
+  free (g->bitmap);
+  g->bitmap = NULL;
+  g->face = NULL;
+}
+
+/* Drops every glyph of face, before it is destroyed */
+static void
+ttf_cache_forget (g15textcontext * text, FT_Face face)
+{
+  struct g15ttf_cache *cache = text->ttf_cache;
+  int i;
+
+  if (cache == NULL)
+    return;
+  for (i = 0; i < cache->used; i++)
+    if (cache->glyph[i].face == face)
+      ttf_cache_evict (cache, i);
+}
+
+/*
+ * Returns the cached glyph for codepoint at the face's current size,
+ * rendering it on a miss.  NULL if FreeType cannot load it.
+ */
+static struct g15ttf_glyph *
+ttf_cache_lookup (g15textcontext * text, FT_Face face, FT_ULong codepoint)
+{
+  struct g15ttf_cache *cache = text->ttf_cache;
+  FT_Fixed x_scale = face->size->metrics.x_scale;
+  FT_Fixed y_scale = face->size->metrics.y_scale;
+  unsigned int h = ttf_cache_hash (face, x_scale, y_scale, codepoint);
+  struct g15ttf_glyph *g;
+  FT_GlyphSlot slot = face->glyph;
+  FT_Bitmap bitmap;
+  int i, x, y;
+
+  if (cache == NULL)
+    {
+      cache = calloc (1, sizeof (struct g15ttf_cache));
+      if (cache == NULL)
+	return NULL;
+      for (i = 0; i < G15_TTF_CACHE_BUCKETS; i++)
+	cache->bucket[i] = -1;
+      cache->newest = cache->oldest = -1;
+      text->ttf_cache = cache;
+    }
+
+  for (i = cache->bucket[h]; i >= 0; i = cache->glyph[i].next)
+    {
+      g = &cache->glyph[i];
+      if (g->face == face && g->codepoint == codepoint &&
+	  g->x_scale == x_scale && g->y_scale == y_scale)
+	{
+	  if (cache->newest != i)
+	    {
+	      ttf_cache_unlink (cache, i);
+	      ttf_cache_push (cache, i);
+	    }
+	  return g;
+	}
+    }
+
+  if (FT_Load_Char (face, codepoint,
+		    FT_LOAD_RENDER | FT_LOAD_MONOCHROME | FT_LOAD_TARGET_MONO))
+    return NULL;
+
+  /* Take a free slot, one left by a forgotten face, or the oldest glyph */
+  if (cache->used < G15_TTF_CACHE_SIZE)
+    i = cache->used++;
+  else
+    {
+      for (i = 0; i < G15_TTF_CACHE_SIZE; i++)
+	if (cache->glyph[i].face == NULL)
+	  break;
+      if (i == G15_TTF_CACHE_SIZE)
+	{
+	  i = cache->oldest;
+	  ttf_cache_evict (cache, i);
+	}
+    }
+
+  g = &cache->glyph[i];
+  g->face = face;
+  g->x_scale = x_scale;
+  g->y_scale = y_scale;
+  g->codepoint = codepoint;
+  g->index = slot->glyph_index;
+  g->advance = slot->advance.x >> 6;
+  g->left = slot->bitmap_left;
+  g->top = slot->bitmap_top;
+
+  /* whatever the pixel mode, any non-zero pixel is ink */
+  FT_Bitmap_New (&bitmap);
+  FT_Bitmap_Convert (text->ftLib, &slot->bitmap, &bitmap, 1);
+  g->width = bitmap.width;
+  g->rows = bitmap.rows;
+  g->pitch = (bitmap.width + 7) / 8;
+  g->bitmap = calloc (g->rows * g->pitch + 1, 1);
+  if (g->bitmap)
+    for (y = 0; y < g->rows; y++)
+      for (x = 0; x < g->width; x++)
+	if (bitmap.buffer[y * bitmap.pitch + x])
+	  g->bitmap[y * g->pitch + x / 8] |= 0x80 >> (x % 8);
+  FT_Bitmap_Done (text->ftLib, &bitmap);
+  if (g->bitmap == NULL)
+    g->width = g->rows = 0;
+
+  g->next = cache->bucket[h];
+  cache->bucket[h] = i;
+  ttf_cache_push (cache, i);
+  return g;
+}
+
+/* Pen movement between two glyphs, including kerning if it is turned on */
+static int
+ttf_advance (g15textcontext * text, FT_Face face, struct g15ttf_glyph *prev,
+	     struct g15ttf_glyph *g)
+{
+  FT_Vector delta;
+
+  if (prev == NULL)
+    return 0;
+  if (text->ttf_kerning && FT_HAS_KERNING (face) &&
+      !FT_Get_Kerning (face, prev->index, g->index, FT_KERNING_DEFAULT,
+		       &delta))
+    return prev->advance + (delta.x >> 6);
+  return prev->advance;
+}
+
 /**
- * Load a font for use with FreeType2 font support
+ * Load a font into a text context for use with FreeType2 font support
  *
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param text The text context the face is loaded into.
  * \param fontname Absolute pathname to font file to be loaded.
  * \param fontsize Size in points for font to be loaded.
  * \param face_num Slot into which font face will be loaded.
  * \return 0 for success or FreeType2 errorcode.
  */
 int
-g15r_ttfLoad (g15canvas * canvas, char *fontname, int fontsize, int face_num)
+g15r_textLoadTTF (g15textcontext * text, char *fontname, int fontsize,
+		  int face_num)
 {
   int errcode = 0;
 
   if (face_num < 0)
     face_num = 0;
-  if (face_num > G15_MAX_FACE)
-    face_num = G15_MAX_FACE;
+  if (face_num >= G15_MAX_FACE)
+    face_num = G15_MAX_FACE - 1;
 
-  if (canvas->ttf_fontsize[face_num])
-    FT_Done_Face (canvas->ttf_face[face_num][0]);	/* destroy the last face */
+  if (text->ttf_fontsize[face_num])
+    {
+      ttf_cache_forget (text, text->ttf_face[face_num]);
+      FT_Done_Face (text->ttf_face[face_num]);	/* destroy the last face */
+    }
 
-  if (!canvas->ttf_fontsize[face_num] && !fontsize)
-    canvas->ttf_fontsize[face_num] = 10;
+  if (!text->ttf_fontsize[face_num] && !fontsize)
+    text->ttf_fontsize[face_num] = 10;
   else
-    canvas->ttf_fontsize[face_num] = fontsize;
+    text->ttf_fontsize[face_num] = fontsize;
 
-  errcode =
-    FT_New_Face (canvas->ftLib, fontname, 0, &canvas->ttf_face[face_num][0]);
+  errcode = FT_New_Face (text->ftLib, fontname, 0, &text->ttf_face[face_num]);
   if (errcode)
     {
-      canvas->ttf_fontsize[face_num] = 0;
+      text->ttf_fontsize[face_num] = 0;
     }
   else
     {
-      if (canvas->ttf_fontsize[face_num]
-	  && FT_IS_SCALABLE (canvas->ttf_face[face_num][0]))
+      if (text->ttf_fontsize[face_num]
+	  && FT_IS_SCALABLE (text->ttf_face[face_num]))
 	errcode =
-	  FT_Set_Char_Size (canvas->ttf_face[face_num][0], 0,
-			    canvas->ttf_fontsize[face_num] * 64, 90, 0);
+	  FT_Set_Char_Size (text->ttf_face[face_num], 0,
+			    text->ttf_fontsize[face_num] * 64, 90, 0);
     }
 	return errcode;
 }
 
+/**
+ * Load a font for use with FreeType2 font support.  The canvas gets a text context of its
+ * own if it has none yet.
+ *
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param fontname Absolute pathname to font file to be loaded.
+ * \param fontsize Size in points for font to be loaded.
+ * \param face_num Slot into which font face will be loaded.
+ * \return 0 for success, FreeType2 errorcode or -1 if no text context could be created.
+ */
+int
+g15r_ttfLoad (g15canvas * canvas, char *fontname, int fontsize, int face_num)
+{
+  if (canvas->text == NULL && (canvas->text = g15r_newTextContext ()) == NULL)
+    return -1;
+  return g15r_textLoadTTF (canvas->text, fontname, fontsize, face_num);
+}
+
+/**
+ * Turn kerning of FreeType2 strings printed with a text context on or off.  Kerning is off
+ * by default.
+ *
+ * \param text The text context to be changed.
+ * \param kerning Pairs of glyphs are kerned if the face has kerning data and kerning != 0.
+ */
+void
+g15r_textSetKerning (g15textcontext * text, int kerning)
+{
+  text->ttf_kerning = kerning;
+}
+
+/**
+ * Turn kerning of FreeType2 strings on or off.  Kerning is off by default.
+ *
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param kerning Pairs of glyphs are kerned if the face has kerning data and kerning != 0.
+ */
+void
+g15r_ttfSetKerning (g15canvas * canvas, int kerning)
+{
+  if (canvas->text == NULL && (canvas->text = g15r_newTextContext ()) == NULL)
+    return;
+  g15r_textSetKerning (canvas->text, kerning);
+}
+
 int
 calc_ttf_true_ypos (FT_Face face, int y, int ttf_fontsize)
 {
@@ -157,29 +445,33 @@ calc_ttf_true_ypos (FT_Face face, int y, int ttf_fontsize)
 }
 
 int
-calc_ttf_totalstringwidth (FT_Face face, char *str)
+calc_ttf_totalstringwidth (g15textcontext * text, FT_Face face, char *str)
 {
-  FT_GlyphSlot slot = face->glyph;
-  FT_UInt glyph_index;
-  int i, errcode;
-  unsigned int len = strlen (str);
+  struct g15ttf_glyph *g, *prev = NULL;
+  const char *p = str;
+  unsigned int c;
   int width = 0;
 
-  for (i = 0; i < len; i++)
+  while ((c = g15r_nextCodepoint (&p)) != 0)
     {
-      glyph_index = FT_Get_Char_Index (face, str[i]);
-      errcode = FT_Load_Glyph (face, glyph_index, 0);
-      width += slot->advance.x >> 6;
+      g = ttf_cache_lookup (text, face, c);
+      if (g == NULL)
+	continue;
+      width += ttf_advance (text, face, prev, g);
+      prev = g;
     }
+  if (prev)
+    width += prev->advance;
   return width;
 }
 
 int
-calc_ttf_centering (FT_Face face, char *str)
+calc_ttf_centering (g15textcontext * text, FT_Face face, char *str,
+		    int width)
 {
   int leftpos;
 
-  leftpos = 80 - (calc_ttf_totalstringwidth (face, str) / 2);
+  leftpos = width / 2 - (calc_ttf_totalstringwidth (text, face, str) / 2);
   if (leftpos < 1)
     leftpos = 1;
 
@@ -187,11 +479,12 @@ calc_ttf_centering (FT_Face face, char *str)
 }
 
 int
-calc_ttf_right_justify (FT_Face face, char *str)
+calc_ttf_right_justify (g15textcontext * text, FT_Face face, char *str,
+			int width)
 {
   int leftpos;
 
-  leftpos = 160 - calc_ttf_totalstringwidth (face, str);
+  leftpos = width - calc_ttf_totalstringwidth (text, face, str);
   if (leftpos < 1)
     leftpos = 1;
 
@@ -199,40 +492,68 @@ calc_ttf_right_justify (FT_Face face, char *str)
 }
 
 void
-draw_ttf_char (g15canvas * canvas, FT_Bitmap charbitmap,
-	       unsigned char character, int x, int y, int color)
+draw_ttf_str (g15surface * surface, g15textcontext * text, char *str, int x,
+	      int y, int color, FT_Face face)
 {
-  FT_Int char_x, char_y, p, q;
-  FT_Int x_max = x + charbitmap.width;
-  FT_Int y_max = y + charbitmap.rows;
-  static FT_Bitmap tmpbuffer;
-
-  /* convert to 8bit format.. */
-  FT_Bitmap_Convert (canvas->ftLib, &charbitmap, &tmpbuffer, 1);
+  struct g15ttf_glyph *g, *prev = NULL;
+  const char *p = str;
+  unsigned int c;
+  int rop = glyphRop (surface, color);
 
-  for (char_y = y, q = 0; char_y < y_max; char_y++, q++)
-      for (char_x = x, p = 0; char_x < x_max; char_x++, p++)
-	  if (tmpbuffer.buffer[q * tmpbuffer.width + p])
-	    g15r_setPixel (canvas, char_x, char_y, color);
+  while ((c = g15r_nextCodepoint (&p)) != 0)
+    {
+      g = ttf_cache_lookup (text, face, c);
+      if (g == NULL)
+	continue;
+      x += ttf_advance (text, face, prev, g);
+      prev = g;
+      if (rop >= 0 && g->width)
+	g15s_blit (surface, g->bitmap, NULL, g->pitch * 8, 0, 0, g->width,
+		   g->rows, x + g->left, y - g->top, rop);
+    }
 }
 
+/**
+ * Render a string with a FreeType2 font loaded into a text context
+ *
+ * \param surface A pointer to the g15surface to be drawn on.
+ * \param text The text context holding the font, or NULL to use the default bitmap font.
+ * \param x initial x position for string.
+ * \param y initial y position for string.
+ * \param fontsize Size of string in points.
+ * \param face_num Font to be used is loaded in this slot.
+ * \param color Text will be drawn this color.
+ * \param center Text will be centered if center == 1 and right justified if center == 2, across the width of the surface.
+ * \param print_string Pointer to the UTF-8 string to be printed.
+ */
 void
-draw_ttf_str (g15canvas * canvas, char *str, int x, int y, int color,
-	      FT_Face face)
+g15s_ttfPrint (g15surface * surface, g15textcontext * text, int x, int y,
+	       int fontsize, int face_num, int color, int center,
+	       char *print_string)
 {
-  FT_GlyphSlot slot = face->glyph;
-  int i, errcode;
-  unsigned int len = strlen (str);
+  FT_Face face;
 
-  for (i = 0; i < len; i++)
+  if (text && face_num >= 0 && face_num < G15_MAX_FACE
+      && text->ttf_fontsize[face_num])
     {
-      errcode =
-	FT_Load_Char (face, str[i],
-		      FT_LOAD_RENDER | FT_LOAD_MONOCHROME |
-		      FT_LOAD_TARGET_MONO);
-      draw_ttf_char (canvas, slot->bitmap, str[i], x + slot->bitmap_left,
-		     y - slot->bitmap_top, color);
-      x += slot->advance.x >> 6;
+      face = text->ttf_face[face_num];
+      if (fontsize > 0 && FT_IS_SCALABLE (face))
+	{
+	  text->ttf_fontsize[face_num] = fontsize;
+	  int errcode = FT_Set_Pixel_Sizes (face, 0, fontsize);
+	  if (errcode)
+	    printf ("Trouble setting the Glyph size!\n");
+	}
+      y = calc_ttf_true_ypos (face, y, text->ttf_fontsize[face_num]);
+      if (center == 1)
+	x = calc_ttf_centering (text, face, print_string, surface->width);
+      else if (center == 2)
+        x = calc_ttf_right_justify (text, face, print_string,
+				    surface->width);
+      draw_ttf_str (surface, text, print_string, x, y, color, face);
+    }
+    else { /* fall back to our default bitmap font */
+        g15s_G15FPrint (surface, print_string, x, y, fontsize, center, color, 0);
     }
 }
 
@@ -252,37 +573,159 @@ void
 g15r_ttfPrint (g15canvas * canvas, int x, int y, int fontsize, int face_num,
 	       int color, int center, char *print_string)
 {
+  g15surface surface;
+
+  g15r_canvasSurface (canvas, &surface);
+  g15s_ttfPrint (&surface, canvas->text, x, y, fontsize, face_num, color,
+		 center, print_string);
+}
 
-  if (canvas->ttf_fontsize[face_num])
+#endif /* TTF_SUPPORT */
+
+/**
+ * Creates a text context for FreeType2 strings.  One context can be shared by any number
+ * of canvases, threads holding their own reference; faces and rendered glyphs are then
+ * loaded once for all of them.  Drawing through a context is not itself thread-safe.
+ *
+ * \return A context holding one reference, or NULL if it could not be created.
+ */
+g15textcontext *
+g15r_newTextContext (void)
+{
+  g15textcontext *text = calloc (1, sizeof (g15textcontext));
+
+  if (text == NULL)
+    return NULL;
+  text->refs = 1;
+#ifdef TTF_SUPPORT
+  if (FT_Init_FreeType (&text->ftLib))
     {
-      if (fontsize > 0 && FT_IS_SCALABLE (canvas->ttf_face[face_num][0]))
-	{
-	  canvas->ttf_fontsize[face_num] = fontsize;
-	  int errcode =
-	    FT_Set_Pixel_Sizes (canvas->ttf_face[face_num][0], 0,
-				canvas->ttf_fontsize[face_num]);
-	  if (errcode)
-	    printf ("Trouble setting the Glyph size!\n");
-	}
-      y =
-	calc_ttf_true_ypos (canvas->ttf_face[face_num][0], y,
-			    canvas->ttf_fontsize[face_num]);
-      if (center == 1)
-	x = calc_ttf_centering (canvas->ttf_face[face_num][0], print_string);
-      else if (center == 2)
-        x = calc_ttf_right_justify (canvas->ttf_face[face_num][0], print_string);
-      draw_ttf_str (canvas, print_string, x, y, color,
-		    canvas->ttf_face[face_num][0]);
+      printf ("Freetype couldnt initialise\n");
+      free (text);
+      return NULL;
     }
-    else { /* fall back to our default bitmap font */
-        g15r_G15FPrint (canvas, print_string, x, y, fontsize, center, color, 0);
+#endif
+  return text;
+}
+
+/**
+ * Takes another reference to a text context.
+ *
+ * \param text The text context, or NULL.
+ * \return text
+ */
+g15textcontext *
+g15r_refTextContext (g15textcontext * text)
+{
+  if (text)
+    __atomic_add_fetch (&text->refs, 1, __ATOMIC_RELAXED);
+  return text;
+}
+
+/**
+ * Drops a reference to a text context.  The last one unloads its faces and frees it.
+ *
+ * \param text The text context, or NULL.
+ */
+void
+g15r_unrefTextContext (g15textcontext * text)
+{
+#ifdef TTF_SUPPORT
+  int i;
+#endif
+
+  if (text == NULL || __atomic_sub_fetch (&text->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+
+#ifdef TTF_SUPPORT
+  if (text->ttf_cache)
+    {
+      for (i = 0; i < text->ttf_cache->used; i++)
+	free (text->ttf_cache->glyph[i].bitmap);
+      free (text->ttf_cache);
     }
+  for (i = 0; i < G15_MAX_FACE; i++)
+    if (text->ttf_fontsize[i])
+      FT_Done_Face (text->ttf_face[i]);
+  FT_Done_FreeType (text->ftLib);
+#endif
+  free (text);
 }
 
-#endif /* TTF_SUPPORT */
+/**
+ * Makes a canvas print FreeType2 strings with a text context, taking a reference to it
+ * and dropping the one held on the previous context.
+ *
+ * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param text The text context to be used, or NULL to release the current one.
+ */
+void
+g15r_setTextContext (g15canvas * canvas, g15textcontext * text)
+{
+  g15textcontext *old = canvas->text;
+
+  canvas->text = g15r_refTextContext (text);
+  g15r_unrefTextContext (old);
+}
 
 /* G15Font Support */
 
+/*
+ * Fills in font from a font image (the contents of a .fnt file) of len bytes.
+ * The glyphs point into data, which must outlive the font.
+ * Returns the number of bytes used, or -1 if the image is not a valid font.
+ */
+static long parseG15Font(g15font *font, const unsigned char *data, size_t len)
+{
+    size_t pos = G15_FONT_HEADER_SIZE;
+    unsigned int i;
+
+    if(len < G15_FONT_HEADER_SIZE ||
+       data[0] != 'G' ||
+       data[1] != 'F' ||
+       data[2] != 'N' ||
+       data[3] != 'T' )
+        return -1;
+
+    font->font_height = data[4] | (data[5] << 8);
+    font->ascender_height = data[6] | (data[7] << 8);
+    font->lineheight = data[8] | (data[9] << 8);
+
+    /* any future expansion that require more than one bit to be set should be recorded at the end of the file, */
+    /* with the extended-feature bit (not defined as yet, probably 1) set here */
+    /* The first byte of the extended packet should indicate the extension data type (none defined yet) */
+    /* The second byte should indicate length in bytes of the packet to read, not inclusive of these two bytes */
+    /* followed by the extended data.  This should allow for a degree of backward compatibility between future versions */
+    /* should they arise. */
+
+    /* features = data[10] | (data[11] << 8) */
+
+    font->numchars = data[12] | (data[13] << 8);
+    font->default_gap = data[14];
+
+    for (i=0;i <font->numchars; i++) {
+        unsigned int character, width;
+        size_t glyphlen;
+
+        if(len - pos < G15_CHAR_HEADER_SIZE)
+            return -1;
+        character = data[pos] | (data[pos + 1] << 8);
+        width = data[pos + 2] | (data[pos + 3] << 8);
+        pos += G15_CHAR_HEADER_SIZE;
+
+        glyphlen = font->font_height * ((width + 7) / 8);
+        if(character >= G15_MAX_GLYPH || len - pos < glyphlen)
+            return -1;
+
+        font->glyph[character].width = width;
+        font->glyph[character].gap = 0;
+        font->glyph[character].buffer = (unsigned char*)data + pos;
+        font->active[character] = 1;
+        pos += glyphlen;
+    }
+    return pos;
+}
+
 /**
  * Load a g15 font from file.
  * \param filename string containing full name and location of font to load.
@@ -290,9 +733,10 @@ g15r_ttfPrint (g15canvas * canvas, int x, int y, int fontsize, int face_num,
 */
 g15font * g15r_loadG15Font(char *filename) {
     FILE *file;
-    g15font *font = calloc(1,sizeof(g15font));
-    unsigned char buffer[128];
-    int i;
+    g15font *font;
+    char *data;
+    long len;
+
     if(access(filename,F_OK)!=0) {
         fprintf(stderr,"loadG15Font: %s doesn't exist or has permissions problem.\n",filename);
         return NULL;
@@ -305,76 +749,101 @@ g15font * g15r_loadG15Font(char *filename) {
     if(!(file=fopen(filename,"rb")))
         return NULL;
 
-    if(fread(buffer,G15_FONT_HEADER_SIZE,1,file)) {
-      if(buffer[0] != 'G' ||
-         buffer[1] != 'F' ||
-         buffer[2] != 'N' ||
-         buffer[3] != 'T' )
-      {
-          fclose(file);
-          return NULL;
-      }
-    } else
-      return NULL;
-    font->font_height = buffer[4] | (buffer[5] << 8);
-    font->ascender_height = buffer[6] | (buffer[7] << 8);
-    font->lineheight = buffer[8] | (buffer[9] << 8);
+    /* The whole file becomes the glyph pool, so glyph pointers never move */
+    if(fseek(file,0,SEEK_END)!=0 || (len=ftell(file))<=0 || fseek(file,0,SEEK_SET)!=0) {
+        fclose(file);
+        return NULL;
+    }
+    data = malloc(len);
+    font = calloc(1,sizeof(g15font));
+    if(data==NULL || font==NULL || fread(data,len,1,file)!=1 ||
+       parseG15Font(font,(unsigned char*)data,len)<0) {
+        fclose(file);
+        free(data);
+        free(font);
+        return NULL;
+    }
+    fclose(file);
 
-    /* any future expansion that require more than one bit to be set should be recorded at the end of the file, */
-    /* with the extended-feature bit (not defined as yet, probably 1) set here */
-    /* The first byte of the extended packet should indicate the extension data type (none defined yet) */
-    /* The second byte should indicate length in bytes of the packet to read, not inclusive of these two bytes */
-    /* followed by the extended data.  This should allow for a degree of backward compatibility between future versions */
-    /* should they arise. */
+    font->glyph_buffer = data;
+    return (font);
+}
 
-    /* features = buffer[10] | (buffer[11] << 8) */
+/*
+ * Maps the default font atlas read-only, the first time it is asked for.
+ * Returns NULL if there is no usable atlas; the per-size files are used then.
+ */
+static const unsigned char *mapG15FontAtlas(void)
+{
+    char filename[128];
+    struct stat st;
+    void *map;
+    int fd;
+
+    if(font_atlas_tried)
+        return font_atlas;
+    font_atlas_tried = 1;
+
+    snprintf(filename,128,"%s/%s",G15FONT_DIR,G15_FONT_ATLAS);
+    fd = open(filename,O_RDONLY);
+    if(fd<0)
+        return NULL;
+    if(fstat(fd,&st)!=0 || st.st_size < G15_ATLAS_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(map==MAP_FAILED)
+        return NULL;
 
-    font->numchars = buffer[12] | (buffer[13] << 8);
-    font->default_gap = buffer[14];
-    unsigned int current_alloc = 2048;
-    char *glyphBuf =  malloc(current_alloc);
-    char *glyphPtr = glyphBuf;
-    unsigned int memsize=0;
-    for (i=0;i <font->numchars; i++) {
-        unsigned char charheader[G15_CHAR_HEADER_SIZE];
-        unsigned int character;
-        fread(charheader, G15_CHAR_HEADER_SIZE, 1, file);
-        character = charheader[0] | (charheader[1] << 8);
-        font->glyph[character].width = charheader[2] | (charheader[3] << 8);
-        memsize+=(font->font_height * ((font->glyph[character].width + 7) / 8));
-        if(memsize>current_alloc) { /* attempt to semi-coherently allocate additional memory */
-            current_alloc+=((font->font_height * ((font->glyph[character].width + 7) / 8)*(font->numchars - i)));
-            glyphBuf = realloc(glyphBuf,(size_t)current_alloc);
-        }
-        font->glyph[character].buffer = (unsigned char*)glyphPtr;
-        font->glyph[character].gap = 0;
-        fread(font->glyph[character].buffer, font->font_height * ((font->glyph[character].width + 7) / 8), 1, file);
-        font->active[character] = 1;
-        glyphPtr+=(font->font_height * ((font->glyph[character].width + 7) / 8));
+    const unsigned char *atlas = map;
+    unsigned int version = atlas[4] | (atlas[5] << 8);
+    unsigned int count = atlas[6] | (atlas[7] << 8);
+    if(atlas[0] != 'G' || atlas[1] != 'F' || atlas[2] != 'N' || atlas[3] != 'A' ||
+       version != G15_ATLAS_VERSION ||
+       (size_t)st.st_size < G15_ATLAS_HEADER_SIZE + count * G15_ATLAS_INDEX_SIZE) {
+        fprintf(stderr,"libg15render: Ignoring font atlas \"%s\" (bad header or version %u)\n",filename,version);
+        munmap(map,st.st_size);
+        return NULL;
     }
 
-    fclose(file);
-    return (font);
+    font_atlas = atlas;
+    font_atlas_len = st.st_size;
+    return font_atlas;
 }
 
-/**
- * Save g15font struct to given file.
- * \param oFilename string containing full name and location of font to save.
- * \param font g15font structure containing glyphs.  Glyphs to be saved should have the corresponding active[glyph] set.
- * \return 0 on success, -1 on failure.
-*/
+/* Builds the default font at size from the atlas, or returns NULL if it is not there */
+static g15font *atlasG15Font(int size)
+{
+    const unsigned char *atlas = mapG15FontAtlas();
+    const unsigned char *entry;
+    unsigned long offset, len;
+    g15font *font;
 
-int g15r_saveG15Font(char *oFilename, g15font *font) {
-    FILE *f;
-    unsigned int i;
-    unsigned char fntheader[G15_FONT_HEADER_SIZE];
+    if(atlas==NULL || size >= (atlas[6] | (atlas[7] << 8)))
+        return NULL;
 
+    entry = atlas + G15_ATLAS_HEADER_SIZE + size * G15_ATLAS_INDEX_SIZE;
+    offset = entry[0] | (entry[1] << 8) | (entry[2] << 16) | ((unsigned long)entry[3] << 24);
+    len = entry[4] | (entry[5] << 8) | (entry[6] << 16) | ((unsigned long)entry[7] << 24);
+    if(offset==0 || offset > font_atlas_len || len > font_atlas_len - offset)
+        return NULL;
+
+    font = calloc(1,sizeof(g15font));
     if(font==NULL)
-        return -1;
+        return NULL;
+    if(parseG15Font(font,atlas + offset,len)<0) {
+        free(font);
+        return NULL;
+    }
+    return font;
+}
 
-    f = fopen(oFilename, "w+b");
-    if(f==NULL)
-        return -1;
+/* Writes font to f in .fnt format */
+static void writeG15Font(FILE *f, g15font *font) {
+    unsigned int i;
+    unsigned char fntheader[G15_FONT_HEADER_SIZE];
 
     font->numchars=0;
     for(i=0;i<G15_MAX_GLYPH;i++) {
@@ -419,17 +888,110 @@ int g15r_saveG15Font(char *oFilename, g15font *font) {
             fwrite(font->glyph[i].buffer,font->font_height * ((font->glyph[i].width + 7) / 8),1,f);
         }
     }
+}
+
+/**
+ * Save g15font struct to given file.
+ * \param oFilename string containing full name and location of font to save.
+ * \param font g15font structure containing glyphs.  Glyphs to be saved should have the corresponding active[glyph] set.
+ * \return 0 on success, -1 on failure.
+*/
+
+int g15r_saveG15Font(char *oFilename, g15font *font) {
+    FILE *f;
+
+    if(font==NULL)
+        return -1;
+
+    f = fopen(oFilename, "w+b");
+    if(f==NULL)
+        return -1;
+
+    writeG15Font(f, font);
     fclose(f);
     return 0;
 }
 
+/**
+ * Save a set of fonts as a font atlas, one entry per size.
+ *
+ * The atlas starts with "GFNA", a 16 bit version (G15_ATLAS_VERSION) and the 16 bit number of
+ * entries, followed by an index holding a 32 bit offset and length for each entry (all little
+ * endian).  Each entry is a complete .fnt image at a 4 byte aligned offset; missing sizes have
+ * offset 0.  Installed as G15_FONT_ATLAS in the font directory, it is mapped once and the
+ * default fonts are served straight from it.
+ * \param oFilename string containing full name and location of atlas to save.
+ * \param fonts array of count fonts, indexed by size.  NULL entries are left out.
+ * \param count number of entries in fonts.
+ * \return 0 on success, -1 on failure.
+*/
+int g15r_saveG15FontAtlas(char *oFilename, g15font *fonts[], int count) {
+    unsigned char header[G15_ATLAS_HEADER_SIZE];
+    unsigned char *index;
+    FILE *f;
+    int i, j;
+
+    if(count <= 0 || count > 0xFFFF)
+        return -1;
+
+    index = calloc(count, G15_ATLAS_INDEX_SIZE);
+    if(index==NULL)
+        return -1;
+
+    f = fopen(oFilename, "w+b");
+    if(f==NULL) {
+        free(index);
+        return -1;
+    }
+
+    header[0] = 'G';
+    header[1] = 'F';
+    header[2] = 'N';
+    header[3] = 'A';
+    header[4] = (unsigned char)G15_ATLAS_VERSION;
+    header[5] = (unsigned char)(G15_ATLAS_VERSION >> 8);
+    header[6] = (unsigned char)count;
+    header[7] = (unsigned char)(count >> 8);
+    fwrite(header, G15_ATLAS_HEADER_SIZE, 1, f);
+    fwrite(index, G15_ATLAS_INDEX_SIZE, count, f);
+
+    for(i=0;i<count;i++) {
+        unsigned long offset, len;
+
+        if(fonts[i]==NULL)
+            continue;
+        while(ftell(f) % 4)
+            fputc(0, f);
+        offset = ftell(f);
+        writeG15Font(f, fonts[i]);
+        len = ftell(f) - offset;
+        for(j=0;j<4;j++) {
+            index[i * G15_ATLAS_INDEX_SIZE + j] = (unsigned char)(offset >> (8 * j));
+            index[i * G15_ATLAS_INDEX_SIZE + 4 + j] = (unsigned char)(len >> (8 * j));
+        }
+    }
+
+    fseek(f, G15_ATLAS_HEADER_SIZE, SEEK_SET);
+    fwrite(index, G15_ATLAS_INDEX_SIZE, count, f);
+    free(index);
+    if(ferror(f)) {
+        fclose(f);
+        return -1;
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
 /**
  * De-allocate memory associated with g15font struct, including glyph buffers
   * \param font g15font structure containing glyphs.
 */
 void g15r_deleteG15Font(g15font*font){
+    int i;
 
     if(font) {
+        g15r_flushTextRuns(font);
+        for(i=0;i<G15_MAX_GLYPH;i++)
+            free(font->glyph[i].shifted);
         if(font->glyph_buffer!=NULL)
             free(font->glyph_buffer);
         free(font);
@@ -438,21 +1000,22 @@ void g15r_deleteG15Font(g15font*font){
 
 /**
  * Calculate width (in pixels) of given string if rendered in font 'font'.
+ * The width matches what g15r_G15FontRenderString advances by; for several lines it is
+ * that of the widest.
  * \param font Loaded g15font structure as returned by g15r_loadG15Font()
  * \param string Pointer to string for width calculations.
  * \return total width in pixels of given string.
 */
 int g15r_testG15FontWidth(g15font *font,char *string){
-    int i;
-    int totalwidth=0;
-    if(font==NULL) return 0;
+    g15textrun *run;
+    int width;
 
-    font->glyph[32].gap = 0;
+    run = g15r_layoutText(font, string, 0, G15_JUSTIFY_LEFT);
+    if(run==NULL) return 0;
+    width = run->width;
+    g15r_unrefTextRun(run);
 
-    for(i=0;i<strlen(string);i++)
-        totalwidth += font->glyph[(int)string[i]].width + font->glyph[(int)string[i]].gap + font->default_gap;
-
-    return totalwidth;
+    return width;
 }
 
 /**
@@ -467,7 +1030,9 @@ g15font * g15r_requestG15DefaultFont (int size)
   if (size<0)  size=0;
   if (size>39) size=39;
 
-  /* check if previously loaded, otherwise load it now */
+  /* check if previously loaded, otherwise take it from the atlas or load it now */
+  if(!defaultfont[size])
+    defaultfont[size] = atlasG15Font(size);
   if(!defaultfont[size]) {
     snprintf(filename,128,"%s/default-%.2i.fnt",G15FONT_DIR,size);
     defaultfont[size] = g15r_loadG15Font(filename);
@@ -479,8 +1044,55 @@ g15font * g15r_requestG15DefaultFont (int size)
   return defaultfont[size];
 }
 
+/*
+ * Returns the glyph's rows pre-shifted right by 0-7 pixels, building them
+ * on first use.  Shift p of row r is at ((p * font_height) + r) * stride,
+ * where stride is one byte more than a row of the glyph so the shifted-out
+ * bits have somewhere to go.  Padding bits past the glyph width are dropped.
+ */
+static unsigned char *shiftedG15Glyph(g15font *font, g15glyph *glyph)
+{
+    int bpr = (glyph->width + 7) / 8;
+    int stride = bpr + 1;
+    int height = font->font_height;
+    unsigned char *shifted, *expected = NULL;
+    int r, j, p;
+
+    /* the default fonts are shared by every thread of the process, so the rows
+       are built privately and only published once they are complete.  a thread
+       that loses the race to publish frees its copy and uses the winner's */
+    shifted = __atomic_load_n(&glyph->shifted, __ATOMIC_ACQUIRE);
+    if(shifted!=NULL)
+        return shifted;
+
+    shifted = calloc(8 * height * stride, 1);
+    if(shifted==NULL)
+        return NULL;
+
+    for(r=0;r<height;r++) {
+        for(j=0;j<bpr;j++) {
+            unsigned char b = glyph->buffer[r * bpr + j];
+            if(j == bpr - 1 && glyph->width % 8)
+                b &= 0xFF << (8 - glyph->width % 8);
+            for(p=0;p<8;p++) {
+                unsigned char *out = shifted + (p * height + r) * stride;
+                out[j] |= b >> p;
+                if(p)
+                    out[j + 1] |= b << (8 - p);
+            }
+        }
+    }
+
+    if(!__atomic_compare_exchange_n(&glyph->shifted, &expected, shifted, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(shifted);
+        return expected;
+    }
+    return shifted;
+}
+
 /** Render a character in given font.
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param font Loaded g15font structure as returned by g15r_loadG15Font()
  * \param character ascii character to render.
  * \param top_left_pixel_x horizontal top-left pixel location.
@@ -488,46 +1100,69 @@ g15font * g15r_requestG15DefaultFont (int size)
  * \param colour desired colour of character when rendered.
  * \param paint_bg should the background of the character cell be painted?
 */
-int g15r_renderG15Glyph(g15canvas *canvas, g15font *font,unsigned char character,int top_left_pixel_x, int top_left_pixel_y, int colour, int paint_bg)
+int g15s_renderG15Glyph(g15surface *surface, g15font *font,unsigned char character,int top_left_pixel_x, int top_left_pixel_y, int colour, int paint_bg)
 {
-    int x,y,w,bp;
+    g15glyph *glyph = &font->glyph[character];
+    unsigned char *shifted;
+    int x, y, r, k, rop;
 
-    if(font->glyph[character].buffer==NULL || font->active[character] == 0)
+    if(glyph->buffer==NULL || font->active[character] == 0)
         return 0;
 
-    unsigned char *buffer = font->glyph[character].buffer;
-    unsigned int height = font->font_height;
-    int i = 0;
+    int width = glyph->width;
+    int height = font->font_height;
+    int pitch = ((width + 7) / 8) * 8;
 
-    int bufferlen = height * ((font->glyph[character].width + 7) / 8);
     top_left_pixel_y-=font->font_height - font->ascender_height - 1 ;
 
-    w = font->glyph[character].width + (7-(font->glyph[character].width % 8 ));
-    if(font->glyph[character].width%8==0)
-        w = font->glyph[character].width-1;
-
-    x=0;y=0;
-
     if(paint_bg)
-      g15r_pixelBox (canvas, top_left_pixel_x, top_left_pixel_y-1,
+      g15s_pixelBox (surface, top_left_pixel_x, top_left_pixel_y-1,
           top_left_pixel_x + font->glyph[character].width+font->default_gap,
           top_left_pixel_y + font->lineheight, colour^1, 1, 1);
 
-    for (bp=0;bp<bufferlen ;bp++){
-        for (i=0;i<8;i++) {
-            if( x > w ) {
-                x=0;y++;
-            }
-            x++;
-            if(x<=font->glyph[character].width) {
-              if( buffer[bp] & (0x80 >> i))
-                g15r_setPixel (canvas, top_left_pixel_x + x, top_left_pixel_y + y,colour);
-              else
-                if(paint_bg)
-                    g15r_setPixel (canvas, top_left_pixel_x + x, top_left_pixel_y + y,colour^1);
+    /* The glyph's first column lands one pixel right of top_left_pixel_x */
+    x = top_left_pixel_x + 1;
+    y = top_left_pixel_y;
+
+    /*
+     * The box already holds the background colour, except below lineheight
+     * in fonts taller than their line, or everywhere if xor toggled it.
+     */
+    rop = glyphRop(surface, colour^1);
+    if(paint_bg && rop >= 0) {
+        int first = surface->mode_xor ? 0 : font->lineheight + 1;
+        if(first < height)
+            g15s_blit (surface, glyph->buffer, NULL, pitch, 0, first, width,
+                       height - first, x, y + first, rop | G15_BLIT_INVERT);
+    }
+
+    rop = glyphRop(surface, colour);
+    if(rop < 0 || width == 0) {
+        /* nothing to paint */
+    } else if(x >= 0 && y >= 0 && x + width <= surface->width &&
+              y + height <= surface->height &&
+              (shifted = shiftedG15Glyph(font, glyph)) != NULL) {
+        int stride = pitch / 8 + 1;
+        int phase = x % 8;
+        int nbytes = (phase + width + 7) / 8;
+
+        g15s_addDamage (surface, x, y, x + width - 1, y + height - 1);
+        shifted += phase * height * stride;
+        for(r=0;r<height;r++,shifted+=stride) {
+            unsigned char *d = surface->buffer + (y + r) * surface->stride + x / 8;
+            for(k=0;k<nbytes;k++) {
+                if(rop == G15_BLIT_OR)
+                    d[k] |= shifted[k];
+                else if(rop == G15_BLIT_ANDNOT)
+                    d[k] &= ~shifted[k];
+                else
+                    d[k] ^= shifted[k];
             }
         }
-    }
+    } else
+        g15s_blit (surface, glyph->buffer, NULL, pitch, 0, 0, width, height,
+                   x, y, rop);
+
     if(character!=32)
         return font->glyph[character].width + font->default_gap;
     else
@@ -535,7 +1170,7 @@ int g15r_renderG15Glyph(g15canvas *canvas, g15font *font,unsigned char character
 }
 
 /** Render a string in given font.
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param font Loaded g15font structure as returned by g15r_loadG15Font()
  * \param string Pointer to string to operate on.
  * \param row vertical font-dependent row to start printing on. can usually be left at 0
@@ -544,36 +1179,37 @@ int g15r_renderG15Glyph(g15canvas *canvas, g15font *font,unsigned char character
  * \param colour desired colour of character when rendered.
  * \param paint_bg if !0, pixels in the glyph background will also be painted, obstructing any image behind the text.
 */
-void g15r_G15FontRenderString (g15canvas * canvas, g15font *font, char *string, int row, unsigned int sx, unsigned int sy, int colour, int paint_bg)
+void g15s_G15FontRenderString (g15surface * surface, g15font *font, char *string, int row, unsigned int sx, unsigned int sy, int colour, int paint_bg)
 {
-    int i=0;
-    int prevwidth=0;
-    if(font==NULL)
-        return;
+    g15textrun *run;
 
-    sy += ( font->lineheight * row );
+    run = g15r_layoutText(font, string, 0, G15_JUSTIFY_LEFT);
+    if(run==NULL)
+        return;
 
-    for(i=0;i<strlen(string);i++){
-        prevwidth = g15r_renderG15Glyph (canvas, font,string[i], sx += prevwidth, sy, colour, paint_bg);
-    }
+    g15s_drawTextRun(surface, run, sx, sy + font->lineheight * row, colour, paint_bg);
+    g15r_unrefTextRun(run);
 }
 
 /** Render a string in the default font.
- * \param canvas A pointer to a g15canvas struct in which the buffer to be operated on is found.
+ * \param surface A pointer to the g15surface to be drawn on.
  * \param string Pointer to string to operate on.
  * \param x horizontal top-left pixel location.
  * \param y vertical top-left pixel location.
  * \param size if size>= 4, denotes height in pixels.  if size<4, standard font sizes are used.
- * \param center Desired text justification. 0==left, 1==centered, 2==right justified.
+ * \param center Desired text justification. 0==left, 1==centered, 2==right justified, the last two across the width of the surface.
  * \param colour desired colour of character when rendered.
  * \param row vertical font-dependent row to start printing on. can usually be left at 0
 */
 /* print string with the default G15Font, with on-demand loading of required sized bitmaps */
-void g15r_G15FPrint (g15canvas *canvas, char *string, int x, int y, int size, int center, int colour, int row) {
-  int xc, paint_bg;
+void g15s_G15FPrint (g15surface *surface, char *string, int x, int y, int size, int center, int colour, int row) {
+  g15font *font;
+  g15textrun *run;
+  int paint_bg;
 
   /* check if previously loaded, otherwise load it now */
-  if(g15r_requestG15DefaultFont(size)==NULL)
+  font = g15r_requestG15DefaultFont(size);
+  if(font==NULL)
     return;
 
   if(size<3)
@@ -587,18 +1223,47 @@ void g15r_G15FPrint (g15canvas *canvas, char *string, int x, int y, int size, in
       paint_bg=0;
   }
 
+  /* one layout both measures and places the string */
   switch(center) {
     case 0:
-      g15r_G15FontRenderString (canvas, defaultfont[size], string, row, x, y, colour, paint_bg);
+      run = g15r_layoutText(font, string, 0, G15_JUSTIFY_LEFT);
       break;
     case 1:
-      xc = g15r_testG15FontWidth(defaultfont[size],string);
-      g15r_G15FontRenderString (canvas, defaultfont[size], string, row, 80-(xc/2),y, colour, paint_bg);
-      break;
     case 2:
-      xc = g15r_testG15FontWidth(defaultfont[size],string);
-      g15r_G15FontRenderString (canvas, defaultfont[size], string, row, 160-xc,y, colour, paint_bg);
+      run = g15r_layoutText(font, string, surface->width, center);
+      x = 0;
       break;
+    default:
+      return;
   }
+  g15s_drawTextRun(surface, run, x, y + font->lineheight * row, colour, paint_bg);
+  g15r_unrefTextRun(run);
+}
+
+
+/** Render a character in given font to a canvas.  See g15s_renderG15Glyph(). */
+int g15r_renderG15Glyph(g15canvas *canvas, g15font *font,unsigned char character,int top_left_pixel_x, int top_left_pixel_y, int colour, int paint_bg)
+{
+    g15surface surface;
+
+    g15r_canvasSurface(canvas, &surface);
+    return g15s_renderG15Glyph(&surface, font, character, top_left_pixel_x, top_left_pixel_y, colour, paint_bg);
+}
+
+/** Render a string in given font to a canvas.  See g15s_G15FontRenderString(). */
+void g15r_G15FontRenderString (g15canvas * canvas, g15font *font, char *string, int row, unsigned int sx, unsigned int sy, int colour, int paint_bg)
+{
+    g15surface surface;
+
+    g15r_canvasSurface(canvas, &surface);
+    g15s_G15FontRenderString(&surface, font, string, row, sx, sy, colour, paint_bg);
 }
 
+/** Render a string in the default font to a canvas.  See g15s_G15FPrint(). */
+void g15r_G15FPrint (g15canvas *canvas, char *string, int x, int y, int size, int center, int colour, int row)
+{
+    g15surface surface;
+
+    g15r_canvasSurface(canvas, &surface);
+    g15s_G15FPrint(&surface, string, x, y, size, center, colour, row);
+}
@@ -0,0 +1,337 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Applies random operations to layer stacks (adding, removing, moving, hiding and
+   restacking layers, changing their ops and masks, drawing on them) and after each
+   g15r_compositeLayers compares the output with the stack blended from scratch.
+   What changed in the output must be inside its damage, and reported. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/liblogitechrender.h"
+
+#define RANDOM_OPS	20000
+#define MAX_LAYERS	8
+
+/* what the test knows of each layer, to blend the stack without its caches */
+typedef struct model
+{
+  g15layer *layer;
+  int z;
+  int stamp;			/* later placements go above earlier ones of the same z */
+  int x, y;
+  int visible;
+  int rop;
+  g15surface *mask;
+} model;
+
+enum
+{
+  OP_ADD,
+  OP_REMOVE,
+  OP_MOVE,
+  OP_SHOW,
+  OP_ROP,
+  OP_Z,
+  OP_MASK,
+  OP_DRAW,
+  OP_POKE,
+  OP_SCRIBBLE,
+  OPS
+};
+
+static const char *op_names[] = {
+  "add", "remove", "move", "show", "rop", "z", "mask", "draw", "poke",
+  "scribble"
+};
+
+static int failures = 0;
+static int composites = 0;
+static unsigned int rng = 12345;
+
+static int
+nextRandom (int range)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % range;
+}
+
+static int
+byOrder (const void *a, const void *b)
+{
+  const model *ma = a, *mb = b;
+
+  if (ma->z != mb->z)
+    return ma->z - mb->z;
+  return ma->stamp - mb->stamp;
+}
+
+/* the stack as it should look: the background, then every visible layer blended on
+   in order */
+static void
+blendStack (g15surface * want, int background, model * models, int count)
+{
+  model sorted[MAX_LAYERS];
+  g15surface *surface;
+  int i;
+
+  memcpy (sorted, models, count * sizeof (model));
+  qsort (sorted, count, sizeof (model), byOrder);
+  g15s_clear (want, background);
+  for (i = 0; i < count; ++i)
+    {
+      if (!sorted[i].visible)
+	continue;
+      surface = g15r_layerSurface (sorted[i].layer);
+      g15s_blit (want, surface->buffer,
+		 sorted[i].mask ? sorted[i].mask->buffer : NULL,
+		 surface->stride * 8, 0, 0, surface->width, surface->height,
+		 sorted[i].x, sorted[i].y, sorted[i].rop);
+    }
+}
+
+/* random shapes and noise on a layer surface or mask */
+static void
+drawSomething (g15surface * surface)
+{
+  int w = surface->width, h = surface->height;
+  int x = nextRandom (w + 4) - 2, y = nextRandom (h + 4) - 2;
+
+  surface->mode_xor = nextRandom (4) == 0;
+  switch (nextRandom (4))
+    {
+    case 0:
+      g15s_pixelReverseFill (surface, x, y, x + nextRandom (w),
+			     y + nextRandom (h), nextRandom (2),
+			     nextRandom (2));
+      break;
+    case 1:
+      g15s_drawLine (surface, x, y, nextRandom (w + 4) - 2,
+		     nextRandom (h + 4) - 2, nextRandom (2));
+      break;
+    case 2:
+      g15s_setPixel (surface, x, y, nextRandom (2));
+      break;
+    default:
+      g15s_drawCircle (surface, x, y, nextRandom (12), nextRandom (2),
+		       nextRandom (2));
+      break;
+    }
+  surface->mode_xor = 0;
+}
+
+/* draw straight into the buffer, which the layer only learns of from
+   g15r_markLayerDirty */
+static void
+pokeBuffer (g15surface * surface)
+{
+  int i, n = 1 + nextRandom (8);
+
+  for (i = 0; i < n; ++i)
+    surface->buffer[nextRandom (surface->height) * surface->stride +
+		    nextRandom ((surface->width + 7) / 8)] = nextRandom (256);
+}
+
+/* the composite must match a blend from scratch, and every pixel it changed must
+   be inside out's damage and reported */
+static void
+checkComposite (g15layers * layers, g15surface * out, g15surface * before,
+		g15surface * want, int background, model * models, int count,
+		int step, int op)
+{
+  int x, y, x1, x2, changed, ret, moved = 0;
+
+  g15s_copy (before, out);
+  g15s_resetDamage (out);
+  ret = g15r_compositeLayers (layers, out);
+  blendStack (want, background, models, count);
+  composites++;
+
+  for (y = 0; y < out->height; ++y)
+    {
+      unsigned char *row = out->buffer + y * out->stride;
+
+      /* rows the composite left alone and got right need no per-pixel look */
+      if (!memcmp (row, want->buffer + y * out->stride, out->stride)
+	  && !memcmp (row, before->buffer + y * out->stride, out->stride))
+	continue;
+      if (!g15s_getDamageRow (out, y, &x1, &x2))
+	{
+	  x1 = out->width;
+	  x2 = -1;
+	}
+      for (x = 0; x < out->width; ++x)
+	{
+	  if (g15s_getPixel (out, x, y) != g15s_getPixel (want, x, y))
+	    {
+	      fprintf (stderr,
+		       "%dx%d step %d after %s, %d layers: pixel %d,%d differs\n",
+		       out->width, out->height, step, op_names[op], count, x,
+		       y);
+	      failures++;
+	      g15r_invalidateLayers (layers);
+	      return;
+	    }
+	  changed = g15s_getPixel (out, x, y) != g15s_getPixel (before, x, y);
+	  moved |= changed;
+	  if (changed && (x < x1 || x > x2))
+	    {
+	      fprintf (stderr,
+		       "%dx%d step %d after %s: pixel %d,%d changed outside the damage\n",
+		       out->width, out->height, step, op_names[op], x, y);
+	      failures++;
+	      return;
+	    }
+	}
+    }
+  if (moved && !ret)
+    {
+      fprintf (stderr, "%dx%d step %d after %s: changes not reported\n",
+	       out->width, out->height, step, op_names[op]);
+      failures++;
+    }
+}
+
+static void
+checkStack (int width, int height, int background)
+{
+  g15layers *layers = g15r_newLayers (width, height, background);
+  g15surface *out = g15s_newSized (width, height);
+  g15surface *before = g15s_newSized (width, height);
+  g15surface *want = g15s_newSized (width, height);
+  model models[MAX_LAYERS];
+  int count = 0, stamp = 0;
+  int step, op, i;
+
+  if (!layers || !out || !before || !want)
+    {
+      fprintf (stderr, "%dx%d: out of memory\n", width, height);
+      failures++;
+      return;
+    }
+
+  for (step = 0; step < RANDOM_OPS; ++step)
+    {
+      op = nextRandom (OPS);
+      if (count == 0 || (op == OP_ADD && count < MAX_LAYERS))
+	{
+	  model *m = &models[count];
+
+	  op = OP_ADD;
+	  m->z = nextRandom (5);
+	  m->layer = g15r_addLayer (layers, 1 + nextRandom (width + 8),
+				    1 + nextRandom (height + 8), m->z);
+	  if (m->layer == NULL)
+	    {
+	      fprintf (stderr, "%dx%d: no layer\n", width, height);
+	      failures++;
+	      break;
+	    }
+	  m->stamp = stamp++;
+	  m->x = m->y = 0;
+	  m->visible = 1;
+	  m->rop = G15_BLIT_COPY;
+	  m->mask = NULL;
+	  drawSomething (g15r_layerSurface (m->layer));
+	  ++count;
+	}
+      else
+	{
+	  model *m = &models[nextRandom (count)];
+	  g15surface *surface = g15r_layerSurface (m->layer);
+
+	  switch (op)
+	    {
+	    case OP_ADD:
+	    case OP_REMOVE:
+	      g15r_removeLayer (m->layer);
+	      *m = models[--count];
+	      op = OP_REMOVE;
+	      break;
+	    case OP_MOVE:
+	      m->x = nextRandom (width + surface->width + 4) - surface->width - 2;
+	      m->y = nextRandom (height + surface->height + 4) - surface->height - 2;
+	      g15r_moveLayer (m->layer, m->x, m->y);
+	      break;
+	    case OP_SHOW:
+	      m->visible = !m->visible;
+	      g15r_showLayer (m->layer, m->visible);
+	      break;
+	    case OP_ROP:
+	      m->rop = nextRandom (5) | (nextRandom (2) ? G15_BLIT_INVERT : 0);
+	      g15r_setLayerRop (m->layer, m->rop);
+	      break;
+	    case OP_Z:
+	      i = nextRandom (5);
+	      if (i != m->z)
+		m->stamp = stamp++;
+	      m->z = i;
+	      g15r_setLayerZ (m->layer, m->z);
+	      break;
+	    case OP_MASK:
+	      m->mask = g15r_layerMask (m->layer);
+	      if (m->mask)
+		drawSomething (m->mask);
+	      break;
+	    case OP_DRAW:
+	      drawSomething (surface);
+	      break;
+	    case OP_POKE:
+	      pokeBuffer (surface);
+	      g15r_markLayerDirty (m->layer);
+	      break;
+	    case OP_SCRIBBLE:
+	      drawSomething (out);
+	      g15r_invalidateLayers (layers);
+	      break;
+	    }
+	}
+
+      /* changes pile up between some composites */
+      if (nextRandom (3))
+	checkComposite (layers, out, before, want, background, models, count,
+			step, op);
+    }
+
+  /* and the stack emptied out again leaves just the background */
+  while (count > 0)
+    g15r_removeLayer (models[--count].layer);
+  checkComposite (layers, out, before, want, background, models, 0, step,
+		  OP_REMOVE);
+
+  g15r_freeLayers (layers);
+  g15s_free (out);
+  g15s_free (before);
+  g15s_free (want);
+}
+
+int
+main (void)
+{
+  checkStack (G15_LCD_WIDTH, G15_LCD_HEIGHT, G15_COLOR_WHITE);
+  checkStack (G15_LCD_WIDTH, G15_LCD_HEIGHT, G15_COLOR_BLACK);
+  checkStack (1, 1, G15_COLOR_WHITE);
+  checkStack (37, 11, G15_COLOR_BLACK);
+  checkStack (300, 20, G15_COLOR_WHITE);
+  printf ("%d composites, %d failures\n", composites, failures);
+  return failures ? 1 : 0;
+}
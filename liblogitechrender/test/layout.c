@@ -0,0 +1,322 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Checks g15r_nextCodepoint against a table of well formed and malformed UTF-8,
+   g15r_layoutText's wrapping and alignment against a table of laid out lines in a
+   font whose glyphs all have the same width, and that runs are cached and
+   flushed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/liblogitechrender.h"
+
+#define MAX_CODEPOINTS	8
+
+static int failures = 0;
+
+/* the codepoints a string decodes to, malformed bytes as Latin-1 */
+static const struct
+{
+  const char *name;
+  const char *string;
+  unsigned int want[MAX_CODEPOINTS];
+} decodes[] = {
+  {"ascii", "Az", {'A', 'z'}},
+  {"2 bytes", "\xC3\xA9", {0xE9}},
+  {"3 bytes", "\xE2\x82\xAC", {0x20AC}},
+  {"4 bytes", "\xF0\x9F\x98\x80", {0x1F600}},
+  {"lowest 2 bytes", "\xC2\x80", {0x80}},
+  {"lowest 3 bytes", "\xE0\xA0\x80", {0x800}},
+  {"lowest 4 bytes", "\xF0\x90\x80\x80", {0x10000}},
+  {"last before surrogates", "\xED\x9F\xBF", {0xD7FF}},
+  {"U+10FFFF", "\xF4\x8F\xBF\xBF", {0x10FFFF}},
+  {"overlong C0", "\xC0\x80", {0xC0, 0x80}},
+  {"overlong C1", "\xC1\xBF", {0xC1, 0xBF}},
+  {"overlong 3 bytes", "\xE0\x80\x80", {0xE0, 0x80, 0x80}},
+  {"overlong U+07FF", "\xE0\x9F\xBF", {0xE0, 0x9F, 0xBF}},
+  {"overlong 4 bytes", "\xF0\x80\x80\x80", {0xF0, 0x80, 0x80, 0x80}},
+  {"overlong U+FFFF", "\xF0\x8F\xBF\xBF", {0xF0, 0x8F, 0xBF, 0xBF}},
+  {"surrogate", "\xED\xA0\x80", {0xED, 0xA0, 0x80}},
+  {"last surrogate", "\xED\xBF\xBF", {0xED, 0xBF, 0xBF}},
+  {"past U+10FFFF", "\xF4\x90\x80\x80", {0xF4, 0x90, 0x80, 0x80}},
+  {"F5 lead", "\xF5\x80\x80\x80", {0xF5, 0x80, 0x80, 0x80}},
+  {"FF", "\xFF", {0xFF}},
+  {"lone continuation", "\x80" "a", {0x80, 'a'}},
+  {"cut short by the end, 2 of 3", "\xE2\x82", {0xE2, 0x82}},
+  {"cut short by the end, 3 of 4", "\xF0\x9F\x98", {0xF0, 0x9F, 0x98}},
+  {"cut short by the end, 1 of 2", "a\xC3", {'a', 0xC3}},
+  {"cut short by ascii", "\xE2" "A", {0xE2, 'A'}},
+  {"latin-1", "caf\xE9", {'c', 'a', 'f', 0xE9}},
+  {"latin-1 before utf-8", "\xE9\xC3\xA9", {0xE9, 0xE9}},
+  {"empty", "", {0}}
+};
+
+static void
+checkDecodes (void)
+{
+  int i, n;
+  unsigned int c;
+  const char *p;
+
+  for (i = 0; i < (int) (sizeof (decodes) / sizeof (decodes[0])); ++i)
+    {
+      p = decodes[i].string;
+      for (n = 0; n < MAX_CODEPOINTS; ++n)
+	{
+	  c = g15r_nextCodepoint (&p);
+	  if (c != decodes[i].want[n])
+	    {
+	      fprintf (stderr, "decode %s: codepoint %d is %x, want %x\n",
+		       decodes[i].name, n, c, decodes[i].want[n]);
+	      failures++;
+	      break;
+	    }
+	  if (c == 0)
+	    break;
+	}
+      /* every byte was taken, and the end is not stepped over */
+      if (p != decodes[i].string + strlen (decodes[i].string))
+	{
+	  fprintf (stderr, "decode %s: stopped %d bytes in, want %d\n",
+		   decodes[i].name, (int) (p - decodes[i].string),
+		   (int) strlen (decodes[i].string));
+	  failures++;
+	}
+    }
+}
+
+/* every glyph 4 pixels wide with a gap of 1, so 5 pixels a letter, the space 2.
+   DEL has no glyph */
+static g15font *
+newFont (void)
+{
+  static unsigned char pixels[8];
+  g15font *font = calloc (1, sizeof (g15font));
+  int i;
+
+  if (font == NULL)
+    return NULL;
+  font->font_height = 8;
+  font->ascender_height = 6;
+  font->lineheight = 8;
+  font->numchars = G15_MAX_GLYPH;
+  font->default_gap = 1;
+  for (i = ' '; i < G15_MAX_GLYPH; ++i)
+    {
+      if (i == 0x7F)
+	continue;
+      font->glyph[i].buffer = pixels;
+      font->glyph[i].width = i == ' ' ? 2 : 4;
+      font->active[i] = 1;
+    }
+  return font;
+}
+
+/* each line of a run as "x:glyphs", lines separated by '|' */
+static const struct
+{
+  const char *name;
+  const char *string;
+  int width;
+  int flags;
+  const char *want;
+  int lines;
+  int run_width;
+} layouts[] = {
+  {"one line", "ab cd", 0, G15_JUSTIFY_LEFT, "0:ab cd", 1, 22},
+  {"fits the box", "ab cd", 22, G15_TEXT_WRAP, "0:ab cd", 1, 22},
+  {"wrapped at the space", "ab cd", 15, G15_TEXT_WRAP, "0:ab|0:cd", 2, 10},
+  {"run of spaces at the break", "ab   cd", 15, G15_TEXT_WRAP, "0:ab|0:cd", 2,
+   10},
+  {"spaces hang past the edge", "abc  d", 16, G15_TEXT_WRAP, "0:abc|0:d", 2,
+   15},
+  {"last word moved", "ab cd ef", 26, G15_TEXT_WRAP, "0:ab cd|0:ef", 2, 22},
+  {"word wider than the box", "abcdefgh", 22, G15_TEXT_WRAP, "0:abcd|0:efgh",
+   2, 20},
+  {"long word after a short one", "ab cdefghij", 22, G15_TEXT_WRAP,
+   "0:ab|0:cdef|0:ghij", 3, 20},
+  {"glyph wider than the box", "ab", 3, G15_TEXT_WRAP, "0:a|0:b", 2, 5},
+  {"not wrapped without the flag", "ab cd", 15, G15_JUSTIFY_LEFT, "0:ab cd",
+   1, 22},
+  {"newline", "ab\ncd", 0, G15_JUSTIFY_LEFT, "0:ab|0:cd", 2, 10},
+  {"empty lines", "\n\nab\n", 0, G15_JUSTIFY_LEFT, "0:ab", 4, 10},
+  {"newline resets the wrap", "abc\nab cd", 15, G15_TEXT_WRAP,
+   "0:abc|0:ab|0:cd", 3, 15},
+  {"centered on the widest line", "ab\nabcd", 0, G15_JUSTIFY_CENTER,
+   "5:ab|0:abcd", 2, 20},
+  {"right on the widest line", "ab\nabcd", 0, G15_JUSTIFY_RIGHT,
+   "10:ab|0:abcd", 2, 20},
+  {"centered in the box", "ab\nabcd", 31, G15_JUSTIFY_CENTER, "10:ab|5:abcd",
+   2, 20},
+  {"right in the box", "ab\nabcd", 31, G15_JUSTIFY_RIGHT, "21:ab|11:abcd", 2,
+   20},
+  {"odd line centered in an even box", "a  ", 30, G15_JUSTIFY_CENTER,
+   "11:a  ", 1, 9},
+  {"wrapped and centered", "ab cd", 15, G15_JUSTIFY_CENTER | G15_TEXT_WRAP,
+   "2:ab|2:cd", 2, 10},
+  {"wrapped and right", "ab   cd", 15, G15_JUSTIFY_RIGHT | G15_TEXT_WRAP,
+   "5:ab|5:cd", 2, 10},
+  {"no glyph and past the font", "a\x7f\xE2\x82\xAC" "b", 0,
+   G15_JUSTIFY_LEFT, "0:a?b", 1, 15},
+  {"latin-1", "\xE9\xC3\xA9", 0, G15_JUSTIFY_LEFT, "0:\xE9\xE9", 1, 10}
+};
+
+/* glyphs on a line follow each other at their advance, and lines are lineheight apart */
+static int
+describeRun (const g15textrun * run, char *out, int size)
+{
+  int i, len = 0, pen = 0;
+
+  out[0] = 0;
+  for (i = 0; i < run->count && len < size - 16; ++i)
+    {
+      const g15runglyph *g = &run->glyph[i];
+
+      if (i == 0 || g->y != run->glyph[i - 1].y)
+	{
+	  if (g->y % run->font->lineheight)
+	    return 0;
+	  len += snprintf (out + len, size - len, "%s%d:", i ? "|" : "", g->x);
+	  pen = g->x;
+	}
+      if (g->x != pen)
+	return 0;
+      out[len++] = g->glyph;
+      out[len] = 0;
+      pen += run->font->glyph[g->glyph].width +
+	(g->glyph == ' ' ? 0 : run->font->default_gap);
+    }
+  return 1;
+}
+
+static void
+checkLayouts (g15font * font)
+{
+  char got[256];
+  g15textrun *run;
+  int i;
+
+  for (i = 0; i < (int) (sizeof (layouts) / sizeof (layouts[0])); ++i)
+    {
+      run = g15r_layoutText (font, layouts[i].string, layouts[i].width,
+			     layouts[i].flags);
+      if (run == NULL)
+	{
+	  fprintf (stderr, "layout %s: no run\n", layouts[i].name);
+	  failures++;
+	  continue;
+	}
+      if (!describeRun (run, got, sizeof (got)))
+	{
+	  fprintf (stderr, "layout %s: glyphs out of step: %s\n",
+		   layouts[i].name, got);
+	  failures++;
+	}
+      else if (strcmp (got, layouts[i].want) != 0
+	       || run->lines != layouts[i].lines
+	       || run->width != layouts[i].run_width
+	       || run->height != run->lines * (int) font->lineheight)
+	{
+	  fprintf (stderr,
+		   "layout %s: got \"%s\" %d lines %d wide, want \"%s\" %d lines %d wide\n",
+		   layouts[i].name, got, run->lines, run->width,
+		   layouts[i].want, layouts[i].lines, layouts[i].run_width);
+	  failures++;
+	}
+      g15r_unrefTextRun (run);
+    }
+}
+
+static void
+expect (int ok, const char *what)
+{
+  if (ok)
+    return;
+  fprintf (stderr, "cache: %s\n", what);
+  failures++;
+}
+
+static void
+checkCache (g15font * font, g15font * other)
+{
+  g15textrun *run, *again, *kept;
+  char string[16];
+  int i;
+
+  run = g15r_layoutText (font, "cached", 0, 0);
+  again = g15r_layoutText (font, "cached", 0, 0);
+  expect (run != NULL && run == again, "the same layout is not the same run");
+  g15r_unrefTextRun (again);
+  again = g15r_layoutText (font, "cached", 0, G15_JUSTIFY_RIGHT);
+  expect (again != run, "another alignment gives the same run");
+  g15r_unrefTextRun (again);
+  again = g15r_layoutText (other, "cached", 0, 0);
+  expect (again != run, "another font gives the same run");
+  g15r_unrefTextRun (again);
+
+  /* flushing another font keeps the run, flushing its own drops it.  the reference
+     held here keeps it alive, so a new run cannot reuse its address */
+  g15r_flushTextRuns (other);
+  again = g15r_layoutText (font, "cached", 0, 0);
+  expect (again == run, "flushing another font dropped the run");
+  g15r_unrefTextRun (again);
+  g15r_flushTextRuns (font);
+  again = g15r_layoutText (font, "cached", 0, 0);
+  expect (again != NULL && again != run, "flushing the font kept the run");
+  g15r_unrefTextRun (again);
+  g15r_unrefTextRun (run);
+
+  /* the oldest run is dropped once the cache is full, a recently used one is not */
+  kept = g15r_layoutText (font, "kept", 0, 0);
+  run = g15r_layoutText (font, "oldest", 0, 0);
+  for (i = 0; i < 100; ++i)
+    {
+      snprintf (string, sizeof (string), "filler %d", i);
+      g15r_unrefTextRun (g15r_layoutText (font, string, 0, 0));
+      g15r_unrefTextRun (g15r_layoutText (font, "kept", 0, 0));
+    }
+  again = g15r_layoutText (font, "kept", 0, 0);
+  expect (again == kept, "a recently used run was dropped");
+  g15r_unrefTextRun (again);
+  again = g15r_layoutText (font, "oldest", 0, 0);
+  expect (again != run, "the oldest run was kept");
+  g15r_unrefTextRun (again);
+  g15r_unrefTextRun (run);
+  g15r_unrefTextRun (kept);
+}
+
+int
+main (void)
+{
+  g15font *font = newFont (), *other = newFont ();
+
+  if (font == NULL || other == NULL)
+    return 1;
+  checkDecodes ();
+  checkLayouts (font);
+  checkCache (font, other);
+  g15r_flushTextRuns (NULL);
+  free (font);
+  free (other);
+  printf ("%d decodes, %d layouts, %d failures\n",
+	  (int) (sizeof (decodes) / sizeof (decodes[0])),
+	  (int) (sizeof (layouts) / sizeof (layouts[0])), failures);
+  return failures ? 1 : 0;
+}
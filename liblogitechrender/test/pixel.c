@@ -0,0 +1,401 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Checks that the span fills, clipped lines and the blitter leave the same pixels
+   behind as the per-pixel loops in pixel_reference.h, in every combination of
+   surface modes and raster ops, on the LCD and on offscreen surfaces whose width is
+   not a multiple of 8, with areas, lines and images running up to, along and past
+   every edge.  Every pixel that changes must also be inside the damage. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/liblogitechrender.h"
+#include "pixel_reference.h"
+
+#define RANDOM_CALLS	20000
+
+enum
+{
+  OP_FILL,
+  OP_REVERSE,
+  OP_BOX,
+  OP_LINE,
+  SHAPE_OPS,
+  OP_BLIT = SHAPE_OPS,
+  OP_SPRITE,
+  OPS
+};
+
+static const char *op_names[] =
+  { "fill", "reverse", "box", "line", "blit", "sprite" };
+
+#define ARGS	8
+
+/* source images for the blits: one whose rows are whole bytes, so aligned copies
+   move bytes whole, and one whose rows start anywhere in a byte, as packed wbmp
+   data does.  each has a mask of the same shape */
+#define IMAGES		2
+#define IMAGE_ROWS	60
+
+static const int image_pitch[IMAGES] = { 64, 203 };
+static unsigned char *image[IMAGES], *image_mask[IMAGES];
+
+static int failures = 0;
+static int calls = 0;
+static unsigned int rng = 12345;
+
+static int
+nextRandom (int range)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % range;
+}
+
+/* for shapes a holds x1, y1, x2, y2, color, thick, fill.  for images it holds
+   dst_x, dst_y, src_x, src_y, width, height, rop, image */
+static void
+draw (g15surface * surface, int ref, int op, const int *a)
+{
+  switch (op)
+    {
+    case OP_FILL:
+    case OP_REVERSE:
+      if (ref)
+	refPixelReverseFill (surface, a[0], a[1], a[2], a[3], op == OP_FILL,
+			     a[4]);
+      else
+	g15s_pixelReverseFill (surface, a[0], a[1], a[2], a[3], op == OP_FILL,
+			       a[4]);
+      break;
+    case OP_BOX:
+      if (ref)
+	refPixelBox (surface, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+      else
+	g15s_pixelBox (surface, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+      break;
+    case OP_LINE:
+      if (ref)
+	refDrawLine (surface, a[0], a[1], a[2], a[3], a[4]);
+      else
+	g15s_drawLine (surface, a[0], a[1], a[2], a[3], a[4]);
+      break;
+    case OP_BLIT:
+      if (ref)
+	refBlit (surface, image[a[7]], image_mask[a[7]], image_pitch[a[7]],
+		 a[2], a[3], a[4], a[5], a[0], a[1], a[6]);
+      else
+	g15s_blit (surface, image[a[7]], image_mask[a[7]], image_pitch[a[7]],
+		   a[2], a[3], a[4], a[5], a[0], a[1], a[6]);
+      break;
+    case OP_SPRITE:
+      if (ref)
+	refDrawSprite (surface, (char *) image[a[7]], a[0], a[1], a[4], a[5],
+		       a[2], a[3], image_pitch[a[7]]);
+      else
+	g15s_drawSprite (surface, (char *) image[a[7]], a[0], a[1], a[4],
+			 a[5], a[2], a[3], image_pitch[a[7]]);
+      break;
+    }
+}
+
+static void
+report (g15surface * surface, int op, const int *a, int x, int y,
+	const char *what)
+{
+  fprintf (stderr,
+	   "%dx%d xor %d reverse %d: %s %d %d %d %d %d %d %d %d: pixel %d,%d %s\n",
+	   surface->width, surface->height, surface->mode_xor,
+	   surface->mode_reverse, op_names[op], a[0], a[1], a[2], a[3], a[4],
+	   a[5], a[6], a[7], x, y, what);
+  failures++;
+}
+
+/* got and want hold the same pixels.  draw op on got with the library and on want
+   with the reference, and compare them, bytes between rows included */
+static void
+check (g15surface * got, g15surface * want, g15surface * before, int op,
+       const int *a)
+{
+  int x, y, x1, x2;
+
+  g15s_copy (before, got);
+  g15s_resetDamage (got);
+  draw (got, 0, op, a);
+  draw (want, 1, op, a);
+  calls++;
+
+  for (y = 0; y < got->height; ++y)
+    {
+      unsigned char *row = got->buffer + y * got->stride;
+
+      if (memcmp (row, want->buffer + y * want->stride, got->stride) != 0)
+	{
+	  for (x = 0; x < got->width; ++x)
+	    if (g15s_getPixel (got, x, y) != g15s_getPixel (want, x, y))
+	      break;
+	  report (got, op, a, x, y, "differs");
+	  g15s_copy (got, want);
+	  return;
+	}
+      if (memcmp (row, before->buffer + y * before->stride, got->stride) == 0)
+	continue;
+      if (!g15s_getDamageRow (got, y, &x1, &x2))
+	{
+	  x1 = got->width;
+	  x2 = -1;
+	}
+      for (x = 0; x < got->width; ++x)
+	if ((x < x1 || x > x2)
+	    && g15s_getPixel (got, x, y) != g15s_getPixel (before, x, y))
+	  {
+	    report (got, op, a, x, y, "changed outside the damage");
+	    return;
+	  }
+    }
+}
+
+static void
+setModes (g15surface * got, g15surface * want, int modes)
+{
+  got->mode_xor = want->mode_xor = modes & 1;
+  got->mode_reverse = want->mode_reverse = (modes >> 1) & 1;
+}
+
+/* areas and lines on, along, and one pixel past each edge, and single pixels in
+   the corners, in every mode and color */
+static void
+checkEdges (g15surface * got, g15surface * want, g15surface * before)
+{
+  int w = got->width, h = got->height;
+  int rects[][4] = {
+    {0, 0, w - 1, h - 1}, {-1, -1, w, h}, {1, 1, w - 2, h - 2},
+    {0, 0, 0, 0}, {w - 1, 0, w - 1, 0}, {0, h - 1, 0, h - 1},
+    {w - 1, h - 1, w - 1, h - 1}, {w, 0, w + 5, h - 1}, {-6, 0, -1, h - 1},
+    {0, h, w - 1, h + 3}, {0, -4, w - 1, -1}, {7, 2, 8, 3}, {8, 0, 15, h - 1},
+    {3, 1, w - 4, 1}, {w - 9, 0, w - 1, h - 1}, {5, 4, 2, 1}
+  };
+  int a[ARGS] = { 0 };
+  int r, op, modes, color, thick;
+
+  for (modes = 0; modes < 4; ++modes)
+    for (r = 0; r < (int) (sizeof (rects) / sizeof (rects[0])); ++r)
+      for (op = 0; op < SHAPE_OPS; ++op)
+	for (color = 0; color < 2; ++color)
+	  for (thick = 0; thick < 3; ++thick)
+	    {
+	      if (op != OP_BOX && thick)
+		continue;
+	      setModes (got, want, modes);
+	      a[0] = rects[r][0];
+	      a[1] = rects[r][1];
+	      a[2] = rects[r][2];
+	      a[3] = rects[r][3];
+	      a[4] = color;
+	      a[5] = thick;
+	      a[6] = thick != 1;
+	      check (got, want, before, op, a);
+	      /* lines the other way round, and across the diagonal */
+	      if (op == OP_LINE)
+		{
+		  a[0] = rects[r][2];
+		  a[2] = rects[r][0];
+		  check (got, want, before, op, a);
+		}
+	    }
+}
+
+/* an area of a random image that lies within it, apart from negative source
+   offsets, which the blitter clips, placed anywhere on or near the surface */
+static void
+randomImageArgs (g15surface * surface, int *a)
+{
+  int k = nextRandom (IMAGES);
+  int width, height;
+
+  width = 1 + nextRandom (image_pitch[k] < surface->width + 16 ?
+			  image_pitch[k] : surface->width + 16);
+  height = 1 + nextRandom (IMAGE_ROWS < surface->height + 8 ?
+			   IMAGE_ROWS : surface->height + 8);
+  a[0] = nextRandom (surface->width + width + 8) - width - 4;
+  a[1] = nextRandom (surface->height + height + 8) - height - 4;
+  a[2] = nextRandom (image_pitch[k] - width + 11) - 10;
+  a[3] = nextRandom (IMAGE_ROWS - height + 5) - 4;
+  a[4] = width;
+  a[5] = height;
+  a[6] = nextRandom (5) | (nextRandom (2) ? G15_BLIT_INVERT : 0);
+  a[7] = k;
+}
+
+/* every raster op, and the sprite in every mode, at source and destination offsets
+   in every bit phase, up to and past each edge */
+static void
+checkImageEdges (g15surface * got, g15surface * want, g15surface * before)
+{
+  int w = got->width, h = got->height;
+  int xs[] = { -9, -8, -1, 0, 1, 7, w - 9, w - 8, w - 1, w };
+  int ys[] = { -3, 0, h - 3, h };
+  int widths[] = { 1, 9, 70 };
+  int src_xs[] = { -3, 0, 5 };
+  int a[ARGS];
+  int k, rop, x, y, i, j;
+
+  for (k = 0; k < IMAGES; ++k)
+    for (rop = 0; rop < 14; ++rop)
+      for (x = 0; x < (int) (sizeof (xs) / sizeof (xs[0])); ++x)
+	for (y = 0; y < (int) (sizeof (ys) / sizeof (ys[0])); ++y)
+	  for (i = 0; i < (int) (sizeof (widths) / sizeof (widths[0])); ++i)
+	    for (j = 0; j < (int) (sizeof (src_xs) / sizeof (src_xs[0])); ++j)
+	      {
+		a[0] = xs[x];
+		a[1] = ys[y];
+		a[2] = src_xs[j];
+		a[3] = j;
+		a[4] = widths[i];
+		if (a[2] + a[4] > image_pitch[k])
+		  a[4] = image_pitch[k] - a[2];
+		a[5] = 5;
+		a[7] = k;
+		/* 0-9 are the five ops, plain and inverted, 10-13 the sprite in each mode */
+		if (rop < 10)
+		  {
+		    setModes (got, want, 0);
+		    a[6] = rop / 2 | (rop % 2 ? G15_BLIT_INVERT : 0);
+		    check (got, want, before, OP_BLIT, a);
+		  }
+		else
+		  {
+		    if (a[2] < 0)
+		      continue;
+		    setModes (got, want, rop - 10);
+		    a[6] = 0;
+		    check (got, want, before, OP_SPRITE, a);
+		  }
+	      }
+}
+
+/* random calls, with lines that start and end far off the surface */
+static void
+checkRandom (g15surface * got, g15surface * want, g15surface * before)
+{
+  int w = got->width, h = got->height;
+  int a[ARGS] = { 0 };
+  int i, op, range;
+
+  for (i = 0; i < RANDOM_CALLS; ++i)
+    {
+      setModes (got, want, nextRandom (4));
+      op = nextRandom (OPS);
+      if (op >= SHAPE_OPS)
+	{
+	  randomImageArgs (got, a);
+	  /* sprites have no source clipping */
+	  if (op == OP_SPRITE && a[2] < 0)
+	    a[2] = 0;
+	  if (op == OP_SPRITE && a[3] < 0)
+	    a[3] = 0;
+	  check (got, want, before, op, a);
+	  continue;
+	}
+      range = (op == OP_LINE && nextRandom (4) == 0) ? 40 : 2;
+      a[0] = nextRandom (w * range + 40) - (w * (range - 1)) / 2 - 20;
+      a[1] = nextRandom (h * range + 20) - (h * (range - 1)) / 2 - 10;
+      a[2] = nextRandom (w * range + 40) - (w * (range - 1)) / 2 - 20;
+      a[3] = nextRandom (h * range + 20) - (h * (range - 1)) / 2 - 10;
+      if (op == OP_LINE && nextRandom (4) == 0)
+	a[3] = a[1];
+      else if (op == OP_LINE && nextRandom (4) == 0)
+	a[2] = a[0];
+      if (nextRandom (8) == 0)
+	{
+	  a[0] = 0;
+	  a[2] = w - 1;
+	}
+      a[4] = nextRandom (2);
+      a[5] = nextRandom (4);
+      a[6] = nextRandom (2);
+      check (got, want, before, op, a);
+    }
+}
+
+static void
+checkSurface (int width, int height)
+{
+  g15surface *got, *want, *before;
+
+  if (width)
+    {
+      got = g15s_newSized (width, height);
+      want = g15s_newSized (width, height);
+      before = g15s_newSized (width, height);
+    }
+  else
+    {
+      got = g15s_new ();
+      want = g15s_new ();
+      before = g15s_new ();
+    }
+  if (!got || !want || !before)
+    {
+      fprintf (stderr, "%dx%d: out of memory\n", width, height);
+      failures++;
+      return;
+    }
+  checkEdges (got, want, before);
+  checkImageEdges (got, want, before);
+  checkRandom (got, want, before);
+  g15s_free (got);
+  g15s_free (want);
+  g15s_free (before);
+}
+
+int
+main (void)
+{
+  int k, i, bytes;
+
+  /* exactly as large as they need to be, so a memory checker sees any read past one */
+  for (k = 0; k < IMAGES; ++k)
+    {
+      bytes = (image_pitch[k] * IMAGE_ROWS + 7) / 8;
+      image[k] = malloc (bytes);
+      image_mask[k] = malloc (bytes);
+      if (!image[k] || !image_mask[k])
+	return 1;
+      for (i = 0; i < bytes; ++i)
+	{
+	  image[k][i] = nextRandom (256);
+	  image_mask[k][i] = nextRandom (256);
+	}
+    }
+
+  checkSurface (0, 0);
+  checkSurface (37, 11);
+  checkSurface (64, 9);
+  checkSurface (203, 50);
+  for (k = 0; k < IMAGES; ++k)
+    {
+      free (image[k]);
+      free (image_mask[k]);
+    }
+  printf ("%d calls, %d failures\n", calls, failures);
+  return failures ? 1 : 0;
+}
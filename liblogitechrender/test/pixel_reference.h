@@ -0,0 +1,205 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* g15s_pixelReverseFill, g15s_drawLine and g15s_pixelBox as they were before the
+   span fills and clipped lines, one g15s_setPixel at a time, and g15s_blit and
+   g15s_drawSprite a pixel at a time.  The library must leave the same pixels
+   behind.  Shared by the pixel test and benchmark. */
+
+#ifndef _PIXEL_REFERENCE_H_
+#define _PIXEL_REFERENCE_H_
+
+static inline void
+refSwap (int *x, int *y)
+{
+  int tmp;
+
+  tmp = *x;
+  *x = *y;
+  *y = tmp;
+}
+
+static inline void
+refPixelReverseFill (g15surface * surface, int x1, int y1, int x2, int y2,
+		     int fill, int color)
+{
+  int x = 0;
+  int y = 0;
+
+  for (x = x1; x <= x2; ++x)
+    {
+      for (y = y1; y <= y2; ++y)
+	{
+	  if (!fill)
+	    color = !g15s_getPixel (surface, x, y);
+	  g15s_setPixel (surface, x, y, color);
+	}
+    }
+}
+
+static inline void
+refDrawLine (g15surface * surface, int px1, int py1, int px2, int py2,
+	     const int color)
+{
+  int steep = 0;
+
+  if (abs (py2 - py1) > abs (px2 - px1))
+    steep = 1;
+
+  if (steep)
+    {
+      refSwap (&px1, &py1);
+      refSwap (&px2, &py2);
+    }
+
+  if (px1 > px2)
+    {
+      refSwap (&px1, &px2);
+      refSwap (&py1, &py2);
+    }
+
+  int dx = px2 - px1;
+  int dy = abs (py2 - py1);
+
+  int error = 0;
+  int y = py1;
+  int ystep = (py1 < py2) ? 1 : -1;
+  int x = 0;
+
+  for (x = px1; x <= px2; ++x)
+    {
+      if (steep)
+	g15s_setPixel (surface, y, x, color);
+      else
+	g15s_setPixel (surface, x, y, color);
+
+      error += dy;
+      if (2 * error >= dx)
+	{
+	  y += ystep;
+	  error -= dx;
+	}
+    }
+}
+
+static inline void
+refPixelBox (g15surface * surface, int x1, int y1, int x2, int y2, int color,
+	     int thick, int fill)
+{
+  int i = 0;
+  for (i = 0; i < thick; ++i)
+    {
+      refDrawLine (surface, x1, y1, x2, y1, color);	/* Top    */
+      refDrawLine (surface, x1, y1, x1, y2, color);	/* Left   */
+      refDrawLine (surface, x2, y1, x2, y2, color);	/* Right  */
+      refDrawLine (surface, x1, y2, x2, y2, color);	/* Bottom */
+      x1++;
+      y1++;
+      x2--;
+      y2--;
+    }
+
+  int x = 0, y = 0;
+
+  if (fill)
+    {
+      for (x = x1; x <= x2; ++x)
+	for (y = y1; y <= y2; ++y)
+	  g15s_setPixel (surface, x, y, color);
+    }
+}
+
+/* bit n of a packed 1-bit image, most significant bit first */
+static inline int
+refImageBit (const unsigned char *image, unsigned long n)
+{
+  return (image[n / 8] >> (7 - n % 8)) & 1;
+}
+
+/* g15s_blit ignores the surface modes, so the pixels are written directly */
+static inline void
+refBlit (g15surface * surface, const unsigned char *src,
+	 const unsigned char *mask, int src_pitch, int src_x, int src_y,
+	 int width, int height, int dst_x, int dst_y, int rop)
+{
+  int op = rop & ~G15_BLIT_INVERT;
+  int x, y, sx, sy, dx, dy, v, m, d;
+  unsigned char *p;
+
+  if (op == G15_BLIT_MASKED && mask == NULL)
+    op = G15_BLIT_COPY;
+
+  for (y = 0; y < height; ++y)
+    for (x = 0; x < width; ++x)
+      {
+	sx = src_x + x;
+	sy = src_y + y;
+	dx = dst_x + x;
+	dy = dst_y + y;
+	if (sx < 0 || sy < 0 || dx < 0 || dy < 0 || dx >= surface->width
+	    || dy >= surface->height)
+	  continue;
+	v = refImageBit (src, (unsigned long) sy * src_pitch + sx);
+	if (rop & G15_BLIT_INVERT)
+	  v = !v;
+	m = op == G15_BLIT_MASKED ?
+	  refImageBit (mask, (unsigned long) sy * src_pitch + sx) : 1;
+	d = g15s_getPixel (surface, dx, dy);
+	switch (op)
+	  {
+	  case G15_BLIT_OR:
+	    d |= v;
+	    break;
+	  case G15_BLIT_ANDNOT:
+	    d &= !v;
+	    break;
+	  case G15_BLIT_XOR:
+	    d ^= v;
+	    break;
+	  default:
+	    d = m ? v : d;
+	    break;
+	  }
+	p = surface->buffer + dy * surface->stride + dx / 8;
+	if (d)
+	  *p |= 0x80 >> (dx % 8);
+	else
+	  *p &= ~(0x80 >> (dx % 8));
+      }
+}
+
+/* the per-pixel sprite loop, drawing the last row and column it used to skip */
+static inline void
+refDrawSprite (g15surface * surface, char *buf, int my_x, int my_y,
+	       int width, int height, int start_x, int start_y,
+	       int total_width)
+{
+  int y, x, val;
+  unsigned int pixel_offset = 0;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+	pixel_offset = (y + start_y) * total_width + (x + start_x);
+	val = refImageBit ((unsigned char *) buf, pixel_offset);
+	g15s_setPixel (surface, x + my_x, y + my_y, val);
+      }
+}
+
+#endif
@@ -0,0 +1,142 @@
+/*
+logitools - Tools for Logitech Gaming Keyboards
+Copyright (C) 2011 Michael Manley ; 2006-2007 The G15tools Project - g15tools.sf.net
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Times the span fills and clipped lines against the per-pixel loops they
+   replaced, in ns per frame on the LCD surface. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/liblogitechrender.h"
+#include "pixel_reference.h"
+
+#define FRAMES	2000
+
+typedef void (*frame_t) (g15surface * surface, int ref);
+
+static void
+reverseScreen (g15surface * surface, int ref)
+{
+  if (ref)
+    refPixelReverseFill (surface, 0, 0, 159, 42, 0, 0);
+  else
+    g15s_pixelReverseFill (surface, 0, 0, 159, 42, 0, 0);
+}
+
+static void
+reverseBar (g15surface * surface, int ref)
+{
+  if (ref)
+    refPixelReverseFill (surface, 13, 20, 112, 27, 0, 0);
+  else
+    g15s_pixelReverseFill (surface, 13, 20, 112, 27, 0, 0);
+}
+
+static void
+fillBox (g15surface * surface, int ref)
+{
+  if (ref)
+    refPixelBox (surface, 0, 0, 159, 42, 1, 1, 1);
+  else
+    g15s_pixelBox (surface, 0, 0, 159, 42, 1, 1, 1);
+}
+
+static void
+line (g15surface * surface, int ref, int x1, int y1, int x2, int y2)
+{
+  if (ref)
+    refDrawLine (surface, x1, y1, x2, y2, 1);
+  else
+    g15s_drawLine (surface, x1, y1, x2, y2, 1);
+}
+
+static void
+grid (g15surface * surface, int ref)
+{
+  int i;
+
+  for (i = 0; i < 160; i += 4)
+    line (surface, ref, i, 0, i, 42);
+  for (i = 0; i < 43; i += 4)
+    line (surface, ref, 0, i, 159, i);
+}
+
+static void
+diagonals (g15surface * surface, int ref)
+{
+  int i;
+
+  for (i = 0; i < 20; ++i)
+    line (surface, ref, i * 8, 0, 159 - i * 8, 42);
+}
+
+static void
+offscreenLines (g15surface * surface, int ref)
+{
+  int i;
+
+  for (i = 0; i < 20; ++i)
+    line (surface, ref, -1000, -50 - i, 1000, -10 - i);
+}
+
+static double
+timeFrames (g15surface * surface, frame_t frame, int ref)
+{
+  struct timespec start, end;
+  int i;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (i = 0; i < FRAMES; ++i)
+    frame (surface, ref);
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+    / FRAMES;
+}
+
+int
+main (void)
+{
+  static const struct
+  {
+    const char *name;
+    frame_t frame;
+  } frames[] = {
+    {"full screen reverse", reverseScreen},
+    {"100x8 bar reverse", reverseBar},
+    {"full screen box fill", fillBox},
+    {"4 pixel grid", grid},
+    {"20 diagonals", diagonals},
+    {"20 offscreen lines", offscreenLines}
+  };
+  g15surface *surface = g15s_new ();
+  double ref, got;
+  int i;
+
+  if (!surface)
+    return 1;
+  for (i = 0; i < (int) (sizeof (frames) / sizeof (frames[0])); ++i)
+    {
+      ref = timeFrames (surface, frames[i].frame, 1);
+      got = timeFrames (surface, frames[i].frame, 0);
+      printf ("%-22s per pixel %9.1f ns  spans %9.1f ns\n", frames[i].name,
+	      ref, got);
+    }
+  g15s_free (surface);
+  return 0;
+}
@@ -246,37 +246,6 @@ char* stringTrim(const char* source, const unsigned int len)
 	return dest;
 }
 
-//TODO: Put into libg15render instead
-void drawXBM(g15canvas* canvas, unsigned char* data, int width, int height ,int pos_x, int pos_y)
-{
-	int y = 0;
-	int z = 0;
-	unsigned char byte;
-	int bytes_per_row = ceil((double) width / 8);
-
-	int bits_left = width;
-	int current_bit = 0;
-
-	for(y = 0; y < height; y ++)
-	{
-		bits_left = width;
-		for(z=0;z < bytes_per_row; z++)
-		{
-			byte = data[(y * bytes_per_row) + z];
-			current_bit = 0;
-			while(current_bit < 8)
-			{
-				if(bits_left > 0)
-				{
-					if((byte >> current_bit) & 1) g15r_setPixel(canvas, (current_bit + (z*8) + pos_x),y + pos_y,G15_COLOR_BLACK);
-					bits_left--;
-				}
-				current_bit++;
-			}
-		}
-	}
-}
-
 void cleanup()
 {
 	int i;
@@ -363,20 +332,26 @@ int runFile(char* file)
 }
 
 
-void renderHelp()
+void renderHelp(g15surface *s)
 {
 	// Draws the helpbox in the bottom right corner.
-	g15r_drawLine(canvas, G15_LCD_WIDTH-37, 16, G15_LCD_WIDTH, 16, G15_COLOR_BLACK);
-	g15r_drawLine(canvas, G15_LCD_WIDTH-37, 16, G15_LCD_WIDTH-37, G15_LCD_HEIGHT, G15_COLOR_BLACK);
-	g15r_renderString (canvas, (unsigned char *)"1:Default\0", 3, G15_TEXT_SMALL, G15_LCD_WIDTH-35, 0);
-	g15r_renderString (canvas, (unsigned char *)"2:     Up\0", 4, G15_TEXT_SMALL, G15_LCD_WIDTH-35, 0);
-	g15r_renderString (canvas, (unsigned char *)"3:   Down\0", 5, G15_TEXT_SMALL, G15_LCD_WIDTH-35, 0);
-	g15r_renderString (canvas, (unsigned char *)"4:     OK\0", 6, G15_TEXT_SMALL, G15_LCD_WIDTH-35, 0);
+	g15s_drawLine(s, G15_LCD_WIDTH-37, 16, G15_LCD_WIDTH, 16, G15_COLOR_BLACK);
+	g15s_drawLine(s, G15_LCD_WIDTH-37, 16, G15_LCD_WIDTH-37, G15_LCD_HEIGHT, G15_COLOR_BLACK);
+	g15s_G15FPrint (s, "1:Default", G15_LCD_WIDTH-35, 0, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 3);
+	g15s_G15FPrint (s, "2:     Up", G15_LCD_WIDTH-35, 0, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 4);
+	g15s_G15FPrint (s, "3:   Down", G15_LCD_WIDTH-35, 0, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 5);
+	g15s_G15FPrint (s, "4:     OK", G15_LCD_WIDTH-35, 0, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 6);
 }
 
 void renderSelectionList()
 {
 	// Draws the three presets in the list (Selected-1,Selected,Selected+1)
+	// on the list layer, which starts at row 15 of the screen
+	g15surface *s = g15r_layerSurface(gui_list);
+	g15surface surface;
+
+	g15s_clear(s, G15_COLOR_WHITE);
+
 	// Find config id to render
 	pthread_mutex_lock(&gui_select);
 	/*static*/ int tmpRenderConfID = 0;
@@ -388,7 +363,7 @@ void renderSelectionList()
 		tmpRenderConfID = numConfigs;
 
 	char* renderLine = stringTrim((char*)getConfigName(tmpRenderConfID),25);
-	g15r_renderString(canvas, (unsigned char*)renderLine, 0, G15_TEXT_MED, 1, 17);
+	g15s_G15FPrint(s, renderLine, 1, 17-15, G15_TEXT_MED, 0, G15_COLOR_BLACK, 0);
 	free(renderLine);
 	renderLine = NULL;
 
@@ -396,7 +371,7 @@ void renderSelectionList()
 	// Render middle entry available for selection
 	renderLine = stringTrim((char*)getConfigName(gui_selectConfig),25);
 
-	g15r_renderString(canvas, (unsigned char*)renderLine, 0, G15_TEXT_MED, 1, 26);
+	g15s_G15FPrint(s, renderLine, 1, 26-15, G15_TEXT_MED, 0, G15_COLOR_BLACK, 0);
 	free(renderLine);
 	renderLine = NULL;
 
@@ -408,13 +383,16 @@ void renderSelectionList()
 	pthread_mutex_unlock(&gui_select);
 
 	renderLine = stringTrim((char*)getConfigName(tmpRenderConfID),25);
-	g15r_renderString(canvas, (unsigned char*)renderLine, 0, G15_TEXT_MED, 1, 35);
+	g15s_G15FPrint(s, renderLine, 1, 35-15, G15_TEXT_MED, 0, G15_COLOR_BLACK, 0);
 	free(renderLine);
 	renderLine = NULL;
 
 	// Make middle look selected by inverting colours
-	g15r_pixelReverseFill(canvas, 0, 24, 121, 33, 0,G15_COLOR_BLACK);
+	g15s_pixelReverseFill(s, 0, 24-15, 121, 33-15, 0,G15_COLOR_BLACK);
 
+	// Only what changed is composited onto the canvas
+	g15r_canvasSurface(canvas, &surface);
+	g15r_compositeLayers(gui_layers, &surface);
 	g15_send(g15screen_fd,(char *)canvas->buffer,G15_BUFFER_LEN);
 	pthread_mutex_lock(&gui_select);
 	gui_oldConfig = gui_selectConfig;
@@ -423,18 +401,27 @@ void renderSelectionList()
 
 void renderFull()
 {
+	static char chromePreset[1024];
 	char currPreset[1024];
 
 	g15macro_log("Redrawing whole screen.\n");
 
-	g15r_clearScreen(canvas,G15_COLOR_WHITE);
-	drawXBM(canvas, (unsigned char*)g15macro_small_bits, g15macro_small_width, g15macro_small_height, 0, 0); // Logo
-	renderHelp(); // Help box to the right
-	// Draw indicator of currently selected preset
 	memset(currPreset,0,sizeof(currPreset));
 	snprintf(currPreset,1024,"Current:%s",getConfigName(currConfig));
-	g15r_drawLine(canvas, 50, 2, 50, 11, G15_COLOR_BLACK); // Line separating logo from Current: <config>
-	g15r_renderString (canvas, (unsigned char *)currPreset, 0, G15_TEXT_MED, 53, 4); // Current: <config>
+	if (strcmp(currPreset, chromePreset) != 0)
+	{
+		g15surface *s = g15r_layerSurface(gui_chrome);
+
+		g15s_clear(s,G15_COLOR_WHITE);
+		g15s_drawXBM(s, (unsigned char*)g15macro_small_bits, g15macro_small_width, g15macro_small_height, 0, 0); // Logo
+		renderHelp(s); // Help box to the right
+		// Draw indicator of currently selected preset
+		g15s_drawLine(s, 50, 2, 50, 11, G15_COLOR_BLACK); // Line separating logo from Current: <config>
+		g15s_G15FPrint (s, currPreset, 53, 4, G15_TEXT_MED, 0, G15_COLOR_BLACK, 0); // Current: <config>
+		strcpy(chromePreset, currPreset);
+	}
+	// Other screens may have drawn over the canvas since
+	g15r_invalidateLayers(gui_layers);
 
 	// Draw selection list
 	renderSelectionList();
@@ -443,10 +430,8 @@ void renderFull()
 void renderSelection()
 {
 	g15macro_log("Redrawing only selection box.\n");
-	//Clear only the selection box, since that's the only thing updated
-	g15r_pixelBox(canvas,0,15,G15_LCD_WIDTH-38,G15_LCD_HEIGHT,G15_COLOR_WHITE,0,1);
 
-	// Draw selection list
+	// Draw selection list, the only layer that changed
 	renderSelectionList();
 }
 
@@ -1473,7 +1458,14 @@ int main(int argc, char **argv)
 
     canvas = (g15canvas *) malloc (sizeof (g15canvas));
 
-    if (canvas != NULL) {
+    gui_layers = g15r_newLayers(G15_LCD_WIDTH, G15_LCD_HEIGHT, G15_COLOR_WHITE);
+    if (gui_layers != NULL) {
+        gui_chrome = g15r_addLayer(gui_layers, G15_LCD_WIDTH, G15_LCD_HEIGHT, 0);
+        gui_list = g15r_addLayer(gui_layers, G15_LCD_WIDTH-37, G15_LCD_HEIGHT-15, 1);
+        g15r_moveLayer(gui_list, 0, 15);
+    }
+
+    if (canvas != NULL && gui_chrome != NULL && gui_list != NULL) {
         g15r_initCanvas(canvas);
     } else {
         printf("Unable to initialise the libg15render canvas\nExiting\n");
@@ -66,6 +66,11 @@
 int g15screen_fd;
 int config_fd;
 g15canvas *canvas;
+// The main screen: the chrome (logo, help box, current config) is only redrawn
+// when the config changes, the selection list layer over it on every move
+g15layers *gui_layers;
+g15layer *gui_chrome;
+g15layer *gui_list;
 
 Display *dpy;
 Window root_win;
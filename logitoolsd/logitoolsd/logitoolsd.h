@@ -38,6 +38,7 @@
 #include <pthread.h>
 #include <pwd.h>
 #include <syslog.h> 
+#include <liblogitech.h>
 
 #define CLIENT_CMD_GET_KEYSTATE 'k'
 #define CLIENT_CMD_SWITCH_PRIORITIES 'p'
@@ -224,6 +225,13 @@ int uf_write_buf_to_g15(lcd_t *lcd);
 /* write a pbm format file 'filename' with image contained in 'buf' */
 int uf_screendump_pbm(unsigned char *buf,char *filename);
 int uf_read_keypresses(unsigned int *keypresses, unsigned int timeout);
+/* event-driven key input from liblogitech */
+int uf_start_key_events();
+void uf_stop_key_events();
+int uf_wait_key_events(lg_key_event_t *events, int max);
+void uf_wake_key_events();
+int uf_start_hotplug_events();
+int uf_wait_device_arrival(unsigned int timeout);
 /* return the pid of a running copy of g15daemon, else -1 */
 int uf_return_running();
 /* create a /var/run/g15daemon.pid file, returning 0 on success else -1 */
@@ -42,6 +42,9 @@
 #define LIBG15_VERSION 1000
 #endif
 
+/* key changes taken from liblogitech at a time */
+#define KEY_EVENT_BATCH 32
+
 /* all threads will exit if leaving >0 */
 volatile int leaving = 0;
 int keyboard_backlight_off_onexit = 0;
@@ -186,14 +189,85 @@ int g15daemon_send_event(void *caller, unsigned int event, unsigned long value)
     return 0;
 }
 
+/* keyboard has been unplugged - wait for it to come back */
+static void keyboard_reconnect(g15daemon_t *masterlist, int hotplug){
+
+    int retval = 0;
+
+#ifndef OSTYPE_SOLARIS
+    if (seteuid(getuid()) != 0)
+        g15daemon_log(LOG_WARNING, "Unable to reset user id to original id %d\n", getuid());
+    if (setegid(getgid()) != 0)
+        g15daemon_log(LOG_WARNING, "Unable to reset group id to original id %d\n", getgid());
+#endif
+    /* only hold the library lock for each attempt, the display thread gets -ENODEV meanwhile */
+    while(!leaving){
+        /* liblogitech tells us when the keyboard is back, until then there is nothing to do.
+           the timeout only covers a device that went away without being unplugged */
+        if(hotplug && uf_wait_device_arrival(10000) != G15_NO_ERROR)
+            break;
+        pthread_mutex_lock(&g15lib_mutex);
+        retval = re_initLibG15();
+        pthread_mutex_unlock(&g15lib_mutex);
+        if(retval == G15_NO_ERROR)
+            break;
+        g15daemon_log(LOG_WARNING,"Keyboard has gone.. Retrying\n");
+        if(!hotplug)
+            sleep(1);
+    }
+#ifndef OSTYPE_SOLARIS
+    if (setegid(nobody_gid) != 0)
+        g15daemon_log(LOG_WARNING, "Unable to reset group id for %s(%d)\n", user, nobody_gid);
+    if (seteuid(nobody_uid) != 0)
+        g15daemon_log(LOG_WARNING, "Unable to reset user id to %s(%d)\n", user, nobody_uid);
+#endif
+    if(!leaving) {
+        masterlist->current->lcd->state_changed=1;
+        g15daemon_send_refresh(masterlist->current->lcd);
+    }
+}
+
+/* hand each change of the keys to the current screen, in the order it happened */
+static void send_key_events(g15daemon_t *masterlist, lg_key_event_t *events, int count, unsigned int *lastkeys){
+
+    int i;
+
+    for(i = 0; i < count; i++) {
+        /* changes of keys the 32 bit mask can't tell apart are not worth an event */
+        if(G15_KEYMASK32(events[i].keys) == *lastkeys)
+            continue;
+        *lastkeys = G15_KEYMASK32(events[i].keys);
+        g15daemon_send_event(masterlist->current->lcd, G15_EVENT_KEYPRESS, *lastkeys);
+    }
+}
+
 static void *keyboard_watch_thread(void *lcdlist){
     
     g15daemon_t *masterlist = (g15daemon_t*)(lcdlist);
     
     unsigned int keypresses = 0;
-    int retval = 0;
-    static int lastkeys = 0;
+    int retval = 0, count;
+    static unsigned int lastkeys = 0;
+    lg_key_event_t events[KEY_EVENT_BATCH];
+    int hotplug = (uf_start_hotplug_events() == G15_NO_ERROR);
+
+    /* liblogitech delivers reports from its event thread as they arrive, so
+       there is nothing to poll. re_initLibG15() re-arms the reader itself. */
+    if(uf_start_key_events() == G15_NO_ERROR) {
+        while (!leaving) {
+            retval = uf_wait_key_events(events, KEY_EVENT_BATCH);
+
+            if(retval > 0) {
+                send_key_events(masterlist, events, retval, &lastkeys);
+            }else if(retval == -ENODEV) {
+                keyboard_reconnect(masterlist, hotplug);
+            }
+        }
+        uf_stop_key_events();
+        return NULL;
+    }
 
+    g15daemon_log(LOG_INFO,"Asynchronous key input unavailable, polling keyboard\n");
     while (!leaving) {
 
         retval = uf_read_keypresses(&keypresses, 20);
@@ -202,34 +276,14 @@ static void *keyboard_watch_thread(void *lcdlist){
             retval = uf_read_keypresses(&keypresses, 20);
         }
 
-        if(retval == G15_NO_ERROR && lastkeys != keypresses) {
-            g15daemon_send_event(masterlist->current->lcd, 
-                                 G15_EVENT_KEYPRESS, keypresses);
-            lastkeys = keypresses;
-
+        /* every report read was queued with its time, take them from there so
+           nothing between two polls is folded into one state */
+        if((count = drainKeyEvents(events, KEY_EVENT_BATCH)) > 0) {
+            send_key_events(masterlist, events, count, &lastkeys);
+            /* the keys are moving, read again straight away */
+            continue;
         }else if(retval == -ENODEV && LIBG15_VERSION>=1200) {
-          pthread_mutex_lock(&g15lib_mutex);
-#ifndef OSTYPE_SOLARIS
-          if (seteuid(getuid()) != 0)
-    		  g15daemon_log(LOG_WARNING, "Unable to reset user id to original id %d\n", getuid());
-          if (setegid(getgid()) != 0)
-    		  g15daemon_log(LOG_WARNING, "Unable to reset group id to original id %d\n", getgid());
-#endif
-          while((retval=re_initLibG15() != G15_NO_ERROR) && !leaving){
-        	 g15daemon_log(LOG_WARNING,"Keyboard has gone.. Retrying\n");
-             sleep(1);
-          }
-#ifndef OSTYPE_SOLARIS
-       	  if (setegid(nobody_gid) != 0)
-       		  g15daemon_log(LOG_WARNING, "Unable to reset group id for %s(%d)\n", user, nobody_gid);
-       	  if (seteuid(nobody_uid) != 0)
-       		  g15daemon_log(LOG_WARNING, "Unable to reset user id to %s(%d)\n", user, nobody_uid);
-#endif
-          if(!leaving) { 
-            masterlist->current->lcd->state_changed=1; 
-            g15daemon_send_refresh(masterlist->current->lcd);
-          }
-          pthread_mutex_unlock(&g15lib_mutex); 
+            keyboard_reconnect(masterlist, hotplug);
         }
       g15daemon_msleep(40);
     }
@@ -262,24 +316,24 @@ static void *lcd_draw_thread(void *lcdlist){
         uf_write_buf_to_g15(displaying);
         g15daemon_log(LOG_DEBUG,"LCD Update Complete");
         
+        /* settings changed during this frame go out together, and only if they differ
+           from what the keyboard already has */
+        pthread_mutex_lock(&g15lib_mutex);
+        deferControls();
         if(prev_state!=displaying->backlight_state && set_backlight!=0) {
               prev_state=displaying->backlight_state;
-              pthread_mutex_lock(&g15lib_mutex);
-              setLCDBrightness(displaying->backlight_state);
-              usleep(5);
               setLCDBrightness(displaying->backlight_state);
               setKBBrightness(displaying->backlight_state);
-              pthread_mutex_unlock(&g15lib_mutex);
         }
 
         if(displaying->state_changed){
-            pthread_mutex_lock(&g15lib_mutex);
             setLCDContrast(displaying->contrast_state);
             if(displaying->masterlist->remote_keyhandler_sock==0) // only allow mled control if the macro recorder isnt running
               setLEDs(displaying->mkey_state);
-            pthread_mutex_unlock(&g15lib_mutex);
             displaying->state_changed = 0;
         }
+        flushControls();
+        pthread_mutex_unlock(&g15lib_mutex);
             
         pthread_mutex_unlock(&lcdlist_mutex);
     }
@@ -343,6 +397,11 @@ int main (int argc, char *argv[])
     struct sigaction new_action;
     cycle_key = G15_KEY_L1;
     unsigned int lcdlevel = 1;
+    unsigned long frames_sent = 0, frames_skipped = 0;
+    unsigned long controls_sent = 0, controls_avoided = 0;
+    lg_bandwidth_stats_t bandwidth;
+    lg_startup_timing_t startup;
+    lg_stats_t stats;
     
     user[0] = 0;
     pthread_t keyboard_thread;
@@ -535,13 +594,13 @@ int main (int argc, char *argv[])
             goto exitnow;
         }
         g15daemon_log(LOG_INFO,"%s loaded\n",PACKAGE_STRING);
+        if (getStartupTiming(&startup) == G15_NO_ERROR)
+            g15daemon_log(LOG_INFO,"Keyboard opened in %u us (enumerate %u, open %u, claim %u, setup %u)",
+                          startup.total, startup.enumerate, startup.open, startup.claim, startup.setup);
         
         snprintf((char*)location,1024,"%s/%s",DATADIR,"splash/g15logo2.wbmp");
 	g15canvas *canvas = (g15canvas *)g15daemon_xmalloc (sizeof (g15canvas));
-	memset (canvas->buffer, 0, G15_BUFFER_LEN);
-	canvas->mode_cache = 0;
-	canvas->mode_reverse = 0;
-	canvas->mode_xor = 0;
+	g15r_initCanvas (canvas);
         g15r_loadWbmpSplash(canvas,(char*)location);
 	memcpy (lcdlist->tail->lcd->buf, canvas->buffer, G15_BUFFER_LEN);
 	free (canvas);
@@ -565,7 +624,30 @@ int main (int argc, char *argv[])
         g15daemon_log(LOG_INFO,"Leaving by request");
 
         pthread_join(lcd_thread,NULL);
+        uf_wake_key_events();
         pthread_join(keyboard_thread,NULL);
+        /* let any queued frames reach the keyboard before blanking it */
+        flushLCD(1000);
+        getLCDFrameCounters(&frames_sent, &frames_skipped);
+        g15daemon_log(LOG_INFO,"%lu LCD frames sent, %lu unchanged frames skipped", frames_sent, frames_skipped);
+        getControlCounters(&controls_sent, &controls_avoided);
+        g15daemon_log(LOG_INFO,"%lu control transfers sent, %lu avoided", controls_sent, controls_avoided);
+        if(getLCDBandwidthStats(&bandwidth) == G15_NO_ERROR && bandwidth.downshifts)
+            g15daemon_log(LOG_INFO,"LCD bandwidth reduced %lu times, raised %lu times, ended at level %i of %i",
+                          bandwidth.downshifts, bandwidth.upshifts, bandwidth.level, bandwidth.levels - 1);
+        if(getTransferStats(&stats) == G15_NO_ERROR) {
+            lg_transfer_stats_t *lcd = &stats.transfers[G15_STATS_LCD];
+            unsigned long errors = 0;
+
+            for(i = 0; i < G15_STATS_ERRORS; i++)
+                errors += lcd->errors[i];
+            g15daemon_log(LOG_INFO,"LCD transfers: %lu, %lu errors, latency p50 %uus p99 %uus max %uus",
+                          lcd->transfers, errors, lg_stats_percentile(&lcd->latency, 50),
+                          lg_stats_percentile(&lcd->latency, 99), lcd->latency.max);
+            g15daemon_log(LOG_INFO,"usb lock held %llums, waited for %llums, %lu reconnects",
+                          (unsigned long long)(stats.lock_held_ns / 1000000),
+                          (unsigned long long)(stats.lock_wait_ns / 1000000), stats.reconnects);
+        }
         /* switch off the lcd backlight */
         char *blank=g15daemon_xmalloc(G15_BUFFER_LEN);
         writePixmapToLCD((unsigned char*)blank);
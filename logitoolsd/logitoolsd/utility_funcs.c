@@ -218,14 +218,15 @@ void g15daemon_convert_buf(lcd_t *lcd, unsigned char * orig_buf)
 }
 
 /* wrap the libg15 functions */
+/* frames are queued asynchronously, so the draw thread never waits on the usb bus */
 int uf_write_buf_to_g15(lcd_t *lcd)
 {
     int retval = 0;
 #ifdef LIBUSB_BLOCKS
-    retval = writePixmapToLCD(lcd->buf);
+    retval = writePixmapToLCDAsync(lcd->buf);
 #else
     pthread_mutex_lock(&g15lib_mutex);
-    retval = writePixmapToLCD(lcd->buf);
+    retval = writePixmapToLCDAsync(lcd->buf);
     pthread_mutex_unlock(&g15lib_mutex);
 #endif    
     return retval;
@@ -244,6 +245,113 @@ int uf_read_keypresses(unsigned int *keypresses, unsigned int timeout)
     return retval;
 }
 
+/* liblogitech queues every change of the keys itself, the handler only wakes the keyboard thread */
+static int key_events_pending = 0;
+static int key_status = G15_NO_ERROR;
+static int key_queue_woken = 0;
+static pthread_mutex_t key_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t key_queue_cond = PTHREAD_COND_INITIALIZER;
+
+static void uf_key_handler(unsigned int pressed_keys, int status, void *userdata)
+{
+    pthread_mutex_lock(&key_queue_mutex);
+    if(status == G15_NO_ERROR)
+        key_events_pending = 1;
+    else
+        key_status = status;
+    pthread_cond_signal(&key_queue_cond);
+    pthread_mutex_unlock(&key_queue_mutex);
+}
+
+/* start receiving key reports asynchronously. returns G15_NO_ERROR, or an error if the caller should poll instead */
+int uf_start_key_events()
+{
+    return registerKeyHandler(uf_key_handler, NULL);
+}
+
+void uf_stop_key_events()
+{
+    registerKeyHandler(NULL, NULL);
+}
+
+/* block until the keys change, then return up to max of the queued changes, oldest first.
+   returns the number of events, an error such as -ENODEV once they have all been
+   returned, or 0 if woken by uf_wake_key_events() */
+int uf_wait_key_events(lg_key_event_t *events, int max)
+{
+    int retval;
+
+    pthread_mutex_lock(&key_queue_mutex);
+    while(!key_events_pending && key_status == G15_NO_ERROR && !key_queue_woken)
+        pthread_cond_wait(&key_queue_cond, &key_queue_mutex);
+    key_events_pending = 0;
+    key_queue_woken = 0;
+    pthread_mutex_unlock(&key_queue_mutex);
+
+    /* only the keyboard thread drains, so this needs neither lock */
+    retval = drainKeyEvents(events, max);
+
+    pthread_mutex_lock(&key_queue_mutex);
+    if(retval == max)
+        key_events_pending = 1;     /* there may be more */
+    else if(retval == 0 && key_status != G15_NO_ERROR) {
+        retval = key_status;
+        key_status = G15_NO_ERROR;
+    }
+    pthread_mutex_unlock(&key_queue_mutex);
+    return retval;
+}
+
+static int device_arrived = 0;
+
+static void uf_hotplug_handler(int event, void *userdata)
+{
+    if(event != G15_HOTPLUG_ARRIVED)
+        return;
+    pthread_mutex_lock(&key_queue_mutex);
+    device_arrived = 1;
+    pthread_cond_broadcast(&key_queue_cond);
+    pthread_mutex_unlock(&key_queue_mutex);
+}
+
+/* be told when an unplugged keyboard comes back. returns G15_NO_ERROR, or an error if the caller should keep retrying instead */
+int uf_start_hotplug_events()
+{
+    return registerHotplugHandler(uf_hotplug_handler, NULL);
+}
+
+/* wait up to timeout ms for the keyboard to be plugged back in. returns -1 if woken by uf_wake_key_events() */
+int uf_wait_device_arrival(unsigned int timeout)
+{
+    struct timespec deadline;
+    int retval = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&key_queue_mutex);
+    while(!device_arrived && !key_queue_woken && retval != ETIMEDOUT)
+        retval = pthread_cond_timedwait(&key_queue_cond, &key_queue_mutex, &deadline);
+    retval = (key_queue_woken && !device_arrived) ? -1 : G15_NO_ERROR;
+    device_arrived = 0;
+    pthread_mutex_unlock(&key_queue_mutex);
+    return retval;
+}
+
+/* release the keyboard thread from uf_wait_key_events(), eg when leaving */
+void uf_wake_key_events()
+{
+    pthread_mutex_lock(&key_queue_mutex);
+    key_queue_woken = 1;
+    pthread_cond_broadcast(&key_queue_cond);
+    pthread_mutex_unlock(&key_queue_mutex);
+}
+
 /* Sleep routine (hackish). */
 void g15daemon_sleep(int seconds) {
     pthread_mutex_t dummy_mutex;
@@ -52,11 +52,19 @@ extern double round(double);
 #define CLOCK_STARTY	(CLOCK_CENTERY-CLOCK_RADIUS)
 #define CLOCK_ENDX		(CLOCK_CENTERX+CLOCK_RADIUS+1)
 #define CLOCK_ENDY		(CLOCK_CENTERY+CLOCK_RADIUS)
+// the texts next to the dial get a layer of their own starting here,
+// on a byte boundary so it is blended with plain copies
+#define CLOCK_TEXTX		((CLOCK_ENDX+8) & ~7)
 
 static int mode=1;
 static int showdate=0;
 static int digital=1;
-g15canvas *static_canvas = NULL;
+static g15canvas *clock_canvas = NULL;
+// the dial is drawn once, only the hands and texts are redrawn every tick
+static g15layers *clock_layers = NULL;
+static g15layer *dial_layer = NULL;
+static g15layer *hands_layer = NULL;
+static g15layer *text_layer = NULL;
 
 //----------------------------------------------------------------------------
 // calc x,y for given minute/hour/sec (pos), cut_off is for radius variations
@@ -84,14 +92,13 @@ static void get_clock_pos(int pos, int *x, int *y, int cut_off)
 }
 
 //----------------------------------------------------------------------------
-// draw clock frame (only once, as it is stored in static_canvas)
+// draw clock frame (only once, as it is stored in the dial layer)
 // NOTE - coords here are hardcoded !
-static void draw_static_canvas(void)
+static void draw_dial(g15surface *s)
 {
-  g15canvas *c = static_canvas;
   int i;
   
-  g15r_clearScreen (c, G15_COLOR_WHITE);
+  g15s_clear (s, G15_COLOR_WHITE);
 
   for (i=0; i<60; i+=5)
   {
@@ -101,19 +108,19 @@ static void draw_static_canvas(void)
 	  switch (i)
 	  {
 		case 0:
-		g15r_renderString(c, (unsigned char*)"12", 0, G15_TEXT_SMALL, 22, 3);
+		g15s_G15FPrint(s, "12", 22, 3, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 0);
 		break;
 
 		case 15:
-		g15r_renderString(c, (unsigned char*)"3", 3, G15_TEXT_SMALL, 42, 1);
+		g15s_G15FPrint(s, "3", 42, 1, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 3);
 		break;
 
 		case 30:
-		g15r_renderString(c, (unsigned char*)"6", 6, G15_TEXT_SMALL, 24, -1);
+		g15s_G15FPrint(s, "6", 24, -1, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 6);
 		break;
 
 		case 45:
-		g15r_renderString(c, (unsigned char*)"9", 3, G15_TEXT_SMALL, 6, 1);
+		g15s_G15FPrint(s, "9", 6, 1, G15_TEXT_SMALL, 0, G15_COLOR_BLACK, 3);
 		break;
 	  }
 	}
@@ -123,15 +130,15 @@ static void draw_static_canvas(void)
 	  int x1,y1,dir;
 	  if (i>15 && i<45) dir=-1; else dir=1;
   	  get_clock_pos(i, &x1, &y1,  3);
-	  g15r_setPixel(c, x1,     y1,     G15_COLOR_BLACK);
-	  g15r_setPixel(c, x1+dir, y1,     G15_COLOR_BLACK);
-	  g15r_setPixel(c, x1,     y1+dir, G15_COLOR_BLACK);
-	  g15r_setPixel(c, x1+dir, y1+dir, G15_COLOR_BLACK);
+	  g15s_setPixel(s, x1,     y1,     G15_COLOR_BLACK);
+	  g15s_setPixel(s, x1+dir, y1,     G15_COLOR_BLACK);
+	  g15s_setPixel(s, x1,     y1+dir, G15_COLOR_BLACK);
+	  g15s_setPixel(s, x1+dir, y1+dir, G15_COLOR_BLACK);
 	}
   }
 
-  g15r_drawCircle(c, CLOCK_CENTERX, CLOCK_CENTERY, CLOCK_RADIUS, 0, G15_COLOR_BLACK);
-  g15r_drawCircle(c, CLOCK_CENTERX, CLOCK_CENTERY, 2,            1, G15_COLOR_BLACK);
+  g15s_drawCircle(s, CLOCK_CENTERX, CLOCK_CENTERY, CLOCK_RADIUS, 0, G15_COLOR_BLACK);
+  g15s_drawCircle(s, CLOCK_CENTERX, CLOCK_CENTERY, 2,            1, G15_COLOR_BLACK);
 }
 
 static int draw_digital(g15canvas *canvas)
@@ -178,6 +185,9 @@ static int draw_analog(g15canvas *c)
   int xh, yh;
   int xm, ym;
   int xs, ys;
+  g15surface surface;
+  g15surface *hands = g15r_layerSurface(hands_layer);
+  g15surface *text = g15r_layerSurface(text_layer);
 
   time_t now = time(NULL);
   struct tm *t = localtime(&now);
@@ -192,23 +202,23 @@ static int draw_analog(g15canvas *c)
   get_clock_pos(t->tm_min, &xm, &ym,  6);
   get_clock_pos(t->tm_sec, &xs, &ys,  3);
  
-  // put background:
-  memcpy(c, static_canvas, sizeof(g15canvas));
-  
+  // the hands are or'd over the dial:
+  g15s_clear(hands, G15_COLOR_WHITE);
+
   // hour
-  g15r_drawLine(c, CLOCK_CENTERX-2,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
-  g15r_drawLine(c, CLOCK_CENTERX-1,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
-  g15r_drawLine(c, CLOCK_CENTERX,    CLOCK_CENTERY, xh,  yh+1, G15_COLOR_BLACK);
-  g15r_drawLine(c, CLOCK_CENTERX+1,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
-  g15r_drawLine(c, CLOCK_CENTERX+2,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX-2,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX-1,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX,    CLOCK_CENTERY, xh,  yh+1, G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX+1,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX+2,  CLOCK_CENTERY, xh,  yh,   G15_COLOR_BLACK);
 
   // minute
-  g15r_drawLine(c, CLOCK_CENTERX-1,  CLOCK_CENTERY, xm,  ym,   G15_COLOR_BLACK);
-  g15r_drawLine(c, CLOCK_CENTERX,    CLOCK_CENTERY, xm,  ym+1, G15_COLOR_BLACK);
-  g15r_drawLine(c, CLOCK_CENTERX+1,  CLOCK_CENTERY, xm,  ym,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX-1,  CLOCK_CENTERY, xm,  ym,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX,    CLOCK_CENTERY, xm,  ym+1, G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX+1,  CLOCK_CENTERY, xm,  ym,   G15_COLOR_BLACK);
 
   // second:
-  g15r_drawLine(c, CLOCK_CENTERX,    CLOCK_CENTERY,   xs,  ys,   G15_COLOR_BLACK);
+  g15s_drawLine(hands, CLOCK_CENTERX,    CLOCK_CENTERY,   xs,  ys,   G15_COLOR_BLACK);
   
   //
   // draw texts:
@@ -226,12 +236,17 @@ static int draw_analog(g15canvas *c)
   else 
     strftime(time,sizeof(time),"%r",t);
   
+  g15s_clear(text, G15_COLOR_WHITE);
   if(showdate) {
-  	g15r_renderString(c, (unsigned char*)time,  0, 10, 60, 4);
-  	g15r_renderString(c, (unsigned char*)day,   1, 10, 60, 4);
-  	g15r_renderString(c, (unsigned char*)date,  2, 10, 60, 4);
+  	g15s_G15FPrint(text, time, 60-CLOCK_TEXTX, 4, 10, 0, G15_COLOR_BLACK, 0);
+  	g15s_G15FPrint(text, day,  60-CLOCK_TEXTX, 4, 10, 0, G15_COLOR_BLACK, 1);
+  	g15s_G15FPrint(text, date, 60-CLOCK_TEXTX, 4, 10, 0, G15_COLOR_BLACK, 2);
   } else 
-	g15r_renderString(c, (unsigned char*)time, 0, 20, 48, 14);
+	g15s_G15FPrint(text, time, 48-CLOCK_TEXTX, 14, 20, 0, G15_COLOR_BLACK, 0);
+
+  // only the layers drawn on above are blended again:
+  g15r_canvasSurface(c, &surface);
+  g15r_compositeLayers(clock_layers, &surface);
 
   return G15_PLUGIN_OK;
 }
@@ -240,28 +255,20 @@ static int draw_analog(g15canvas *c)
 static int lcdclock(lcd_t *lcd)
 {
     int ret = 0;
-    g15canvas *canvas = (g15canvas *) malloc (sizeof (g15canvas));
-
-    if (canvas == NULL) {
-        g15daemon_log(LOG_ERR, "Unable to allocate canvas");
-        return G15_PLUGIN_QUIT;
-    }
-
-   	memset(canvas->buffer, 0, G15_BUFFER_LEN);
-	canvas->mode_cache = 0;
-	canvas->mode_reverse = 0;
-	canvas->mode_xor = 0;
+    g15canvas *canvas = clock_canvas;
 
     memset(lcd->buf,0,G15_BUFFER_LEN);
 
-    if(digital)
+    if(digital) {
+      g15r_clearScreen(canvas, G15_COLOR_WHITE);
       ret = draw_digital(canvas);
-    else
+      // the digital clock drew over the composite, so the next analog one is copied whole
+      g15r_invalidateLayers(clock_layers);
+    } else
       ret = draw_analog(canvas);
 
     memcpy (lcd->buf, canvas->buffer, G15_BUFFER_LEN);
     g15daemon_send_refresh(lcd);
-    free(canvas);
     return G15_PLUGIN_OK;
 }
 
@@ -298,7 +305,10 @@ static int myeventhandler(plugin_event_t *myevent) {
 
 /* completely uncessary function called when plugin is exiting */
 static void callmewhenimdone(lcd_t *lcd){
-    if(static_canvas != NULL) free(static_canvas);
+    free(clock_canvas);
+    clock_canvas = NULL;
+    g15r_freeLayers(clock_layers);
+    clock_layers = NULL;
     return;
 }
 
@@ -309,17 +319,28 @@ static int myinithandler(lcd_t *lcd){
     showdate=g15daemon_cfg_read_bool(clockcfg, "ShowDate",0);
     digital=g15daemon_cfg_read_bool(clockcfg, "Digital",1);
 
-    static_canvas = (g15canvas*)malloc(sizeof(g15canvas));
-    if (static_canvas != NULL)
+    clock_canvas = (g15canvas*)malloc(sizeof(g15canvas));
+    clock_layers = g15r_newLayers(G15_LCD_WIDTH, G15_LCD_HEIGHT, G15_COLOR_WHITE);
+    if (clock_layers != NULL)
       {
-      	memset(static_canvas->buffer, 0, G15_BUFFER_LEN);
-	static_canvas->mode_cache = 0;
-	static_canvas->mode_reverse = 0;
-	static_canvas->mode_xor = 0;
-        draw_static_canvas();
+        dial_layer = g15r_addLayer(clock_layers, G15_LCD_WIDTH, G15_LCD_HEIGHT, 0);
+        hands_layer = g15r_addLayer(clock_layers, CLOCK_TEXTX, G15_LCD_HEIGHT, 1);
+        text_layer = g15r_addLayer(clock_layers, G15_LCD_WIDTH-CLOCK_TEXTX, G15_LCD_HEIGHT, 1);
       }
+    if (clock_canvas == NULL || clock_layers == NULL || dial_layer == NULL
+        || hands_layer == NULL || text_layer == NULL)
+      {
+        g15daemon_log(LOG_ERR, "Unable to allocate canvas");
+        callmewhenimdone(lcd);
+        return G15_PLUGIN_QUIT;
+      }
+
+    g15r_initCanvas(clock_canvas);
+    g15r_setLayerRop(hands_layer, G15_BLIT_OR);
+    g15r_moveLayer(text_layer, CLOCK_TEXTX, 0);
+    draw_dial(g15r_layerSurface(dial_layer));
 
-    return static_canvas == NULL ? G15_PLUGIN_QUIT : G15_PLUGIN_OK;
+    return G15_PLUGIN_OK;
 }
 
 /* if no exitfunc or eventhandler, member should be NULL */